@@ -0,0 +1,264 @@
+#pragma once
+
+#include <glad/gl.h>
+
+#include <glm/glm.hpp>
+
+#include "glhandle.h"
+#include "light.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Clustered forward lighting of any number of point lights. The view frustum is split into TilesX x TilesY screen
+// tiles and Slices depth slices, exponentially spaced from the near to the far plane; every Build assigns the lights
+// to the froxels their range sphere (LightAttenuation::Range) touches, one slice per ThreadPool task, and uploads:
+//   ClusterLights   (std430, LightsBinding)   PointLightRecord of every light
+//   ClusterGrid     (std430, GridBinding)     offset and count of each froxel's run in ClusterIndices
+//   ClusterIndices  (std430, IndexBinding)    light indices
+//   Clusters        (std140, ParametersBinding) grid size and the pixel and depth to froxel scales
+// clusters.glsl reads them in programs built with CLUSTERED_LIGHTS. Clustered lights cast no shadows.
+class ClusteredLights
+{
+    public:
+        static const unsigned int TilesX = 16;
+        static const unsigned int TilesY = 9;
+        static const unsigned int Slices = 24;
+        static const unsigned int ClusterCount = TilesX * TilesY * Slices;
+        // layout (binding) of the blocks in clusters.glsl; below them are DrawRecords and the culling buffers
+        static const GLuint LightsBinding = 4;
+        static const GLuint GridBinding = 5;
+        static const GLuint IndexBinding = 6;
+        static const GLuint ParametersBinding = 2; // uniform block, after LightBuffer's Matrices and Lights
+
+        struct Stats
+        {
+            unsigned int lights = 0;       // lights in front of the camera
+            unsigned int litClusters = 0;  // froxels with at least one light
+            unsigned int indices = 0;      // light references over all froxels
+            unsigned int maxPerCluster = 0;
+        };
+
+        ClusteredLights()
+        {
+            glGenBuffers(1, lightsBuffer.Replace());
+            glGenBuffers(1, gridBuffer.Replace());
+            glGenBuffers(1, indexBuffer.Replace());
+            glGenBuffers(1, parametersBuffer.Replace());
+            clusterLists.resize(ClusterCount);
+        }
+
+        ClusteredLights(const ClusteredLights&) = delete;
+        ClusteredLights& operator=(const ClusteredLights&) = delete;
+
+        // Assigns lights to the froxels of a perspective camera (fovY in radians, viewport in pixels) and uploads the
+        // lists; light records are uploaded again only when a light is marked dirty or the light count changes.
+        // Lights given here should not be in a LightBuffer too, both clear the dirty flag.
+        void Build(std::span<PointLight* const> lights, const glm::mat4 &view, float fovY, float aspect, float nearPlane, float farPlane,
+                   unsigned int width, unsigned int height)
+        {
+            stats = Stats();
+            float tanY = std::tan(fovY * 0.5f);
+            float tanX = tanY * aspect;
+            float sliceScale = float(Slices) / std::log(farPlane / nearPlane);
+            float sliceBias = sliceScale * std::log(nearPlane);
+            auto sliceDepth = [&](unsigned int slice) {
+                return nearPlane * std::pow(farPlane / nearPlane, float(slice) / float(Slices));
+            };
+            auto sliceOf = [&](float depth) {
+                return static_cast<int>(std::clamp(std::floor(std::log(depth) * sliceScale - sliceBias), 0.0f, float(Slices - 1)));
+            };
+            auto tileOf = [](float ndc, unsigned int tiles) {
+                return static_cast<int>(std::clamp(std::floor((ndc * 0.5f + 0.5f) * float(tiles)), 0.0f, float(tiles - 1)));
+            };
+
+            // view space spheres of the lights in front of the camera and the froxel ranges they may touch
+            bounds.clear();
+            for (uint32_t i = 0; i < lights.size(); i++)
+            {
+                glm::vec3 center = glm::vec3(view * glm::vec4(lights[i]->position, 1.0f));
+                float depth = -center.z;
+                float radius = lights[i]->Range();
+                if (depth + radius < nearPlane || depth - radius > farPlane || radius <= 0.0f)
+                    continue;
+                LightBounds light;
+                light.index = i;
+                light.center = center;
+                light.radius = radius;
+                float nearest = std::max(depth - radius, nearPlane);
+                float farthest = std::min(depth + radius, farPlane);
+                light.slices = glm::ivec2(sliceOf(nearest), sliceOf(farthest));
+                // the sphere's box projects widest at the nearest or the farthest depth it covers
+                float left = std::min((center.x - radius) / (nearest * tanX), (center.x - radius) / (farthest * tanX));
+                float right = std::max((center.x + radius) / (nearest * tanX), (center.x + radius) / (farthest * tanX));
+                float bottom = std::min((center.y - radius) / (nearest * tanY), (center.y - radius) / (farthest * tanY));
+                float top = std::max((center.y + radius) / (nearest * tanY), (center.y + radius) / (farthest * tanY));
+                if (left > 1.0f || right < -1.0f || bottom > 1.0f || top < -1.0f)
+                    continue;
+                light.tilesX = glm::ivec2(tileOf(left, TilesX), tileOf(right, TilesX));
+                light.tilesY = glm::ivec2(tileOf(bottom, TilesY), tileOf(top, TilesY));
+                bounds.push_back(light);
+            }
+            stats.lights = static_cast<unsigned int>(bounds.size());
+
+            grid.resize(ClusterCount);
+            indices.clear();
+            if (!culling)
+            {
+                // one list of every visible light, shared by all froxels
+                for (const LightBounds &light : bounds)
+                    indices.push_back(light.index);
+                std::fill(grid.begin(), grid.end(), glm::uvec2(0, static_cast<uint32_t>(indices.size())));
+                stats.litClusters = indices.empty() ? 0 : ClusterCount;
+                stats.indices = static_cast<unsigned int>(indices.size()) * ClusterCount;
+                stats.maxPerCluster = static_cast<unsigned int>(indices.size());
+                finish(lights, width, height, sliceScale, sliceBias);
+                return;
+            }
+
+            // every task owns the froxel lists of one slice; the sphere is tested against each froxel's view space box
+            auto assignSlice = [&](size_t slice) {
+                float nearDepth = sliceDepth(static_cast<unsigned int>(slice));
+                float farDepth = sliceDepth(static_cast<unsigned int>(slice) + 1);
+                for (unsigned int tile = 0; tile < TilesX * TilesY; tile++)
+                    clusterLists[slice * TilesX * TilesY + tile].clear();
+                for (const LightBounds &light : bounds)
+                {
+                    if (int(slice) < light.slices.x || int(slice) > light.slices.y)
+                        continue;
+                    for (int y = light.tilesY.x; y <= light.tilesY.y; y++)
+                    {
+                        float ndcBottom = float(y) / float(TilesY) * 2.0f - 1.0f;
+                        float ndcTop = float(y + 1) / float(TilesY) * 2.0f - 1.0f;
+                        for (int x = light.tilesX.x; x <= light.tilesX.y; x++)
+                        {
+                            float ndcLeft = float(x) / float(TilesX) * 2.0f - 1.0f;
+                            float ndcRight = float(x + 1) / float(TilesX) * 2.0f - 1.0f;
+                            glm::vec3 boxMin(std::min(ndcLeft * nearDepth, ndcLeft * farDepth) * tanX,
+                                             std::min(ndcBottom * nearDepth, ndcBottom * farDepth) * tanY, -farDepth);
+                            glm::vec3 boxMax(std::max(ndcRight * nearDepth, ndcRight * farDepth) * tanX,
+                                             std::max(ndcTop * nearDepth, ndcTop * farDepth) * tanY, -nearDepth);
+                            glm::vec3 closest = glm::clamp(light.center, boxMin, boxMax);
+                            glm::vec3 offset = closest - light.center;
+                            if (glm::dot(offset, offset) <= light.radius * light.radius)
+                                clusterLists[(slice * TilesY + y) * TilesX + x].push_back(light.index);
+                        }
+                    }
+                }
+            };
+            if (threaded)
+                ThreadPool::Shared().ParallelFor(Slices, assignSlice);
+            else
+                for (size_t slice = 0; slice < Slices; slice++)
+                    assignSlice(slice);
+
+            for (unsigned int cluster = 0; cluster < ClusterCount; cluster++)
+            {
+                const std::vector<uint32_t> &list = clusterLists[cluster];
+                grid[cluster] = glm::uvec2(static_cast<uint32_t>(indices.size()), static_cast<uint32_t>(list.size()));
+                indices.insert(indices.end(), list.begin(), list.end());
+                stats.litClusters += list.empty() ? 0 : 1;
+                stats.maxPerCluster = std::max(stats.maxPerCluster, static_cast<unsigned int>(list.size()));
+            }
+            stats.indices = static_cast<unsigned int>(indices.size());
+            finish(lights, width, height, sliceScale, sliceBias);
+        }
+
+        // Binds the four blocks for the lit draws that follow
+        void Bind()
+        {
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LightsBinding, lightsBuffer);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GridBinding, gridBuffer);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, IndexBinding, indexBuffer);
+            glBindBufferBase(GL_UNIFORM_BUFFER, ParametersBinding, parametersBuffer);
+        }
+
+        // Both on by default; without culling every froxel lists every light in front of the camera (the forward shading baseline)
+        void SetThreaded(bool threaded)
+        {
+            this->threaded = threaded;
+        }
+
+        void SetCulling(bool culling)
+        {
+            this->culling = culling;
+        }
+
+        // Light indices assigned to froxel (slice * TilesY + y) * TilesX + x by the last Build
+        std::span<const uint32_t> ClusterLights(unsigned int cluster) const
+        {
+            return std::span<const uint32_t>(indices).subspan(grid[cluster].x, grid[cluster].y);
+        }
+
+        // Counts of the last Build
+        const Stats& GetStats() const
+        {
+            return stats;
+        }
+
+    private:
+        struct LightBounds
+        {
+            uint32_t index;
+            glm::vec3 center; // view space
+            float radius;
+            glm::ivec2 tilesX, tilesY, slices;
+        };
+
+        // std140 Clusters block
+        struct Parameters
+        {
+            glm::uvec4 clusterCount;
+            glm::vec4 clusterScale;
+        };
+
+        BufferHandle lightsBuffer, gridBuffer, indexBuffer, parametersBuffer;
+        std::vector<LightBounds> bounds;
+        std::vector<std::vector<uint32_t>> clusterLists;
+        std::vector<glm::uvec2> grid;
+        std::vector<uint32_t> indices;
+        std::vector<PointLightRecord> records;
+        bool threaded = true;
+        bool culling = true;
+        Stats stats;
+
+        void finish(std::span<PointLight* const> lights, unsigned int width, unsigned int height, float sliceScale, float sliceBias)
+        {
+            if (indices.empty())
+                indices.push_back(0); // keeps the buffer valid to bind
+            upload(lights);
+            Parameters parameters;
+            parameters.clusterCount = glm::uvec4(TilesX, TilesY, Slices, static_cast<uint32_t>(lights.size()));
+            parameters.clusterScale = glm::vec4(float(width) / float(TilesX), float(height) / float(TilesY), sliceScale, sliceBias);
+            glBindBuffer(GL_UNIFORM_BUFFER, parametersBuffer);
+            glBufferData(GL_UNIFORM_BUFFER, sizeof(Parameters), &parameters, GL_STREAM_DRAW);
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        }
+
+        void upload(std::span<PointLight* const> lights)
+        {
+            bool dirty = records.size() != lights.size();
+            for (PointLight *light : lights)
+                dirty = dirty || light->Dirty();
+            if (dirty)
+            {
+                records.resize(lights.size());
+                for (size_t i = 0; i < lights.size(); i++)
+                {
+                    records[i] = lights[i]->Record();
+                    lights[i]->ClearDirty();
+                }
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightsBuffer);
+                glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(records.size(), 1) * sizeof(PointLightRecord), records.empty() ? nullptr : records.data(), GL_DYNAMIC_DRAW);
+            }
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, gridBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, grid.size() * sizeof(glm::uvec2), grid.data(), GL_STREAM_DRAW);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, indexBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, indices.size() * sizeof(uint32_t), indices.data(), GL_STREAM_DRAW);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        }
+};
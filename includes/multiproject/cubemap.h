@@ -3,7 +3,9 @@
 #include <glad/gl.h>
 #include <stb/stb_image.h>
 
+#include "glstate.h"
 #include "shader.h"
+#include "ktx2.h"
 
 #include <string>
 #include <vector>
@@ -23,7 +25,6 @@ class Cubemap
 		Cubemap(const char* posx, const char *negx, const char *posy, const char *negy, const char *posz, const char *negz, int textureUnit)
 		{
 			this->textureUnit = textureUnit;
-			glActiveTexture(GL_TEXTURE0 + textureUnit);
 			SetupCubeMap(posx, negx, posy, negy, posz, negz);
 		}
 
@@ -42,26 +43,25 @@ class Cubemap
 			loadCubemap(faces);
         }
 
-        void SetShaderUniform(Shader& shader, const char *uniformName)
+        void SetShaderUniform(Shader& shader, UniformName uniformName)
         {
             shader.setInt(uniformName, textureUnit);
 		}
 
         void Bind()
         {
-			glActiveTexture(GL_TEXTURE0 + textureUnit);
-            glBindTexture(GL_TEXTURE_CUBE_MAP, ID);
+            GLState::Instance().BindTexture(textureUnit, ID);
         }
 
         void Unbind()
         {
-            glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+            GLState::Instance().BindTexture(textureUnit, 0);
 		}
 
 	private:
         unsigned int loadCubemap(std::vector<std::string> faces)
         {
-			stbi_set_flip_vertically_on_load(false);
+			stbi_set_flip_vertically_on_load_thread(false);
 
             glGenTextures(1, &ID);
             glBindTexture(GL_TEXTURE_CUBE_MAP, ID);
@@ -71,6 +71,19 @@ class Cubemap
             GLenum format;
             for (unsigned int i = 0; i < faces.size(); i++)
             {
+                // precompressed faces skip decoding; a single six-face .ktx2 fills the whole cubemap
+                if (isKtx2Path(faces[i]))
+                {
+                    Ktx2Image ktx;
+                    if (!ktx.Load(faces[i]))
+                        continue;
+                    for (unsigned int face = 0; face < ktx.faceCount && i + face < 6; face++)
+                        ktx.Upload(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i + face, face);
+                    if (ktx.faceCount == 6)
+                        break;
+                    continue;
+                }
+
                 unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
 
                 if (nrChannels == 4)
@@ -110,7 +123,7 @@ class Cubemap
             glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
             glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
-			stbi_set_flip_vertically_on_load(true);
+			stbi_set_flip_vertically_on_load_thread(true);
 
             return ID;
         }
@@ -0,0 +1,403 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define MULTIPROJECT_X86 1
+    #include <immintrin.h>
+    #ifdef _MSC_VER
+        #include <intrin.h>
+        #define MULTIPROJECT_TARGET_AVX2
+    #else
+        #define MULTIPROJECT_TARGET_AVX2 __attribute__((target("avx2")))
+    #endif
+#endif
+
+// Frustum culling of axis aligned boxes: world bounds in structure of arrays form, plane-vs-box tests 8 (AVX2) or
+// 4 (SSE) boxes at a time, and a BVH over the boxes that is refitted when objects move and rebuilt when they are
+// added or removed. A box is culled when it lies entirely behind one plane (conservative near the frustum corners).
+
+// Six inward facing planes (xyz normal, w distance): left, right, bottom, top, near, far
+struct Frustum
+{
+    glm::vec4 planes[6];
+
+    // Planes of a view projection matrix (Gribb & Hartmann), normalized
+    static Frustum FromMatrix(const glm::mat4 &viewProjection)
+    {
+        Frustum frustum;
+        glm::vec4 row[4];
+        for(int i = 0; i < 4; i++)
+            row[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+        frustum.planes[0] = row[3] + row[0];
+        frustum.planes[1] = row[3] - row[0];
+        frustum.planes[2] = row[3] + row[1];
+        frustum.planes[3] = row[3] - row[1];
+        frustum.planes[4] = row[3] + row[2];
+        frustum.planes[5] = row[3] - row[2];
+        for(glm::vec4 &plane : frustum.planes)
+            plane /= glm::length(glm::vec3(plane));
+        return frustum;
+    }
+
+    // The box itself, e.g. the reach of a point light's shadow cube map
+    static Frustum FromBox(const glm::vec3 &min, const glm::vec3 &max)
+    {
+        Frustum frustum;
+        for(int axis = 0; axis < 3; axis++)
+        {
+            glm::vec3 normal(0.0f);
+            normal[axis] = 1.0f;
+            frustum.planes[axis * 2] = glm::vec4(normal, -min[axis]);
+            frustum.planes[axis * 2 + 1] = glm::vec4(-normal, max[axis]);
+        }
+        return frustum;
+    }
+};
+
+// World space boxes as center and half extent per axis
+struct BoundsSoA
+{
+    std::vector<float> centerX, centerY, centerZ;
+    std::vector<float> extentX, extentY, extentZ;
+
+    size_t Size() const
+    {
+        return centerX.size();
+    }
+
+    void Clear()
+    {
+        for(std::vector<float> *array : { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ })
+            array->clear();
+    }
+
+    void Resize(size_t count)
+    {
+        for(std::vector<float> *array : { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ })
+            array->resize(count);
+    }
+
+    void Set(size_t index, const glm::vec3 &center, const glm::vec3 &extent)
+    {
+        centerX[index] = center.x;
+        centerY[index] = center.y;
+        centerZ[index] = center.z;
+        extentX[index] = extent.x;
+        extentY[index] = extent.y;
+        extentZ[index] = extent.z;
+    }
+
+    // Box of a local box under transform (Arvo: the extent goes through the absolute matrix)
+    void Set(size_t index, const glm::vec3 &localMin, const glm::vec3 &localMax, const glm::mat4 &transform)
+    {
+        glm::vec3 center = glm::vec3(transform * glm::vec4((localMin + localMax) * 0.5f, 1.0f));
+        glm::vec3 extent = glm::mat3(glm::abs(glm::vec3(transform[0])), glm::abs(glm::vec3(transform[1])), glm::abs(glm::vec3(transform[2]))) * ((localMax - localMin) * 0.5f);
+        Set(index, center, extent);
+    }
+
+    size_t Add(const glm::vec3 &localMin, const glm::vec3 &localMax, const glm::mat4 &transform)
+    {
+        size_t index = Size();
+        Resize(index + 1);
+        Set(index, localMin, localMax, transform);
+        return index;
+    }
+
+    glm::vec3 Min(size_t index) const
+    {
+        return glm::vec3(centerX[index] - extentX[index], centerY[index] - extentY[index], centerZ[index] - extentZ[index]);
+    }
+
+    glm::vec3 Max(size_t index) const
+    {
+        return glm::vec3(centerX[index] + extentX[index], centerY[index] + extentY[index], centerZ[index] + extentZ[index]);
+    }
+};
+
+// Per pass counters
+struct CullStats
+{
+    unsigned int objects = 0;
+    unsigned int visible = 0;
+    unsigned int boxesTested = 0; // individual box tests (all objects for a flat cull, fewer with the BVH)
+    unsigned int nodesVisited = 0;
+
+    unsigned int Culled() const
+    {
+        return objects - visible;
+    }
+};
+
+inline bool cpuSupportsAVX2()
+{
+#ifdef MULTIPROJECT_X86
+    static const bool supported = []() {
+    #ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        if(info[0] < 7)
+            return false;
+        __cpuid(info, 1);
+        bool osSavesYmm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+        __cpuidex(info, 7, 0);
+        return osSavesYmm && (info[1] & (1 << 5)) != 0;
+    #else
+        return __builtin_cpu_supports("avx2") != 0;
+    #endif
+    }();
+    return supported;
+#else
+    return false;
+#endif
+}
+
+inline void cullBoxesScalar(const Frustum &frustum, const BoundsSoA &bounds, size_t begin, size_t end, uint8_t *visible)
+{
+    for(size_t i = begin; i < end; i++)
+    {
+        bool inside = true;
+        for(const glm::vec4 &plane : frustum.planes)
+        {
+            float distance = plane.x * bounds.centerX[i] + plane.y * bounds.centerY[i] + plane.z * bounds.centerZ[i] + plane.w
+                           + std::abs(plane.x) * bounds.extentX[i] + std::abs(plane.y) * bounds.extentY[i] + std::abs(plane.z) * bounds.extentZ[i];
+            inside &= distance >= 0.0f;
+        }
+        visible[i] = inside ? 1 : 0;
+    }
+}
+
+#ifdef MULTIPROJECT_X86
+inline size_t cullBoxesSSE(const Frustum &frustum, const BoundsSoA &bounds, size_t begin, size_t end, uint8_t *visible)
+{
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    size_t i = begin;
+    for(; i + 4 <= end; i += 4)
+    {
+        __m128 cx = _mm_loadu_ps(&bounds.centerX[i]), cy = _mm_loadu_ps(&bounds.centerY[i]), cz = _mm_loadu_ps(&bounds.centerZ[i]);
+        __m128 ex = _mm_loadu_ps(&bounds.extentX[i]), ey = _mm_loadu_ps(&bounds.extentY[i]), ez = _mm_loadu_ps(&bounds.extentZ[i]);
+        __m128 outside = _mm_setzero_ps();
+        for(const glm::vec4 &plane : frustum.planes)
+        {
+            __m128 nx = _mm_set1_ps(plane.x), ny = _mm_set1_ps(plane.y), nz = _mm_set1_ps(plane.z);
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)), _mm_add_ps(_mm_mul_ps(nz, cz), _mm_set1_ps(plane.w)));
+            __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signMask, nx), ex), _mm_mul_ps(_mm_andnot_ps(signMask, ny), ey)), _mm_mul_ps(_mm_andnot_ps(signMask, nz), ez));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+        }
+        int mask = _mm_movemask_ps(outside);
+        for(int lane = 0; lane < 4; lane++)
+            visible[i + lane] = (mask >> lane) & 1 ? 0 : 1;
+    }
+    return i;
+}
+
+MULTIPROJECT_TARGET_AVX2 inline size_t cullBoxesAVX2(const Frustum &frustum, const BoundsSoA &bounds, size_t begin, size_t end, uint8_t *visible)
+{
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    size_t i = begin;
+    for(; i + 8 <= end; i += 8)
+    {
+        __m256 cx = _mm256_loadu_ps(&bounds.centerX[i]), cy = _mm256_loadu_ps(&bounds.centerY[i]), cz = _mm256_loadu_ps(&bounds.centerZ[i]);
+        __m256 ex = _mm256_loadu_ps(&bounds.extentX[i]), ey = _mm256_loadu_ps(&bounds.extentY[i]), ez = _mm256_loadu_ps(&bounds.extentZ[i]);
+        __m256 outside = _mm256_setzero_ps();
+        for(const glm::vec4 &plane : frustum.planes)
+        {
+            __m256 nx = _mm256_set1_ps(plane.x), ny = _mm256_set1_ps(plane.y), nz = _mm256_set1_ps(plane.z);
+            __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, cx), _mm256_mul_ps(ny, cy)), _mm256_add_ps(_mm256_mul_ps(nz, cz), _mm256_set1_ps(plane.w)));
+            __m256 radius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_andnot_ps(signMask, nx), ex), _mm256_mul_ps(_mm256_andnot_ps(signMask, ny), ey)), _mm256_mul_ps(_mm256_andnot_ps(signMask, nz), ez));
+            outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), _mm256_setzero_ps(), _CMP_LT_OQ));
+        }
+        int mask = _mm256_movemask_ps(outside);
+        for(int lane = 0; lane < 8; lane++)
+            visible[i + lane] = (mask >> lane) & 1 ? 0 : 1;
+    }
+    return i;
+}
+#endif
+
+// visible[i] = 1 for the boxes in [begin, end) that are not entirely behind a frustum plane
+inline void cullBoxes(const Frustum &frustum, const BoundsSoA &bounds, size_t begin, size_t end, uint8_t *visible)
+{
+    size_t done = begin;
+#ifdef MULTIPROJECT_X86
+    if(cpuSupportsAVX2())
+        done = cullBoxesAVX2(frustum, bounds, done, end, visible);
+    done = cullBoxesSSE(frustum, bounds, done, end, visible);
+#endif
+    cullBoxesScalar(frustum, bounds, done, end, visible);
+}
+
+inline CullStats cullBoxes(const Frustum &frustum, const BoundsSoA &bounds, std::vector<uint8_t> &visible)
+{
+    CullStats stats;
+    visible.resize(bounds.Size());
+    cullBoxes(frustum, bounds, 0, bounds.Size(), visible.data());
+    stats.objects = stats.boxesTested = static_cast<unsigned int>(bounds.Size());
+    for(uint8_t flag : visible)
+        stats.visible += flag;
+    return stats;
+}
+
+// Bounding volume hierarchy over a BoundsSoA. Leaves keep their boxes contiguous (in a reordered copy) so they are
+// tested with cullBoxes; subtrees entirely inside the frustum are accepted without testing their boxes.
+class BoundsBVH
+{
+    public:
+        static const unsigned int LeafSize = 8;
+
+        // Median split on the longest axis of the box centers
+        void Build(const BoundsSoA &bounds)
+        {
+            size_t count = bounds.Size();
+            order.resize(count);
+            std::iota(order.begin(), order.end(), 0u);
+            nodes.clear();
+            nodes.reserve(count / LeafSize * 2 + 1);
+            nodes.push_back(Node());
+            if(count > 0)
+                split(bounds, 0, 0, static_cast<uint32_t>(count));
+            Refit(bounds);
+        }
+
+        // Recomputes the boxes for moved objects; the object count must match the last Build
+        void Refit(const BoundsSoA &bounds)
+        {
+            leafBounds.Resize(order.size());
+            for(size_t i = 0; i < order.size(); i++)
+            {
+                uint32_t object = order[i];
+                leafBounds.Set(i, glm::vec3(bounds.centerX[object], bounds.centerY[object], bounds.centerZ[object]),
+                               glm::vec3(bounds.extentX[object], bounds.extentY[object], bounds.extentZ[object]));
+            }
+            // children always come after their parent
+            for(size_t n = nodes.size(); n-- > 0;)
+            {
+                Node &node = nodes[n];
+                if(node.left == 0)
+                {
+                    node.min = glm::vec3(std::numeric_limits<float>::max());
+                    node.max = glm::vec3(-std::numeric_limits<float>::max());
+                    for(uint32_t i = node.first; i < node.first + node.count; i++)
+                    {
+                        node.min = glm::min(node.min, leafBounds.Min(i));
+                        node.max = glm::max(node.max, leafBounds.Max(i));
+                    }
+                }
+                else
+                {
+                    node.min = glm::min(nodes[node.left].min, nodes[node.left + 1].min);
+                    node.max = glm::max(nodes[node.left].max, nodes[node.left + 1].max);
+                }
+            }
+        }
+
+        size_t Size() const
+        {
+            return order.size();
+        }
+
+        // visible[object] = 1 for every object of the last Build that is in the frustum
+        CullStats Cull(const Frustum &frustum, std::vector<uint8_t> &visible) const
+        {
+            CullStats stats;
+            stats.objects = static_cast<unsigned int>(order.size());
+            visible.assign(order.size(), 0);
+            leafVisible.resize(order.size());
+            if(!order.empty())
+                cullNode(frustum, 0, 0x3F, visible, stats);
+            return stats;
+        }
+
+    private:
+        struct Node
+        {
+            glm::vec3 min;
+            uint32_t first = 0; // objects [first, first + count) of order, for inner nodes too
+            glm::vec3 max;
+            uint32_t count = 0;
+            uint32_t left = 0;  // children at left and left + 1; 0 for leaves
+        };
+
+        std::vector<Node> nodes;
+        std::vector<uint32_t> order;
+        BoundsSoA leafBounds;
+        mutable std::vector<uint8_t> leafVisible;
+
+        void split(const BoundsSoA &bounds, uint32_t nodeIndex, uint32_t first, uint32_t count)
+        {
+            nodes[nodeIndex].first = first;
+            nodes[nodeIndex].count = count;
+            if(count <= LeafSize)
+                return;
+
+            glm::vec3 minCenter(std::numeric_limits<float>::max()), maxCenter(-std::numeric_limits<float>::max());
+            for(uint32_t i = first; i < first + count; i++)
+            {
+                glm::vec3 center(bounds.centerX[order[i]], bounds.centerY[order[i]], bounds.centerZ[order[i]]);
+                minCenter = glm::min(minCenter, center);
+                maxCenter = glm::max(maxCenter, center);
+            }
+            glm::vec3 size = maxCenter - minCenter;
+            int axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+            const std::vector<float> &centers = axis == 0 ? bounds.centerX : axis == 1 ? bounds.centerY : bounds.centerZ;
+            uint32_t half = count / 2;
+            std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count,
+                             [&](uint32_t a, uint32_t b) { return centers[a] < centers[b]; });
+
+            uint32_t left = static_cast<uint32_t>(nodes.size());
+            nodes[nodeIndex].left = left;
+            nodes.push_back(Node());
+            nodes.push_back(Node());
+            split(bounds, left, first, half);
+            split(bounds, left + 1, first + half, count - half);
+        }
+
+        // planeMask: planes the node still straddles (parents entirely in front of the others)
+        void cullNode(const Frustum &frustum, uint32_t nodeIndex, unsigned int planeMask, std::vector<uint8_t> &visible, CullStats &stats) const
+        {
+            const Node &node = nodes[nodeIndex];
+            stats.nodesVisited++;
+            glm::vec3 center = (node.min + node.max) * 0.5f;
+            glm::vec3 extent = (node.max - node.min) * 0.5f;
+            for(int p = 0; p < 6; p++)
+            {
+                if((planeMask & (1u << p)) == 0)
+                    continue;
+                const glm::vec4 &plane = frustum.planes[p];
+                float distance = glm::dot(glm::vec3(plane), center) + plane.w;
+                float radius = glm::dot(glm::abs(glm::vec3(plane)), extent);
+                if(distance + radius < 0.0f)
+                    return;
+                if(distance - radius >= 0.0f)
+                    planeMask &= ~(1u << p);
+            }
+
+            if(planeMask == 0)
+            {
+                for(uint32_t i = node.first; i < node.first + node.count; i++)
+                    visible[order[i]] = 1;
+                stats.visible += node.count;
+                return;
+            }
+            if(node.left == 0)
+            {
+                cullBoxes(frustum, leafBounds, node.first, node.first + node.count, leafVisible.data());
+                stats.boxesTested += node.count;
+                for(uint32_t i = node.first; i < node.first + node.count; i++)
+                {
+                    visible[order[i]] = leafVisible[i];
+                    stats.visible += leafVisible[i];
+                }
+                return;
+            }
+            cullNode(frustum, node.left, planeMask, visible, stats);
+            cullNode(frustum, node.left + 1, planeMask, visible, stats);
+        }
+};
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <glad/gl.h>
+
+#include <glm/glm.hpp>
+
+#include "culling.h"
+#include "indirectdraw.h"
+#include "mesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Depth pre-pass of the forward camera pass. Select splits the visible draws of an IndirectDrawList: the ones worth a
+// position only pass (depthprepass.vs) are drawn there first and shaded afterwards with GL_EQUAL, so each of their
+// pixels runs the lit fragment shader once; the others are shaded directly, depth tested against the pre-pass.
+// A mesh pays off when it covers enough of the screen to hide or overdraw other fragments and its triangles are large
+// enough on screen that transforming them twice costs less than the shading it saves.
+// Fragment shader invocations of both passes come from GL_FRAGMENT_SHADER_INVOCATIONS queries, read back without
+// stalling StatsLatency frames late.
+class DepthPrepass
+{
+    public:
+        enum Pass { Prepass, Shading, PassCount };
+        static const unsigned int StatsLatency = 3;
+
+        struct Settings
+        {
+            float minCoverage = 0.01f;          // projected bounding sphere area over the viewport area
+            float maxTrianglesPerPixel = 0.5f;  // triangles of the current LOD over the projected area
+        };
+
+        struct Stats
+        {
+            unsigned int selected = 0; // draws in the pre-pass, of the last Select
+            unsigned int direct = 0;   // visible draws shaded without it
+            uint64_t prepassInvocations = 0;
+            uint64_t shadingInvocations = 0;
+            uint64_t pixels = 0;       // viewport of the measured frame
+
+            // lit fragments per viewport pixel
+            float Overdraw() const
+            {
+                return pixels > 0 ? float(shadingInvocations) / float(pixels) : 0.0f;
+            }
+        };
+
+        Settings settings;
+
+        DepthPrepass()
+        {
+            for (unsigned int slot = 0; slot < StatsLatency; slot++)
+                glGenQueries(PassCount, queries[slot]);
+        }
+
+        DepthPrepass(const DepthPrepass&) = delete;
+        DepthPrepass& operator=(const DepthPrepass&) = delete;
+
+        ~DepthPrepass()
+        {
+            for (unsigned int slot = 0; slot < StatsLatency; slot++)
+                glDeleteQueries(PassCount, queries[slot]);
+        }
+
+        // Splits visible (one flag per Add of drawList) into the pre-pass draws and the ones shaded directly.
+        // fovY in radians, viewport in pixels.
+        void Select(const IndirectDrawList &drawList, const std::vector<uint8_t> &visible, const glm::vec3 &viewPosition, float fovY,
+                    unsigned int width, unsigned int height, std::vector<uint8_t> &prepass, std::vector<uint8_t> &direct)
+        {
+            const std::vector<Mesh*> &meshes = drawList.Meshes();
+            const BoundsSoA &bounds = drawList.Bounds();
+            prepass.assign(meshes.size(), 0);
+            direct.assign(meshes.size(), 0);
+            stats.selected = stats.direct = 0;
+            float pixelsPerUnit = float(height) * 0.5f / std::tan(fovY * 0.5f); // at distance 1
+            float viewportArea = float(width) * float(height);
+            for (size_t i = 0; i < meshes.size(); i++)
+            {
+                if (!visible[i])
+                    continue;
+                glm::vec3 center(bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i]);
+                float radius = glm::length(glm::vec3(bounds.extentX[i], bounds.extentY[i], bounds.extentZ[i]));
+                float distance = glm::length(center - viewPosition);
+                // inside the sphere the mesh may cover the whole view
+                float area = viewportArea;
+                if (distance > radius)
+                {
+                    float projectedRadius = radius / distance * pixelsPerUnit;
+                    area = std::min(3.14159265f * projectedRadius * projectedRadius, viewportArea);
+                }
+                const Mesh &mesh = *meshes[i];
+                float triangles = float(mesh.lods[mesh.currentLod].indexCount / 3);
+                bool pays = area >= settings.minCoverage * viewportArea && triangles <= settings.maxTrianglesPerPixel * area;
+                if (pays)
+                {
+                    prepass[i] = 1;
+                    stats.selected++;
+                }
+                else
+                {
+                    direct[i] = 1;
+                    stats.direct++;
+                }
+            }
+        }
+
+        // Starts a frame of queries: collects the results of the slot about to be reused
+        void BeginFrame(unsigned int width, unsigned int height)
+        {
+            slot = (slot + 1) % StatsLatency;
+            bool complete = true;
+            uint64_t results[PassCount] = {};
+            for (unsigned int pass = 0; pass < PassCount; pass++)
+            {
+                if (!issued[slot][pass])
+                    continue;
+                GLuint available = 0;
+                glGetQueryObjectuiv(queries[slot][pass], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (available)
+                    glGetQueryObjectui64v(queries[slot][pass], GL_QUERY_RESULT, &results[pass]);
+                complete = complete && available;
+            }
+            if (complete && issued[slot][Shading])
+            {
+                stats.prepassInvocations = issued[slot][Prepass] ? results[Prepass] : 0;
+                stats.shadingInvocations = results[Shading];
+                stats.pixels = pixels[slot];
+            }
+            issued[slot][Prepass] = issued[slot][Shading] = false;
+            pixels[slot] = uint64_t(width) * height;
+        }
+
+        // Counts the fragment shader invocations of the draws up to End; one Begin per pass and frame
+        void Begin(Pass pass)
+        {
+            glBeginQuery(GL_FRAGMENT_SHADER_INVOCATIONS, queries[slot][pass]);
+            issued[slot][pass] = true;
+        }
+
+        void End()
+        {
+            glEndQuery(GL_FRAGMENT_SHADER_INVOCATIONS);
+        }
+
+        // Selection of the last Select, invocations of the frame StatsLatency frames back
+        const Stats& GetStats() const
+        {
+            return stats;
+        }
+
+    private:
+        GLuint queries[StatsLatency][PassCount];
+        bool issued[StatsLatency][PassCount] = {};
+        uint64_t pixels[StatsLatency] = {};
+        unsigned int slot = 0;
+        Stats stats;
+};
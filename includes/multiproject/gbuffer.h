@@ -0,0 +1,118 @@
+#pragma once
+
+#include <glad/gl.h>
+
+#include <glm/glm.hpp>
+
+#include "glhandle.h"
+#include "glstate.h"
+#include "postprocesseffect.h"
+#include "shader.h"
+
+#include <iostream>
+
+// Target of the deferred path. The geometry pass (gbuffer.fs) writes 8 bytes of color per pixel plus depth:
+//   Albedo  GL_SRGB8_ALPHA8      diffuse color, specular mask in alpha
+//   Normal  GL_RG16              octahedral world space normal (gbuffer.glsl)
+//   Depth   GL_DEPTH24_STENCIL8  world positions are rebuilt from it with the inverse view projection
+// Resolve then shades every covered pixel once, a screen space pass of deferred.fs over the same lights as the forward
+// path (LightBuffer, ClusteredLights), into the PostProcessEffect framebuffer. The G-buffer is single sampled, the lit
+// color fills every sample of the multisampled target.
+class GBuffer
+{
+    public:
+        // after the material (0, 1) and shadow map (2 to 4) units
+        static const GLuint AlbedoUnit = 5;
+        static const GLuint NormalUnit = 6;
+        static const GLuint DepthUnit = 7;
+
+        unsigned int width, height;
+
+        GBuffer(unsigned int width, unsigned int height) : width(width), height(height)
+        {
+            glGenFramebuffers(1, framebuffer.Replace());
+            glGenTextures(1, albedoTexture.Replace());
+            glGenTextures(1, normalTexture.Replace());
+            glGenTextures(1, depthTexture.Replace());
+            allocate();
+
+            GLState::Instance().BindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedoTexture, 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normalTexture, 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+            const GLenum attachments[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+            glDrawBuffers(2, attachments);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                std::cout << "ERROR::GBUFFER:: Framebuffer is not complete!" << std::endl;
+            GLState::Instance().BindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+
+        GBuffer(const GBuffer&) = delete;
+        GBuffer& operator=(const GBuffer&) = delete;
+
+        // Framebuffer of the geometry pass, for PipelineState::WithFramebuffer
+        GLuint Framebuffer() const
+        {
+            return framebuffer;
+        }
+
+        // Single sampled depth of the geometry pass, e.g. for HiZCuller::BuildPyramid
+        GLuint DepthTexture() const
+        {
+            return depthTexture;
+        }
+
+        // Points the G-buffer samplers of a deferred.fs program at their units; once per program
+        void SetSamplers(Shader &shader) const
+        {
+            shader.Activate();
+            shader.setInt("gAlbedo", AlbedoUnit);
+            shader.setInt("gNormal", NormalUnit);
+            shader.setInt("gDepth", DepthUnit);
+        }
+
+        // Clears target's framebuffer to the current clear color and lights the G-buffer into it with shader (deferred.fs).
+        // The caller binds the light blocks and shadow maps as for the forward pass.
+        void Resolve(Shader &shader, PostProcessEffect &target, const glm::mat4 &viewProjection)
+        {
+            GLState &state = GLState::Instance();
+            state.Apply(PipelineState().WithFramebuffer(target.framebuffer).WithViewport(0, 0, width, height)
+                                       .WithDepthTest(false).WithCullFace(GL_NONE));
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            shader.Activate();
+            shader.setMat4("inverseViewProjection", glm::inverse(viewProjection));
+            state.BindTexture(AlbedoUnit, albedoTexture);
+            state.BindTexture(NormalUnit, normalTexture);
+            state.BindTexture(DepthUnit, depthTexture);
+            glBindVertexArray(target.quadVAO);
+            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+            glBindVertexArray(0);
+        }
+
+        void Resize(unsigned int width, unsigned int height)
+        {
+            this->width = width;
+            this->height = height;
+            allocate();
+        }
+
+    private:
+        FramebufferHandle framebuffer;
+        TextureHandle albedoTexture, normalTexture, depthTexture;
+
+        void allocate()
+        {
+            auto target = [&](GLuint texture, GLenum internalFormat, GLenum format, GLenum type) {
+                glBindTexture(GL_TEXTURE_2D, texture);
+                glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            };
+            target(albedoTexture, GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE);
+            target(normalTexture, GL_RG16, GL_RG, GL_UNSIGNED_SHORT);
+            target(depthTexture, GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+};
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <glad/gl.h>
+
+#include "vertexformat.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// One vertex and one index buffer shared by every mesh of a vertex format, with a single VAO, so meshes can be
+// drawn together by glMultiDrawElementsIndirect (see indirectdraw.h). Indices are 32-bit and relative to the
+// mesh's baseVertex. Buffers grow by doubling; allocations are never moved relative to each other.
+// The arenas live until exit, after the context, so their objects are released by Delete() rather than a destructor;
+// space of destroyed meshes is not reused.
+class GeometryArena
+{
+    public:
+        struct Allocation
+        {
+            uint32_t baseVertex = 0;
+            uint32_t firstIndex = 0;
+        };
+
+        static GeometryArena& Instance(VertexFormat format)
+        {
+            static GeometryArena floatArena(VertexFormat::Float);
+            static GeometryArena quantizedArena(VertexFormat::Quantized);
+            return format == VertexFormat::Quantized ? quantizedArena : floatArena;
+        }
+
+        GeometryArena(const GeometryArena&) = delete;
+        GeometryArena& operator=(const GeometryArena&) = delete;
+
+        // vertices are Vertex or PackedVertex depending on the arena's format
+        Allocation Add(const void *vertices, size_t vertexCount, const unsigned int *indices, size_t indexCount)
+        {
+            if (VAO == 0)
+                glGenVertexArrays(1, &VAO);
+
+            bool grown = grow(VBO, vertexCapacity, vertexUsed, vertexUsed + vertexCount * vertexStride());
+            grown |= grow(EBO, indexCapacity, indexUsed, indexUsed + indexCount * sizeof(unsigned int));
+            if (grown)
+            {
+                glBindVertexArray(VAO);
+                glBindBuffer(GL_ARRAY_BUFFER, VBO);
+                setupVertexAttributes(format);
+                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+                glBindVertexArray(0);
+                glBindBuffer(GL_ARRAY_BUFFER, 0);
+            }
+
+            Allocation allocation;
+            allocation.baseVertex = static_cast<uint32_t>(vertexUsed / vertexStride());
+            allocation.firstIndex = static_cast<uint32_t>(indexUsed / sizeof(unsigned int));
+
+            // the copy targets leave the element buffer binding of whatever VAO is bound untouched
+            glBindBuffer(GL_COPY_WRITE_BUFFER, VBO);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, vertexUsed, vertexCount * vertexStride(), vertices);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, indexUsed, indexCount * sizeof(unsigned int), indices);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+            vertexUsed += vertexCount * vertexStride();
+            indexUsed += indexCount * sizeof(unsigned int);
+            return allocation;
+        }
+
+        unsigned int GetVAO() const
+        {
+            return VAO;
+        }
+
+        // Buffers of the arena, e.g. to read vertices in a shader; the names change when the arena grows
+        unsigned int GetVertexBuffer() const
+        {
+            return VBO;
+        }
+
+        unsigned int GetIndexBuffer() const
+        {
+            return EBO;
+        }
+
+        VertexFormat Format() const
+        {
+            return format;
+        }
+
+        size_t VertexBytes() const
+        {
+            return vertexUsed;
+        }
+
+        size_t IndexBytes() const
+        {
+            return indexUsed;
+        }
+
+        void Delete()
+        {
+            glDeleteVertexArrays(1, &VAO);
+            glDeleteBuffers(1, &VBO);
+            glDeleteBuffers(1, &EBO);
+            VAO = VBO = EBO = 0;
+            vertexCapacity = vertexUsed = indexCapacity = indexUsed = 0;
+        }
+
+    private:
+        VertexFormat format;
+        unsigned int VAO = 0, VBO = 0, EBO = 0;
+        size_t vertexCapacity = 0, vertexUsed = 0; // bytes
+        size_t indexCapacity = 0, indexUsed = 0;
+
+        explicit GeometryArena(VertexFormat format) : format(format) {}
+
+        size_t vertexStride() const
+        {
+            return format == VertexFormat::Quantized ? sizeof(PackedVertex) : sizeof(Vertex);
+        }
+
+        // Reallocates buffer to hold at least required bytes, keeping its first used bytes
+        static bool grow(unsigned int &buffer, size_t &capacity, size_t used, size_t required)
+        {
+            if (required <= capacity)
+                return false;
+
+            size_t newCapacity = std::max(required, std::max(capacity * 2, size_t(4) << 20));
+            unsigned int grown;
+            glGenBuffers(1, &grown);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+            glBufferData(GL_COPY_WRITE_BUFFER, newCapacity, nullptr, GL_STATIC_DRAW);
+            if (used > 0)
+            {
+                glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used);
+                glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            }
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            glDeleteBuffers(1, &buffer);
+            buffer = grown;
+            capacity = newCapacity;
+            return true;
+        }
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <glad/gl.h>
+
+#include "glstate.h"
+
+#include <utility>
+
+// Move-only owner of one GL object name, deleted with the handle. Converts to the name, so it can be passed to GL
+// calls as is; glGen* calls write through Replace(). Handles must be destroyed while their context is current.
+template<typename Deleter>
+class GLHandle
+{
+    public:
+        GLHandle() = default;
+        explicit GLHandle(GLuint id) : id(id) {}
+
+        GLHandle(const GLHandle&) = delete;
+        GLHandle& operator=(const GLHandle&) = delete;
+
+        GLHandle(GLHandle &&other) noexcept : id(std::exchange(other.id, 0)) {}
+
+        GLHandle& operator=(GLHandle &&other) noexcept
+        {
+            if(this != &other)
+            {
+                Reset();
+                id = std::exchange(other.id, 0);
+            }
+            return *this;
+        }
+
+        ~GLHandle()
+        {
+            Reset();
+        }
+
+        operator GLuint() const
+        {
+            return id;
+        }
+
+        // Deletes the current object and returns the slot for the new name, e.g. glGenBuffers(1, buffer.Replace())
+        GLuint* Replace()
+        {
+            Reset();
+            return &id;
+        }
+
+        void Reset()
+        {
+            if(id != 0)
+                Deleter()(id);
+            id = 0;
+        }
+
+    private:
+        GLuint id = 0;
+};
+
+struct GLBufferDeleter { void operator()(GLuint id) const { glDeleteBuffers(1, &id); } };
+struct GLVertexArrayDeleter { void operator()(GLuint id) const { glDeleteVertexArrays(1, &id); } };
+struct GLTextureDeleter { void operator()(GLuint id) const { GLState::Instance().TextureDeleted(id); glDeleteTextures(1, &id); } };
+struct GLProgramDeleter { void operator()(GLuint id) const { GLState::Instance().ProgramDeleted(id); glDeleteProgram(id); } };
+struct GLShaderDeleter { void operator()(GLuint id) const { glDeleteShader(id); } };
+struct GLFramebufferDeleter { void operator()(GLuint id) const { GLState::Instance().FramebufferDeleted(id); glDeleteFramebuffers(1, &id); } };
+
+using BufferHandle = GLHandle<GLBufferDeleter>;
+using VertexArrayHandle = GLHandle<GLVertexArrayDeleter>;
+using TextureHandle = GLHandle<GLTextureDeleter>;
+using ProgramHandle = GLHandle<GLProgramDeleter>;
+using ShaderStageHandle = GLHandle<GLShaderDeleter>;
+using FramebufferHandle = GLHandle<GLFramebufferDeleter>;
@@ -0,0 +1,329 @@
+#pragma once
+
+#include <glad/gl.h>
+
+#include <cstdint>
+
+// Fixed function state of a pass, applied as a whole with GLState::Apply. Immutable: the With* calls return a copy,
+// starting from depth test LESS with writes, back face culling, no blending and the window framebuffer, e.g.
+//   const PipelineState shadowPass = PipelineState().WithFramebuffer(fbo).WithViewport(0, 0, 1024, 1024).WithCullFace(GL_FRONT);
+class PipelineState
+{
+    public:
+        PipelineState WithDepthTest(bool enabled, GLenum func = GL_LESS) const
+        {
+            PipelineState state = *this;
+            state.depthTest = enabled;
+            state.depthFunc = func;
+            return state;
+        }
+
+        PipelineState WithDepthWrite(bool enabled) const
+        {
+            PipelineState state = *this;
+            state.depthWrite = enabled;
+            return state;
+        }
+
+        // GL_NONE disables culling
+        PipelineState WithCullFace(GLenum face) const
+        {
+            PipelineState state = *this;
+            state.cullFace = face;
+            return state;
+        }
+
+        // GL_ONE, GL_ZERO disables blending
+        PipelineState WithBlend(GLenum source, GLenum destination) const
+        {
+            PipelineState state = *this;
+            state.blendSource = source;
+            state.blendDestination = destination;
+            return state;
+        }
+
+        // 0 (the default) leaves the program to the draws
+        PipelineState WithProgram(GLuint program) const
+        {
+            PipelineState state = *this;
+            state.program = program;
+            return state;
+        }
+
+        PipelineState WithFramebuffer(GLuint framebuffer) const
+        {
+            PipelineState state = *this;
+            state.framebuffer = framebuffer;
+            return state;
+        }
+
+        // a width of 0 (the default) leaves the viewport as it is
+        PipelineState WithViewport(GLint x, GLint y, GLsizei width, GLsizei height) const
+        {
+            PipelineState state = *this;
+            state.viewport[0] = x;
+            state.viewport[1] = y;
+            state.viewport[2] = width;
+            state.viewport[3] = height;
+            return state;
+        }
+
+    private:
+        friend class GLState;
+
+        bool depthTest = true;
+        GLenum depthFunc = GL_LESS;
+        bool depthWrite = true;
+        GLenum cullFace = GL_BACK;
+        GLenum blendSource = GL_ONE, blendDestination = GL_ZERO;
+        GLuint program = 0;
+        GLuint framebuffer = 0;
+        GLint viewport[4] = { 0, 0, 0, 0 };
+};
+
+// Shadow copy of the GL state the renderer changes per pass and per draw: capabilities, depth, culling and blend
+// modes, viewport, framebuffers, program and texture units. Calls setting a value that is already current are dropped
+// and counted. Everything starts unknown, so the first call of each kind always reaches GL.
+// Texture units are bound with glBindTextureUnit; the active unit stays on UploadUnit, where texture creation and
+// uploads bind (glBindTexture), so they never disturb a tracked unit. Code that changes tracked state directly must
+// call Invalidate before the next GLState call.
+class GLState
+{
+    public:
+        static const GLuint UploadUnit = 31;      // below the minimum GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS of 4.x
+        static const GLuint MaxTextureUnits = 16; // tracked units, binds to higher units always reach GL
+
+        struct Stats
+        {
+            unsigned int issued = 0;     // calls that reached GL
+            unsigned int suppressed = 0; // calls dropped because the state was already set
+        };
+
+        // State of the current context
+        static GLState& Instance()
+        {
+            static GLState state;
+            return state;
+        }
+
+        // GL_DEPTH_TEST, GL_CULL_FACE, GL_BLEND and GL_FRAMEBUFFER_SRGB are tracked, other capabilities pass through
+        void Enable(GLenum capability, bool enabled)
+        {
+            int index = capabilityIndex(capability);
+            if (index >= 0 && !changed(capabilities[index], int8_t(enabled ? 1 : 0)))
+                return;
+            if (index < 0)
+                stats.issued++;
+            if (enabled)
+                glEnable(capability);
+            else
+                glDisable(capability);
+        }
+
+        void DepthFunc(GLenum func)
+        {
+            if (changed(depthFunc, func))
+                glDepthFunc(func);
+        }
+
+        void DepthMask(bool write)
+        {
+            if (changed(depthMask, int8_t(write ? 1 : 0)))
+                glDepthMask(write ? GL_TRUE : GL_FALSE);
+        }
+
+        void CullFace(GLenum face)
+        {
+            if (changed(cullFace, face))
+                glCullFace(face);
+        }
+
+        void BlendFunc(GLenum source, GLenum destination)
+        {
+            if (blendSource == source && blendDestination == destination)
+            {
+                stats.suppressed++;
+                return;
+            }
+            blendSource = source;
+            blendDestination = destination;
+            stats.issued++;
+            glBlendFunc(source, destination);
+        }
+
+        void Viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+        {
+            if (viewport[0] == x && viewport[1] == y && viewport[2] == width && viewport[3] == height)
+            {
+                stats.suppressed++;
+                return;
+            }
+            viewport[0] = x;
+            viewport[1] = y;
+            viewport[2] = width;
+            viewport[3] = height;
+            stats.issued++;
+            glViewport(x, y, width, height);
+        }
+
+        // GL_FRAMEBUFFER binds both the read and the draw framebuffer
+        void BindFramebuffer(GLenum target, GLuint framebuffer)
+        {
+            if (target == GL_FRAMEBUFFER)
+            {
+                if (readFramebuffer == framebuffer && drawFramebuffer == framebuffer)
+                {
+                    stats.suppressed++;
+                    return;
+                }
+                readFramebuffer = drawFramebuffer = framebuffer;
+                stats.issued++;
+                glBindFramebuffer(target, framebuffer);
+                return;
+            }
+            if (changed(target == GL_READ_FRAMEBUFFER ? readFramebuffer : drawFramebuffer, framebuffer))
+                glBindFramebuffer(target, framebuffer);
+        }
+
+        // true when glUseProgram was called
+        bool UseProgram(GLuint program)
+        {
+            if (!changed(this->program, program))
+                return false;
+            glUseProgram(program);
+            return true;
+        }
+
+        // Binds texture (any target) to unit; true when glBindTextureUnit was called
+        bool BindTexture(GLuint unit, GLuint texture)
+        {
+            if (!uploadUnitActive)
+            {
+                glActiveTexture(GL_TEXTURE0 + UploadUnit);
+                uploadUnitActive = true;
+            }
+            if (unit >= MaxTextureUnits)
+            {
+                stats.issued++;
+                glBindTextureUnit(unit, texture);
+                return true;
+            }
+            if (!changed(textures[unit], texture))
+                return false;
+            glBindTextureUnit(unit, texture);
+            return true;
+        }
+
+        // Sets what differs between the pipeline state and the current state
+        void Apply(const PipelineState &state)
+        {
+            BindFramebuffer(GL_FRAMEBUFFER, state.framebuffer);
+            if (state.viewport[2] > 0)
+                Viewport(state.viewport[0], state.viewport[1], state.viewport[2], state.viewport[3]);
+            Enable(GL_DEPTH_TEST, state.depthTest);
+            if (state.depthTest)
+                DepthFunc(state.depthFunc);
+            DepthMask(state.depthWrite);
+            Enable(GL_CULL_FACE, state.cullFace != GL_NONE);
+            if (state.cullFace != GL_NONE)
+                CullFace(state.cullFace);
+            bool blend = state.blendSource != GL_ONE || state.blendDestination != GL_ZERO;
+            Enable(GL_BLEND, blend);
+            if (blend)
+                BlendFunc(state.blendSource, state.blendDestination);
+            if (state.program != 0)
+                UseProgram(state.program);
+        }
+
+        // Forgets the shadowed state, e.g. after code outside GLState changed it
+        void Invalidate()
+        {
+            *this = GLState(stats);
+        }
+
+        // Called when the names are deleted, so a new object with a reused name is bound again
+        void ProgramDeleted(GLuint program)
+        {
+            if (this->program == program)
+                this->program = Unknown;
+        }
+
+        void TextureDeleted(GLuint texture)
+        {
+            for (GLuint &bound : textures)
+                if (bound == texture)
+                    bound = Unknown;
+        }
+
+        // Deleting a bound framebuffer reverts its binding to 0, and a recycled name must be bound again
+        void FramebufferDeleted(GLuint framebuffer)
+        {
+            if (readFramebuffer == framebuffer)
+                readFramebuffer = Unknown;
+            if (drawFramebuffer == framebuffer)
+                drawFramebuffer = Unknown;
+        }
+
+        // Counts since the last ResetStats, e.g. per frame
+        const Stats& GetStats() const
+        {
+            return stats;
+        }
+
+        void ResetStats()
+        {
+            stats = Stats();
+        }
+
+    private:
+        static const GLuint Unknown = 0xFFFFFFFFu;
+        static const int CapabilityCount = 4;
+
+        int8_t capabilities[CapabilityCount] = { -1, -1, -1, -1 };
+        GLenum depthFunc = Unknown;
+        int8_t depthMask = -1;
+        GLenum cullFace = Unknown;
+        GLenum blendSource = Unknown, blendDestination = Unknown;
+        GLint viewport[4] = { -1, -1, -1, -1 };
+        GLuint readFramebuffer = Unknown, drawFramebuffer = Unknown;
+        GLuint program = Unknown;
+        GLuint textures[MaxTextureUnits];
+        bool uploadUnitActive = false;
+        Stats stats;
+
+        GLState()
+        {
+            for (GLuint &texture : textures)
+                texture = Unknown;
+        }
+
+        explicit GLState(const Stats &stats) : GLState()
+        {
+            this->stats = stats;
+        }
+
+        template<typename T>
+        bool changed(T &current, T value)
+        {
+            if (current == value)
+            {
+                stats.suppressed++;
+                return false;
+            }
+            current = value;
+            stats.issued++;
+            return true;
+        }
+
+        static int capabilityIndex(GLenum capability)
+        {
+            switch (capability)
+            {
+                case GL_DEPTH_TEST: return 0;
+                case GL_CULL_FACE: return 1;
+                case GL_BLEND: return 2;
+                case GL_FRAMEBUFFER_SRGB: return 3;
+                default: return -1;
+            }
+        }
+};
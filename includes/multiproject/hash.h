@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// 64-bit FNV-1a, used to fingerprint files, paths and decoded images
+inline uint64_t hashBytes(const void *data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+    const unsigned char *bytes = static_cast<const unsigned char*>(data);
+    for(size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
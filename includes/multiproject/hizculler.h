@@ -0,0 +1,235 @@
+#pragma once
+
+#include <glad/gl.h>
+
+#include <glm/glm.hpp>
+
+#include "glhandle.h"
+#include "glstate.h"
+#include "indirectdraw.h"
+#include "shader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Hierarchical-Z occlusion culling of an IndirectDrawList. The pyramid (hizbuild.cs) keeps the farthest depth per
+// texel of every mip level; hizcull.cs zeroes the instanceCount of commands whose box lies behind it. A camera pass
+// runs in two phases so nothing visible is lost to a stale pyramid:
+//   CullFirst   test against the pyramid of the previous frame, then draw the list
+//   BuildPyramid from the depth drawn so far
+//   CullSecond  re-test only what CullFirst rejected, then draw the list again
+// Restore then re-enables everything either phase drew, when a later pass shades the same commands (depth pre-pass),
+// and CullCurrent tests a newly prepared list once against this frame's pyramid, for draws that follow it.
+// Counters are read back without stalling, StatsLatency frames late.
+class HiZCuller
+{
+    public:
+        // layout (binding) of the buffers in hizcull.cs
+        static const GLuint CommandBinding = 0;
+        static const GLuint BoundsBinding = 1;
+        static const GLuint PhaseBinding = 2;
+        static const GLuint CounterBinding = 3;
+        static const GLuint PyramidUnit = 0;     // texture and image unit used while culling and building
+        static const unsigned int StatsLatency = 3;
+
+        struct Stats
+        {
+            unsigned int tested = 0;        // commands of the camera pass
+            unsigned int visibleFirst = 0;  // drawn in the first phase
+            unsigned int visibleSecond = 0; // rejected by the previous frame's depth but visible in this frame's
+
+            unsigned int Skipped() const
+            {
+                return tested - visibleFirst - visibleSecond;
+            }
+        };
+
+        HiZCuller() : buildShader(Shader::Compute("hizbuild.cs")), cullShader(Shader::Compute("hizcull.cs"))
+        {
+            glGenBuffers(1, boundsBuffer.Replace());
+            glGenBuffers(1, phaseBuffer.Replace());
+
+            // one slot of counters per frame in flight, persistently mapped for the fenced read back
+            glGenBuffers(1, counterBuffer.Replace());
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, counterBuffer);
+            GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_SHADER_STORAGE_BUFFER, StatsLatency * CounterStride, nullptr, flags);
+            counters = static_cast<uint8_t*>(glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, StatsLatency * CounterStride, flags));
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        }
+
+        HiZCuller(const HiZCuller&) = delete;
+        HiZCuller& operator=(const HiZCuller&) = delete;
+
+        ~HiZCuller()
+        {
+            for (GLsync &fence : fences)
+                if (fence)
+                    glDeleteSync(fence);
+        }
+
+        // Rebuilds the pyramid from a single sampled depth texture, e.g. PostProcessEffect::depthTexture after ResolveDepth
+        void BuildPyramid(GLuint depthTexture, unsigned int width, unsigned int height)
+        {
+            if (width != pyramidWidth || height != pyramidHeight)
+            {
+                pyramidWidth = width;
+                pyramidHeight = height;
+                pyramidLevels = 1;
+                while ((std::max(width, height) >> pyramidLevels) > 0)
+                    pyramidLevels++;
+                glGenTextures(1, pyramid.Replace());
+                glBindTexture(GL_TEXTURE_2D, pyramid);
+                glTexStorage2D(GL_TEXTURE_2D, pyramidLevels, GL_R32F, width, height);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+                glBindTexture(GL_TEXTURE_2D, 0);
+            }
+
+            buildShader.Activate();
+            GLState::Instance().BindTexture(PyramidUnit, depthTexture);
+            for (unsigned int level = 0; level < pyramidLevels; level++)
+            {
+                glm::ivec2 size = glm::max(glm::ivec2(width >> level, height >> level), glm::ivec2(1));
+                buildShader.setInt("sourceLevel", static_cast<int>(level) - 1);
+                glBindImageTexture(PyramidUnit, pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+                glDispatchCompute((size.x + 7) / 8, (size.y + 7) / 8, 1);
+                glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+                if (level == 0)
+                    GLState::Instance().BindTexture(PyramidUnit, pyramid);
+            }
+            GLState::Instance().BindTexture(PyramidUnit, 0);
+            pyramidValid = true;
+        }
+
+        // Phase one: after drawList.Prepare, before its first Draw
+        void CullFirst(IndirectDrawList &drawList, const glm::mat4 &viewProjection)
+        {
+            beginFrame();
+            uploadBounds(drawList);
+            dispatch(drawList, viewProjection, 0);
+        }
+
+        // Phase two: after BuildPyramid, before the second Draw of drawList
+        void CullSecond(IndirectDrawList &drawList, const glm::mat4 &viewProjection)
+        {
+            dispatch(drawList, viewProjection, 1);
+            fence();
+        }
+
+        // After CullSecond and its Draw: the commands of every mesh drawn by either phase, for another Draw of them
+        void Restore(IndirectDrawList &drawList)
+        {
+            dispatch(drawList, glm::mat4(1.0f), 2);
+        }
+
+        // After CullSecond, once drawList was prepared again (same Adds, other commands): one test against the pyramid
+        // of this frame, counted as tested and visible in the second phase
+        void CullCurrent(IndirectDrawList &drawList, const glm::mat4 &viewProjection)
+        {
+            dispatch(drawList, viewProjection, 3);
+            fence();
+        }
+
+        // Drops the pyramid, e.g. after a camera cut; the next CullFirst draws everything
+        void Invalidate()
+        {
+            pyramidValid = false;
+        }
+
+        // Counters of the frame StatsLatency frames back
+        const Stats& LastStats() const
+        {
+            return stats;
+        }
+
+        GLuint Pyramid() const
+        {
+            return pyramid;
+        }
+
+    private:
+        static const size_t CounterStride = 256; // GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT is at most 256
+
+        Shader buildShader, cullShader;
+        TextureHandle pyramid;
+        unsigned int pyramidWidth = 0, pyramidHeight = 0, pyramidLevels = 0;
+        bool pyramidValid = false;
+        BufferHandle boundsBuffer, phaseBuffer, counterBuffer;
+        size_t phaseCapacity = 0;
+        uint8_t *counters = nullptr;
+        GLsync fences[StatsLatency] = {};
+        unsigned int slot = 0;
+        Stats stats;
+        std::vector<glm::vec4> bounds;
+
+        // Reads the counters of the slot about to be reused, then clears them
+        void beginFrame()
+        {
+            slot = (slot + 1) % StatsLatency;
+            uint32_t *slotCounters = reinterpret_cast<uint32_t*>(counters + slot * CounterStride);
+            if (fences[slot])
+            {
+                glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+                glDeleteSync(fences[slot]);
+                fences[slot] = nullptr;
+                stats.tested = slotCounters[0];
+                stats.visibleFirst = slotCounters[1];
+                stats.visibleSecond = slotCounters[2];
+            }
+            std::memset(slotCounters, 0, 3 * sizeof(uint32_t));
+        }
+
+        // the counters of the frame are complete once the commands issued so far are
+        void fence()
+        {
+            glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+            if (fences[slot])
+                glDeleteSync(fences[slot]);
+            fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+
+        void uploadBounds(IndirectDrawList &drawList)
+        {
+            const BoundsSoA &source = drawList.Bounds();
+            bounds.resize(source.Size() * 2);
+            for (size_t i = 0; i < source.Size(); i++)
+            {
+                bounds[i * 2] = glm::vec4(source.centerX[i], source.centerY[i], source.centerZ[i], 0.0f);
+                bounds[i * 2 + 1] = glm::vec4(source.extentX[i], source.extentY[i], source.extentZ[i], 0.0f);
+            }
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, boundsBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, bounds.size() * sizeof(glm::vec4), bounds.data(), GL_STREAM_DRAW);
+
+            if (drawList.CommandCount() > phaseCapacity)
+            {
+                phaseCapacity = std::max(drawList.CommandCount(), phaseCapacity * 2);
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, phaseBuffer);
+                glBufferData(GL_SHADER_STORAGE_BUFFER, phaseCapacity * sizeof(uint32_t), nullptr, GL_DYNAMIC_COPY);
+            }
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        }
+
+        void dispatch(IndirectDrawList &drawList, const glm::mat4 &viewProjection, int phase)
+        {
+            GLuint commandCount = static_cast<GLuint>(drawList.CommandCount());
+            if (commandCount == 0)
+                return;
+
+            cullShader.Activate();
+            cullShader.setMat4("viewProjection", viewProjection);
+            cullShader.setInt("phase", phase);
+            cullShader.setInt("commandCount", static_cast<int>(commandCount));
+            cullShader.setBool("pyramidValid", pyramidValid);
+            GLState::Instance().BindTexture(PyramidUnit, pyramidValid ? static_cast<GLuint>(pyramid) : 0);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CommandBinding, drawList.CommandBuffer());
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BoundsBinding, boundsBuffer);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PhaseBinding, phaseBuffer);
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, CounterBinding, counterBuffer, slot * CounterStride, 3 * sizeof(uint32_t));
+            glDispatchCompute((commandCount + 63) / 64, 1, 1);
+            glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+            GLState::Instance().BindTexture(PyramidUnit, 0);
+        }
+};
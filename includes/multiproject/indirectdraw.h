@@ -0,0 +1,244 @@
+#pragma once
+
+#include <glad/gl.h>
+
+#include <glm/glm.hpp>
+
+#include "culling.h"
+#include "glhandle.h"
+#include "mesh.h"
+#include "shader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+// Layout of glMultiDrawElementsIndirect commands
+struct DrawElementsIndirectCommand
+{
+    uint32_t count;
+    uint32_t instanceCount;
+    uint32_t firstIndex;
+    int32_t baseVertex;
+    uint32_t baseInstance;
+};
+
+// Per draw data read by vertex.glsl when built with INDIRECT_DRAWS (std430, indexed by gl_BaseInstance)
+struct DrawRecord
+{
+    glm::mat4 model;
+    glm::vec4 positionOffset; // xyz, VertexQuantization of quantized meshes
+    glm::vec4 positionScale;
+    glm::vec4 uvTransform;
+};
+
+// Meshes of one frame, collected from arena meshes (Model::Draw(IndirectDrawList&, ...)) and submitted with
+// glMultiDrawElementsIndirect. The same list can be submitted to several passes; the shader must be built with
+// INDIRECT_DRAWS (and QUANTIZED_VERTICES for quantized meshes).
+class IndirectDrawList
+{
+    public:
+        static const GLuint RecordBinding = 0; // layout (binding) of DrawRecords in vertex.glsl
+
+        struct Stats
+        {
+            unsigned int drawCalls = 0; // glMultiDrawElementsIndirect calls since the last Prepare (or Submit)
+            unsigned int commands = 0;
+        };
+
+        IndirectDrawList() = default;
+        IndirectDrawList(const IndirectDrawList&) = delete;
+        IndirectDrawList& operator=(const IndirectDrawList&) = delete;
+
+        void Clear()
+        {
+            meshes.clear();
+            records.clear();
+            bounds.Clear();
+            groups.clear();
+            commandCount = 0;
+            uploaded = false;
+        }
+
+        // Queues mesh at its current LOD; meshes outside a GeometryArena cannot be drawn indirectly
+        bool Add(Mesh &mesh, const glm::mat4 &model)
+        {
+            if (!mesh.inArena)
+            {
+                std::cout << "ERROR::INDIRECTDRAW:: Mesh is not in a geometry arena" << std::endl;
+                return false;
+            }
+            DrawRecord record;
+            record.model = model;
+            record.positionOffset = glm::vec4(mesh.quantization.positionOffset, 0.0f);
+            record.positionScale = glm::vec4(mesh.quantization.positionScale, 0.0f);
+            record.uvTransform = mesh.quantization.uvTransform;
+            meshes.push_back(&mesh);
+            records.push_back(record);
+            bounds.Add(mesh.boundsMin, mesh.boundsMax, model);
+            uploaded = false;
+            return true;
+        }
+
+        // One glMultiDrawElementsIndirect per vertex format and, when bindTextures is set, per texture set.
+        // Depth only passes pass bindTextures = false and draw each format's meshes with a single call.
+        // visible (one flag per Add, e.g. from cullBoxes or BoundsBVH::Cull over Bounds()) skips the culled meshes.
+        void Submit(Shader &shader, bool bindTextures = true, const std::vector<uint8_t> *visible = nullptr)
+        {
+            Prepare(bindTextures, visible);
+            Draw(shader);
+        }
+
+        // First half of Submit: writes the commands to CommandBuffer(), where a compute pass may change them
+        // (e.g. zero the instanceCount of occluded meshes, see HiZCuller) before Draw
+        void Prepare(bool bindTextures = true, const std::vector<uint8_t> *visible = nullptr)
+        {
+            stats = Stats();
+            groups.clear();
+            commandCount = 0;
+            preparedWithTextures = bindTextures;
+            if (meshes.empty())
+                return;
+            if (!uploaded)
+                upload();
+
+            std::vector<uint32_t> order;
+            order.reserve(meshes.size());
+            for (uint32_t i = 0; i < meshes.size(); i++)
+                if (!visible || (*visible)[i])
+                    order.push_back(i);
+            if (order.empty())
+                return;
+            std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+                if (meshes[a]->format != meshes[b]->format)
+                    return meshes[a]->format < meshes[b]->format;
+                return bindTextures && meshes[a]->textures < meshes[b]->textures;
+            });
+
+            std::vector<DrawElementsIndirectCommand> commands;
+            commands.reserve(order.size());
+            for (uint32_t i : order)
+            {
+                const Mesh &mesh = *meshes[i];
+                const MeshLod &lod = mesh.lods[mesh.currentLod];
+                commands.push_back({ lod.indexCount, 1, mesh.arenaAllocation.firstIndex + lod.indexOffset, static_cast<int32_t>(mesh.arenaAllocation.baseVertex), i });
+            }
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_STREAM_DRAW);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            commandCount = commands.size();
+
+            size_t first = 0;
+            while (first < order.size())
+            {
+                Mesh *mesh = meshes[order[first]];
+                size_t last = first + 1;
+                while (last < order.size() && meshes[order[last]]->format == mesh->format && (!bindTextures || meshes[order[last]]->textures == mesh->textures))
+                    last++;
+                groups.push_back({ mesh, first, last - first });
+                first = last;
+            }
+        }
+
+        // Second half of Submit, may be repeated after the commands were changed on the GPU. bindTextures = false draws
+        // commands prepared with textures without binding them, e.g. the depth pre-pass of the commands it shades.
+        void Draw(Shader &shader, bool bindTextures = true)
+        {
+            if (groups.empty())
+                return;
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, RecordBinding, recordBuffer);
+
+            shader.Activate();
+            for (const Group &group : groups)
+            {
+                if (preparedWithTextures && bindTextures)
+                    group.mesh->BindTextures(shader);
+                glBindVertexArray(GeometryArena::Instance(group.mesh->format).GetVAO());
+                glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const void *)(group.first * sizeof(DrawElementsIndirectCommand)), static_cast<GLsizei>(group.count), 0);
+                stats.drawCalls++;
+            }
+            stats.commands += static_cast<unsigned int>(commandCount);
+
+            glBindVertexArray(0);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        }
+
+        size_t Size() const
+        {
+            return meshes.size();
+        }
+
+        // World space boxes of the queued meshes, in Add order
+        const BoundsSoA& Bounds() const
+        {
+            return bounds;
+        }
+
+        const Stats& GetStats() const
+        {
+            return stats;
+        }
+
+        // Commands of the last Prepare; their baseInstance is the Add index of the mesh
+        GLuint CommandBuffer() const
+        {
+            return commandBuffer;
+        }
+
+        size_t CommandCount() const
+        {
+            return commandCount;
+        }
+
+        // Queued meshes in Add order, the index of each is its command's baseInstance
+        const std::vector<Mesh*>& Meshes() const
+        {
+            return meshes;
+        }
+
+        // DrawRecords of the queued meshes, uploaded by Prepare
+        GLuint RecordBuffer() const
+        {
+            return recordBuffer;
+        }
+
+        void Delete()
+        {
+            commandBuffer.Reset();
+            recordBuffer.Reset();
+        }
+
+    private:
+        std::vector<Mesh*> meshes;
+        std::vector<DrawRecord> records;
+        BoundsSoA bounds;
+        BufferHandle commandBuffer, recordBuffer;
+
+        // consecutive commands drawn by one glMultiDrawElementsIndirect
+        struct Group
+        {
+            Mesh *mesh; // first mesh, for the format and textures
+            size_t first;
+            size_t count;
+        };
+        std::vector<Group> groups;
+        size_t commandCount = 0;
+        bool preparedWithTextures = true;
+        bool uploaded = false;
+        Stats stats;
+
+        void upload()
+        {
+            if (commandBuffer == 0)
+            {
+                glGenBuffers(1, commandBuffer.Replace());
+                glGenBuffers(1, recordBuffer.Replace());
+            }
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, recordBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, records.size() * sizeof(DrawRecord), records.data(), GL_STREAM_DRAW);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+            uploaded = true;
+        }
+};
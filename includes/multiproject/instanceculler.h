@@ -0,0 +1,131 @@
+#pragma once
+
+#include <glad/gl.h>
+
+#include <glm/glm.hpp>
+
+#include "culling.h"
+#include "glhandle.h"
+#include "indirectdraw.h"
+#include "model.h"
+#include "shader.h"
+
+#include <iostream>
+#include <vector>
+
+// Frustum culls the instances of an instanced Model on the GPU (instancecull.cs) and draws the survivors with one
+// glDrawElementsIndirect per mesh, so the CPU cost of a pass depends on the mesh count, not the instance count.
+// Cull and Draw are called per pass (camera, each shadow map) with that pass's frustum; the draw shader must be built
+// with INSTANCE_MATRICES. The culler refers to the model, which must outlive it and not be moved.
+class InstanceCuller
+{
+    public:
+        // layout (binding) of the buffers in instancecull.cs
+        static const GLuint InstanceBinding = 0;
+        static const GLuint BoundsBinding = 1;
+        static const GLuint VisibleBinding = 2;
+        static const GLuint CommandBinding = 3;
+        static const GLuint WorkGroupSize = 64; // local_size_x
+
+        explicit InstanceCuller(Model &model) : model(model), cullShader(Shader::Compute("instancecull.cs"))
+        {
+            std::vector<Mesh> &meshes = model.Meshes();
+            if (model.InstanceBuffer() == 0)
+                std::cout << "ERROR::INSTANCECULLER:: Model is not instanced" << std::endl;
+
+            std::vector<glm::vec4> bounds;
+            for (const Mesh &mesh : meshes)
+            {
+                bounds.push_back(glm::vec4(mesh.boundsMin, 0.0f));
+                bounds.push_back(glm::vec4(mesh.boundsMax, 0.0f));
+            }
+            glGenBuffers(1, boundsBuffer.Replace());
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, boundsBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, bounds.size() * sizeof(glm::vec4), bounds.data(), GL_STATIC_DRAW);
+
+            // every mesh owns a range of InstanceCount() matrices
+            glGenBuffers(1, visibleBuffer.Replace());
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibleBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, size_t(meshes.size()) * model.InstanceCount() * sizeof(glm::mat4), nullptr, GL_DYNAMIC_COPY);
+
+            glGenBuffers(1, commandBuffer.Replace());
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, meshes.size() * sizeof(DrawElementsIndirectCommand), nullptr, GL_DYNAMIC_COPY);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+            commands.resize(meshes.size());
+        }
+
+        InstanceCuller(const InstanceCuller&) = delete;
+        InstanceCuller& operator=(const InstanceCuller&) = delete;
+
+        // Resets the draw commands (at each mesh's current LOD) and fills them with the instances in frustum
+        void Cull(const Frustum &frustum)
+        {
+            if (model.InstanceBuffer() == 0)
+                return;
+            std::vector<Mesh> &meshes = model.Meshes();
+            unsigned int instances = model.InstanceCount();
+            for (size_t i = 0; i < meshes.size(); i++)
+            {
+                const MeshLod &lod = meshes[i].lods[meshes[i].currentLod];
+                commands[i] = { lod.indexCount, 0, lod.indexOffset, 0, static_cast<uint32_t>(i * instances) };
+            }
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data());
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+            cullShader.Activate();
+            for (int i = 0; i < 6; i++)
+                cullShader.setVec4(UniformName("planes").Index(i), frustum.planes[i]);
+            cullShader.setInt("instanceCount", static_cast<int>(instances));
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, InstanceBinding, model.InstanceBuffer());
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BoundsBinding, boundsBuffer);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VisibleBinding, visibleBuffer);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CommandBinding, commandBuffer);
+            glDispatchCompute((instances + WorkGroupSize - 1) / WorkGroupSize, static_cast<GLuint>(meshes.size()), 1);
+            glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+        }
+
+        // Draws the instances kept by the last Cull; depth only passes pass bindTextures = false
+        void Draw(Shader &shader, bool bindTextures = true)
+        {
+            if (model.InstanceBuffer() == 0)
+                return;
+            std::vector<Mesh> &meshes = model.Meshes();
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+            for (size_t i = 0; i < meshes.size(); i++)
+                meshes[i].DrawIndirect(shader, visibleBuffer, i * sizeof(DrawElementsIndirectCommand), bindTextures);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        }
+
+        // Counts of the last Cull, one object per instance and mesh. Reads the commands back, which waits for the
+        // GPU: meant for statistics, not for every frame.
+        CullStats ReadStats() const
+        {
+            CullStats stats;
+            stats.objects = stats.boxesTested = static_cast<unsigned int>(commands.size()) * model.InstanceCount();
+            if (commands.empty() || model.InstanceBuffer() == 0)
+                return stats;
+            std::vector<DrawElementsIndirectCommand> culled(commands.size());
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+            glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, culled.size() * sizeof(DrawElementsIndirectCommand), culled.data());
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+            for (const DrawElementsIndirectCommand &command : culled)
+                stats.visible += command.instanceCount;
+            return stats;
+        }
+
+        void Delete()
+        {
+            boundsBuffer.Reset();
+            visibleBuffer.Reset();
+            commandBuffer.Reset();
+            cullShader.Delete();
+        }
+
+    private:
+        Model &model;
+        Shader cullShader;
+        BufferHandle boundsBuffer, visibleBuffer, commandBuffer;
+        std::vector<DrawElementsIndirectCommand> commands;
+};
@@ -0,0 +1,314 @@
+#pragma once
+
+#include <glad/gl.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+// S3TC is not core, but every desktop driver exposes EXT_texture_compression_s3tc / EXT_texture_sRGB
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+    #define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+    #define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+    #define GL_COMPRESSED_RGBA_S3TC_DXT3_EXT 0x83F2
+    #define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+    #define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+    #define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT 0x8C4D
+    #define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT 0x8C4E
+    #define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+// Vulkan format numbers used by KTX2 for the block compressed payloads we understand
+enum Ktx2Format : uint32_t {
+    KTX2_BC1_RGB_UNORM = 131,
+    KTX2_BC1_RGB_SRGB = 132,
+    KTX2_BC1_RGBA_UNORM = 133,
+    KTX2_BC1_RGBA_SRGB = 134,
+    KTX2_BC2_UNORM = 135,
+    KTX2_BC2_SRGB = 136,
+    KTX2_BC3_UNORM = 137,
+    KTX2_BC3_SRGB = 138,
+    KTX2_BC4_UNORM = 139,
+    KTX2_BC4_SNORM = 140,
+    KTX2_BC5_UNORM = 141,
+    KTX2_BC5_SNORM = 142,
+    KTX2_BC6H_UFLOAT = 143,
+    KTX2_BC6H_SFLOAT = 144,
+    KTX2_BC7_UNORM = 145,
+    KTX2_BC7_SRGB = 146,
+    KTX2_ETC2_RGB_UNORM = 147,
+    KTX2_ETC2_RGB_SRGB = 148,
+    KTX2_ETC2_RGBA1_UNORM = 149,
+    KTX2_ETC2_RGBA1_SRGB = 150,
+    KTX2_ETC2_RGBA8_UNORM = 151,
+    KTX2_ETC2_RGBA8_SRGB = 152,
+    KTX2_EAC_R11_UNORM = 153,
+    KTX2_EAC_R11_SNORM = 154,
+    KTX2_EAC_RG11_UNORM = 155,
+    KTX2_EAC_RG11_SNORM = 156,
+};
+
+const unsigned char KTX2_IDENTIFIER[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+inline bool isKtx2Path(const std::string &path)
+{
+    return path.size() > 5 && path.compare(path.size() - 5, 5, ".ktx2") == 0;
+}
+
+// GL internal format and 4x4 block size of a KTX2 vkFormat; false when unsupported
+inline bool ktx2FormatInfo(uint32_t vkFormat, GLenum &internalFormat, uint32_t &blockBytes)
+{
+    struct FormatInfo { uint32_t vkFormat; GLenum internalFormat; uint32_t blockBytes; };
+    static const FormatInfo formats[] = {
+        { KTX2_BC1_RGB_UNORM, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, 8 },
+        { KTX2_BC1_RGB_SRGB, GL_COMPRESSED_SRGB_S3TC_DXT1_EXT, 8 },
+        { KTX2_BC1_RGBA_UNORM, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 8 },
+        { KTX2_BC1_RGBA_SRGB, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT, 8 },
+        { KTX2_BC2_UNORM, GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, 16 },
+        { KTX2_BC2_SRGB, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT, 16 },
+        { KTX2_BC3_UNORM, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 16 },
+        { KTX2_BC3_SRGB, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, 16 },
+        { KTX2_BC4_UNORM, GL_COMPRESSED_RED_RGTC1, 8 },
+        { KTX2_BC4_SNORM, GL_COMPRESSED_SIGNED_RED_RGTC1, 8 },
+        { KTX2_BC5_UNORM, GL_COMPRESSED_RG_RGTC2, 16 },
+        { KTX2_BC5_SNORM, GL_COMPRESSED_SIGNED_RG_RGTC2, 16 },
+        { KTX2_BC6H_UFLOAT, GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT, 16 },
+        { KTX2_BC6H_SFLOAT, GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT, 16 },
+        { KTX2_BC7_UNORM, GL_COMPRESSED_RGBA_BPTC_UNORM, 16 },
+        { KTX2_BC7_SRGB, GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM, 16 },
+        { KTX2_ETC2_RGB_UNORM, GL_COMPRESSED_RGB8_ETC2, 8 },
+        { KTX2_ETC2_RGB_SRGB, GL_COMPRESSED_SRGB8_ETC2, 8 },
+        { KTX2_ETC2_RGBA1_UNORM, GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2, 8 },
+        { KTX2_ETC2_RGBA1_SRGB, GL_COMPRESSED_SRGB8_PUNCHTHROUGH_ALPHA1_ETC2, 8 },
+        { KTX2_ETC2_RGBA8_UNORM, GL_COMPRESSED_RGBA8_ETC2_EAC, 16 },
+        { KTX2_ETC2_RGBA8_SRGB, GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC, 16 },
+        { KTX2_EAC_R11_UNORM, GL_COMPRESSED_R11_EAC, 8 },
+        { KTX2_EAC_R11_SNORM, GL_COMPRESSED_SIGNED_R11_EAC, 8 },
+        { KTX2_EAC_RG11_UNORM, GL_COMPRESSED_RG11_EAC, 16 },
+        { KTX2_EAC_RG11_SNORM, GL_COMPRESSED_SIGNED_RG11_EAC, 16 },
+    };
+    for(const FormatInfo &format : formats)
+    {
+        if(format.vkFormat == vkFormat)
+        {
+            internalFormat = format.internalFormat;
+            blockBytes = format.blockBytes;
+            return true;
+        }
+    }
+    return false;
+}
+
+// A KTX2 file holding a block compressed 2D texture or cubemap with its mip chain.
+// Only uncompressed containers (supercompressionScheme 0) are supported.
+class Ktx2Image
+{
+public:
+    // the 64-bit sgd fields sit at a 4-byte boundary in the file
+#pragma pack(push, 4)
+    struct Header
+    {
+        uint32_t vkFormat;
+        uint32_t typeSize;
+        uint32_t pixelWidth;
+        uint32_t pixelHeight;
+        uint32_t pixelDepth;
+        uint32_t layerCount;
+        uint32_t faceCount;
+        uint32_t levelCount;
+        uint32_t supercompressionScheme;
+        uint32_t dfdByteOffset;
+        uint32_t dfdByteLength;
+        uint32_t kvdByteOffset;
+        uint32_t kvdByteLength;
+        uint64_t sgdByteOffset;
+        uint64_t sgdByteLength;
+    };
+#pragma pack(pop)
+    static_assert(sizeof(Header) == 68, "KTX2 header layout");
+
+    struct LevelIndex
+    {
+        uint64_t byteOffset;
+        uint64_t byteLength;
+        uint64_t uncompressedByteLength;
+    };
+
+    GLenum internalFormat = 0;
+    uint32_t vkFormat = 0;
+    uint32_t width = 0, height = 0;
+    uint32_t faceCount = 0;
+    uint32_t blockBytes = 0;
+    std::vector<LevelIndex> levels;
+    std::vector<unsigned char> bytes;
+
+    bool Valid() const
+    {
+        return !levels.empty();
+    }
+
+    bool Load(const std::string &path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if(!file)
+        {
+            std::cerr << "ERROR::KTX2:: Could not open " << path << std::endl;
+            return false;
+        }
+        bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        if(!parse())
+        {
+            std::cerr << "ERROR::KTX2:: Unsupported or corrupt file " << path << std::endl;
+            levels.clear();
+            bytes.clear();
+            return false;
+        }
+        return true;
+    }
+
+    uint32_t LevelWidth(uint32_t level) const { return std::max(1u, width >> level); }
+    uint32_t LevelHeight(uint32_t level) const { return std::max(1u, height >> level); }
+
+    // Size in bytes of one face of a mip level
+    size_t ImageSize(uint32_t level) const
+    {
+        return size_t((LevelWidth(level) + 3) / 4) * ((LevelHeight(level) + 3) / 4) * blockBytes;
+    }
+
+    const unsigned char *LevelData(uint32_t level, uint32_t face = 0) const
+    {
+        return bytes.data() + levels[level].byteOffset + face * ImageSize(level);
+    }
+
+    // GPU memory taken by every level and face
+    size_t MemoryBytes() const
+    {
+        size_t total = 0;
+        for(uint32_t level = 0; level < levels.size(); level++)
+            total += ImageSize(level) * faceCount;
+        return total;
+    }
+
+    // Uploads every mip level of one face to target (GL_TEXTURE_2D or a cube map face), the texture must be bound
+    void Upload(GLenum target, uint32_t face = 0) const
+    {
+        for(uint32_t level = 0; level < levels.size(); level++)
+            glCompressedTexImage2D(target, level, internalFormat, LevelWidth(level), LevelHeight(level), 0, static_cast<GLsizei>(ImageSize(level)), LevelData(level, face));
+    }
+
+private:
+    bool parse()
+    {
+        if(bytes.size() < sizeof(KTX2_IDENTIFIER) + sizeof(Header) || std::memcmp(bytes.data(), KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
+            return false;
+        Header header;
+        std::memcpy(&header, bytes.data() + sizeof(KTX2_IDENTIFIER), sizeof(Header));
+        if(header.supercompressionScheme != 0 || header.pixelDepth > 1 || header.layerCount > 1)
+            return false;
+        if(header.faceCount != 1 && header.faceCount != 6)
+            return false;
+        if(!ktx2FormatInfo(header.vkFormat, internalFormat, blockBytes))
+            return false;
+
+        vkFormat = header.vkFormat;
+        width = header.pixelWidth;
+        height = header.pixelHeight;
+        faceCount = header.faceCount;
+
+        if(width == 0 || height == 0)
+            return false;
+        // a full chain has floor(log2(max(width, height))) + 1 levels; more would shift LevelWidth past 31 bits
+        uint32_t maxLevels = 1;
+        while((std::max(width, height) >> maxLevels) != 0)
+            maxLevels++;
+        uint32_t levelCount = std::max(1u, header.levelCount);
+        if(levelCount > maxLevels)
+            return false;
+        size_t indexOffset = sizeof(KTX2_IDENTIFIER) + sizeof(Header);
+        if(bytes.size() < indexOffset + levelCount * sizeof(LevelIndex))
+            return false;
+        levels.resize(levelCount);
+        std::memcpy(levels.data(), bytes.data() + indexOffset, levelCount * sizeof(LevelIndex));
+        for(uint32_t level = 0; level < levelCount; level++)
+        {
+            if(levels[level].byteOffset > bytes.size() || levels[level].byteLength > bytes.size() - levels[level].byteOffset)
+                return false;
+            if(levels[level].byteLength < ImageSize(level) * faceCount)
+                return false;
+        }
+        return true;
+    }
+};
+
+// Writes a KTX2 file from block compressed levels (level 0 first, every face of a level back to back)
+inline bool writeKtx2(const std::string &path, uint32_t vkFormat, uint32_t width, uint32_t height, uint32_t faceCount,
+                      const std::vector<std::vector<unsigned char>> &levels, const std::vector<unsigned char> &dfd,
+                      const std::vector<std::pair<std::string, std::string>> &keyValues)
+{
+    auto align = [](size_t offset, size_t alignment) { return (offset + alignment - 1) / alignment * alignment; };
+
+    std::vector<unsigned char> kvd;
+    for(const auto &keyValue : keyValues)
+    {
+        uint32_t length = static_cast<uint32_t>(keyValue.first.size() + 1 + keyValue.second.size() + 1);
+        kvd.insert(kvd.end(), reinterpret_cast<unsigned char*>(&length), reinterpret_cast<unsigned char*>(&length) + 4);
+        kvd.insert(kvd.end(), keyValue.first.begin(), keyValue.first.end());
+        kvd.push_back(0);
+        kvd.insert(kvd.end(), keyValue.second.begin(), keyValue.second.end());
+        kvd.push_back(0);
+        kvd.resize(align(kvd.size(), 4), 0);
+    }
+
+    Ktx2Image::Header header = {};
+    header.vkFormat = vkFormat;
+    header.typeSize = 1;
+    header.pixelWidth = width;
+    header.pixelHeight = height;
+    header.faceCount = faceCount;
+    header.levelCount = static_cast<uint32_t>(levels.size());
+
+    size_t offset = sizeof(KTX2_IDENTIFIER) + sizeof(Ktx2Image::Header) + levels.size() * sizeof(Ktx2Image::LevelIndex);
+    header.dfdByteOffset = static_cast<uint32_t>(offset);
+    header.dfdByteLength = static_cast<uint32_t>(dfd.size());
+    offset += dfd.size();
+    header.kvdByteOffset = kvd.empty() ? 0 : static_cast<uint32_t>(offset);
+    header.kvdByteLength = static_cast<uint32_t>(kvd.size());
+    offset += kvd.size();
+
+    // mip levels are stored smallest first, each aligned to the block size
+    std::vector<Ktx2Image::LevelIndex> index(levels.size());
+    for(size_t level = levels.size(); level-- > 0;)
+    {
+        offset = align(offset, 16);
+        index[level] = { offset, levels[level].size(), levels[level].size() };
+        offset += levels[level].size();
+    }
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if(!out)
+    {
+        std::cerr << "ERROR::KTX2:: Could not write " << path << std::endl;
+        return false;
+    }
+    out.write(reinterpret_cast<const char*>(KTX2_IDENTIFIER), sizeof(KTX2_IDENTIFIER));
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(Ktx2Image::LevelIndex));
+    out.write(reinterpret_cast<const char*>(dfd.data()), dfd.size());
+    out.write(reinterpret_cast<const char*>(kvd.data()), kvd.size());
+    size_t written = header.dfdByteOffset + dfd.size() + kvd.size();
+    for(size_t level = levels.size(); level-- > 0;)
+    {
+        std::vector<char> padding(index[level].byteOffset - written, 0);
+        out.write(padding.data(), padding.size());
+        out.write(reinterpret_cast<const char*>(levels[level].data()), levels[level].size());
+        written = index[level].byteOffset + levels[level].size();
+    }
+    return static_cast<bool>(out);
+}
@@ -1,7 +1,54 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "glstate.h"
 #include "shader.h"
+#include "shadervariants.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <span>
+#include <string>
+
+// std140 records of the Lights block in lighting.glsl, packed by LightBuffer (lightbuffer.h)
+struct DirLightRecord {
+    glm::vec3 ambient;
+    float padding0;
+    glm::vec3 diffuse;
+    float padding1;
+    glm::vec3 specular;
+    float padding2;
+    glm::vec3 direction;
+    float padding3;
+};
+
+struct PointLightRecord {
+    glm::vec3 ambient;
+    float constant;
+    glm::vec3 diffuse;
+    float linear;
+    glm::vec3 specular;
+    float quadratic;
+    glm::vec3 position;
+    float farPlane;
+};
+
+struct SpotLightRecord {
+    glm::vec3 ambient;
+    float constant;
+    glm::vec3 diffuse;
+    float linear;
+    glm::vec3 specular;
+    float quadratic;
+    glm::vec3 position;
+    float cutOff;
+    glm::vec3 direction;
+    float outerCutOff;
+};
+
+static_assert(sizeof(DirLightRecord) == 64 && sizeof(PointLightRecord) == 64 && sizeof(SpotLightRecord) == 80, "std140 light records");
 
 class Light
 {
@@ -16,16 +63,21 @@ class Light
             this->specular = specular;
         }
 
-        virtual void setInShader(Shader &shader, const std::string &name){
-            shader.setVec3(name + ".ambient", ambient);
-            shader.setVec3(name + ".diffuse", diffuse);
-            shader.setVec3(name + ".specular", specular);
+        // Call after changing the light, so LightBuffer::Update uploads it again
+        void MarkDirty() {
+            dirty = true;
+        }
+
+        bool Dirty() const {
+            return dirty;
         }
 
-        void setInShader(Shader &shader, const std::string &name, int index) {
-            std::string fullName = name + "[" + std::to_string(index) + "]";
-            setInShader(shader, fullName);
+        void ClearDirty() {
+            dirty = false;
         }
+
+    private:
+        bool dirty = true;
 };
 
 class LightShadow : public Light {
@@ -41,31 +93,20 @@ class LightShadow : public Light {
             this->shadowIndex = shadowIndex;
         }
 
-        using Light::setInShader;
-        void setInShader(Shader &shader, const std::string &name) override {
-            Light::setInShader(shader, name);
-            shader.setBool(name + ".hasShadow", hasShadow);
-            shader.setInt(name + ".shadowMap", shadowMap);
-            shader.setInt(name + ".shadowIndex", shadowIndex);
-        }
-
         virtual void bindShadowMap() {
-            glActiveTexture(GL_TEXTURE0 + shadowMap);
-            glBindTexture(GL_TEXTURE_2D, depthMap);
+            GLState::Instance().BindTexture(shadowMap, depthMap);
         }
 
+        // Leaves the shadow pass state bound; the next pass applies its own, so consecutive shadow passes only
+        // change the framebuffer
         template<typename T>
         void renderDepthMap(T renderSceneFunc) {
             if(!hasShadow)
                 return;
 
-            glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-            glBindFramebuffer(GL_FRAMEBUFFER, this->depthMapFBO);
+            GLState::Instance().Apply(shadowPassState());
             glClear(GL_DEPTH_BUFFER_BIT);
-            glCullFace(GL_FRONT);
             renderSceneFunc();
-            glCullFace(GL_BACK);
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
         }
 
         virtual void getLightSpaceMatrix(glm::mat4 &lightSpaceMatrix) = 0;
@@ -76,6 +117,10 @@ class LightShadow : public Light {
         const unsigned int SHADOW_HEIGHT = 1024;
 
         virtual void initShadowMap() = 0;
+
+        PipelineState shadowPassState() const {
+            return PipelineState().WithFramebuffer(depthMapFBO).WithViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT).WithCullFace(GL_FRONT);
+        }
 };
 
 class LightAttenuation : public LightShadow {
@@ -90,12 +135,17 @@ class LightAttenuation : public LightShadow {
             this->quadratic = quadratic;
         }
 
-        using LightShadow::setInShader;
-        void setInShader(Shader &shader, const std::string &name) override {
-            LightShadow::setInShader(shader, name);
-            shader.setFloat(name + ".constant", constant);
-            shader.setFloat(name + ".linear", linear);
-            shader.setFloat(name + ".quadratic", quadratic);
+        // Distance past which the attenuation leaves less than threshold of the brightest channel
+        float Range(float threshold = 1.0f / 256.0f) const {
+            glm::vec3 color = glm::max(ambient, glm::max(diffuse, specular));
+            float brightest = std::max(color.r, std::max(color.g, color.b));
+            // constant + linear * d + quadratic * d^2 = brightest / threshold
+            float target = brightest / threshold;
+            if(target <= constant)
+                return 0.0f;
+            if(quadratic <= 0.0f)
+                return linear > 0.0f ? (target - constant) / linear : FLT_MAX;
+            return (-linear + std::sqrt(linear * linear + 4.0f * quadratic * (target - constant))) / (2.0f * quadratic);
         }
 };
 
@@ -111,10 +161,8 @@ class DirectionalLight : public LightShadow {
                 initShadowMap();
         }
 
-        using LightShadow::setInShader;
-        void setInShader(Shader &shader, const std::string &name) override {
-            LightShadow::setInShader(shader, name);
-            shader.setVec3(name + ".direction", direction);
+        DirLightRecord Record() const {
+            return { ambient, 0.0f, diffuse, 0.0f, specular, 0.0f, direction, 0.0f };
         }
 
         void getLightSpaceMatrix(glm::mat4 &lightSpaceMatrix) override {
@@ -141,11 +189,11 @@ class DirectionalLight : public LightShadow {
             glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
 
             glGenFramebuffers(1, &depthMapFBO);
-            glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
+            GLState::Instance().BindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
             glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMap, 0);
             glDrawBuffer(GL_NONE);
             glReadBuffer(GL_NONE);
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            GLState::Instance().BindFramebuffer(GL_FRAMEBUFFER, 0);
         }
 };
 
@@ -160,16 +208,12 @@ class PointLight : public LightAttenuation {
             this->position = position;
         }
 
-        using LightAttenuation::setInShader;
-        void setInShader(Shader &shader, const std::string &name) override {
-            LightAttenuation::setInShader(shader, name);
-            shader.setVec3(name + ".position", position);
-            shader.setFloat(name + ".farPlane", farPlane);
+        PointLightRecord Record() const {
+            return { ambient, constant, diffuse, linear, specular, quadratic, position, farPlane };
         }
 
         void bindShadowMap() override {
-            glActiveTexture(GL_TEXTURE0 + shadowMap);
-            glBindTexture(GL_TEXTURE_CUBE_MAP, depthMap);
+            GLState::Instance().BindTexture(shadowMap, depthMap);
         }
 
         void getLightSpaceMatrix(glm::mat4 &lightSpaceMatrix) override {
@@ -203,11 +247,11 @@ class PointLight : public LightAttenuation {
             glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
             glGenFramebuffers(1, &depthMapFBO);
-            glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
+            GLState::Instance().BindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
             glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthMap, 0);
             glDrawBuffer(GL_NONE);
             glReadBuffer(GL_NONE);
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            GLState::Instance().BindFramebuffer(GL_FRAMEBUFFER, 0);
         }
 };
 
@@ -227,13 +271,8 @@ class SpotLight : public LightAttenuation {
             this->outerCutOff = outerCutOff;
         }
 
-        using LightAttenuation::setInShader;
-        void setInShader(Shader &shader, const std::string &name) override {
-            LightAttenuation::setInShader(shader, name);
-            shader.setVec3(name + ".position", position);
-            shader.setVec3(name + ".direction", direction);
-            shader.setFloat(name + ".cutOff", cutOff);
-            shader.setFloat(name + ".outerCutOff", outerCutOff);
+        SpotLightRecord Record() const {
+            return { ambient, constant, diffuse, linear, specular, quadratic, position, cutOff, direction, outerCutOff };
         }
 
         void getLightSpaceMatrix(glm::mat4 &lightSpaceMatrix) override {
@@ -258,10 +297,56 @@ class SpotLight : public LightAttenuation {
             glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
 
             glGenFramebuffers(1, &depthMapFBO);
-            glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
+            GLState::Instance().BindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
             glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMap, 0);
             glDrawBuffer(GL_NONE);
             glReadBuffer(GL_NONE);
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            GLState::Instance().BindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+};
+
+// Permutation of defaultShadow.fs / defaultNoUboShadow.vs for a fixed set of lights: array sizes, specular model,
+// shadow slots and an unrolled APPLY_LIGHTS statement where only lights with a shadow map sample it.
+// Adding or removing lights, toggling hasShadow or blinn selects another variant.
+inline ShaderPermutation LightPermutation(std::span<DirectionalLight* const> dirLights, std::span<PointLight* const> pointLights, std::span<SpotLight* const> spotLights, bool blinn)
+{
+    unsigned int shadowSlots = 1;
+    std::string apply;
+    for(size_t i = 0; i < dirLights.size(); i++)
+    {
+        std::string light = "dirLights[" + std::to_string(i) + "]";
+        std::string shadow = "0.0";
+        if(dirLights[i]->hasShadow)
+        {
+            shadow = "CalcDirShadow(" + light + ", dirShadowMaps[" + std::to_string(i) + "], fs_in.FragPosLightSpace[" + std::to_string(dirLights[i]->shadowIndex) + "], norm)";
+            shadowSlots = std::max(shadowSlots, dirLights[i]->shadowIndex + 1);
+        }
+        apply += " result += CalcDirLight(" + light + ", norm, viewDir, albedo, specularMask, " + shadow + ");";
+    }
+    for(size_t i = 0; i < pointLights.size(); i++)
+    {
+        std::string light = "pointLights[" + std::to_string(i) + "]";
+        std::string shadow = pointLights[i]->hasShadow ? "CalcPointShadow(" + light + ", pointShadowMaps[" + std::to_string(i) + "], fs_in.FragPos, viewPos)" : "0.0";
+        apply += " result += CalcPointLight(" + light + ", norm, fs_in.FragPos, viewDir, albedo, specularMask, " + shadow + ");";
+    }
+    for(size_t i = 0; i < spotLights.size(); i++)
+    {
+        std::string light = "spotLights[" + std::to_string(i) + "]";
+        std::string shadow = "0.0";
+        if(spotLights[i]->hasShadow)
+        {
+            shadow = "CalcSpotShadow(" + light + ", spotShadowMaps[" + std::to_string(i) + "], fs_in.FragPosLightSpace[" + std::to_string(spotLights[i]->shadowIndex) + "], norm)";
+            shadowSlots = std::max(shadowSlots, spotLights[i]->shadowIndex + 1);
         }
-};
\ No newline at end of file
+        apply += " result += CalcSpotLight(" + light + ", norm, fs_in.FragPos, viewDir, albedo, specularMask, " + shadow + ");";
+    }
+
+    ShaderPermutation permutation;
+    permutation.Define("NR_DIR_LIGHTS", static_cast<int>(dirLights.size()))
+               .Define("NR_POINT_LIGHTS", static_cast<int>(pointLights.size()))
+               .Define("NR_SPOT_LIGHTS", static_cast<int>(spotLights.size()))
+               .Define("SHADOW_SLOTS", static_cast<int>(shadowSlots))
+               .Define("BLINN", blinn ? 1 : 0)
+               .Define("APPLY_LIGHTS", apply);
+    return permutation;
+}
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <glad/gl.h>
+
+#include <glm/glm.hpp>
+
+#include "glhandle.h"
+#include "light.h"
+#include "shader.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <span>
+#include <vector>
+
+// Uniform blocks shared by every lit program, bound once to fixed binding points:
+//   Matrices (matrices.glsl)  camera matrices and position, uploaded when they change, and the light space matrices
+//   Lights   (lighting.glsl)  one record per light, repacked and uploaded only for lights marked dirty
+// Shadow maps stay sampler uniforms, pointed at the lights' texture units once per program by SetShadowSamplers.
+class LightBuffer
+{
+    public:
+        static const GLuint MatricesBinding = 0; // layout (binding) of Matrices in matrices.glsl and default.vs
+        static const GLuint LightsBinding = 1;   // layout (binding) of Lights in lighting.glsl
+        static const unsigned int MaxDirLights = 4;
+        static const unsigned int MaxPointLights = 4;
+        static const unsigned int MaxSpotLights = 4;
+        static const unsigned int MaxShadowSlots = 4;
+
+        struct Stats
+        {
+            unsigned int uploads = 0; // glBufferSubData calls
+            size_t bytes = 0;
+        };
+
+        // The lights are referenced, not copied; lights beyond the Max* counts are left out
+        LightBuffer(std::span<DirectionalLight* const> dirLights, std::span<PointLight* const> pointLights, std::span<SpotLight* const> spotLights)
+            : dirLights(dirLights.begin(), dirLights.begin() + std::min<size_t>(dirLights.size(), MaxDirLights)),
+              pointLights(pointLights.begin(), pointLights.begin() + std::min<size_t>(pointLights.size(), MaxPointLights)),
+              spotLights(spotLights.begin(), spotLights.begin() + std::min<size_t>(spotLights.size(), MaxSpotLights))
+        {
+            if (dirLights.size() > MaxDirLights || pointLights.size() > MaxPointLights || spotLights.size() > MaxSpotLights)
+                std::cout << "ERROR::LIGHTBUFFER:: More lights than the Lights block holds" << std::endl;
+
+            matrices = {};
+            lights = {};
+            glGenBuffers(1, matricesBuffer.Replace());
+            glBindBuffer(GL_UNIFORM_BUFFER, matricesBuffer);
+            glBufferData(GL_UNIFORM_BUFFER, sizeof(MatricesBlock), &matrices, GL_DYNAMIC_DRAW);
+            glGenBuffers(1, lightsBuffer.Replace());
+            glBindBuffer(GL_UNIFORM_BUFFER, lightsBuffer);
+            glBufferData(GL_UNIFORM_BUFFER, sizeof(LightsBlock), &lights, GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+            Bind();
+        }
+
+        // Binds both blocks; needed again only if other code rebinds the two binding points
+        void Bind()
+        {
+            glBindBufferBase(GL_UNIFORM_BUFFER, MatricesBinding, matricesBuffer);
+            glBindBufferBase(GL_UNIFORM_BUFFER, LightsBinding, lightsBuffer);
+        }
+
+        // Camera of the frame; skipped when nothing changed since the last call
+        void SetCamera(const glm::mat4 &projection, const glm::mat4 &view, const glm::vec3 &viewPosition)
+        {
+            CameraBlock camera = { projection, view, glm::vec4(viewPosition, 1.0f) };
+            if (cameraUploaded && std::memcmp(&camera, &matrices.camera, sizeof(CameraBlock)) == 0)
+                return;
+            matrices.camera = camera;
+            cameraUploaded = true;
+            upload(matricesBuffer, &matrices, offsetof(MatricesBlock, camera), sizeof(CameraBlock));
+        }
+
+        // Repacks the lights marked dirty and uploads the range they cover; shadowed directional and spot lights
+        // also refresh their light space matrix
+        void Update()
+        {
+            size_t first = sizeof(LightsBlock), last = 0;
+            size_t firstMatrix = MaxShadowSlots, lastMatrix = 0;
+            auto touch = [](size_t &first, size_t &last, size_t begin, size_t end) {
+                first = std::min(first, begin);
+                last = std::max(last, end);
+            };
+            auto updateMatrix = [&](LightShadow &light) {
+                if (!light.hasShadow || light.shadowIndex >= MaxShadowSlots)
+                    return;
+                light.getLightSpaceMatrix(matrices.lightSpaceMatrix[light.shadowIndex]);
+                touch(firstMatrix, lastMatrix, light.shadowIndex, light.shadowIndex + 1);
+            };
+
+            for (size_t i = 0; i < dirLights.size(); i++)
+            {
+                if (!dirLights[i]->Dirty())
+                    continue;
+                lights.dirLights[i] = dirLights[i]->Record();
+                updateMatrix(*dirLights[i]);
+                size_t offset = offsetof(LightsBlock, dirLights) + i * sizeof(DirLightRecord);
+                touch(first, last, offset, offset + sizeof(DirLightRecord));
+            }
+            for (size_t i = 0; i < pointLights.size(); i++)
+            {
+                if (!pointLights[i]->Dirty())
+                    continue;
+                lights.pointLights[i] = pointLights[i]->Record();
+                size_t offset = offsetof(LightsBlock, pointLights) + i * sizeof(PointLightRecord);
+                touch(first, last, offset, offset + sizeof(PointLightRecord));
+            }
+            for (size_t i = 0; i < spotLights.size(); i++)
+            {
+                if (!spotLights[i]->Dirty())
+                    continue;
+                lights.spotLights[i] = spotLights[i]->Record();
+                updateMatrix(*spotLights[i]);
+                size_t offset = offsetof(LightsBlock, spotLights) + i * sizeof(SpotLightRecord);
+                touch(first, last, offset, offset + sizeof(SpotLightRecord));
+            }
+
+            // cleared afterwards, a light listed twice fills both records
+            for (Light *light : dirLights)
+                light->ClearDirty();
+            for (Light *light : pointLights)
+                light->ClearDirty();
+            for (Light *light : spotLights)
+                light->ClearDirty();
+
+            if (first < last)
+                upload(lightsBuffer, &lights, first, last - first);
+            if (firstMatrix < lastMatrix)
+                upload(matricesBuffer, &matrices, offsetof(MatricesBlock, lightSpaceMatrix) + firstMatrix * sizeof(glm::mat4), (lastMatrix - firstMatrix) * sizeof(glm::mat4));
+        }
+
+        // Sets dirShadowMaps, pointShadowMaps and spotShadowMaps of a lit program; once per program
+        void SetShadowSamplers(Shader &shader) const
+        {
+            shader.Activate();
+            for (size_t i = 0; i < dirLights.size(); i++)
+                shader.setInt(UniformName("dirShadowMaps").Index(static_cast<int>(i)), dirLights[i]->shadowMap);
+            for (size_t i = 0; i < pointLights.size(); i++)
+                shader.setInt(UniformName("pointShadowMaps").Index(static_cast<int>(i)), pointLights[i]->shadowMap);
+            for (size_t i = 0; i < spotLights.size(); i++)
+                shader.setInt(UniformName("spotShadowMaps").Index(static_cast<int>(i)), spotLights[i]->shadowMap);
+        }
+
+        // Binds the shadow maps to their units
+        void BindShadowMaps()
+        {
+            for (DirectionalLight *light : dirLights)
+                if (light->hasShadow)
+                    light->bindShadowMap();
+            for (PointLight *light : pointLights)
+                if (light->hasShadow)
+                    light->bindShadowMap();
+            for (SpotLight *light : spotLights)
+                if (light->hasShadow)
+                    light->bindShadowMap();
+        }
+
+        // Counts since construction
+        const Stats& GetStats() const
+        {
+            return stats;
+        }
+
+    private:
+        // std140 mirrors of the blocks; glm::mat4 and glm::vec4 already have the std140 size and alignment
+        struct CameraBlock
+        {
+            glm::mat4 projection;
+            glm::mat4 view;
+            glm::vec4 viewPosition;
+        };
+
+        struct MatricesBlock
+        {
+            CameraBlock camera;
+            glm::mat4 lightSpaceMatrix[MaxShadowSlots];
+        };
+
+        struct LightsBlock
+        {
+            DirLightRecord dirLights[MaxDirLights];
+            PointLightRecord pointLights[MaxPointLights];
+            SpotLightRecord spotLights[MaxSpotLights];
+        };
+
+        std::vector<DirectionalLight*> dirLights;
+        std::vector<PointLight*> pointLights;
+        std::vector<SpotLight*> spotLights;
+        MatricesBlock matrices;
+        LightsBlock lights;
+        BufferHandle matricesBuffer, lightsBuffer;
+        bool cameraUploaded = false;
+        Stats stats;
+
+        void upload(GLuint buffer, const void *block, size_t offset, size_t size)
+        {
+            glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+            glBufferSubData(GL_UNIFORM_BUFFER, offset, size, static_cast<const uint8_t*>(block) + offset);
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+            stats.uploads++;
+            stats.bytes += size;
+        }
+};
@@ -5,72 +5,178 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "glhandle.h"
+#include "glstate.h"
 #include "shader.h"
 #include "texture.h"
+#include "vertexformat.h"
+#include "meshsimplify.h"
+#include "geometryarena.h"
 
 #include <string>
+#include <utility>
 #include <vector>
 
-struct Vertex {
-    glm::vec3 Position;
-    glm::vec3 Normal;
-    glm::vec2 TexCoords;
-};
-
+// Owns its vertex array and buffers (none when in the arena); move-only
 class Mesh {
     public:
-        // mesh data
+        // mesh data, empty after ReleaseMeshData or when built from external memory
         std::vector<Vertex>       vertices;
         std::vector<unsigned int> indices;
-        std::vector<Texture>      textures;
+        std::vector<Texture*>     textures; // owned by the TextureCache
         unsigned int instancing;
+        unsigned int indexCount;
+        VertexFormat format;
+        VertexQuantization quantization; // only used by VertexFormat::Quantized
+        size_t vertexBytes;              // size of the vertex buffer
+        GLenum indexType;                // GL_UNSIGNED_SHORT when every index fits in 16 bits
+        size_t indexBytes;
+        std::vector<MeshLod> lods;       // index ranges from full detail down, lods[0] is the whole mesh
+        unsigned int currentLod = 0;     // level drawn by Draw, picked by Model::SelectLod
+        glm::vec3 boundsMin, boundsMax;  // object space bounding box
+        glm::vec3 boundsCenter;          // object space bounding sphere
+        float boundsRadius;
+        bool inArena = false;            // geometry lives in GeometryArena::Instance(format) instead of own buffers
+        GeometryArena::Allocation arenaAllocation;
+
+        // lods are ranges of indices (see buildLodChain); empty draws all indices as one level.
+        // useArena uploads into the shared GeometryArena (ignored for instanced meshes, which need their own VAO)
+        Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture*> textures, unsigned int instancing = 1, unsigned int instanceVBO = 0, VertexFormat format = VertexFormat::Float, std::vector<MeshLod> lods = {}, bool useArena = false)
+        {
+            this->format = format;
+            this->vertices = std::move(vertices);
+            this->indices = std::move(indices);
+            this->textures = std::move(textures);
+            this->lods = std::move(lods);
+            this->inArena = useArena && instancing == 1;
+            setupTextureUniforms();
 
-        Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures, unsigned int instancing = 1, unsigned int instanceVBO = 0)
+			setupInstancing(instancing, instanceVBO);
+            setupMesh(this->vertices.data(), this->vertices.size(), this->indices.data(), this->indices.size());
+        }
+
+        // Uploads straight from external memory (e.g. a mapped mesh cache) without keeping a CPU copy
+        Mesh(const Vertex *vertices, size_t vertexCount, const unsigned int *indices, size_t indexCount, std::vector<Texture*> textures, unsigned int instancing = 1, unsigned int instanceVBO = 0, VertexFormat format = VertexFormat::Float, std::vector<MeshLod> lods = {}, bool useArena = false)
         {
-            this->vertices = vertices;
-            this->indices = indices;
-            this->textures = textures;
+            this->format = format;
+            this->textures = std::move(textures);
+            this->lods = std::move(lods);
+            this->inArena = useArena && instancing == 1;
+            setupTextureUniforms();
 
 			setupInstancing(instancing, instanceVBO);
-            setupMesh();
+            setupMesh(vertices, vertexCount, indices, indexCount);
         }
 
         void Draw(Shader &shader)
         {
-            unsigned int diffuseNr = 1;
-            unsigned int specularNr = 1;
-            for(unsigned int i = 0; i < textures.size(); i++)
+            shader.Activate();
+            BindTextures(shader);
+            glBindVertexArray(VertexArray());
+            DrawBound(shader);
+            glBindVertexArray(0);
+        }
+
+        // Issues the draw call of the current LOD; the shader must be active and VertexArray() bound (see RenderQueue)
+        void DrawBound(Shader &shader)
+        {
+            if (format == VertexFormat::Quantized)
             {
-                glActiveTexture(textures[i].unit);
-                std::string number;
-                std::string name = textures[i].type;
-                if(name == "diffuse")
-                    number = std::to_string(diffuseNr++);
-                else if(name == "specular")
-                    number = std::to_string(specularNr++);
-
-                shader.Activate();
-                shader.setInt(("material." + name).c_str(), i);
-                glBindTexture(GL_TEXTURE_2D, textures[i].ID);
+                shader.setVec3("positionOffset", quantization.positionOffset);
+                shader.setVec3("positionScale", quantization.positionScale);
+                shader.setVec4("uvTransform", quantization.uvTransform);
             }
-            glActiveTexture(GL_TEXTURE0);
 
-            glBindVertexArray(VAO);
+            const MeshLod &lod = lods[currentLod];
+            if (inArena)
+            {
+                const void *offset = (const void *)(size_t(arenaAllocation.firstIndex + lod.indexOffset) * sizeof(unsigned int));
+                glDrawElementsBaseVertex(GL_TRIANGLES, static_cast<GLsizei>(lod.indexCount), GL_UNSIGNED_INT, offset, static_cast<GLint>(arenaAllocation.baseVertex));
+                return;
+            }
 
+            const void *offset = (const void *)(size_t(lod.indexOffset) * (indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int)));
             if (instancing == 1)
             {
-                glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(indices.size()), GL_UNSIGNED_INT, 0);
+                glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(lod.indexCount), indexType, offset);
             }
             else
             {
-                glDrawElementsInstanced(GL_TRIANGLES, static_cast<GLsizei>(indices.size()), GL_UNSIGNED_INT, 0, instancing);
+                glDrawElementsInstanced(GL_TRIANGLES, static_cast<GLsizei>(lod.indexCount), indexType, offset, instancing);
+            }
+        }
+
+        // The arena's vertex array for arena meshes, the mesh's own otherwise
+        GLuint VertexArray() const
+        {
+            return inArena ? GeometryArena::Instance(format).GetVAO() : static_cast<GLuint>(VAO);
+        }
+
+        // Instanced meshes only: draws the command at commandOffset of the bound GL_DRAW_INDIRECT_BUFFER with the
+        // instance matrices read from instanceBuffer instead of the Model's (see InstanceCuller)
+        void DrawIndirect(Shader &shader, GLuint instanceBuffer, size_t commandOffset, bool bindTextures = true)
+        {
+            shader.Activate();
+            if (bindTextures)
+                BindTextures(shader);
+
+            if (format == VertexFormat::Quantized)
+            {
+                shader.setVec3("positionOffset", quantization.positionOffset);
+                shader.setVec3("positionScale", quantization.positionScale);
+                shader.setVec4("uvTransform", quantization.uvTransform);
             }
 
+            glBindVertexArray(VAO);
+            for (GLuint column = 0; column < 4; column++)
+                glBindVertexBuffer(3 + column, instanceBuffer, column * sizeof(glm::vec4), sizeof(glm::mat4));
+            glDrawElementsIndirect(GL_TRIANGLES, indexType, (const void *)commandOffset);
+            for (GLuint column = 0; column < 4; column++)
+                glBindVertexBuffer(3 + column, instanceVBO, column * sizeof(glm::vec4), sizeof(glm::mat4));
             glBindVertexArray(0);
         }
+
+        // Frees the CPU copy of the geometry once it is on the GPU
+        void ReleaseMeshData()
+        {
+            std::vector<Vertex>().swap(vertices);
+            std::vector<unsigned int>().swap(indices);
+        }
+
+        // Binds the textures whose material sampler the active shader uses to units 0, 1, ... in texture order and
+        // points the samplers at them; textures the program doesn't sample are skipped so they can't take the units
+        // of other textures (e.g. shadow maps)
+        void BindTextures(Shader &shader)
+        {
+            GLint unit = 0;
+            for(unsigned int i = 0; i < textures.size(); i++)
+            {
+                if(shader.Location(textureUniforms[i]) < 0)
+                    continue;
+                GLState::Instance().BindTexture(unit, textures[i]->DrawID());
+                shader.setInt(textureUniforms[i], unit);
+                unit++;
+            }
+        }
+
+        // material.<type> of every texture, in texture order
+        const std::vector<UniformName>& TextureUniforms() const
+        {
+            return textureUniforms;
+        }
     private:
         //  render data
-        unsigned int VAO, VBO, EBO, instanceVBO;
+        VertexArrayHandle VAO;
+        BufferHandle VBO, EBO;
+        unsigned int instanceVBO; // owned by the Model
+        std::vector<UniformName> textureUniforms; // material.<type>, hashed once
+
+        void setupTextureUniforms()
+        {
+            textureUniforms.clear();
+            for(Texture *texture : textures)
+                textureUniforms.push_back(UniformName("material").Member(texture->type));
+        }
 
         void setupInstancing(unsigned int instancing, unsigned int instanceVBO)
         {
@@ -78,30 +184,70 @@ class Mesh {
             this->instanceVBO = instanceVBO;
         }
 
-        void setupMesh()
+        void setupMesh(const Vertex *vertices, size_t vertexCount, const unsigned int *indices, size_t indexCount)
         {
-            glGenVertexArrays(1, &VAO);
-            glGenBuffers(1, &VBO);
-            glGenBuffers(1, &EBO);
+            this->indexCount = static_cast<unsigned int>(indexCount);
+            if (lods.empty())
+                lods.push_back({ 0, static_cast<uint32_t>(indexCount), 0.0f });
+            currentLod = 0;
+
+            // box center sphere, loose but enough for LOD selection
+            glm::vec3 minPosition(0.0f), maxPosition(0.0f);
+            for (size_t i = 0; i < vertexCount; i++)
+            {
+                minPosition = i == 0 ? vertices[i].Position : glm::min(minPosition, vertices[i].Position);
+                maxPosition = i == 0 ? vertices[i].Position : glm::max(maxPosition, vertices[i].Position);
+            }
+            boundsMin = minPosition;
+            boundsMax = maxPosition;
+            boundsCenter = (minPosition + maxPosition) * 0.5f;
+            boundsRadius = 0.0f;
+            for (size_t i = 0; i < vertexCount; i++)
+                boundsRadius = std::max(boundsRadius, glm::length(vertices[i].Position - boundsCenter));
+
+            std::vector<PackedVertex> packed;
+            const void *vertexData = vertices;
+            if (format == VertexFormat::Quantized)
+            {
+                quantization = quantizeVertices(vertices, vertexCount, packed);
+                vertexData = packed.data();
+                vertexBytes = packed.size() * sizeof(PackedVertex);
+            }
+            else
+                vertexBytes = vertexCount * sizeof(Vertex);
+
+            if (inArena)
+            {
+                arenaAllocation = GeometryArena::Instance(format).Add(vertexData, vertexCount, indices, indexCount);
+                indexType = GL_UNSIGNED_INT;
+                indexBytes = indexCount * sizeof(unsigned int);
+                return;
+            }
+
+            glGenVertexArrays(1, VAO.Replace());
+            glGenBuffers(1, VBO.Replace());
+            glGenBuffers(1, EBO.Replace());
 
             glBindVertexArray(VAO);
             glBindBuffer(GL_ARRAY_BUFFER, VBO);
-
-            glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+            glBufferData(GL_ARRAY_BUFFER, vertexBytes, vertexData, GL_STATIC_DRAW);
 
             glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
-                         &indices[0], GL_STATIC_DRAW);
-
-            // vertex positions
-            glEnableVertexAttribArray(0);
-            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)0);
-            // vertex normals
-            glEnableVertexAttribArray(1);
-            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, Normal));
-            // vertex texture coords
-            glEnableVertexAttribArray(2);
-            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, TexCoords));
+            if (vertexCount <= 65536)
+            {
+                std::vector<uint16_t> shortIndices(indices, indices + indexCount);
+                indexType = GL_UNSIGNED_SHORT;
+                indexBytes = indexCount * sizeof(uint16_t);
+                glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, shortIndices.data(), GL_STATIC_DRAW);
+            }
+            else
+            {
+                indexType = GL_UNSIGNED_INT;
+                indexBytes = indexCount * sizeof(unsigned int);
+                glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, indices, GL_STATIC_DRAW);
+            }
+
+            setupVertexAttributes(format);
 
             if (instancing != 1)
             {
@@ -0,0 +1,440 @@
+#pragma once
+
+#include "mesh.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile()
+    {
+        Close();
+    }
+
+    bool Open(const std::string &path)
+    {
+        Close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if(file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER fileSize;
+        if(!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+        {
+            Close();
+            return false;
+        }
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if(mapping == NULL)
+        {
+            Close();
+            return false;
+        }
+        bytes = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        size = static_cast<size_t>(fileSize.QuadPart);
+#else
+        file = open(path.c_str(), O_RDONLY);
+        if(file < 0)
+            return false;
+        struct stat info;
+        if(fstat(file, &info) != 0 || info.st_size == 0)
+        {
+            Close();
+            return false;
+        }
+        void *address = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        bytes = address == MAP_FAILED ? nullptr : static_cast<const unsigned char*>(address);
+        size = static_cast<size_t>(info.st_size);
+#endif
+        if(bytes == nullptr)
+        {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    void Close()
+    {
+#ifdef _WIN32
+        if(bytes != nullptr)
+            UnmapViewOfFile(bytes);
+        if(mapping != NULL)
+            CloseHandle(mapping);
+        if(file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+        mapping = NULL;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if(bytes != nullptr)
+            munmap(const_cast<unsigned char*>(bytes), size);
+        if(file >= 0)
+            close(file);
+        file = -1;
+#endif
+        bytes = nullptr;
+        size = 0;
+    }
+
+    const unsigned char *Data() const { return bytes; }
+    size_t Size() const { return size; }
+
+private:
+    const unsigned char *bytes = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#else
+    int file = -1;
+#endif
+};
+
+struct MeshCacheTexture
+{
+    std::string type;
+    std::string path; // relative to the model directory
+};
+
+// View of one mesh inside a mapped cache file
+struct MeshCacheView
+{
+    const Vertex *vertices;
+    uint32_t vertexCount;
+    const unsigned int *indices;
+    uint32_t indexCount;
+    std::vector<MeshLod> lods; // empty for meshes without a LOD chain
+    std::vector<MeshCacheTexture> textures;
+};
+
+// Binary cache of the vertex, index and material data Model extracts with Assimp.
+// Layout: header, the files besides the source the data depends on (material libraries, textures), then for every mesh
+// a record followed by its vertices, indices, LOD ranges and texture references.
+// Everything is 4-byte aligned so the mapping can be handed to glBufferData as is.
+class MeshCache
+{
+public:
+    static const uint32_t VERSION = 4;
+
+    struct Header
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t importFlags;
+        uint32_t meshCount;
+        uint32_t processFlags; // post-import processing done by the caller (e.g. Model's mesh optimization)
+        uint32_t dependencyCount;
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        uint64_t sourceHash;
+    };
+
+    // followed by pathLength characters (relative to the source's directory), padded to 4 bytes
+    struct Dependency
+    {
+        uint64_t size; // ~0 when the file did not exist
+        int64_t time;
+        uint32_t pathLength;
+        uint32_t reserved;
+    };
+
+    struct Record
+    {
+        uint32_t vertexCount;
+        uint32_t indexCount;
+        uint32_t textureCount;
+        uint32_t lodCount;
+    };
+
+    static std::string GetCachePath(const std::string &sourcePath)
+    {
+        return sourcePath + ".mpcache";
+    }
+
+    // Maps the cache of sourcePath and checks it still matches the source file, import and process flags
+    bool Open(const std::string &sourcePath, unsigned int importFlags, unsigned int processFlags = 0)
+    {
+        Close();
+        if(!file.Open(GetCachePath(sourcePath)))
+            return false;
+
+        const unsigned char *cursor = file.Data();
+        const unsigned char *end = file.Data() + file.Size();
+        Header header;
+        if(!read(cursor, end, &header, sizeof(Header)))
+            return fail();
+        if(std::memcmp(header.magic, "MPMC", 4) != 0 || header.version != VERSION || header.importFlags != importFlags || header.processFlags != processFlags)
+            return fail();
+        if(!sourceMatches(sourcePath, header))
+            return fail();
+
+        // an edited material library or replaced texture invalidates the cache like an edited source
+        std::filesystem::path directory = std::filesystem::path(sourcePath).parent_path();
+        for(uint32_t i = 0; i < header.dependencyCount; i++)
+        {
+            Dependency dependency;
+            if(!read(cursor, end, &dependency, sizeof(Dependency)))
+                return fail();
+            const char *chars = reinterpret_cast<const char*>(cursor);
+            if(!skip(cursor, end, align(dependency.pathLength)))
+                return fail();
+            uint64_t size;
+            int64_t time;
+            statFile(directory / std::string(chars, dependency.pathLength), size, time);
+            if(size != dependency.size || time != dependency.time)
+                return fail();
+        }
+
+        meshes.reserve(header.meshCount);
+        for(uint32_t i = 0; i < header.meshCount; i++)
+        {
+            Record record;
+            if(!read(cursor, end, &record, sizeof(Record)))
+                return fail();
+
+            MeshCacheView mesh;
+            mesh.vertexCount = record.vertexCount;
+            mesh.indexCount = record.indexCount;
+            mesh.vertices = reinterpret_cast<const Vertex*>(cursor);
+            if(!skip(cursor, end, size_t(record.vertexCount) * sizeof(Vertex)))
+                return fail();
+            mesh.indices = reinterpret_cast<const unsigned int*>(cursor);
+            if(!skip(cursor, end, size_t(record.indexCount) * sizeof(unsigned int)))
+                return fail();
+            mesh.lods.resize(record.lodCount);
+            if(!read(cursor, end, mesh.lods.data(), size_t(record.lodCount) * sizeof(MeshLod)))
+                return fail();
+
+            for(uint32_t j = 0; j < record.textureCount; j++)
+            {
+                uint32_t lengths[2];
+                if(!read(cursor, end, lengths, sizeof(lengths)))
+                    return fail();
+                MeshCacheTexture texture;
+                const char *chars = reinterpret_cast<const char*>(cursor);
+                if(!skip(cursor, end, align(size_t(lengths[0]) + lengths[1])))
+                    return fail();
+                texture.type.assign(chars, lengths[0]);
+                texture.path.assign(chars + lengths[0], lengths[1]);
+                mesh.textures.push_back(texture);
+            }
+            meshes.push_back(mesh);
+        }
+        return true;
+    }
+
+    void Close()
+    {
+        meshes.clear();
+        file.Close();
+    }
+
+    const std::vector<MeshCacheView>& GetMeshes() const
+    {
+        return meshes;
+    }
+
+    // Serializes meshes for sourcePath; the file is written aside and renamed so readers never see it half done
+    static bool Write(const std::string &sourcePath, unsigned int importFlags, const std::vector<MeshCacheView> &meshes, unsigned int processFlags = 0)
+    {
+        Header header;
+        std::memcpy(header.magic, "MPMC", 4);
+        header.version = VERSION;
+        header.importFlags = importFlags;
+        header.processFlags = processFlags;
+        header.meshCount = static_cast<uint32_t>(meshes.size());
+        if(!fingerprint(sourcePath, header.sourceSize, header.sourceTime, header.sourceHash))
+            return false;
+        std::vector<std::string> dependencies = collectDependencies(sourcePath, meshes);
+        header.dependencyCount = static_cast<uint32_t>(dependencies.size());
+        std::filesystem::path directory = std::filesystem::path(sourcePath).parent_path();
+
+        std::string cachePath = GetCachePath(sourcePath);
+        std::string tempPath = cachePath + ".tmp";
+        {
+            std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+            if(!out)
+            {
+                std::cerr << "ERROR::MESHCACHE:: Could not write " << tempPath << std::endl;
+                return false;
+            }
+            out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+            const char padding[4] = {};
+            for(const std::string &path : dependencies)
+            {
+                Dependency dependency = {};
+                statFile(directory / path, dependency.size, dependency.time);
+                dependency.pathLength = static_cast<uint32_t>(path.size());
+                out.write(reinterpret_cast<const char*>(&dependency), sizeof(Dependency));
+                out.write(path.data(), path.size());
+                out.write(padding, align(path.size()) - path.size());
+            }
+            for(const MeshCacheView &mesh : meshes)
+            {
+                Record record = { mesh.vertexCount, mesh.indexCount, static_cast<uint32_t>(mesh.textures.size()), static_cast<uint32_t>(mesh.lods.size()) };
+                out.write(reinterpret_cast<const char*>(&record), sizeof(Record));
+                out.write(reinterpret_cast<const char*>(mesh.vertices), size_t(mesh.vertexCount) * sizeof(Vertex));
+                out.write(reinterpret_cast<const char*>(mesh.indices), size_t(mesh.indexCount) * sizeof(unsigned int));
+                out.write(reinterpret_cast<const char*>(mesh.lods.data()), mesh.lods.size() * sizeof(MeshLod));
+                for(const MeshCacheTexture &texture : mesh.textures)
+                {
+                    uint32_t lengths[2] = { static_cast<uint32_t>(texture.type.size()), static_cast<uint32_t>(texture.path.size()) };
+                    out.write(reinterpret_cast<const char*>(lengths), sizeof(lengths));
+                    out.write(texture.type.data(), texture.type.size());
+                    out.write(texture.path.data(), texture.path.size());
+                    out.write(padding, align(texture.type.size() + texture.path.size()) - (texture.type.size() + texture.path.size()));
+                }
+            }
+            if(!out)
+                return false;
+        }
+
+        std::error_code error;
+        std::filesystem::rename(tempPath, cachePath, error);
+        if(error)
+        {
+            std::cerr << "ERROR::MESHCACHE:: Could not replace " << cachePath << ": " << error.message() << std::endl;
+            std::filesystem::remove(tempPath, error);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    MappedFile file;
+    std::vector<MeshCacheView> meshes;
+
+    bool fail()
+    {
+        Close();
+        return false;
+    }
+
+    static size_t align(size_t size)
+    {
+        return (size + 3) & ~size_t(3);
+    }
+
+    static bool read(const unsigned char *&cursor, const unsigned char *end, void *out, size_t size)
+    {
+        if(size_t(end - cursor) < size)
+            return false;
+        std::memcpy(out, cursor, size);
+        cursor += size;
+        return true;
+    }
+
+    static bool skip(const unsigned char *&cursor, const unsigned char *end, size_t size)
+    {
+        if(size_t(end - cursor) < size)
+            return false;
+        cursor += size;
+        return true;
+    }
+
+    static bool fingerprint(const std::string &sourcePath, uint64_t &size, int64_t &time, uint64_t &hash)
+    {
+        std::error_code error;
+        size = std::filesystem::file_size(sourcePath, error);
+        if(error)
+            return false;
+        time = static_cast<int64_t>(std::filesystem::last_write_time(sourcePath, error).time_since_epoch().count());
+        if(error)
+            return false;
+        MappedFile source;
+        if(!source.Open(sourcePath))
+            return false;
+        hash = hashBytes(source.Data(), source.Size());
+        return true;
+    }
+
+    // Files the cached data was built from besides the source: the material libraries an OBJ names (mtllib) and the
+    // referenced textures, relative to the source's directory
+    static std::vector<std::string> collectDependencies(const std::string &sourcePath, const std::vector<MeshCacheView> &meshes)
+    {
+        std::vector<std::string> dependencies;
+        auto add = [&](const std::string &path) {
+            if(!path.empty() && std::find(dependencies.begin(), dependencies.end(), path) == dependencies.end())
+                dependencies.push_back(path);
+        };
+        std::string extension = std::filesystem::path(sourcePath).extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+        if(extension == ".obj")
+        {
+            std::ifstream source(sourcePath);
+            std::string line;
+            while(std::getline(source, line))
+            {
+                if(line.compare(0, 7, "mtllib ") != 0)
+                    continue;
+                size_t first = line.find_first_not_of(" \t", 7);
+                size_t last = line.find_last_not_of(" \t\r");
+                if(first != std::string::npos && last >= first)
+                    add(line.substr(first, last - first + 1));
+            }
+        }
+        for(const MeshCacheView &mesh : meshes)
+            for(const MeshCacheTexture &texture : mesh.textures)
+                add(texture.path);
+        return dependencies;
+    }
+
+    static void statFile(const std::filesystem::path &path, uint64_t &size, int64_t &time)
+    {
+        std::error_code error;
+        size = std::filesystem::file_size(path, error);
+        if(!error)
+            time = static_cast<int64_t>(std::filesystem::last_write_time(path, error).time_since_epoch().count());
+        if(error)
+        {
+            size = ~uint64_t(0);
+            time = 0;
+        }
+    }
+
+    // Same size and timestamp is trusted; a touched but identical file is accepted through its content hash
+    static bool sourceMatches(const std::string &sourcePath, const Header &header)
+    {
+        std::error_code error;
+        uint64_t size = std::filesystem::file_size(sourcePath, error);
+        if(error || size != header.sourceSize)
+            return false;
+        int64_t time = static_cast<int64_t>(std::filesystem::last_write_time(sourcePath, error).time_since_epoch().count());
+        if(error)
+            return false;
+        if(time == header.sourceTime)
+            return true;
+        MappedFile source;
+        return source.Open(sourcePath) && hashBytes(source.Data(), source.Size()) == header.sourceHash;
+    }
+};
@@ -0,0 +1,319 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "vertexformat.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
+#include <vector>
+
+// Import time optimization of indexed triangle lists: welding, post-transform cache order (Forsyth),
+// overdraw aware cluster order (Sander et al., "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw")
+// and fetch order. Cache efficiency is measured with a FIFO cache simulation.
+
+// Vertex cache misses of an index buffer; acmr = misses per triangle, atvr = misses per vertex (1.0 is optimal)
+struct VertexCacheStats
+{
+    size_t misses = 0;
+    size_t triangles = 0;
+    size_t vertices = 0;
+
+    float ACMR() const
+    {
+        return triangles == 0 ? 0.0f : float(misses) / float(triangles);
+    }
+
+    float ATVR() const
+    {
+        return vertices == 0 ? 0.0f : float(misses) / float(vertices);
+    }
+
+    VertexCacheStats& operator+=(const VertexCacheStats &other)
+    {
+        misses += other.misses;
+        triangles += other.triangles;
+        vertices += other.vertices;
+        return *this;
+    }
+};
+
+struct MeshOptimizationStats
+{
+    VertexCacheStats before;
+    VertexCacheStats after;
+
+    MeshOptimizationStats& operator+=(const MeshOptimizationStats &other)
+    {
+        before += other.before;
+        after += other.after;
+        return *this;
+    }
+};
+
+inline VertexCacheStats analyzeVertexCache(const unsigned int *indices, size_t indexCount, size_t vertexCount, unsigned int cacheSize = 16)
+{
+    VertexCacheStats stats;
+    stats.triangles = indexCount / 3;
+    stats.vertices = vertexCount;
+
+    // a vertex is in the FIFO while fewer than cacheSize misses happened since it was loaded
+    std::vector<size_t> loadedAt(vertexCount, 0);
+    size_t time = cacheSize + 1;
+    for(size_t i = 0; i < indexCount; i++)
+    {
+        unsigned int vertex = indices[i];
+        if(time - loadedAt[vertex] > cacheSize)
+        {
+            loadedAt[vertex] = time++;
+            stats.misses++;
+        }
+    }
+    return stats;
+}
+
+// Merges bitwise identical vertices
+inline void weldVertices(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices)
+{
+    struct VertexHash
+    {
+        const std::vector<Vertex> *vertices;
+        size_t operator()(unsigned int index) const { return hashBytes(&(*vertices)[index], sizeof(Vertex)); }
+    };
+    struct VertexEqual
+    {
+        const std::vector<Vertex> *vertices;
+        bool operator()(unsigned int a, unsigned int b) const { return std::memcmp(&(*vertices)[a], &(*vertices)[b], sizeof(Vertex)) == 0; }
+    };
+
+    std::unordered_map<unsigned int, unsigned int, VertexHash, VertexEqual> unique(vertices.size(), VertexHash{ &vertices }, VertexEqual{ &vertices });
+    std::vector<unsigned int> remap(vertices.size());
+    std::vector<Vertex> welded;
+    welded.reserve(vertices.size());
+    for(unsigned int i = 0; i < vertices.size(); i++)
+    {
+        auto [it, inserted] = unique.try_emplace(i, static_cast<unsigned int>(welded.size()));
+        if(inserted)
+            welded.push_back(vertices[i]);
+        remap[i] = it->second;
+    }
+    for(unsigned int &index : indices)
+        index = remap[index];
+    vertices = std::move(welded);
+}
+
+// Forsyth's linear-speed vertex cache optimization
+inline std::vector<unsigned int> optimizeVertexCache(const std::vector<unsigned int> &indices, size_t vertexCount)
+{
+    const int cacheSize = 32;
+    auto vertexScore = [](int cachePosition, unsigned int liveTriangles)
+    {
+        if(liveTriangles == 0)
+            return -1.0f;
+        float score = 0.0f;
+        if(cachePosition >= 3)
+            score = std::pow(1.0f - float(cachePosition - 3) / float(cacheSize - 3), 1.5f);
+        else if(cachePosition >= 0)
+            score = 0.75f; // the last triangle's vertices, so strips are not favoured over fans
+        return score + 2.0f / std::sqrt(float(liveTriangles));
+    };
+
+    size_t triangleCount = indices.size() / 3;
+    std::vector<unsigned int> live(vertexCount, 0);
+    for(unsigned int index : indices)
+        live[index]++;
+    std::vector<unsigned int> offsets(vertexCount + 1, 0);
+    for(size_t v = 0; v < vertexCount; v++)
+        offsets[v + 1] = offsets[v] + live[v];
+    std::vector<unsigned int> adjacency(indices.size());
+    std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+    for(size_t i = 0; i < indices.size(); i++)
+        adjacency[fill[indices[i]]++] = static_cast<unsigned int>(i / 3);
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> scores(vertexCount);
+    for(size_t v = 0; v < vertexCount; v++)
+        scores[v] = vertexScore(-1, live[v]);
+    std::vector<float> triangleScores(triangleCount);
+    for(size_t t = 0; t < triangleCount; t++)
+        triangleScores[t] = scores[indices[t * 3]] + scores[indices[t * 3 + 1]] + scores[indices[t * 3 + 2]];
+    std::vector<char> emitted(triangleCount, 0);
+
+    std::vector<unsigned int> result;
+    result.reserve(indices.size());
+    std::vector<unsigned int> cache;
+    cache.reserve(cacheSize + 3);
+    size_t scanCursor = 0;
+    long best = -1;
+    while(result.size() < triangleCount * 3)
+    {
+        if(best < 0)
+        {
+            while(emitted[scanCursor])
+                scanCursor++;
+            best = static_cast<long>(scanCursor);
+        }
+
+        size_t triangle = static_cast<size_t>(best);
+        emitted[triangle] = 1;
+        for(int k = 0; k < 3; k++)
+        {
+            unsigned int vertex = indices[triangle * 3 + k];
+            result.push_back(vertex);
+
+            unsigned int *begin = &adjacency[offsets[vertex]];
+            unsigned int *last = begin + live[vertex] - 1;
+            std::iter_swap(std::find(begin, last + 1, static_cast<unsigned int>(triangle)), last);
+            live[vertex]--;
+
+            auto cached = std::find(cache.begin(), cache.end(), vertex);
+            if(cached != cache.end())
+                cache.erase(cached);
+            cache.insert(cache.begin(), vertex);
+        }
+
+        for(size_t i = 0; i < cache.size(); i++)
+        {
+            unsigned int vertex = cache[i];
+            cachePosition[vertex] = i < size_t(cacheSize) ? static_cast<int>(i) : -1;
+            scores[vertex] = vertexScore(cachePosition[vertex], live[vertex]);
+        }
+
+        best = -1;
+        float bestScore = -1.0f;
+        for(size_t i = 0; i < cache.size(); i++)
+        {
+            unsigned int vertex = cache[i];
+            for(unsigned int j = offsets[vertex]; j < offsets[vertex] + live[vertex]; j++)
+            {
+                unsigned int t = adjacency[j];
+                triangleScores[t] = scores[indices[t * 3]] + scores[indices[t * 3 + 1]] + scores[indices[t * 3 + 2]];
+                if(triangleScores[t] > bestScore)
+                {
+                    bestScore = triangleScores[t];
+                    best = t;
+                }
+            }
+        }
+        if(cache.size() > size_t(cacheSize))
+            cache.resize(cacheSize);
+    }
+    return result;
+}
+
+// Reorders the clusters of a cache optimized index buffer so outward facing, outer clusters are drawn first.
+// Clusters start wherever the FIFO cache is fully missed; the new order is kept only if ACMR grows by less than threshold.
+inline void optimizeOverdraw(std::vector<unsigned int> &indices, const std::vector<Vertex> &vertices, float threshold = 1.05f, unsigned int cacheSize = 16)
+{
+    size_t triangleCount = indices.size() / 3;
+    if(triangleCount < 2)
+        return;
+
+    std::vector<size_t> clusterStarts;
+    std::vector<size_t> loadedAt(vertices.size(), 0);
+    size_t time = cacheSize + 1;
+    for(size_t t = 0; t < triangleCount; t++)
+    {
+        int misses = 0;
+        for(int k = 0; k < 3; k++)
+        {
+            unsigned int vertex = indices[t * 3 + k];
+            if(time - loadedAt[vertex] > cacheSize)
+            {
+                loadedAt[vertex] = time++;
+                misses++;
+            }
+        }
+        if(t == 0 || misses == 3)
+            clusterStarts.push_back(t);
+    }
+    clusterStarts.push_back(triangleCount);
+    size_t clusterCount = clusterStarts.size() - 1;
+    if(clusterCount < 2)
+        return;
+
+    // area weighted centroids and normals
+    glm::vec3 meshCentroid(0.0f);
+    float meshArea = 0.0f;
+    std::vector<glm::vec3> clusterCentroids(clusterCount, glm::vec3(0.0f));
+    std::vector<glm::vec3> clusterNormals(clusterCount, glm::vec3(0.0f));
+    for(size_t c = 0; c < clusterCount; c++)
+    {
+        float clusterArea = 0.0f;
+        for(size_t t = clusterStarts[c]; t < clusterStarts[c + 1]; t++)
+        {
+            const glm::vec3 &a = vertices[indices[t * 3]].Position;
+            const glm::vec3 &b = vertices[indices[t * 3 + 1]].Position;
+            const glm::vec3 &d = vertices[indices[t * 3 + 2]].Position;
+            glm::vec3 normal = glm::cross(b - a, d - a);
+            float area = glm::length(normal);
+            glm::vec3 center = (a + b + d) / 3.0f;
+            clusterCentroids[c] += center * area;
+            clusterNormals[c] += normal;
+            clusterArea += area;
+            meshCentroid += center * area;
+            meshArea += area;
+        }
+        if(clusterArea > 0.0f)
+            clusterCentroids[c] /= clusterArea;
+    }
+    if(meshArea > 0.0f)
+        meshCentroid /= meshArea;
+
+    std::vector<float> sortKeys(clusterCount);
+    for(size_t c = 0; c < clusterCount; c++)
+    {
+        float length = glm::length(clusterNormals[c]);
+        sortKeys[c] = length > 0.0f ? glm::dot(clusterCentroids[c] - meshCentroid, clusterNormals[c] / length) : 0.0f;
+    }
+    std::vector<size_t> order(clusterCount);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sortKeys[a] > sortKeys[b]; });
+
+    std::vector<unsigned int> sorted;
+    sorted.reserve(indices.size());
+    for(size_t c : order)
+        sorted.insert(sorted.end(), indices.begin() + clusterStarts[c] * 3, indices.begin() + clusterStarts[c + 1] * 3);
+
+    float before = analyzeVertexCache(indices.data(), indices.size(), vertices.size(), cacheSize).ACMR();
+    float after = analyzeVertexCache(sorted.data(), sorted.size(), vertices.size(), cacheSize).ACMR();
+    if(after <= before * threshold)
+        indices = std::move(sorted);
+}
+
+// Renumbers vertices in first use order (and drops unreferenced ones)
+inline void optimizeVertexFetch(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices)
+{
+    const unsigned int unused = ~0u;
+    std::vector<unsigned int> remap(vertices.size(), unused);
+    std::vector<Vertex> ordered;
+    ordered.reserve(vertices.size());
+    for(unsigned int &index : indices)
+    {
+        if(remap[index] == unused)
+        {
+            remap[index] = static_cast<unsigned int>(ordered.size());
+            ordered.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices = std::move(ordered);
+}
+
+inline MeshOptimizationStats optimizeMesh(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices)
+{
+    MeshOptimizationStats stats;
+    stats.before = analyzeVertexCache(indices.data(), indices.size(), vertices.size());
+
+    weldVertices(vertices, indices);
+    indices = optimizeVertexCache(indices, vertices.size());
+    optimizeOverdraw(indices, vertices);
+    optimizeVertexFetch(vertices, indices);
+
+    stats.after = analyzeVertexCache(indices.data(), indices.size(), vertices.size());
+    return stats;
+}
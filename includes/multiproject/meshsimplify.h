@@ -0,0 +1,256 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "vertexformat.h"
+#include "meshoptimize.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+// Quadric error metric simplification (Garland & Heckbert) by edge collapse onto existing vertices, so every LOD
+// of a mesh indexes the same vertex buffer. Vertices on UV/normal seams and open borders never move.
+
+// A range of a mesh's index buffer; error is the geometric deviation (object units) from LOD 0
+struct MeshLod
+{
+    uint32_t indexOffset;
+    uint32_t indexCount;
+    float error;
+};
+
+struct Quadric
+{
+    // symmetric 4x4: a00 a01 a02 a03 a11 a12 a13 a22 a23 a33
+    double q[10] = {};
+
+    static Quadric FromPlane(const glm::dvec3 &normal, double distance)
+    {
+        Quadric quadric;
+        double plane[4] = { normal.x, normal.y, normal.z, distance };
+        int k = 0;
+        for(int i = 0; i < 4; i++)
+            for(int j = i; j < 4; j++)
+                quadric.q[k++] = plane[i] * plane[j];
+        return quadric;
+    }
+
+    Quadric& operator+=(const Quadric &other)
+    {
+        for(int i = 0; i < 10; i++)
+            q[i] += other.q[i];
+        return *this;
+    }
+
+    // sum of squared distances of p to the accumulated planes
+    double Error(const glm::dvec3 &p) const
+    {
+        return q[0] * p.x * p.x + 2.0 * q[1] * p.x * p.y + 2.0 * q[2] * p.x * p.z + 2.0 * q[3] * p.x
+             + q[4] * p.y * p.y + 2.0 * q[5] * p.y * p.z + 2.0 * q[6] * p.y
+             + q[7] * p.z * p.z + 2.0 * q[8] * p.z
+             + q[9];
+    }
+};
+
+// Collapses edges until at most targetIndexCount indices remain or the next collapse would exceed maxError.
+// resultError receives the largest collapse error (object units) of this call.
+inline std::vector<unsigned int> simplifyMesh(const std::vector<Vertex> &vertices, const std::vector<unsigned int> &indices, size_t targetIndexCount, float maxError, float &resultError)
+{
+    size_t vertexCount = vertices.size();
+    resultError = 0.0f;
+
+    // vertices sharing a position form one topological vertex; more than one attribute vertex means a seam
+    struct PositionHash
+    {
+        size_t operator()(const glm::vec3 &p) const { return hashBytes(&p, sizeof(p)); }
+    };
+    std::unordered_map<glm::vec3, unsigned int, PositionHash> positionIds;
+    std::vector<unsigned int> positionOf(vertexCount);
+    std::vector<unsigned int> attributeVertices;
+    for(size_t v = 0; v < vertexCount; v++)
+    {
+        auto [it, inserted] = positionIds.try_emplace(vertices[v].Position, static_cast<unsigned int>(attributeVertices.size()));
+        if(inserted)
+            attributeVertices.push_back(0);
+        positionOf[v] = it->second;
+        attributeVertices[it->second]++;
+    }
+    size_t positionCount = attributeVertices.size();
+    std::vector<char> locked(positionCount, 0);
+    for(size_t p = 0; p < positionCount; p++)
+        locked[p] = attributeVertices[p] > 1;
+
+    // open border edges (used by one triangle) lock their endpoints
+    std::unordered_map<uint64_t, int> edgeUse;
+    auto edgeKey = [](unsigned int a, unsigned int b) { return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a; };
+    for(size_t i = 0; i < indices.size(); i += 3)
+        for(int k = 0; k < 3; k++)
+            edgeUse[edgeKey(positionOf[indices[i + k]], positionOf[indices[i + (k + 1) % 3]])]++;
+    for(const auto &[key, uses] : edgeUse)
+        if(uses == 1)
+        {
+            locked[key >> 32] = 1;
+            locked[key & 0xFFFFFFFFu] = 1;
+        }
+
+    std::vector<Quadric> quadrics(positionCount);
+    for(size_t i = 0; i < indices.size(); i += 3)
+    {
+        glm::dvec3 a = vertices[indices[i]].Position, b = vertices[indices[i + 1]].Position, c = vertices[indices[i + 2]].Position;
+        glm::dvec3 normal = glm::cross(b - a, c - a);
+        double length = glm::length(normal);
+        if(length <= 0.0)
+            continue;
+        normal /= length;
+        Quadric plane = Quadric::FromPlane(normal, -glm::dot(normal, a));
+        for(int k = 0; k < 3; k++)
+            quadrics[positionOf[indices[i + k]]] += plane;
+    }
+
+    struct Collapse
+    {
+        unsigned int from, to; // attribute vertices
+        double cost;
+    };
+
+    std::vector<unsigned int> result = indices;
+    double maxCost = double(maxError) * double(maxError);
+    double worstCost = 0.0;
+    std::vector<unsigned int> remap(vertexCount);
+    std::vector<char> touched(positionCount);
+    std::vector<unsigned int> triangleOffsets(vertexCount + 1);
+    std::vector<unsigned int> vertexTriangles;
+    while(result.size() > targetIndexCount)
+    {
+        std::vector<Collapse> collapses;
+        for(size_t i = 0; i < result.size(); i += 3)
+            for(int k = 0; k < 3; k++)
+            {
+                unsigned int a = result[i + k], b = result[i + (k + 1) % 3];
+                for(int direction = 0; direction < 2; direction++)
+                {
+                    unsigned int from = direction == 0 ? a : b, to = direction == 0 ? b : a;
+                    if(locked[positionOf[from]])
+                        continue;
+                    Quadric quadric = quadrics[positionOf[from]];
+                    quadric += quadrics[positionOf[to]];
+                    collapses.push_back({ from, to, std::max(0.0, quadric.Error(glm::dvec3(vertices[to].Position))) });
+                }
+            }
+        if(collapses.empty())
+            break;
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse &x, const Collapse &y) { return x.cost < y.cost; });
+
+        // triangles around every vertex, for the flip test
+        std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+        for(unsigned int index : result)
+            triangleOffsets[index + 1]++;
+        for(size_t v = 0; v < vertexCount; v++)
+            triangleOffsets[v + 1] += triangleOffsets[v];
+        vertexTriangles.resize(result.size());
+        std::vector<unsigned int> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+        for(size_t i = 0; i < result.size(); i++)
+            vertexTriangles[fill[result[i]]++] = static_cast<unsigned int>(i / 3);
+
+        auto flips = [&](unsigned int from, unsigned int to)
+        {
+            glm::vec3 target = vertices[to].Position;
+            for(unsigned int j = triangleOffsets[from]; j < triangleOffsets[from + 1]; j++)
+            {
+                const unsigned int *triangle = &result[size_t(vertexTriangles[j]) * 3];
+                glm::vec3 p[3], moved[3];
+                bool containsTarget = false;
+                for(int k = 0; k < 3; k++)
+                {
+                    p[k] = vertices[triangle[k]].Position;
+                    moved[k] = triangle[k] == from ? target : p[k];
+                    containsTarget |= positionOf[triangle[k]] == positionOf[to];
+                }
+                if(containsTarget)
+                    continue; // removed by the collapse
+                glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+                glm::vec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+                if(glm::dot(before, after) <= 0.0f)
+                    return true;
+            }
+            return false;
+        };
+
+        for(size_t v = 0; v < vertexCount; v++)
+            remap[v] = static_cast<unsigned int>(v);
+        std::fill(touched.begin(), touched.end(), 0);
+        size_t trianglesToRemove = (result.size() - targetIndexCount) / 3;
+        size_t removed = 0;
+        size_t applied = 0;
+        for(const Collapse &collapse : collapses)
+        {
+            if(collapse.cost > maxCost)
+                break;
+            if(touched[positionOf[collapse.from]] || touched[positionOf[collapse.to]] || flips(collapse.from, collapse.to))
+                continue;
+
+            remap[collapse.from] = collapse.to;
+            quadrics[positionOf[collapse.to]] += quadrics[positionOf[collapse.from]];
+            worstCost = std::max(worstCost, collapse.cost);
+            // the one-ring changes shape, so none of it collapses again in this pass
+            for(unsigned int j = triangleOffsets[collapse.from]; j < triangleOffsets[collapse.from + 1]; j++)
+                for(int k = 0; k < 3; k++)
+                    touched[positionOf[result[size_t(vertexTriangles[j]) * 3 + k]]] = 1;
+            applied++;
+            removed += 2;
+            if(removed >= trianglesToRemove)
+                break;
+        }
+        if(applied == 0)
+            break;
+
+        std::vector<unsigned int> next;
+        next.reserve(result.size());
+        for(size_t i = 0; i < result.size(); i += 3)
+        {
+            unsigned int a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+            if(positionOf[a] == positionOf[b] || positionOf[b] == positionOf[c] || positionOf[a] == positionOf[c])
+                continue;
+            next.push_back(a);
+            next.push_back(b);
+            next.push_back(c);
+        }
+        result = std::move(next);
+    }
+
+    resultError = static_cast<float>(std::sqrt(worstCost));
+    return result;
+}
+
+// Appends up to maxLods - 1 simplified levels (half the triangles each) to indices and returns the LOD table.
+// Stops early when a level cannot drop at least 10% of the triangles (e.g. mostly seams or borders).
+inline std::vector<MeshLod> buildLodChain(const std::vector<Vertex> &vertices, std::vector<unsigned int> &indices, unsigned int maxLods = 5, size_t minTriangles = 64)
+{
+    std::vector<MeshLod> lods;
+    lods.push_back({ 0, static_cast<uint32_t>(indices.size()), 0.0f });
+
+    std::vector<unsigned int> current(indices);
+    float error = 0.0f;
+    while(lods.size() < maxLods)
+    {
+        size_t target = (current.size() / 3 / 2) * 3;
+        if(target < minTriangles * 3)
+            break;
+        float levelError;
+        std::vector<unsigned int> next = simplifyMesh(vertices, current, target, FLT_MAX, levelError);
+        if(next.size() * 10 > current.size() * 9)
+            break;
+
+        next = optimizeVertexCache(next, vertices.size());
+        // levels are simplified from the previous one, so their errors add up
+        error += levelError;
+        lods.push_back({ static_cast<uint32_t>(indices.size()), static_cast<uint32_t>(next.size()), error });
+        indices.insert(indices.end(), next.begin(), next.end());
+        current = std::move(next);
+    }
+    return lods;
+}
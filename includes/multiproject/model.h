@@ -8,93 +8,162 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+#include "camera.h"
 #include "mesh.h"
+#include "indirectdraw.h"
+#include "renderqueue.h"
+#include "meshcache.h"
+#include "meshoptimize.h"
+#include "meshsimplify.h"
+#include "texturecache.h"
 #include "shader.h"
 #include "filesystem.h"
+#include "threadpool.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <map>
+#include <unordered_map>
 #include <vector>
 
+struct ModelLoadOptions
+{
+    // read meshes from (and write them to) the binary cache next to the source file
+    bool useMeshCache = true;
+    // decode all texture images on the shared thread pool before uploading them
+    bool parallelTextureDecode = true;
+    // when set, textures are streamed in by this streamer over the next frames instead of uploaded during the load
+    TextureStreamer *textureStreamer = nullptr;
+    // load <texture>.ktx2 instead of the referenced image when the converter produced one
+    bool preferCompressedTextures = true;
+    // GPU vertex layout; Quantized halves vertex memory and needs shaders built with QUANTIZED_VERTICES
+    VertexFormat vertexFormat = VertexFormat::Float;
+    // weld vertices and reorder triangles/vertices for the post-transform cache, overdraw and fetch (see meshoptimize.h)
+    bool optimizeMeshes = true;
+    // simplify every mesh into a chain of up to maxLods levels (see meshsimplify.h), picked per frame by Model::SelectLod;
+    // welds the vertices first, also without optimizeMeshes
+    bool generateLods = true;
+    unsigned int maxLods = 5;
+    // put the meshes into the shared GeometryArena so they can be drawn through an IndirectDrawList
+    bool useGeometryArena = false;
+    // keep the vertices and indices of every mesh in memory after the upload (Mesh::vertices/indices), also when loaded from the mesh cache
+    bool keepMeshData = true;
+};
+
 class Model
 {
     public:
-        Model(const char *path, unsigned int instancing = 1, std::vector<glm::mat4> instanceMatrix = {})
+        static const unsigned int importFlags = aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace;
+
+        // load statistics of the last loadModel call
+        bool loadedFromCache = false;
+        MeshOptimizationStats optimization; // only filled by an Assimp import with optimizeMeshes
+        double loadMilliseconds = 0.0;
+        double textureMilliseconds = 0.0;
+
+        Model(const char *path, unsigned int instancing = 1, std::vector<glm::mat4> instanceMatrix = {}, ModelLoadOptions options = {})
         {
-			setupInstancing(instancing, instanceMatrix);
+            this->options = options;
+			setupInstancing(instancing, std::move(instanceMatrix));
             loadModel(path);
         }
+
+        // textures are shared through the TextureCache, which this model holds references into;
+        // a moved-from model holds none
+        Model(const Model&) = delete;
+        Model& operator=(const Model&) = delete;
+        Model(Model&&) = default;
+        Model& operator=(Model&&) = delete;
+
+        ~Model()
+        {
+            for (Texture *texture : textures_loaded)
+                TextureCache::Instance().Release(texture);
+        }
+
         void Draw(Shader &shader)
         {
             for (unsigned int i = 0; i < meshes.size(); i++)
                 meshes[i].Draw(shader);
         }
-    private:
-        // model data
-        std::vector<Mesh> meshes;
-        std::string directory;
-        std::vector<Texture> textures_loaded;
-
-        //instancing data
-        unsigned int instancing, instanceVBO;
-		std::vector<glm::mat4> instanceMatrix;
 
-        void loadModel(std::string path)
+        // Queues every mesh for a glMultiDrawElementsIndirect submission (needs useGeometryArena)
+        void Draw(IndirectDrawList &drawList, const glm::mat4 &model)
         {
-            Assimp::Importer importer;
-            const aiScene *scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
-            // check for errors
-            if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
-            {
-                std::cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << std::endl;
-                return;
-            }
-            // retrieve the directory path of the filepath
-            directory = path.substr(0, path.find_last_of(PATH_SEP));
+            for (Mesh &mesh : meshes)
+                drawList.Add(mesh, model);
+        }
 
-            // process ASSIMP's root node recursively
-            processNode(scene->mRootNode, scene);
+        // Queues every mesh into a pass of a RenderQueue, drawn sorted by state and depth
+        void Draw(RenderQueue &queue, unsigned int pass, Shader &shader, const glm::mat4 &model, bool translucent = false)
+        {
+            for (Mesh &mesh : meshes)
+                queue.Add(pass, shader, mesh, model, translucent);
         }
 
-        void setupInstancing(unsigned int instancing, std::vector<glm::mat4> instanceMatrices)
+        // Picks for every mesh the coarsest LOD whose simplification error projects to at most pixelError pixels
+        // from the camera; model is the world transform (a representative one for instanced models).
+        // Returns the number of triangles the next Draw submits per instance.
+        size_t SelectLod(const Camera &camera, const glm::mat4 &model, float viewportHeight, float pixelError = 1.0f)
         {
-			this->instancing = instancing;
-			this->instanceMatrix = instanceMatrices;
+            float maxScale = std::sqrt(std::max({ glm::dot(glm::vec3(model[0]), glm::vec3(model[0])),
+                                                  glm::dot(glm::vec3(model[1]), glm::vec3(model[1])),
+                                                  glm::dot(glm::vec3(model[2]), glm::vec3(model[2])) }));
+            // pixels per world unit at distance 1
+            float projection = viewportHeight / (2.0f * std::tan(glm::radians(camera.Zoom) * 0.5f));
 
-            if(instancing != 1)
+            size_t triangles = 0;
+            for (Mesh &mesh : meshes)
             {
-                glGenBuffers(1, &instanceVBO);
-                glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-                glBufferData(GL_ARRAY_BUFFER, instanceMatrix.size() * sizeof(glm::mat4), &instanceMatrix[0], GL_STATIC_DRAW);
+                glm::vec3 center = glm::vec3(model * glm::vec4(mesh.boundsCenter, 1.0f));
+                float distance = glm::length(center - camera.Position) - mesh.boundsRadius * maxScale;
+                unsigned int lod = 0;
+                if (distance > 0.0f)
+                    while (lod + 1 < mesh.lods.size() && mesh.lods[lod + 1].error * maxScale * projection / distance <= pixelError)
+                        lod++;
+                mesh.currentLod = lod;
+                triangles += mesh.lods[lod].indexCount / 3;
             }
-		}
+            return triangles;
+        }
 
-        void processNode(aiNode *node, const aiScene *scene)
+        // triangles of the currently selected LODs (full detail before SelectLod is called)
+        size_t TriangleCount() const
         {
+            size_t triangles = 0;
+            for (const Mesh &mesh : meshes)
+                triangles += mesh.lods[mesh.currentLod].indexCount / 3;
+            return triangles;
+        }
 
-            for (unsigned int i = 0; i < node->mNumMeshes; i++)
-            {
-                // the node object only contains indices to index the actual objects in the scene.
-                // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
-                aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-                meshes.push_back(processMesh(mesh, scene));
-            }
-            // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
-            for (unsigned int i = 0; i < node->mNumChildren; i++)
-            {
-                processNode(node->mChildren[i], scene);
-            }
+        std::vector<Mesh>& Meshes()
+        {
+            return meshes;
         }
 
-        Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+        // instances drawn by Draw (1 when not instanced)
+        unsigned int InstanceCount() const
         {
-            std::vector<Vertex> vertices;
-            std::vector<unsigned int> indices;
-            std::vector<Texture> textures;
+            return instancing;
+        }
+
+        // per instance model matrices, 0 when not instanced
+        GLuint InstanceBuffer() const
+        {
+            return instanceVBO;
+        }
 
+        // Vertices and indices of an imported mesh as Assimp delivers them, before optimization; needs no GL context
+        static void ReadMesh(const aiMesh *mesh, std::vector<Vertex> &vertices, std::vector<unsigned int> &indices)
+        {
+            vertices.clear();
+            indices.clear();
             for (unsigned int i = 0; i < mesh->mNumVertices; i++)
             {
                 Vertex vertex;
@@ -130,48 +199,301 @@ class Model
                 for (unsigned int j = 0; j < face.mNumIndices; j++)
                     indices.push_back(face.mIndices[j]);
             }
+        }
+
+        // GPU vertex buffer size of all meshes
+        size_t VertexBytes() const
+        {
+            size_t bytes = 0;
+            for (const Mesh &mesh : meshes)
+                bytes += mesh.vertexBytes;
+            return bytes;
+        }
+    private:
+        // model data
+        std::vector<Mesh> meshes;
+        std::string directory;
+        std::vector<Texture*> textures_loaded;
+        std::unordered_map<std::string, Texture*> textures_by_path;
+        ModelLoadOptions options;
+
+        // texture references per mesh, kept to write the mesh cache
+        std::vector<std::vector<MeshCacheTexture>> meshTextures;
+
+        //instancing data
+        unsigned int instancing;
+        BufferHandle instanceVBO;
+		std::vector<glm::mat4> instanceMatrix;
+
+        void loadModel(std::string path)
+        {
+            auto start = std::chrono::steady_clock::now();
+            textureMilliseconds = 0.0;
+            // retrieve the directory path of the filepath
+            directory = path.substr(0, path.find_last_of(PATH_SEP));
+
+            loadedFromCache = options.useMeshCache && loadFromCache(path);
+            if (!loadedFromCache)
+            {
+                Assimp::Importer importer;
+                const aiScene *scene = importer.ReadFile(path, importFlags);
+                // check for errors
+                if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+                {
+                    std::cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << std::endl;
+                    return;
+                }
+
+                std::vector<MeshCacheTexture> references;
+                for (unsigned int i = 0; i < scene->mNumMeshes; i++)
+                {
+                    if (scene->mMeshes[i]->mMaterialIndex >= scene->mNumMaterials)
+                        continue;
+                    aiMaterial *material = scene->mMaterials[scene->mMeshes[i]->mMaterialIndex];
+                    collectMaterialTextures(material, aiTextureType_DIFFUSE, "diffuse", references);
+                    collectMaterialTextures(material, aiTextureType_SPECULAR, "specular", references);
+                }
+                preloadTextures(references);
+
+                // process ASSIMP's root node recursively
+                processNode(scene->mRootNode, scene);
+
+                if (options.useMeshCache)
+                    writeCache(path);
+                if (options.optimizeMeshes)
+                    std::cout << "Model " << path << " optimized: " << optimization.before.vertices << " -> " << optimization.after.vertices << " vertices, ACMR "
+                              << optimization.before.ACMR() << " -> " << optimization.after.ACMR() << ", ATVR "
+                              << optimization.before.ATVR() << " -> " << optimization.after.ATVR() << std::endl;
+                if (options.generateLods)
+                    printLods(path);
+            }
+            if (!options.keepMeshData)
+                for (Mesh &mesh : meshes)
+                    mesh.ReleaseMeshData();
+
+            loadMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "Model " << path << " loaded from " << (loadedFromCache ? "mesh cache" : "Assimp") << " in " << loadMilliseconds << " ms"
+                      << " (textures " << textureMilliseconds << " ms, " << (options.parallelTextureDecode ? "parallel" : "serial") << " decode)" << std::endl;
+        }
+
+        // cached meshes are only valid for the same post-import processing
+        unsigned int processFlags() const
+        {
+            unsigned int flags = options.optimizeMeshes ? 1u : 0u;
+            if (options.generateLods)
+                flags |= 2u | (options.maxLods << 8);
+            return flags;
+        }
+
+        void printLods(const std::string &path) const
+        {
+            std::vector<size_t> triangles;
+            for (const Mesh &mesh : meshes)
+                for (size_t i = 0; i < mesh.lods.size(); i++)
+                {
+                    if (triangles.size() <= i)
+                        triangles.push_back(0);
+                    triangles[i] += mesh.lods[i].indexCount / 3;
+                }
+            std::cout << "Model " << path << " LOD triangles:";
+            for (size_t count : triangles)
+                std::cout << " " << count;
+            std::cout << std::endl;
+        }
+
+        bool loadFromCache(const std::string &path)
+        {
+            MeshCache cache;
+            if (!cache.Open(path, importFlags, processFlags()))
+                return false;
+
+            std::vector<MeshCacheTexture> references;
+            for (const MeshCacheView &cached : cache.GetMeshes())
+                references.insert(references.end(), cached.textures.begin(), cached.textures.end());
+            preloadTextures(references);
+
+            for (const MeshCacheView &cached : cache.GetMeshes())
+            {
+                std::vector<Texture*> textures;
+                for (const MeshCacheTexture &reference : cached.textures)
+                    textures.push_back(loadTexture(reference.path, reference.type));
+                // the mapped file goes away with the cache, so kept mesh data is copied out of it
+                if (options.keepMeshData)
+                    meshes.emplace_back(std::vector<Vertex>(cached.vertices, cached.vertices + cached.vertexCount), std::vector<unsigned int>(cached.indices, cached.indices + cached.indexCount),
+                                        std::move(textures), instancing, instanceVBO, options.vertexFormat, cached.lods, options.useGeometryArena);
+                else
+                    meshes.emplace_back(cached.vertices, cached.vertexCount, cached.indices, cached.indexCount, std::move(textures), instancing, instanceVBO, options.vertexFormat, cached.lods, options.useGeometryArena);
+            }
+            return true;
+        }
+
+        void writeCache(const std::string &path)
+        {
+            std::vector<MeshCacheView> views;
+            for (unsigned int i = 0; i < meshes.size(); i++)
+            {
+                MeshCacheView view;
+                view.vertices = meshes[i].vertices.data();
+                view.vertexCount = static_cast<uint32_t>(meshes[i].vertices.size());
+                view.indices = meshes[i].indices.data();
+                view.indexCount = static_cast<uint32_t>(meshes[i].indices.size());
+                view.lods = meshes[i].lods;
+                view.textures = meshTextures[i];
+                views.push_back(view);
+            }
+            MeshCache::Write(path, importFlags, views, processFlags());
+            meshTextures.clear();
+        }
+
+        void setupInstancing(unsigned int instancing, std::vector<glm::mat4> instanceMatrices)
+        {
+			this->instancing = instancing;
+			this->instanceMatrix = std::move(instanceMatrices);
+
+            if(instancing != 1)
+            {
+                glGenBuffers(1, instanceVBO.Replace());
+                glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+                glBufferData(GL_ARRAY_BUFFER, instanceMatrix.size() * sizeof(glm::mat4), &instanceMatrix[0], GL_STATIC_DRAW);
+            }
+		}
+
+        void processNode(aiNode *node, const aiScene *scene)
+        {
+
+            for (unsigned int i = 0; i < node->mNumMeshes; i++)
+            {
+                // the node object only contains indices to index the actual objects in the scene.
+                // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
+                aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
+                meshes.push_back(processMesh(mesh, scene));
+            }
+            // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
+            for (unsigned int i = 0; i < node->mNumChildren; i++)
+            {
+                processNode(node->mChildren[i], scene);
+            }
+        }
+
+        Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+        {
+            std::vector<Vertex> vertices;
+            std::vector<unsigned int> indices;
+            std::vector<Texture*> textures;
+            ReadMesh(mesh, vertices, indices);
+
+            if (options.optimizeMeshes)
+                optimization += optimizeMesh(vertices, indices);
+            else if (options.generateLods)
+                weldVertices(vertices, indices); // Assimp's unwelded corners would all be locked as seams by simplifyMesh
+            // LOD levels are appended to indices, so this comes after the reordering above
+            std::vector<MeshLod> lods;
+            if (options.generateLods)
+                lods = buildLodChain(vertices, indices, options.maxLods);
 
             // process material
-            if (mesh->mMaterialIndex >= 0)
+            meshTextures.emplace_back();
+            if (mesh->mMaterialIndex < scene->mNumMaterials)
             {
                 aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
-                std::vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "diffuse");
+                std::vector<Texture*> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "diffuse");
                 textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
-                std::vector<Texture> specularMaps = loadMaterialTextures(material,
+                std::vector<Texture*> specularMaps = loadMaterialTextures(material,
                                                                     aiTextureType_SPECULAR, "specular");
                 textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
             }
 
-            return Mesh(vertices, indices, textures, instancing, instanceVBO);
+            return Mesh(std::move(vertices), std::move(indices), std::move(textures), instancing, instanceVBO, options.vertexFormat, std::move(lods), options.useGeometryArena);
         }
 
-        std::vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, std::string typeName)
+        std::vector<Texture*> loadMaterialTextures(aiMaterial *mat, aiTextureType type, std::string typeName)
         {
-            std::vector<Texture> textures;
+            std::vector<Texture*> textures;
             for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
             {
                 aiString str;
                 mat->GetTexture(type, i, &str);
-                bool skip = false;
-                for (unsigned int j = 0; j < textures_loaded.size(); j++)
+                textures.push_back(loadTexture(std::string(str.C_Str()), typeName));
+                meshTextures.back().push_back({ typeName, std::string(str.C_Str()) });
+            }
+            return textures;
+        }
+
+        void collectMaterialTextures(aiMaterial *mat, aiTextureType type, const std::string &typeName, std::vector<MeshCacheTexture> &references)
+        {
+            for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
+            {
+                aiString str;
+                mat->GetTexture(type, i, &str);
+                references.push_back({ typeName, std::string(str.C_Str()) });
+            }
+        }
+
+        // Takes the textures already in the TextureCache, decodes the rest (in parallel when enabled)
+        // and then uploads them in one go on this thread; adds its time to textureMilliseconds
+        void preloadTextures(const std::vector<MeshCacheTexture> &references)
+        {
+            auto start = std::chrono::steady_clock::now();
+            TextureCache &cache = TextureCache::Instance();
+
+            // pending[i].path is the file actually decoded, keys[i] the path the meshes refer to
+            std::vector<MeshCacheTexture> pending;
+            std::vector<std::string> keys;
+            for (const MeshCacheTexture &reference : references)
+            {
+                std::string path = directory + PATH_SEP + reference.path;
+                if (textures_by_path.count(path))
+                    continue;
+                std::string loadPath = path;
+                if (options.preferCompressedTextures)
                 {
-					std::string temptativePath = directory + PATH_SEP + std::string(str.C_Str());
-                    if (std::strcmp(textures_loaded[j].path.data(), temptativePath.c_str()) == 0)
-                    {
-                        textures.push_back(textures_loaded[j]);
-                        skip = true;
-                        break;
-                    }
+                    std::string compressed = path.substr(0, path.find_last_of('.')) + ".ktx2";
+                    if (std::filesystem::exists(compressed))
+                        loadPath = compressed;
                 }
-                if (!skip)
-                { // if texture hasn't been loaded already, load it
-                    std::string path = std::string(str.C_Str());
-                    path = directory + PATH_SEP + path;
-                    Texture texture(path.c_str(), typeName, GL_TEXTURE0 + textures_loaded.size());
-                    textures.push_back(texture);
-                    textures_loaded.push_back(texture); // add to loaded textures
+                Texture *cached = cache.Acquire(loadPath);
+                textures_by_path[path] = cached;
+                if (cached != nullptr)
+                    textures_loaded.push_back(cached);
+                else
+                {
+                    pending.push_back({ reference.type, loadPath });
+                    keys.push_back(path);
                 }
             }
-            return textures;
+
+            std::vector<ImageData> images(pending.size());
+            std::vector<uint64_t> contentHashes(pending.size(), 0);
+            bool hashContent = cache.contentDeduplication;
+            auto decode = [&](size_t i) {
+                images[i] = ImageData::Decode(pending[i].path.c_str());
+                if (hashContent)
+                    contentHashes[i] = TextureCache::HashImage(images[i]);
+            };
+            if (options.parallelTextureDecode)
+                ThreadPool::Shared().ParallelFor(pending.size(), decode);
+            else
+                for (size_t i = 0; i < pending.size(); i++)
+                    decode(i);
+
+            for (size_t i = 0; i < pending.size(); i++)
+            {
+                Texture *texture = cache.Add(pending[i].path, std::move(images[i]), contentHashes[i], pending[i].type, GL_TEXTURE0 + textures_loaded.size(), options.textureStreamer);
+                textures_by_path[keys[i]] = texture;
+                textures_loaded.push_back(texture);
+            }
+
+            textureMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        Texture* loadTexture(const std::string &relativePath, const std::string &typeName)
+        {
+            std::string path = directory + PATH_SEP + relativePath;
+            auto found = textures_by_path.find(path);
+            if (found != textures_by_path.end())
+                return found->second;
+            // not announced to preloadTextures, load it on its own
+            preloadTextures({ { typeName, relativePath } });
+            return textures_by_path[path];
         }
 };
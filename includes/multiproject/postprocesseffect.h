@@ -2,6 +2,7 @@
 
 #include <glad/gl.h>
 
+#include "glstate.h"
 #include "shader.h"
 
 #include <iostream>
@@ -25,6 +26,7 @@ public:
 	unsigned int RBO;
 	unsigned int intermediateFBO;
 	unsigned int screenTexture;
+	unsigned int depthTexture; // single sampled copy of the depth buffer, filled by ResolveDepth
 	unsigned int width, height;
 
     PostProcessEffect(const unsigned int screenWidth, const unsigned int screenHeight)
@@ -43,7 +45,7 @@ public:
 		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
 
 		glGenFramebuffers(1, &framebuffer);
-		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		GLState::Instance().BindFramebuffer(GL_FRAMEBUFFER, framebuffer);
 
 		glGenTextures(1, &textureColorBuffer);
 		glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, textureColorBuffer);
@@ -58,10 +60,10 @@ public:
 
 		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
 			std::cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << std::endl;
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		GLState::Instance().BindFramebuffer(GL_FRAMEBUFFER, 0);
 
     	glGenFramebuffers(1, &intermediateFBO);
-    	glBindFramebuffer(GL_FRAMEBUFFER, intermediateFBO);
+    	GLState::Instance().BindFramebuffer(GL_FRAMEBUFFER, intermediateFBO);
 
     	glGenTextures(1, &screenTexture);
     	glBindTexture(GL_TEXTURE_2D, screenTexture);
@@ -73,26 +75,43 @@ public:
 		glBindTexture(GL_TEXTURE_2D, 0);
     	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, screenTexture, 0);
 
+		glGenTextures(1, &depthTexture);
+		glBindTexture(GL_TEXTURE_2D, depthTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, width, height, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+
 	   	 if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
     	    std::cout << "ERROR::FRAMEBUFFER:: Intermediate framebuffer is not complete!" << std::endl;
-    	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    	GLState::Instance().BindFramebuffer(GL_FRAMEBUFFER, 0);
     }
 
 	void Bind()
 	{
-		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		GLState::Instance().BindFramebuffer(GL_FRAMEBUFFER, framebuffer);
 	}
 
 	void Blit()
 	{
-		glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, intermediateFBO);
+		GLState::Instance().BindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+		GLState::Instance().BindFramebuffer(GL_DRAW_FRAMEBUFFER, intermediateFBO);
 		glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
 	}
 
+	// Copies the multisampled depth into depthTexture (one sample per pixel) and rebinds the framebuffer
+	void ResolveDepth()
+	{
+		GLState::Instance().BindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+		GLState::Instance().BindFramebuffer(GL_DRAW_FRAMEBUFFER, intermediateFBO);
+		glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+		GLState::Instance().BindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	}
+
 	void Unbind()
 	{
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		GLState::Instance().BindFramebuffer(GL_FRAMEBUFFER, 0);
 	}
 
 	void Render(Shader &shader)
@@ -100,8 +119,7 @@ public:
 		shader.Activate();
 		shader.setInt("screenTexture", 0);
 		glBindVertexArray(quadVAO);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, screenTexture);
+		GLState::Instance().BindTexture(0, screenTexture);
 		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 		glBindVertexArray(0);
 	}
@@ -116,11 +134,13 @@ public:
 		glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
 
 		glBindRenderbuffer(GL_RENDERBUFFER, RBO);
-		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+		glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_DEPTH24_STENCIL8, width, height);
 		glBindRenderbuffer(GL_RENDERBUFFER, 0);
 
 		glBindTexture(GL_TEXTURE_2D, screenTexture);
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, NULL);
+		glBindTexture(GL_TEXTURE_2D, depthTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, width, height, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
 		glBindTexture(GL_TEXTURE_2D, 0);
 	}
 };
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+    #include <psapi.h>
+    #ifdef _MSC_VER
+        #pragma comment(lib, "psapi.lib")
+    #endif
+#else
+    #include <sys/resource.h>
+    #include <fstream>
+    #include <string>
+    #ifdef __GLIBC__
+        #include <malloc.h>
+    #endif
+#endif
+
+// Resident memory of this process, for load time measurements
+namespace ProcessMemory
+{
+#if defined(__linux__)
+    // "<key> <n> kB" line of /proc/self/status, in bytes
+    inline size_t readStatusBytes(const std::string &wanted)
+    {
+        std::ifstream status("/proc/self/status");
+        std::string key;
+        while(status >> key)
+        {
+            if(key == wanted)
+            {
+                size_t kilobytes = 0;
+                status >> kilobytes;
+                return kilobytes * 1024;
+            }
+            status.ignore(256, '\n');
+        }
+        return 0;
+    }
+#endif
+
+    // High-water mark of the resident set since start (or the last ResetPeak)
+    inline size_t PeakResidentBytes()
+    {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS counters;
+        if(!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+            return 0;
+        return counters.PeakWorkingSetSize;
+#elif defined(__linux__)
+        // VmHWM, unlike getrusage, follows ResetPeak
+        return readStatusBytes("VmHWM:");
+#else
+        struct rusage usage;
+        if(getrusage(RUSAGE_SELF, &usage) != 0)
+            return 0;
+        return static_cast<size_t>(usage.ru_maxrss); // bytes on macOS
+#endif
+    }
+
+    inline size_t CurrentResidentBytes()
+    {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS counters;
+        if(!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+            return 0;
+        return counters.WorkingSetSize;
+#elif defined(__linux__)
+        return readStatusBytes("VmRSS:");
+#else
+        return PeakResidentBytes();
+#endif
+    }
+
+    // Returns freed heap pages to the system, so CurrentResidentBytes drops after large frees. glibc otherwise keeps
+    // them mapped and the resident size does not show what a load released.
+    inline void ReleaseFreeHeap()
+    {
+#ifdef __GLIBC__
+        malloc_trim(0);
+#endif
+    }
+
+    // Restarts the high-water mark at the current resident size. Needs Linux with /proc/self/clear_refs; returns
+    // false where the peak cannot be reset, in which case peaks only grow over the process lifetime.
+    inline bool ResetPeak()
+    {
+#if defined(__linux__)
+        size_t before = PeakResidentBytes();
+        {
+            std::ofstream clearRefs("/proc/self/clear_refs");
+            clearRefs << "5";
+        }
+        return PeakResidentBytes() < before || before <= CurrentResidentBytes();
+#else
+        return false;
+#endif
+    }
+}
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <glad/gl.h>
+
+#include "hash.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+// On disk cache of linked programs (glGetProgramBinary), one file per program under shadercache/.
+// Entries are keyed by the stage sources, the program defines and the driver vendor/renderer/version,
+// so a driver update or any source change simply misses. Binaries the driver rejects are recompiled.
+class ProgramBinaryCache
+{
+public:
+    struct Stats
+    {
+        unsigned int hits = 0;
+        unsigned int misses = 0;
+        unsigned int rejected = 0; // binaries found on disk but refused by glProgramBinary
+    };
+
+    bool enabled = true;
+    std::string directory = "shadercache";
+
+    static ProgramBinaryCache& Instance()
+    {
+        static ProgramBinaryCache cache;
+        return cache;
+    }
+
+    static uint64_t Key(const std::vector<std::string> &sources, const std::string &defines)
+    {
+        uint64_t hash = hashBytes(defines.data(), defines.size());
+        for(const std::string &source : sources)
+        {
+            uint64_t length = source.size();
+            hash = hashBytes(&length, sizeof(length), hash);
+            hash = hashBytes(source.data(), source.size(), hash);
+        }
+        const std::string &driver = driverString();
+        return hashBytes(driver.data(), driver.size(), hash);
+    }
+
+    // Loads the cached binary into program; false when missing or rejected (the program must then be built from source)
+    bool Load(GLuint program, uint64_t key)
+    {
+        if(!available())
+            return false;
+
+        std::ifstream file(path(key), std::ios::binary);
+        if(!file)
+        {
+            stats.misses++;
+            return false;
+        }
+        FileHeader header;
+        file.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if(!file || header.magic != MAGIC || header.key != key)
+        {
+            stats.misses++;
+            return false;
+        }
+        // a truncated or corrupt entry must not size the allocation
+        std::error_code error;
+        uintmax_t fileSize = std::filesystem::file_size(path(key), error);
+        if(error || header.length == 0 || header.length > fileSize - sizeof(header))
+        {
+            stats.misses++;
+            return false;
+        }
+        std::vector<char> binary(header.length);
+        file.read(binary.data(), binary.size());
+        if(!file)
+        {
+            stats.misses++;
+            return false;
+        }
+
+        glProgramBinary(program, header.format, binary.data(), static_cast<GLsizei>(binary.size()));
+        GLint success = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if(!success)
+        {
+            stats.rejected++;
+            stats.misses++;
+            return false;
+        }
+        stats.hits++;
+        return true;
+    }
+
+    // Call before linking a program that will be stored
+    void PrepareForLink(GLuint program)
+    {
+        if(available())
+            glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    void Store(GLuint program, uint64_t key)
+    {
+        if(!available())
+            return;
+
+        GLint success = GL_FALSE, length = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if(!success || length <= 0)
+            return;
+
+        FileHeader header;
+        header.magic = MAGIC;
+        header.key = key;
+        std::vector<char> binary(length);
+        glGetProgramBinary(program, length, nullptr, &header.format, binary.data());
+        header.length = static_cast<uint32_t>(length);
+
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        // written next to the entry and renamed over it, so a crash or a second process never leaves a torn binary
+        std::string cachePath = path(key);
+        std::string tempPath = cachePath + ".tmp";
+        {
+            std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+            if(!file)
+            {
+                std::cerr << "ERROR::PROGRAMBINARYCACHE:: Could not write " << tempPath << std::endl;
+                return;
+            }
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(binary.data(), binary.size());
+            if(!file)
+            {
+                file.close();
+                std::filesystem::remove(tempPath, error);
+                return;
+            }
+        }
+
+        std::filesystem::rename(tempPath, cachePath, error);
+        if(error)
+        {
+            std::cerr << "ERROR::PROGRAMBINARYCACHE:: Could not replace " << cachePath << ": " << error.message() << std::endl;
+            std::filesystem::remove(tempPath, error);
+        }
+    }
+
+    const Stats& GetStats() const
+    {
+        return stats;
+    }
+
+    float HitRate() const
+    {
+        unsigned int lookups = stats.hits + stats.misses;
+        return lookups == 0 ? 0.0f : float(stats.hits) / float(lookups);
+    }
+
+private:
+    static const uint32_t MAGIC = 0x4D504250; // "MPBP"
+
+    struct FileHeader
+    {
+        uint32_t magic;
+        GLenum format;
+        uint64_t key;
+        uint32_t length;
+        uint32_t reserved = 0;
+    };
+
+    Stats stats;
+
+    ProgramBinaryCache() = default;
+
+    bool available() const
+    {
+        if(!enabled)
+            return false;
+        static GLint formats = -1;
+        if(formats < 0)
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        return formats > 0;
+    }
+
+    std::string path(uint64_t key) const
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(key));
+        return (std::filesystem::path(directory) / name).string();
+    }
+
+    static const std::string& driverString()
+    {
+        static std::string driver = std::string(reinterpret_cast<const char*>(glGetString(GL_VENDOR))) + "|"
+                                  + reinterpret_cast<const char*>(glGetString(GL_RENDERER)) + "|"
+                                  + reinterpret_cast<const char*>(glGetString(GL_VERSION));
+        return driver;
+    }
+};
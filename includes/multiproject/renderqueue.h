@@ -0,0 +1,220 @@
+#pragma once
+
+#include <glad/gl.h>
+
+#include <glm/glm.hpp>
+
+#include "glstate.h"
+#include "hash.h"
+#include "mesh.h"
+#include "shader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Per frame queue of mesh draws. Every draw gets a 64 bit key, most significant bits first:
+//   opaque       pass 4 | 0 | program 10 | material 14 | vertex array 11 | depth 24    (state, then front to back)
+//   translucent  pass 4 | 1 | inverted depth 24 | program 10 | material 14 | vertex array 11    (back to front)
+// Keys are radix sorted and Execute walks them changing the program, textures and vertex array only when they differ
+// from the previous draw. Program, material and vertex array ids are small numbers handed out on first use; past
+// their field width they wrap, which only makes the sort less effective.
+class RenderQueue
+{
+    public:
+        struct Stats
+        {
+            unsigned int draws = 0;
+            unsigned int programBinds = 0;    // glUseProgram
+            unsigned int materialChanges = 0;
+            unsigned int textureBinds = 0;    // texture unit binds, after GLState skipped the ones already in place
+            unsigned int vertexArrayBinds = 0;
+        };
+
+        static const unsigned int MaxPasses = 16;
+
+        // Starts a frame: drops the queued draws and the bind counts. Depth is the distance from viewPosition to the
+        // mesh's bounding sphere center, quantized over [0, farDistance].
+        void Begin(const glm::vec3 &viewPosition, float farDistance)
+        {
+            this->viewPosition = viewPosition;
+            this->farDistance = farDistance;
+            items.clear();
+            entries.clear();
+            sorted = true;
+            stats = Stats();
+        }
+
+        // Queues mesh at its current LOD; pass is a caller defined number below MaxPasses, drawn by Execute(pass)
+        void Add(unsigned int pass, Shader &shader, Mesh &mesh, const glm::mat4 &model, bool translucent = false)
+        {
+            glm::vec3 center = glm::vec3(model * glm::vec4(mesh.boundsCenter, 1.0f));
+            float depth = glm::clamp(glm::length(center - viewPosition) / farDistance, 0.0f, 1.0f);
+            uint64_t depthBits = static_cast<uint64_t>(depth * float(DepthMask));
+            uint64_t state = (uint64_t(programId(shader) & ProgramMask) << 25) | (uint64_t(materialId(mesh) & MaterialMask) << 11) | (vertexArrayId(mesh) & VertexArrayMask);
+
+            uint64_t key = uint64_t(pass & (MaxPasses - 1)) << 60;
+            if (translucent)
+                key |= (uint64_t(1) << 59) | ((DepthMask - depthBits) << 35) | state;
+            else
+                key |= (state << 24) | depthBits;
+
+            entries.push_back({ key, static_cast<uint32_t>(items.size()) });
+            items.push_back({ &shader, &mesh, model });
+            sorted = false;
+        }
+
+        // Draws the queued draws of one pass in key order; the pass's uniforms other than model are set by the caller
+        void Execute(unsigned int pass)
+        {
+            if (!sorted)
+                Sort();
+
+            uint64_t passBits = uint64_t(pass & (MaxPasses - 1)) << 60;
+            auto first = std::lower_bound(entries.begin(), entries.end(), passBits, [](const Entry &entry, uint64_t key) { return entry.key < key; });
+
+            // state is tracked within one Execute, other code may change it between passes
+            Shader *program = nullptr;
+            const std::vector<Texture*> *material = nullptr;
+            GLuint vertexArray = 0;
+            for (auto entry = first; entry != entries.end() && (entry->key >> 60) == (passBits >> 60); ++entry)
+            {
+                Item &item = items[entry->item];
+                bool programChanged = item.shader != program;
+                if (programChanged)
+                {
+                    item.shader->Activate();
+                    program = item.shader;
+                    stats.programBinds++;
+                }
+                if (programChanged || material == nullptr || *material != item.mesh->textures)
+                {
+                    if (material == nullptr || *material != item.mesh->textures)
+                        stats.materialChanges++;
+                    bindTextures(*item.shader, *item.mesh);
+                    material = &item.mesh->textures;
+                }
+                GLuint meshVertexArray = item.mesh->VertexArray();
+                if (meshVertexArray != vertexArray)
+                {
+                    glBindVertexArray(meshVertexArray);
+                    vertexArray = meshVertexArray;
+                    stats.vertexArrayBinds++;
+                }
+                item.shader->setMat4("model", item.model);
+                item.mesh->DrawBound(*item.shader);
+                stats.draws++;
+            }
+            glBindVertexArray(0);
+        }
+
+        // LSD radix sort of the keys, 16 bits per pass; passes whose digit is the same for every key are skipped.
+        // Called by Execute when draws were added since the last sort.
+        void Sort()
+        {
+            sorted = true;
+            if (entries.empty())
+                return;
+            scratch.resize(entries.size());
+            histogram.resize(1 << 16);
+            for (int shift = 0; shift < 64; shift += 16)
+            {
+                std::fill(histogram.begin(), histogram.end(), 0u);
+                for (const Entry &entry : entries)
+                    histogram[(entry.key >> shift) & 0xFFFF]++;
+                if (histogram[(entries.front().key >> shift) & 0xFFFF] == entries.size())
+                    continue;
+                uint32_t offset = 0;
+                for (uint32_t &count : histogram)
+                {
+                    uint32_t next = offset + count;
+                    count = offset;
+                    offset = next;
+                }
+                for (const Entry &entry : entries)
+                    scratch[histogram[(entry.key >> shift) & 0xFFFF]++] = entry;
+                entries.swap(scratch);
+            }
+        }
+
+        size_t Size() const
+        {
+            return items.size();
+        }
+
+        // Counts since Begin, over every executed pass
+        const Stats& GetStats() const
+        {
+            return stats;
+        }
+
+    private:
+        static constexpr uint64_t DepthMask = (uint64_t(1) << 24) - 1;
+        static const uint32_t ProgramMask = (1u << 10) - 1;
+        static const uint32_t MaterialMask = (1u << 14) - 1;
+        static const uint32_t VertexArrayMask = (1u << 11) - 1;
+
+        struct Item
+        {
+            Shader *shader;
+            Mesh *mesh;
+            glm::mat4 model;
+        };
+
+        struct Entry
+        {
+            uint64_t key;
+            uint32_t item;
+        };
+
+        glm::vec3 viewPosition = glm::vec3(0.0f);
+        float farDistance = 1.0f;
+        std::vector<Item> items;
+        std::vector<Entry> entries, scratch;
+        std::vector<uint32_t> histogram;
+        bool sorted = true;
+        Stats stats;
+
+        // ids persist across frames so equal state keeps its place in the order
+        std::unordered_map<GLuint, uint32_t> programIds, vertexArrayIds;
+        std::unordered_map<uint64_t, uint32_t> materialIds;
+
+        uint32_t programId(const Shader &shader)
+        {
+            return programIds.emplace(static_cast<GLuint>(shader.ID), static_cast<uint32_t>(programIds.size())).first->second;
+        }
+
+        uint32_t vertexArrayId(const Mesh &mesh)
+        {
+            return vertexArrayIds.emplace(mesh.VertexArray(), static_cast<uint32_t>(vertexArrayIds.size())).first->second;
+        }
+
+        // materials are the texture lists of the meshes, identified by their GL textures
+        uint32_t materialId(const Mesh &mesh)
+        {
+            uint64_t hash = hashBytes(nullptr, 0);
+            for (const Texture *texture : mesh.textures)
+            {
+                GLuint id = texture->ID;
+                hash = hashBytes(&id, sizeof(id), hash);
+            }
+            return materialIds.emplace(hash, static_cast<uint32_t>(materialIds.size())).first->second;
+        }
+
+        // Mesh::BindTextures, counting the binds that reached GL
+        void bindTextures(Shader &shader, const Mesh &mesh)
+        {
+            const std::vector<UniformName> &uniforms = mesh.TextureUniforms();
+            GLuint unit = 0;
+            for (size_t i = 0; i < mesh.textures.size(); i++)
+            {
+                if (shader.Location(uniforms[i]) < 0)
+                    continue;
+                if (GLState::Instance().BindTexture(unit, mesh.textures[i]->DrawID()))
+                    stats.textureBinds++;
+                shader.setInt(uniforms[i], static_cast<GLint>(unit));
+                unit++;
+            }
+        }
+};
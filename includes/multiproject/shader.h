@@ -3,164 +3,367 @@
 #include <glad/gl.h>
 #include <glm/glm.hpp>
 
+#include "glhandle.h"
+#include "glstate.h"
+#include "programbinarycache.h"
+#include "uniform.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <set>
+#include <cstring>
 #include <string>
 #include <fstream>
+#include <initializer_list>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+#include <vector>
+
+// from GL_KHR_parallel_shader_compile, not part of the core profile header
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
 
 class Shader
 {
     public:
-        unsigned int ID;
-        Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
-        {
-            std::string vertexCode;
-            std::string fragmentCode;
-            std::string geometryCode;
-            std::ifstream vShaderFile;
-            std::ifstream fShaderFile;
-            std::ifstream gShaderFile;
-            vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-            fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-            gShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+        ProgramHandle ID; // deleted with the Shader; shaders are move-only
+        // Stage sources may #include "file" (resolved relative to the including file, each file once per stage).
+        // defines: block of #define lines injected right after each stage's #version line
+        Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr, const std::string &defines = "")
+        {
+            std::vector<std::string> sources;
+            sources.push_back(readStage(vertexPath, defines));
+            sources.push_back(readStage(fragmentPath, defines));
+            if(geometryPath != nullptr)
+                sources.push_back(readStage(geometryPath, defines));
 
-            try
+            build(sources, { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, GL_GEOMETRY_SHADER }, defines);
+        }
+
+        // Compute program from a single stage (e.g. instancecull.cs), dispatched with glDispatchCompute after Activate
+        static Shader Compute(const char* computePath, const std::string &defines = "")
+        {
+            Shader shader;
+            std::vector<std::string> sources;
+            sources.push_back(shader.readStage(computePath, defines));
+            shader.build(sources, { GL_COMPUTE_SHADER }, defines);
+            return shader;
+        }
+
+        // True once the driver has finished building the program (always true without GL_KHR_parallel_shader_compile)
+        bool Ready() const
+        {
+            if(!pending || !ParallelCompileSupported())
+                return true;
+            GLint completed = GL_FALSE;
+            glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &completed);
+            return completed == GL_TRUE;
+        }
+
+        // Waits for the build, reports compile/link errors, stores the binary and resolves uniforms; called on first use
+        void Finish() const
+        {
+            if(!pending)
+                return;
+            pending = false;
+
+            for(const PendingStage &stage : pendingStages)
+                checkCompileErrors(stage.shader, stage.type);
+            checkCompileErrors(ID, "PROGRAM");
+            for(const PendingStage &stage : pendingStages)
+                glDetachShader(ID, stage.shader);
+            pendingStages.clear();
+            ProgramBinaryCache::Instance().Store(ID, binaryKey);
+            resolveUniforms();
+        }
+
+        // glUseProgram through GLState, skipped when the program is already in use
+        void Activate()
+        {
+            Finish();
+            GLState::Instance().UseProgram(ID);
+        }
+
+        // Releases the program before the Shader goes away (e.g. ahead of the context)
+        void Delete()
+        {
+            pendingStages.clear();
+            pending = false;
+            ID.Reset();
+        }
+
+        static bool ParallelCompileSupported()
+        {
+            static int supported = -1;
+            if(supported < 0)
             {
-                vShaderFile.open(vertexPath);
-                fShaderFile.open(fragmentPath);
-                std::stringstream vShaderStream, fShaderStream;
-                vShaderStream << vShaderFile.rdbuf();
-                fShaderStream << fShaderFile.rdbuf();
-                vShaderFile.close();
-                fShaderFile.close();
-                vertexCode = vShaderStream.str();
-                fragmentCode = fShaderStream.str();
-
-                if(geometryPath != nullptr)
+                supported = 0;
+                GLint count = 0;
+                glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+                for(GLint i = 0; i < count; i++)
                 {
-                    gShaderFile.open(geometryPath);
-                    std::stringstream gShaderStream;
-                    gShaderStream << gShaderFile.rdbuf();
-                    gShaderFile.close();
-                    geometryCode = gShaderStream.str();
+                    const char *extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+                    if(std::strcmp(extension, "GL_KHR_parallel_shader_compile") == 0 || std::strcmp(extension, "GL_ARB_parallel_shader_compile") == 0)
+                        supported = 1;
                 }
             }
-            catch(std::ifstream::failure& e)
-            {
-                std::cerr << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ\n" << e.what() << '\n';
-            }
-
-            const char* vShaderCode = vertexCode.c_str();
-            const char* fShaderCode = fragmentCode.c_str();
+            return supported == 1;
+        }
 
-            unsigned int vertex, fragment;
+        // Location resolved after link, -1 when the uniform is not active
+        GLint Location(UniformName name) const
+        {
+            return location(name);
+        }
 
-            vertex = glCreateShader(GL_VERTEX_SHADER);
-            glShaderSource(vertex, 1, &vShaderCode, NULL);
-            glCompileShader(vertex);
-            checkCompileErrors(vertex, "VERTEX");
+        void setBool(UniformName name, bool value) const
+        {
+            glUniform1i(location(name), (int)value);
+        }
 
-            fragment = glCreateShader(GL_FRAGMENT_SHADER);
-            glShaderSource(fragment, 1, &fShaderCode, NULL);
-            glCompileShader(fragment);
-            checkCompileErrors(fragment, "FRAGMENT");
+        void setInt(UniformName name, int value) const
+        {
+            glUniform1i(location(name), value);
+        }
 
-            unsigned int geometry;
-            if(geometryPath != nullptr)
-            {
-                const char* gShaderCode = geometryCode.c_str();
-                geometry = glCreateShader(GL_GEOMETRY_SHADER);
-                glShaderSource(geometry, 1, &gShaderCode, NULL);
-                glCompileShader(geometry);
-                checkCompileErrors(geometry, "GEOMETRY");
-            }
+        void setFloat(UniformName name, float value) const
+        {
+            glUniform1f(location(name), value);
+        }
 
-            ID = glCreateProgram();
-            glAttachShader(ID, vertex);
-            glAttachShader(ID, fragment);
-            if(geometryPath != nullptr)
-                glAttachShader(ID, geometry);
-            glLinkProgram(ID);
-            checkCompileErrors(ID, "PROGRAM");
-            glDeleteShader(vertex);
-            glDeleteShader(fragment);
-            if(geometryPath != nullptr)
-                glDeleteShader(geometry);
+        void setVec2(UniformName name, const glm::vec2 &value) const
+        {
+            glUniform2fv(location(name), 1, &value[0]);
         }
 
-        void Activate()
+        void setVec2(UniformName name, float x, float y) const
         {
-            glUseProgram(ID);
+            glUniform2f(location(name), x, y);
         }
 
-        void Delete()
+        void setVec3(UniformName name, const glm::vec3 &value) const
         {
-            glDeleteProgram(ID);
+            glUniform3fv(location(name), 1, &value[0]);
         }
 
-        void setBool(const std::string &name, bool value) const
+        void setVec3(UniformName name, float x, float y, float z) const
         {
-            glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+            glUniform3f(location(name), x, y, z);
         }
 
-        void setInt(const std::string &name, int value) const
+        void setVec4(UniformName name, const glm::vec4 &value) const
         {
-            glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+            glUniform4fv(location(name), 1, &value[0]);
         }
 
-        void setFloat(const std::string &name, float value) const
+        void setVec4(UniformName name, float x, float y, float z, float w) const
         {
-            glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+            glUniform4f(location(name), x, y, z, w);
         }
 
-        void setVec2(const std::string &name, const glm::vec2 &value) const
+        void setMat2(UniformName name, const glm::mat2 &mat) const
         {
-            glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+            glUniformMatrix2fv(location(name), 1, GL_FALSE, &mat[0][0]);
         }
 
-        void setVec2(const std::string &name, float x, float y) const
+        void setMat3(UniformName name, const glm::mat3 &mat) const
         {
-            glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+            glUniformMatrix3fv(location(name), 1, GL_FALSE, &mat[0][0]);
         }
 
-        void setVec3(const std::string &name, const glm::vec3 &value) const
+        void setMat4(UniformName name, const glm::mat4 &mat) const
         {
-            glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+            glUniformMatrix4fv(location(name), 1, GL_FALSE, &mat[0][0]);
         }
 
-        void setVec3(const std::string &name, float x, float y, float z) const
+    private:
+        Shader() = default;
+
+        // stageTypes[i] is the type of sources[i]
+        void build(const std::vector<std::string> &sources, std::initializer_list<GLenum> stageTypes, const std::string &defines)
         {
-            glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+            ProgramBinaryCache &binaryCache = ProgramBinaryCache::Instance();
+            uint64_t key = ProgramBinaryCache::Key(sources, defines);
+
+            ID = ProgramHandle(glCreateProgram());
+            if(binaryCache.Load(ID, key))
+            {
+                resolveUniforms();
+                return;
+            }
+
+            // stages are compiled and linked without querying their status, so the driver can build several
+            // programs at once; errors are checked (and the binary stored) when the program is first used
+            const GLenum *stageType = stageTypes.begin();
+            for(size_t i = 0; i < sources.size(); i++, stageType++)
+            {
+                const char* code = sources[i].c_str();
+                GLuint stage = glCreateShader(*stageType);
+                glShaderSource(stage, 1, &code, NULL);
+                glCompileShader(stage);
+                glAttachShader(ID, stage);
+                pendingStages.push_back({ ShaderStageHandle(stage), stageName(*stageType) });
+            }
+            binaryCache.PrepareForLink(ID);
+            glLinkProgram(ID);
+            binaryKey = key;
+            pending = true;
         }
 
-        void setVec4(const std::string &name, const glm::vec4 &value) const
+        static const char* stageName(GLenum stageType)
         {
-            glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+            switch(stageType)
+            {
+                case GL_VERTEX_SHADER: return "VERTEX";
+                case GL_FRAGMENT_SHADER: return "FRAGMENT";
+                case GL_GEOMETRY_SHADER: return "GEOMETRY";
+                case GL_COMPUTE_SHADER: return "COMPUTE";
+                default: return "UNKNOWN";
+            }
         }
 
-        void setVec4(const std::string &name, float x, float y, float z, float w) const
+        struct PendingStage
+        {
+            ShaderStageHandle shader;
+            const char *type;
+        };
+
+        mutable std::unordered_map<uint64_t, GLint> uniformLocations;
+        mutable std::vector<PendingStage> pendingStages;
+        mutable bool pending = false;
+        uint64_t binaryKey = 0;
+
+        GLint location(UniformName name) const
         {
-            glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+            Finish();
+            UniformStats &stats = UniformStats::Global();
+            stats.lookups++;
+            auto it = uniformLocations.find(name.hash);
+            if(it == uniformLocations.end())
+            {
+                stats.misses++;
+                return -1;
+            }
+            return it->second;
         }
 
-        void setMat2(const std::string &name, const glm::mat2 &mat) const
+        // Queries every active uniform once; array elements are registered both as name[i] and, for [0], as name
+        void resolveUniforms() const
         {
-            glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+            UniformStats &stats = UniformStats::Global();
+            GLint count = 0, maxLength = 0;
+            glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+            glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+            std::vector<GLchar> buffer(maxLength + 16);
+            for(GLint i = 0; i < count; i++)
+            {
+                GLsizei length = 0;
+                GLint size = 0;
+                GLenum type;
+                glGetActiveUniform(ID, i, maxLength, &length, &size, &type, buffer.data());
+                std::string name(buffer.data(), length);
+
+                stats.locationQueries++;
+                GLint location = glGetUniformLocation(ID, name.c_str());
+                if(location < 0)
+                    continue; // uniform block member
+                uniformLocations[hashUniformName(name)] = location;
+
+                if(name.size() < 3 || name.compare(name.size() - 3, 3, "[0]") != 0)
+                    continue;
+                std::string base = name.substr(0, name.size() - 3);
+                uniformLocations[hashUniformName(base)] = location;
+                for(GLint element = 1; element < size; element++)
+                {
+                    std::string elementName = base + "[" + std::to_string(element) + "]";
+                    stats.locationQueries++;
+                    GLint elementLocation = glGetUniformLocation(ID, elementName.c_str());
+                    if(elementLocation >= 0)
+                        uniformLocations[hashUniformName(elementName)] = elementLocation;
+                }
+            }
         }
 
-        void setMat3(const std::string &name, const glm::mat3 &mat) const
+        std::vector<std::string> sourceFiles; // #line source string numbers, reported with compile errors
+
+        static std::string readFile(const std::filesystem::path &path)
         {
-            glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+            std::ifstream file;
+            file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+            try
+            {
+                file.open(path);
+                std::stringstream stream;
+                stream << file.rdbuf();
+                return stream.str();
+            }
+            catch(std::ifstream::failure& e)
+            {
+                std::cerr << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ " << path.string() << "\n" << e.what() << '\n';
+                return "";
+            }
         }
 
-        void setMat4(const std::string &name, const glm::mat4 &mat) const
+        // Reads a stage, expands its includes and injects the defines after #version
+        std::string readStage(const char *path, const std::string &defines)
         {
-            glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+            int fileIndex = static_cast<int>(sourceFiles.size());
+            sourceFiles.push_back(path);
+            std::set<std::string> included;
+            std::string code = resolveIncludes(readFile(path), std::filesystem::path(path).parent_path(), fileIndex, included);
+
+            size_t versionLine = code.find("#version");
+            size_t versionEnd = versionLine == std::string::npos ? std::string::npos : code.find('\n', versionLine);
+            if(versionEnd == std::string::npos)
+                return defines + "\n" + code;
+            int nextLine = static_cast<int>(std::count(code.begin(), code.begin() + versionEnd, '\n')) + 2;
+            return code.substr(0, versionEnd + 1) + defines + "\n#line " + std::to_string(nextLine) + " " + std::to_string(fileIndex) + "\n"
+                 + code.substr(versionEnd + 1);
         }
 
-    private:
+        std::string resolveIncludes(const std::string &code, const std::filesystem::path &directory, int fileIndex, std::set<std::string> &included)
+        {
+            std::string result;
+            std::istringstream lines(code);
+            std::string line;
+            int lineNumber = 0;
+            while(std::getline(lines, line))
+            {
+                lineNumber++;
+                size_t directive = line.find_first_not_of(" \t");
+                if(directive == std::string::npos || line.compare(directive, 8, "#include") != 0)
+                {
+                    result += line + "\n";
+                    continue;
+                }
+
+                size_t open = line.find('"', directive);
+                size_t close = open == std::string::npos ? std::string::npos : line.find('"', open + 1);
+                if(close == std::string::npos)
+                {
+                    std::cerr << "ERROR::SHADER::MALFORMED_INCLUDE " << line << std::endl;
+                    result += "\n";
+                    continue;
+                }
+                std::filesystem::path includePath = (directory / line.substr(open + 1, close - open - 1)).lexically_normal();
+                if(!included.insert(includePath.generic_string()).second)
+                {
+                    result += "\n";
+                    continue;
+                }
+
+                int includeIndex = static_cast<int>(sourceFiles.size());
+                sourceFiles.push_back(includePath.generic_string());
+                result += "#line 1 " + std::to_string(includeIndex) + "\n";
+                result += resolveIncludes(readFile(includePath), includePath.parent_path(), includeIndex, included);
+                result += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(fileIndex) + "\n";
+            }
+            return result;
+        }
 
-        void checkCompileErrors(unsigned int shader, std::string type)
+        void checkCompileErrors(unsigned int shader, std::string type) const
         {
             GLint success;
             GLchar infoLog[1024];
@@ -171,6 +374,8 @@ class Shader
                 {
                     glGetShaderInfoLog(shader, 1024, NULL, infoLog);
                     std::cerr << "ERROR::SHADER_COMPILATION_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
+                    for(size_t i = 0; i < sourceFiles.size(); i++)
+                        std::cerr << "source " << i << ": " << sourceFiles[i] << std::endl;
                 }
             }
             else
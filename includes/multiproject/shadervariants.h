@@ -0,0 +1,83 @@
+#pragma once
+
+#include "shader.h"
+#include "hash.h"
+
+#include <map>
+#include <string>
+#include <unordered_map>
+
+// Set of #defines a program is specialised with; two permutations with the same defines share a key
+class ShaderPermutation
+{
+    public:
+        ShaderPermutation& Define(const std::string &name, const std::string &value = "1")
+        {
+            defines[name] = value;
+            return *this;
+        }
+
+        ShaderPermutation& Define(const std::string &name, int value)
+        {
+            return Define(name, std::to_string(value));
+        }
+
+        // One #define line per entry, sorted by name so the text (and the program binary key) is stable
+        std::string Defines() const
+        {
+            std::string text;
+            for(const auto &[name, value] : defines)
+                text += "#define " + name + " " + value + "\n";
+            return text;
+        }
+
+        uint64_t Key() const
+        {
+            std::string text = Defines();
+            return hashBytes(text.data(), text.size());
+        }
+
+    private:
+        std::map<std::string, std::string> defines;
+};
+
+// Variants of one program, compiled the first time their permutation is requested
+class ShaderVariants
+{
+    public:
+        ShaderVariants(const std::string &vertexPath, const std::string &fragmentPath, const std::string &geometryPath = "")
+        {
+            this->vertexPath = vertexPath;
+            this->fragmentPath = fragmentPath;
+            this->geometryPath = geometryPath;
+        }
+
+        Shader& Get(const ShaderPermutation &permutation)
+        {
+            uint64_t key = permutation.Key();
+            auto it = variants.find(key);
+            if(it != variants.end())
+                return it->second;
+
+            const char *geometry = geometryPath.empty() ? nullptr : geometryPath.c_str();
+            return variants.try_emplace(key, vertexPath.c_str(), fragmentPath.c_str(), geometry, permutation.Defines()).first->second;
+        }
+
+        size_t Count() const
+        {
+            return variants.size();
+        }
+
+        void Delete()
+        {
+            for(auto &[key, shader] : variants)
+                shader.Delete();
+            variants.clear();
+        }
+
+    private:
+        std::string vertexPath;
+        std::string fragmentPath;
+        std::string geometryPath;
+        std::unordered_map<uint64_t, Shader> variants;
+};
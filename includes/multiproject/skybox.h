@@ -3,6 +3,7 @@
 #include <glad/gl.h>
 
 #include "cubemap.h"
+#include "glstate.h"
 #include "shader.h"
 
 float skyboxVertices[] =
@@ -53,14 +54,14 @@ class Skybox
 
 		void Draw(Shader &shader)
 		{
-			glDepthFunc(GL_LEQUAL);
+			GLState::Instance().DepthFunc(GL_LEQUAL);
 			glBindVertexArray(VAO);
 			cubemap.Bind();
 			cubemap.SetShaderUniform(shader, "skybox");
 			glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
 			cubemap.Unbind();
 			glBindVertexArray(0);
-			glDepthFunc(GL_LESS);
+			GLState::Instance().DepthFunc(GL_LESS);
 		}
 
 	private:
@@ -0,0 +1,484 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "culling.h"
+#include "meshsimplify.h"
+#include "threadpool.h"
+#include "vertexformat.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+// CPU occlusion culling: a few occluder meshes are rasterized into a small depth buffer, then object boxes are tested
+// against it before their draws are submitted. Needs no GPU and no read back.
+// Occluders write one conservative depth per triangle (their farthest vertex), so the buffer never claims more
+// occlusion than the occluders give; a box is occluded when every pixel it covers holds a nearer depth. Rows of 8
+// pixels are rasterized with AVX2 where available, tile rows and box batches are spread over the shared ThreadPool.
+
+// Triangle soup used as occluder, in object space
+struct OccluderMesh
+{
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> indices;
+
+    size_t TriangleCount() const
+    {
+        return indices.size() / 3;
+    }
+};
+
+inline OccluderMesh makeBoxOccluder(const glm::vec3 &min, const glm::vec3 &max)
+{
+    OccluderMesh box;
+    for(int i = 0; i < 8; i++)
+        box.positions.push_back(glm::vec3(i & 1 ? max.x : min.x, i & 2 ? max.y : min.y, i & 4 ? max.z : min.z));
+    box.indices = { 0, 2, 6, 0, 6, 4,   1, 5, 7, 1, 7, 3,
+                    0, 4, 5, 0, 5, 1,   2, 3, 7, 2, 7, 6,
+                    0, 1, 3, 0, 3, 2,   4, 6, 7, 4, 7, 5 };
+    return box;
+}
+
+// Low poly occluder from mesh data (Mesh::vertices/indices, kept with ModelLoadOptions::keepMeshData): positions are welded across
+// normal and UV seams and the result is simplified (meshsimplify.h) to about targetTriangles. The proxy may leave the
+// surface by the simplification error; keep targetTriangles high enough for meshes that occlude at close range.
+inline OccluderMesh makeOccluderProxy(const std::vector<Vertex> &vertices, const std::vector<unsigned int> &indices, size_t targetTriangles = 128)
+{
+    std::vector<uint32_t> order(vertices.size());
+    std::iota(order.begin(), order.end(), 0u);
+    auto less = [&](uint32_t a, uint32_t b) {
+        const glm::vec3 &p = vertices[a].Position, &q = vertices[b].Position;
+        return p.x != q.x ? p.x < q.x : p.y != q.y ? p.y < q.y : p.z < q.z;
+    };
+    std::sort(order.begin(), order.end(), less);
+
+    std::vector<Vertex> welded;
+    std::vector<uint32_t> remap(vertices.size());
+    for(size_t i = 0; i < order.size(); i++)
+    {
+        if(i == 0 || vertices[order[i]].Position != vertices[order[i - 1]].Position)
+        {
+            Vertex vertex = {};
+            vertex.Position = vertices[order[i]].Position;
+            welded.push_back(vertex);
+        }
+        remap[order[i]] = static_cast<uint32_t>(welded.size() - 1);
+    }
+
+    std::vector<unsigned int> weldedIndices;
+    for(size_t i = 0; i + 2 < indices.size(); i += 3)
+    {
+        uint32_t a = remap[indices[i]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+        if(a != b && b != c && a != c)
+            weldedIndices.insert(weldedIndices.end(), { a, b, c });
+    }
+
+    float error = 0.0f;
+    std::vector<unsigned int> simplified = weldedIndices.size() / 3 > targetTriangles ? simplifyMesh(welded, weldedIndices, targetTriangles * 3, FLT_MAX, error) : weldedIndices;
+
+    OccluderMesh proxy;
+    std::vector<uint32_t> compact(welded.size(), UINT32_MAX);
+    for(unsigned int index : simplified)
+    {
+        if(compact[index] == UINT32_MAX)
+        {
+            compact[index] = static_cast<uint32_t>(proxy.positions.size());
+            proxy.positions.push_back(welded[index].Position);
+        }
+        proxy.indices.push_back(compact[index]);
+    }
+    return proxy;
+}
+
+class SoftwareOcclusion
+{
+    public:
+        static const unsigned int TileSize = 8;
+
+        struct Stats
+        {
+            unsigned int occluderTriangles = 0; // queued since Begin
+            unsigned int skippedTriangles = 0;  // crossing the near plane, off screen or degenerate
+        };
+
+        // width and height are rounded up to whole tiles
+        SoftwareOcclusion(unsigned int width = 256, unsigned int height = 128)
+        {
+            this->width = (width + TileSize - 1) / TileSize * TileSize;
+            this->height = (height + TileSize - 1) / TileSize * TileSize;
+            tilesX = this->width / TileSize;
+            tilesY = this->height / TileSize;
+            depth.assign(size_t(this->width) * this->height, 1.0f);
+            tileMax.assign(size_t(tilesX) * tilesY, 1.0f);
+        }
+
+        // Starts a frame seen through viewProjection: drops the occluders and clears the depth to the far plane
+        void Begin(const glm::mat4 &viewProjection)
+        {
+            this->viewProjection = viewProjection;
+            triangles.clear();
+            stats = Stats();
+            std::fill(depth.begin(), depth.end(), 1.0f);
+            std::fill(tileMax.begin(), tileMax.end(), 1.0f);
+        }
+
+        void AddOccluder(const OccluderMesh &mesh, const glm::mat4 &model)
+        {
+            glm::mat4 transform = viewProjection * model;
+            projected.resize(mesh.positions.size());
+            for(size_t i = 0; i < mesh.positions.size(); i++)
+                projected[i] = transform * glm::vec4(mesh.positions[i], 1.0f);
+
+            for(size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+            {
+                stats.occluderTriangles++;
+                if(!setupTriangle(projected[mesh.indices[i]], projected[mesh.indices[i + 1]], projected[mesh.indices[i + 2]]))
+                    stats.skippedTriangles++;
+            }
+        }
+
+        // Rasterizes the occluders added since Begin, one tile row per task
+        void Rasterize()
+        {
+            auto rasterizeTileRow = [&](size_t tileRow) {
+                int rowBegin = static_cast<int>(tileRow * TileSize);
+                int rowEnd = rowBegin + TileSize - 1;
+                for(const Triangle &triangle : triangles)
+                {
+                    if(triangle.maxY < rowBegin || triangle.minY > rowEnd)
+                        continue;
+                    int y0 = std::max(triangle.minY, rowBegin), y1 = std::min(triangle.maxY, rowEnd);
+#ifdef MULTIPROJECT_X86
+                    if(useSimd && cpuSupportsAVX2())
+                    {
+                        rasterizeRowsAVX2(triangle, y0, y1);
+                        continue;
+                    }
+#endif
+                    rasterizeRows(triangle, y0, y1);
+                }
+                updateTileRow(static_cast<unsigned int>(tileRow));
+            };
+            if(threaded)
+                ThreadPool::Shared().ParallelFor(tilesY, rasterizeTileRow);
+            else
+                for(size_t tileRow = 0; tileRow < tilesY; tileRow++)
+                    rasterizeTileRow(tileRow);
+        }
+
+        // False when the world box is hidden behind the occluders or outside the view
+        bool IsVisible(const glm::vec3 &min, const glm::vec3 &max) const
+        {
+            glm::vec2 screenMin, screenMax;
+            float nearest;
+#ifdef MULTIPROJECT_X86
+            bool inFront = useSimd && cpuSupportsAVX2() ? projectBoxAVX2(min, max, screenMin, screenMax, nearest) : projectBox(min, max, screenMin, screenMax, nearest);
+#else
+            bool inFront = projectBox(min, max, screenMin, screenMax, nearest);
+#endif
+            if(!inFront)
+                return true;
+            if(screenMax.x < 0.0f || screenMax.y < 0.0f || screenMin.x >= float(width) || screenMin.y >= float(height) || nearest > 1.0f)
+                return false;
+
+            int x0 = std::max(0, int(std::floor(screenMin.x))), x1 = std::min(int(width) - 1, int(std::floor(screenMax.x)));
+            int y0 = std::max(0, int(std::floor(screenMin.y))), y1 = std::min(int(height) - 1, int(std::floor(screenMax.y)));
+            for(int tileY = y0 / int(TileSize); tileY <= y1 / int(TileSize); tileY++)
+                for(int tileX = x0 / int(TileSize); tileX <= x1 / int(TileSize); tileX++)
+                {
+                    if(tileMax[size_t(tileY) * tilesX + tileX] < nearest)
+                        continue;
+                    int px0 = std::max(x0, tileX * int(TileSize)), px1 = std::min(x1, tileX * int(TileSize) + int(TileSize) - 1);
+                    int py0 = std::max(y0, tileY * int(TileSize)), py1 = std::min(y1, tileY * int(TileSize) + int(TileSize) - 1);
+                    for(int y = py0; y <= py1; y++)
+                        for(int x = px0; x <= px1; x++)
+                            if(depth[size_t(y) * width + x] >= nearest)
+                                return true;
+                }
+            return false;
+        }
+
+        // Clears visible[i] for the boxes found occluded; entries already 0 (e.g. frustum culled) are not tested.
+        // visible is grown to the box count with 1s.
+        CullStats Test(const BoundsSoA &bounds, std::vector<uint8_t> &visible) const
+        {
+            const size_t batch = 256;
+            size_t count = bounds.Size();
+            visible.resize(count, 1);
+            std::vector<unsigned int> batchTested((count + batch - 1) / batch), batchVisible(batchTested.size());
+            auto testBatch = [&](size_t b) {
+                for(size_t i = b * batch; i < std::min(count, (b + 1) * batch); i++)
+                {
+                    if(!visible[i])
+                        continue;
+                    batchTested[b]++;
+                    visible[i] = IsVisible(bounds.Min(i), bounds.Max(i)) ? 1 : 0;
+                    batchVisible[b] += visible[i];
+                }
+            };
+            if(threaded)
+                ThreadPool::Shared().ParallelFor(batchTested.size(), testBatch);
+            else
+                for(size_t b = 0; b < batchTested.size(); b++)
+                    testBatch(b);
+
+            CullStats result;
+            result.objects = static_cast<unsigned int>(count);
+            for(size_t b = 0; b < batchTested.size(); b++)
+            {
+                result.boxesTested += batchTested[b];
+                result.visible += batchVisible[b];
+            }
+            return result;
+        }
+
+        // Both on by default; for comparisons and single threaded callers
+        void SetThreaded(bool threaded)
+        {
+            this->threaded = threaded;
+        }
+
+        void SetSimd(bool useSimd)
+        {
+            this->useSimd = useSimd;
+        }
+
+        unsigned int Width() const
+        {
+            return width;
+        }
+
+        unsigned int Height() const
+        {
+            return height;
+        }
+
+        // Window depth in [0, 1], 1 where no occluder was drawn; row 0 is the bottom of the view
+        float DepthAt(unsigned int x, unsigned int y) const
+        {
+            return depth[size_t(y) * width + x];
+        }
+
+        const Stats& GetStats() const
+        {
+            return stats;
+        }
+
+    private:
+        static constexpr float NearW = 1e-5f;
+
+        // Screen space triangle, counter-clockwise: edge i is inside where a * (x - x0) + b * (y - y0) > 0, or = 0 where
+        // the edge is owned. (x0, y0) is the lower endpoint of the edge, so two triangles sharing it compute exactly negated
+        // values and ownership (a > 0, or a = 0 and b > 0) gives the pixel centers on it to exactly one of them.
+        struct Triangle
+        {
+            float a[3], b[3], x0[3], y0[3];
+            bool owns[3];
+            float depth; // farthest vertex
+            int minX, maxX, minY, maxY;
+        };
+
+        unsigned int width, height, tilesX, tilesY;
+        glm::mat4 viewProjection = glm::mat4(1.0f);
+        std::vector<float> depth;
+        std::vector<float> tileMax; // farthest depth per tile
+        std::vector<Triangle> triangles;
+        std::vector<glm::vec4> projected;
+        Stats stats;
+        bool threaded = true;
+        bool useSimd = true;
+
+        glm::vec2 toPixel(const glm::vec3 &ndc) const
+        {
+            return glm::vec2((ndc.x * 0.5f + 0.5f) * float(width), (ndc.y * 0.5f + 0.5f) * float(height));
+        }
+
+        bool setupTriangle(const glm::vec4 &c0, const glm::vec4 &c1, const glm::vec4 &c2)
+        {
+            // clipping would move the vertices; triangles through the near plane are left out instead
+            if(c0.w <= NearW || c1.w <= NearW || c2.w <= NearW || c0.z < -c0.w || c1.z < -c1.w || c2.z < -c2.w)
+                return false;
+            glm::vec3 ndc[3] = { glm::vec3(c0) / c0.w, glm::vec3(c1) / c1.w, glm::vec3(c2) / c2.w };
+            glm::vec2 p[3] = { toPixel(ndc[0]), toPixel(ndc[1]), toPixel(ndc[2]) };
+            float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[1].y - p[0].y) * (p[2].x - p[0].x);
+            if(area == 0.0f)
+                return false;
+            if(area < 0.0f)
+                std::swap(p[1], p[2]);
+
+            Triangle triangle;
+            triangle.depth = std::max({ ndc[0].z, ndc[1].z, ndc[2].z }) * 0.5f + 0.5f;
+            if(triangle.depth > 1.0f)
+                return false;
+            glm::vec2 pixelMin = glm::min(p[0], glm::min(p[1], p[2])), pixelMax = glm::max(p[0], glm::max(p[1], p[2]));
+            triangle.minX = std::max(0, int(std::floor(pixelMin.x)));
+            triangle.maxX = std::min(int(width) - 1, int(std::floor(pixelMax.x)));
+            triangle.minY = std::max(0, int(std::floor(pixelMin.y)));
+            triangle.maxY = std::min(int(height) - 1, int(std::floor(pixelMax.y)));
+            if(triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+                return false;
+            for(int i = 0; i < 3; i++)
+            {
+                const glm::vec2 &from = p[i], &to = p[(i + 1) % 3];
+                const glm::vec2 &anchor = from.y < to.y || (from.y == to.y && from.x < to.x) ? from : to;
+                triangle.a[i] = from.y - to.y;
+                triangle.b[i] = to.x - from.x;
+                triangle.x0[i] = anchor.x;
+                triangle.y0[i] = anchor.y;
+                triangle.owns[i] = triangle.a[i] > 0.0f || (triangle.a[i] == 0.0f && triangle.b[i] > 0.0f);
+            }
+            triangles.push_back(triangle);
+            return true;
+        }
+
+        // Screen rectangle (pixels) and nearest depth of the box; false when a corner is behind the near plane
+        bool projectBox(const glm::vec3 &min, const glm::vec3 &max, glm::vec2 &screenMin, glm::vec2 &screenMax, float &nearest) const
+        {
+            screenMin = glm::vec2(FLT_MAX);
+            screenMax = glm::vec2(-FLT_MAX);
+            nearest = FLT_MAX;
+            // corners as the min corner plus the projected box edges
+            glm::vec4 base = viewProjection * glm::vec4(min, 1.0f);
+            glm::vec4 edgeX = viewProjection[0] * (max.x - min.x), edgeY = viewProjection[1] * (max.y - min.y), edgeZ = viewProjection[2] * (max.z - min.z);
+            for(int i = 0; i < 8; i++)
+            {
+                glm::vec4 clip = base;
+                if(i & 1)
+                    clip += edgeX;
+                if(i & 2)
+                    clip += edgeY;
+                if(i & 4)
+                    clip += edgeZ;
+                if(clip.w <= NearW || clip.z < -clip.w)
+                    return false;
+                glm::vec3 ndc = glm::vec3(clip) / clip.w;
+                glm::vec2 pixel = toPixel(ndc);
+                screenMin = glm::min(screenMin, pixel);
+                screenMax = glm::max(screenMax, pixel);
+                nearest = std::min(nearest, ndc.z * 0.5f + 0.5f);
+            }
+            return true;
+        }
+
+#ifdef MULTIPROJECT_X86
+        // the 8 corners in the 8 lanes
+        MULTIPROJECT_TARGET_AVX2 bool projectBoxAVX2(const glm::vec3 &min, const glm::vec3 &max, glm::vec2 &screenMin, glm::vec2 &screenMax, float &nearest) const
+        {
+            const __m256 cornerX = _mm256_setr_ps(0, 1, 0, 1, 0, 1, 0, 1);
+            const __m256 cornerY = _mm256_setr_ps(0, 0, 1, 1, 0, 0, 1, 1);
+            const __m256 cornerZ = _mm256_setr_ps(0, 0, 0, 0, 1, 1, 1, 1);
+            glm::vec4 base = viewProjection * glm::vec4(min, 1.0f);
+            glm::vec4 edgeX = viewProjection[0] * (max.x - min.x), edgeY = viewProjection[1] * (max.y - min.y), edgeZ = viewProjection[2] * (max.z - min.z);
+            __m256 clip[4];
+            for(int c = 0; c < 4; c++)
+            {
+                clip[c] = _mm256_add_ps(_mm256_set1_ps(base[c]), _mm256_mul_ps(cornerX, _mm256_set1_ps(edgeX[c])));
+                clip[c] = _mm256_add_ps(clip[c], _mm256_mul_ps(cornerY, _mm256_set1_ps(edgeY[c])));
+                clip[c] = _mm256_add_ps(clip[c], _mm256_mul_ps(cornerZ, _mm256_set1_ps(edgeZ[c])));
+            }
+            __m256 behind = _mm256_or_ps(_mm256_cmp_ps(clip[3], _mm256_set1_ps(NearW), _CMP_LE_OQ),
+                                         _mm256_cmp_ps(_mm256_add_ps(clip[2], clip[3]), _mm256_setzero_ps(), _CMP_LT_OQ));
+            if(_mm256_movemask_ps(behind) != 0)
+                return false;
+
+            __m256 inverseW = _mm256_div_ps(_mm256_set1_ps(1.0f), clip[3]);
+            __m256 half = _mm256_set1_ps(0.5f);
+            __m256 pixelX = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(clip[0], inverseW), half), half), _mm256_set1_ps(float(width)));
+            __m256 pixelY = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(clip[1], inverseW), half), half), _mm256_set1_ps(float(height)));
+            __m256 depth = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(clip[2], inverseW), half), half);
+            screenMin = glm::vec2(horizontalMin(pixelX), horizontalMin(pixelY));
+            screenMax = glm::vec2(-horizontalMin(_mm256_sub_ps(_mm256_setzero_ps(), pixelX)), -horizontalMin(_mm256_sub_ps(_mm256_setzero_ps(), pixelY)));
+            nearest = horizontalMin(depth);
+            return true;
+        }
+
+        MULTIPROJECT_TARGET_AVX2 static float horizontalMin(__m256 value)
+        {
+            __m128 half = _mm_min_ps(_mm256_castps256_ps128(value), _mm256_extractf128_ps(value, 1));
+            half = _mm_min_ps(half, _mm_movehl_ps(half, half));
+            half = _mm_min_ss(half, _mm_shuffle_ps(half, half, 1));
+            return _mm_cvtss_f32(half);
+        }
+#endif
+
+        // pixel centers inside the triangle take its depth if nearer
+        void rasterizeRows(const Triangle &triangle, int y0, int y1)
+        {
+            for(int y = y0; y <= y1; y++)
+            {
+                float py = float(y) + 0.5f;
+                float rowTerm[3];
+                for(int i = 0; i < 3; i++)
+                    rowTerm[i] = triangle.b[i] * (py - triangle.y0[i]);
+                float *row = &depth[size_t(y) * width];
+                for(int x = triangle.minX; x <= triangle.maxX; x++)
+                {
+                    float px = float(x) + 0.5f;
+                    bool inside = true;
+                    for(int i = 0; i < 3; i++)
+                    {
+                        float edge = triangle.a[i] * (px - triangle.x0[i]) + rowTerm[i];
+                        inside &= edge > 0.0f || (edge == 0.0f && triangle.owns[i]);
+                    }
+                    if(inside)
+                        row[x] = std::min(row[x], triangle.depth);
+                }
+            }
+        }
+
+#ifdef MULTIPROJECT_X86
+        // 8 pixels per step from the 8 aligned column before minX; width is a multiple of 8
+        MULTIPROJECT_TARGET_AVX2 void rasterizeRowsAVX2(const Triangle &triangle, int y0, int y1)
+        {
+            const __m256 offsets = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+            const __m256 zero = _mm256_setzero_ps();
+            const __m256 triangleDepth = _mm256_set1_ps(triangle.depth);
+            __m256 a[3], x0[3], owns[3];
+            for(int i = 0; i < 3; i++)
+            {
+                a[i] = _mm256_set1_ps(triangle.a[i]);
+                x0[i] = _mm256_set1_ps(triangle.x0[i]);
+                owns[i] = _mm256_castsi256_ps(_mm256_set1_epi32(triangle.owns[i] ? -1 : 0));
+            }
+            int xBegin = triangle.minX & ~7;
+            for(int y = y0; y <= y1; y++)
+            {
+                float py = float(y) + 0.5f;
+                __m256 rowTerm[3];
+                for(int i = 0; i < 3; i++)
+                    rowTerm[i] = _mm256_set1_ps(triangle.b[i] * (py - triangle.y0[i]));
+                float *row = &depth[size_t(y) * width];
+                for(int x = xBegin; x <= triangle.maxX; x += 8)
+                {
+                    __m256 px = _mm256_add_ps(_mm256_set1_ps(float(x)), offsets);
+                    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+                    for(int i = 0; i < 3; i++)
+                    {
+                        __m256 edge = _mm256_add_ps(_mm256_mul_ps(a[i], _mm256_sub_ps(px, x0[i])), rowTerm[i]);
+                        __m256 onEdge = _mm256_and_ps(_mm256_cmp_ps(edge, zero, _CMP_EQ_OQ), owns[i]);
+                        inside = _mm256_and_ps(inside, _mm256_or_ps(_mm256_cmp_ps(edge, zero, _CMP_GT_OQ), onEdge));
+                    }
+                    if(_mm256_movemask_ps(inside) == 0)
+                        continue;
+                    __m256 current = _mm256_loadu_ps(row + x);
+                    _mm256_storeu_ps(row + x, _mm256_blendv_ps(current, _mm256_min_ps(current, triangleDepth), inside));
+                }
+            }
+        }
+#endif
+
+        void updateTileRow(unsigned int tileY)
+        {
+            for(unsigned int tileX = 0; tileX < tilesX; tileX++)
+            {
+                float farthest = 0.0f;
+                for(unsigned int y = tileY * TileSize; y < (tileY + 1) * TileSize; y++)
+                    for(unsigned int x = tileX * TileSize; x < (tileX + 1) * TileSize; x++)
+                        farthest = std::max(farthest, depth[size_t(y) * width + x]);
+                tileMax[size_t(tileY) * tilesX + tileX] = farthest;
+            }
+        }
+};
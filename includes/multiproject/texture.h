@@ -3,38 +3,154 @@
 #include <glad/gl.h>
 #include <stb/stb_image.h>
 
+#include "glhandle.h"
+#include "glstate.h"
 #include "shader.h"
+#include "ktx2.h"
 #include <string>
+#include <utility>
 
+// Decoded image pixels, owned until the image goes out of scope.
+// Decoding touches no GL state, so it can run on any thread.
+struct ImageData
+{
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    unsigned char *pixels = nullptr;
+    Ktx2Image ktx; // filled instead of pixels for precompressed .ktx2 files
+
+    ImageData() = default;
+    ImageData(const ImageData&) = delete;
+    ImageData& operator=(const ImageData&) = delete;
+
+    ImageData(ImageData &&other) noexcept
+    {
+        *this = std::move(other);
+    }
+
+    ImageData& operator=(ImageData &&other) noexcept
+    {
+        std::swap(width, other.width);
+        std::swap(height, other.height);
+        std::swap(channels, other.channels);
+        std::swap(pixels, other.pixels);
+        std::swap(ktx, other.ktx);
+        return *this;
+    }
+
+    ~ImageData()
+    {
+        if(pixels != nullptr)
+            stbi_image_free(pixels);
+    }
+
+    // KTX2 files are read as is: their levels are expected to be stored bottom row first like the flipped images
+    static ImageData Decode(const char *path, bool flip = true)
+    {
+        ImageData image;
+        if(isKtx2Path(path))
+        {
+            if(image.ktx.Load(path))
+            {
+                image.width = image.ktx.width;
+                image.height = image.ktx.height;
+            }
+            return image;
+        }
+        // per thread flag, so concurrent decodes don't race on stb's global
+        stbi_set_flip_vertically_on_load_thread(flip);
+        image.pixels = stbi_load(path, &image.width, &image.height, &image.channels, 0);
+        return image;
+    }
+};
+
+// Owns its GL texture; move-only
 class Texture
 {
 public:
-    GLuint ID;
+    TextureHandle ID;
     std::string type;
     std::string path;
     GLenum unit; // Texture unit
+    int width = 0, height = 0;
+    GLenum format = GL_RGB; // client pixel format of the source image
+    bool resident = true; // false while the pixels are still being streamed in
+    size_t memoryBytes = 0; // estimated GPU memory, mip chain included
     Texture(const char *path, std::string type, GLenum slot, bool transparent = false)
+        : Texture(ImageData::Decode(path), path, type, slot, transparent)
     {
-        this->path = std::string(path);
-        this->type = type;
-        this->unit = slot;
+    }
 
-        int widthImg, heightImg, numColCh;
-        stbi_set_flip_vertically_on_load(true);
-        unsigned char *bytes = stbi_load(path, &widthImg, &heightImg, &numColCh, 0);
+    // Uploads an already decoded image; must run on the thread owning the GL context
+    Texture(const ImageData &image, const char *path, std::string type, GLenum slot, bool transparent = false)
+    {
+        if(image.ktx.Valid())
+            createCompressed(image.ktx, path, type, slot, transparent);
+        else
+            create(image.width, image.height, image.channels, image.pixels, path, type, slot, transparent);
+    }
 
-        glGenTextures(1, &ID);
+    // Allocates the storage only; the texture stays non resident until its pixels are streamed in (see TextureStreamer)
+    Texture(int width, int height, int channels, const char *path, std::string type, GLenum slot, bool transparent = false)
+    {
+        create(width, height, channels, nullptr, path, type, slot, transparent);
+    }
 
-        glActiveTexture(slot);
+    // Completes a streamed texture once all of its level 0 rows have been submitted
+    void MarkResident()
+    {
         glBindTexture(GL_TEXTURE_2D, ID);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        resident = true;
+    }
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    // 1x1 texture sampled instead of a non resident one: mid grey for colour maps, black for specular
+    static GLuint Placeholder(const std::string &type)
+    {
+        static GLuint grey = createPlaceholder(128);
+        static GLuint black = createPlaceholder(0);
+        return type == "specular" ? black : grey;
+    }
 
-		GLenum wrapMode = transparent ? GL_CLAMP_TO_EDGE : GL_REPEAT;
+    // Texture bound when drawing: the placeholder until the texture is resident
+    GLuint DrawID() const
+    {
+        return resident ? ID : Placeholder(type);
+    }
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapMode);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapMode);
+    // Assigns a texture unit to a texture
+    void SetShaderUniform(Shader &shader, UniformName uniform)
+    {
+        shader.Activate();
+        shader.setInt(uniform, unit);
+    }
+    // Binds a texture to its unit
+    void Bind()
+    {
+        GLState::Instance().BindTexture(unit - GL_TEXTURE0, DrawID());
+    }
+    // Unbinds a texture
+    void Unbind()
+    {
+        GLState::Instance().BindTexture(unit - GL_TEXTURE0, 0);
+    }
+    // Deletes a texture
+    void Delete()
+    {
+        ID.Reset();
+    }
+private:
+    void create(int widthImg, int heightImg, int numColCh, const unsigned char *bytes, const char *path, std::string type, GLenum slot, bool transparent)
+    {
+        this->path = std::string(path);
+        this->type = type;
+        this->unit = slot;
+        this->width = widthImg;
+        this->height = heightImg;
+
+        genTexture(transparent);
 
         // Extra lines in case you choose to use GL_CLAMP_TO_BORDER
         // float flatColor[] = {1.0f, 1.0f, 1.0f, 1.0f};
@@ -73,33 +189,61 @@ public:
         else
             format = GL_RED;
 
+        this->format = format;
+        memoryBytes = size_t(widthImg) * heightImg * (numColCh == 3 ? 4 : numColCh) * 4 / 3;
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
         glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, widthImg, heightImg, 0, format, GL_UNSIGNED_BYTE, bytes);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        resident = bytes != nullptr;
+        if(resident)
+            glGenerateMipmap(GL_TEXTURE_2D);
 
-        stbi_image_free(bytes);
         glBindTexture(GL_TEXTURE_2D, 0);
     }
 
-    // Assigns a texture unit to a texture
-    void SetShaderUniform(Shader &shader, const char *uniform)
+    // Uploads the prebuilt mip chain of a block compressed KTX2 file
+    void createCompressed(const Ktx2Image &ktx, const char *path, std::string type, GLenum slot, bool transparent)
     {
-        shader.Activate();
-        shader.setInt(uniform, unit);
+        this->path = std::string(path);
+        this->type = type;
+        this->unit = slot;
+        this->width = ktx.width;
+        this->height = ktx.height;
+        this->memoryBytes = ktx.MemoryBytes();
+
+        genTexture(transparent);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(ktx.levels.size()) - 1);
+        ktx.Upload(GL_TEXTURE_2D);
+        resident = true;
+
+        glBindTexture(GL_TEXTURE_2D, 0);
     }
-    // Binds a texture
-    void Bind()
+
+    void genTexture(bool transparent)
     {
-		glActiveTexture(GL_TEXTURE0 + unit);
+        // created on the active (upload) unit, sampling units belong to GLState
+        glGenTextures(1, ID.Replace());
         glBindTexture(GL_TEXTURE_2D, ID);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+		GLenum wrapMode = transparent ? GL_CLAMP_TO_EDGE : GL_REPEAT;
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapMode);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapMode);
     }
-    // Unbinds a texture
-    void Unbind()
+
+    static GLuint createPlaceholder(unsigned char value)
     {
+        unsigned char pixel[4] = { value, value, value, 255 };
+        GLuint placeholder;
+        glGenTextures(1, &placeholder);
+        glBindTexture(GL_TEXTURE_2D, placeholder);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixel);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
         glBindTexture(GL_TEXTURE_2D, 0);
-    }
-    // Deletes a texture
-    void Delete()
-    {
-        glDeleteTextures(1, &ID);
+        return placeholder;
     }
 };
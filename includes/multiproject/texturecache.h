@@ -0,0 +1,162 @@
+#pragma once
+
+#include <glad/gl.h>
+
+#include "texture.h"
+#include "texturestreamer.h"
+#include "hash.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Process-wide owner of every texture loaded by a Model.
+// Entries are found by their normalized path and, when content deduplication is on,
+// by the hash of their decoded pixels so the same image saved under two names is uploaded once.
+// Every Acquire/Add must be paired with a Release; the GL texture is deleted with its last reference.
+// Only meant to be used from the thread owning the GL context.
+class TextureCache
+{
+public:
+    struct Stats
+    {
+        unsigned int hits = 0;
+        unsigned int contentHits = 0;
+        unsigned int misses = 0;
+        unsigned int textures = 0;
+        size_t bytes = 0; // GPU memory of the live textures
+    };
+
+    // also match decoded images by pixel content (costs a hash over every decoded image)
+    bool contentDeduplication = false;
+
+    static TextureCache& Instance()
+    {
+        static TextureCache cache;
+        return cache;
+    }
+
+    static std::string NormalizePath(const std::string &path)
+    {
+        return std::filesystem::path(path).lexically_normal().generic_string();
+    }
+
+    static uint64_t HashImage(const ImageData &image)
+    {
+        int header[3] = { image.width, image.height, image.channels };
+        uint64_t hash = hashBytes(header, sizeof(header));
+        if(image.ktx.Valid())
+            return hashBytes(image.ktx.bytes.data(), image.ktx.bytes.size(), hash);
+        if(image.pixels == nullptr)
+            return hash;
+        return hashBytes(image.pixels, size_t(image.width) * image.height * image.channels, hash);
+    }
+
+    // Returns the texture cached for path with one more reference, or nullptr on a miss
+    Texture* Acquire(const std::string &path)
+    {
+        std::string normalized = NormalizePath(path);
+        auto found = byPath.find(normalized);
+        if(found == byPath.end())
+        {
+            stats.misses++;
+            return nullptr;
+        }
+        stats.hits++;
+        found->second->references++;
+        return found->second->texture.get();
+    }
+
+    // Caches a decoded image under path and returns it with one reference.
+    // contentHash is HashImage(image) when content deduplication is on, ignored otherwise.
+    // With a streamer the texture starts non resident and the image is handed over to it.
+    Texture* Add(const std::string &path, ImageData &&image, uint64_t contentHash, const std::string &type, GLenum slot, TextureStreamer *streamer = nullptr)
+    {
+        std::string normalized = NormalizePath(path);
+
+        if(contentDeduplication)
+        {
+            auto found = byContent.find(contentHash);
+            if(found != byContent.end() && found->second->texture->type == type)
+            {
+                std::shared_ptr<Entry> entry = found->second;
+                stats.contentHits++;
+                entry->references++;
+                if(byPath.emplace(normalized, entry).second)
+                    entry->paths.push_back(normalized);
+                return entry->texture.get();
+            }
+        }
+
+        std::shared_ptr<Entry> entry = std::make_shared<Entry>();
+        if(streamer != nullptr && image.pixels != nullptr)
+        {
+            entry->texture = std::make_unique<Texture>(image.width, image.height, image.channels, path.c_str(), type, slot);
+            entry->streamer = streamer;
+            streamer->Enqueue(entry->texture.get(), std::move(image));
+        }
+        else
+            entry->texture = std::make_unique<Texture>(image, path.c_str(), type, slot);
+        entry->references = 1;
+        if(byPath.emplace(normalized, entry).second)
+            entry->paths.push_back(normalized);
+        if(contentDeduplication && byContent.emplace(contentHash, entry).second)
+            entry->contentKeys.push_back(contentHash);
+        byTexture[entry->texture.get()] = entry;
+        stats.textures++;
+        stats.bytes += entry->texture->memoryBytes;
+        return entry->texture.get();
+    }
+
+    void Release(Texture *texture)
+    {
+        auto found = byTexture.find(texture);
+        if(found == byTexture.end())
+            return;
+        std::shared_ptr<Entry> entry = found->second;
+        if(--entry->references > 0)
+            return;
+
+        for(const std::string &path : entry->paths)
+            byPath.erase(path);
+        for(uint64_t key : entry->contentKeys)
+            byContent.erase(key);
+        byTexture.erase(found);
+        if(entry->streamer != nullptr && !entry->texture->resident)
+            entry->streamer->Cancel(entry->texture.get());
+        entry->texture->Delete();
+        stats.textures--;
+        stats.bytes -= entry->texture->memoryBytes;
+    }
+
+    const Stats& GetStats() const
+    {
+        return stats;
+    }
+
+    void ResetCounters()
+    {
+        stats.hits = stats.contentHits = stats.misses = 0;
+    }
+
+private:
+    struct Entry
+    {
+        std::unique_ptr<Texture> texture;
+        unsigned int references = 0;
+        TextureStreamer *streamer = nullptr;
+        std::vector<std::string> paths; // normalized paths this entry is cached under
+        std::vector<uint64_t> contentKeys;
+    };
+
+    // keyed by the path itself, so paths whose hashes collide still get their own entries
+    std::unordered_map<std::string, std::shared_ptr<Entry>> byPath;
+    std::unordered_map<uint64_t, std::shared_ptr<Entry>> byContent;
+    std::unordered_map<const Texture*, std::shared_ptr<Entry>> byTexture;
+    Stats stats;
+
+    TextureCache() = default;
+};
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <glad/gl.h>
+
+#include "glhandle.h"
+#include "texture.h"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <vector>
+
+// Streams decoded images into their textures over several frames.
+// Pixels are copied into a persistently mapped pixel unpack buffer split in segments; each frame fills at most
+// one free segment (bounded by bytesPerFrame) and issues glTexSubImage2D from it, then fences the segment so it is
+// only rewritten once the GPU has consumed it. A frame never waits: when the next segment is still busy it does nothing.
+class TextureStreamer
+{
+public:
+    struct Stats
+    {
+        size_t bytesLastFrame = 0;
+        size_t pendingTextures = 0;
+        unsigned int busyFrames = 0; // frames skipped because the next segment was still in flight
+    };
+
+    // maximum bytes copied and submitted per Update call
+    size_t bytesPerFrame;
+
+    TextureStreamer(size_t segmentSize = 4 * 1024 * 1024, unsigned int segmentCount = 3)
+    {
+        this->segmentSize = segmentSize;
+        this->bytesPerFrame = segmentSize;
+        segments.resize(segmentCount);
+
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glGenBuffers(1, PBO.Replace());
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, PBO);
+        glBufferStorage(GL_PIXEL_UNPACK_BUFFER, segmentSize * segmentCount, nullptr, flags);
+        mapped = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, segmentSize * segmentCount, flags));
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        if(mapped == nullptr)
+            std::cerr << "ERROR::TEXTURESTREAMER:: Could not map the pixel unpack buffer" << std::endl;
+    }
+
+    TextureStreamer(const TextureStreamer&) = delete;
+    TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+    ~TextureStreamer()
+    {
+        for(Segment &segment : segments)
+            if(segment.fence != nullptr)
+                glDeleteSync(segment.fence);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, PBO);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    // texture must have been created with storage only (non resident); the streamer keeps the image until it is uploaded
+    void Enqueue(Texture *texture, ImageData &&image)
+    {
+        if(image.pixels == nullptr)
+        {
+            std::cerr << "ERROR::TEXTURESTREAMER:: Nothing to stream for " << texture->path << std::endl;
+            return;
+        }
+        Upload upload;
+        upload.texture = texture;
+        upload.image = std::move(image);
+        upload.rowBytes = size_t(upload.image.width) * upload.image.channels;
+        if(upload.rowBytes > segmentSize)
+        {
+            std::cerr << "ERROR::TEXTURESTREAMER:: A row of " << texture->path << " does not fit in a segment" << std::endl;
+            return;
+        }
+        queue.push_back(std::move(upload));
+    }
+
+    // Drops a texture that is about to be deleted; rows already submitted are harmless
+    void Cancel(Texture *texture)
+    {
+        queue.erase(std::remove_if(queue.begin(), queue.end(), [texture](const Upload &upload) { return upload.texture == texture; }), queue.end());
+    }
+
+    // Call once per frame on the context thread
+    void Update()
+    {
+        stats.bytesLastFrame = 0;
+        stats.pendingTextures = queue.size();
+        if(queue.empty() || mapped == nullptr)
+            return;
+
+        Segment &segment = segments[current];
+        if(segment.fence != nullptr)
+        {
+            GLenum status = glClientWaitSync(segment.fence, 0, 0);
+            if(status == GL_TIMEOUT_EXPIRED)
+            {
+                stats.busyFrames++;
+                return;
+            }
+            glDeleteSync(segment.fence);
+            segment.fence = nullptr;
+        }
+
+        size_t base = current * segmentSize;
+        size_t budget = std::min(bytesPerFrame, segmentSize);
+        size_t offset = 0;
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, PBO);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        while(!queue.empty())
+        {
+            Upload &upload = queue.front();
+            int rows = std::min(upload.image.height - upload.nextRow, static_cast<int>((budget - offset) / upload.rowBytes));
+            if(rows <= 0)
+                break;
+
+            size_t bytes = rows * upload.rowBytes;
+            std::memcpy(mapped + base + offset, upload.image.pixels + upload.nextRow * upload.rowBytes, bytes);
+            glBindTexture(GL_TEXTURE_2D, upload.texture->ID);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, upload.nextRow, upload.image.width, rows, upload.texture->format, GL_UNSIGNED_BYTE, (void*)(base + offset));
+            offset += bytes;
+            upload.nextRow += rows;
+
+            if(upload.nextRow == upload.image.height)
+            {
+                upload.texture->MarkResident();
+                queue.pop_front();
+            }
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        if(offset > 0)
+        {
+            segment.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            current = (current + 1) % segments.size();
+        }
+        stats.bytesLastFrame = offset;
+        stats.pendingTextures = queue.size();
+    }
+
+    bool Idle() const
+    {
+        return queue.empty();
+    }
+
+    const Stats& GetStats() const
+    {
+        return stats;
+    }
+
+private:
+    struct Segment
+    {
+        GLsync fence = nullptr;
+    };
+
+    struct Upload
+    {
+        Texture *texture;
+        ImageData image;
+        size_t rowBytes;
+        int nextRow = 0;
+    };
+
+    BufferHandle PBO;
+    unsigned char *mapped;
+    size_t segmentSize;
+    std::vector<Segment> segments;
+    unsigned int current = 0;
+    std::deque<Upload> queue;
+    Stats stats;
+};
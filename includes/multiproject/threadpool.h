@@ -0,0 +1,105 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for CPU side work (image decoding, mesh processing...)
+class ThreadPool
+{
+public:
+    ThreadPool(unsigned int threadCount = std::max(1u, std::thread::hardware_concurrency()))
+    {
+        for(unsigned int i = 0; i < threadCount; i++)
+            workers.emplace_back([this]() { workerLoop(); });
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        condition.notify_all();
+        for(std::thread &worker : workers)
+            worker.join();
+    }
+
+    // Pool shared by everything that does not need its own workers
+    static ThreadPool& Shared()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    size_t Size() const
+    {
+        return workers.size();
+    }
+
+    template<typename F>
+    auto Submit(F &&task) -> std::future<decltype(task())>
+    {
+        using Result = decltype(task());
+        auto packaged = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(task));
+        std::future<Result> result = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.emplace([packaged]() { (*packaged)(); });
+        }
+        condition.notify_one();
+        return result;
+    }
+
+    // Runs body(i) for every i in [0, count) across the workers and waits for all of them
+    template<typename F>
+    void ParallelFor(size_t count, F &&body)
+    {
+        size_t chunks = std::min(count, workers.size());
+        std::vector<std::future<void>> pending;
+        for(size_t chunk = 0; chunk < chunks; chunk++)
+        {
+            size_t begin = count * chunk / chunks;
+            size_t end = count * (chunk + 1) / chunks;
+            pending.push_back(Submit([&body, begin, end]() {
+                for(size_t i = begin; i < end; i++)
+                    body(i);
+            }));
+        }
+        for(std::future<void> &result : pending)
+            result.get();
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping = false;
+
+    void workerLoop()
+    {
+        while(true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                if(stopping && tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+};
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+// Uniform names are identified by their 64-bit FNV-1a hash (same function as hashBytes).
+// Literal names are hashed at compile time; indexed and member names ("pointLights[2].linear") are
+// composed from a hashed prefix without building strings, since FNV-1a can continue from any prefix.
+
+constexpr uint64_t hashUniformName(std::string_view name, uint64_t hash = 14695981039346656037ull)
+{
+    for(char c : name)
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Counters for uniform traffic; frame deltas of locationQueries and runtimeNames must stay at zero
+struct UniformStats
+{
+    unsigned long long locationQueries = 0; // glGetUniformLocation calls, only while resolving a program
+    unsigned long long runtimeNames = 0;    // names hashed from runtime strings
+    unsigned long long lookups = 0;         // table lookups by hash
+    unsigned long long misses = 0;          // lookups of names not active in the program
+
+    static UniformStats& Global()
+    {
+        static UniformStats stats;
+        return stats;
+    }
+};
+
+class UniformName
+{
+    public:
+        uint64_t hash;
+
+        consteval UniformName(const char *name) : hash(hashUniformName(name)) {}
+
+        // For names only known at runtime (counted, prefer literals or Index/Member)
+        static UniformName Runtime(std::string_view name)
+        {
+            UniformStats::Global().runtimeNames++;
+            return UniformName(hashUniformName(name), 0);
+        }
+
+        // name[index]
+        constexpr UniformName Index(unsigned int index) const
+        {
+            char digits[10];
+            int count = 0;
+            do
+            {
+                digits[count++] = static_cast<char>('0' + index % 10);
+                index /= 10;
+            } while(index > 0);
+
+            uint64_t result = hashUniformName("[", hash);
+            while(count > 0)
+                result = hashUniformName(std::string_view(&digits[--count], 1), result);
+            return UniformName(hashUniformName("]", result), 0);
+        }
+
+        // name.member
+        constexpr UniformName Member(std::string_view member) const
+        {
+            return UniformName(hashUniformName(member, hashUniformName(".", hash)), 0);
+        }
+
+        constexpr bool operator==(const UniformName &other) const = default;
+
+    private:
+        constexpr UniformName(uint64_t hash, int) : hash(hash) {}
+};
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <glad/gl.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct Vertex {
+    glm::vec3 Position;
+    glm::vec3 Normal;
+    glm::vec2 TexCoords;
+};
+
+enum class VertexFormat
+{
+    Float,     // Vertex, 32 bytes
+    Quantized  // PackedVertex, 16 bytes; shaders need QUANTIZED_VERTICES (see vertex.glsl)
+};
+
+// 16 byte vertex: unorm16 position inside the mesh bounds, octahedral snorm16 normal, unorm16 uv inside the mesh uv bounds
+struct PackedVertex {
+    uint16_t Position[4]; // w unused, keeps the normal 8 byte aligned
+    int16_t Normal[2];
+    uint16_t TexCoords[2];
+};
+
+// Per mesh dequantization: position = positionOffset + value * positionScale, uv = uvTransform.xy + value * uvTransform.zw
+struct VertexQuantization {
+    glm::vec3 positionOffset = glm::vec3(0.0f);
+    glm::vec3 positionScale = glm::vec3(1.0f);
+    glm::vec4 uvTransform = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+};
+
+inline uint16_t quantizeUnorm16(float value)
+{
+    return static_cast<uint16_t>(std::clamp(value, 0.0f, 1.0f) * 65535.0f + 0.5f);
+}
+
+inline int16_t quantizeSnorm16(float value)
+{
+    return static_cast<int16_t>(std::round(std::clamp(value, -1.0f, 1.0f) * 32767.0f));
+}
+
+// Octahedral mapping of a unit vector onto [-1, 1]^2
+inline glm::vec2 octahedralEncode(glm::vec3 normal)
+{
+    normal /= std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+    glm::vec2 encoded(normal.x, normal.y);
+    if(normal.z < 0.0f)
+    {
+        glm::vec2 sign(encoded.x >= 0.0f ? 1.0f : -1.0f, encoded.y >= 0.0f ? 1.0f : -1.0f);
+        encoded = (1.0f - glm::abs(glm::vec2(encoded.y, encoded.x))) * sign;
+    }
+    return encoded;
+}
+
+inline glm::vec3 octahedralDecode(glm::vec2 encoded)
+{
+    glm::vec3 normal(encoded.x, encoded.y, 1.0f - std::abs(encoded.x) - std::abs(encoded.y));
+    float t = std::max(-normal.z, 0.0f);
+    normal.x += normal.x >= 0.0f ? -t : t;
+    normal.y += normal.y >= 0.0f ? -t : t;
+    return glm::normalize(normal);
+}
+
+inline VertexQuantization quantizeVertices(const Vertex *vertices, size_t vertexCount, std::vector<PackedVertex> &packed)
+{
+    VertexQuantization quantization;
+    packed.resize(vertexCount);
+    if(vertexCount == 0)
+        return quantization;
+
+    glm::vec3 minPosition = vertices[0].Position, maxPosition = vertices[0].Position;
+    glm::vec2 minUV = vertices[0].TexCoords, maxUV = vertices[0].TexCoords;
+    for(size_t i = 1; i < vertexCount; i++)
+    {
+        minPosition = glm::min(minPosition, vertices[i].Position);
+        maxPosition = glm::max(maxPosition, vertices[i].Position);
+        minUV = glm::min(minUV, vertices[i].TexCoords);
+        maxUV = glm::max(maxUV, vertices[i].TexCoords);
+    }
+    // flat extents keep a scale of 1 so the division below stays finite
+    glm::vec3 positionExtent = maxPosition - minPosition;
+    glm::vec2 uvExtent = maxUV - minUV;
+    for(int c = 0; c < 3; c++)
+        positionExtent[c] = positionExtent[c] > 0.0f ? positionExtent[c] : 1.0f;
+    for(int c = 0; c < 2; c++)
+        uvExtent[c] = uvExtent[c] > 0.0f ? uvExtent[c] : 1.0f;
+
+    quantization.positionOffset = minPosition;
+    quantization.positionScale = positionExtent;
+    quantization.uvTransform = glm::vec4(minUV, uvExtent);
+
+    for(size_t i = 0; i < vertexCount; i++)
+    {
+        glm::vec3 position = (vertices[i].Position - minPosition) / positionExtent;
+        glm::vec2 uv = (vertices[i].TexCoords - minUV) / uvExtent;
+        float normalLength = glm::length(vertices[i].Normal);
+        glm::vec2 normal = normalLength > 0.0f ? octahedralEncode(vertices[i].Normal / normalLength) : glm::vec2(0.0f);
+
+        PackedVertex &out = packed[i];
+        for(int c = 0; c < 3; c++)
+            out.Position[c] = quantizeUnorm16(position[c]);
+        out.Position[3] = 0;
+        out.Normal[0] = quantizeSnorm16(normal.x);
+        out.Normal[1] = quantizeSnorm16(normal.y);
+        out.TexCoords[0] = quantizeUnorm16(uv.x);
+        out.TexCoords[1] = quantizeUnorm16(uv.y);
+    }
+    return quantization;
+}
+
+// Attribute pointers 0-2 of the bound VAO for vertices of format in the bound GL_ARRAY_BUFFER
+inline void setupVertexAttributes(VertexFormat format)
+{
+    if (format == VertexFormat::Quantized)
+    {
+        // normalized integers, dequantized in vertex.glsl
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (void *)offsetof(PackedVertex, Position));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void *)offsetof(PackedVertex, Normal));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (void *)offsetof(PackedVertex, TexCoords));
+    }
+    else
+    {
+        // vertex positions
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)0);
+        // vertex normals
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, Normal));
+        // vertex texture coords
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, TexCoords));
+    }
+}
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <glad/gl.h>
+
+#include <glm/glm.hpp>
+
+#include "geometryarena.h"
+#include "glhandle.h"
+#include "glstate.h"
+#include "indirectdraw.h"
+#include "postprocesseffect.h"
+#include "shader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+// Visibility buffer rendering of the arena meshes of an IndirectDrawList. The geometry pass (visibility.vs/.fs) writes
+// one 32 bit id per pixel, draw index << TriangleBits | primitive, plus depth; Prepare checks beforehand that every
+// draw of the frame has an id. Resolve shades every covered pixel once with visibilityresolve.fs: it fetches the
+// triangle's indices and vertices straight from the GeometryArena buffers, rebuilds perspective correct barycentrics
+// and their screen derivatives for texture filtering, and lights the result with the forward path's lights into the
+// PostProcessEffect framebuffer, depth included, so forward draws can follow.
+// Texture sets cannot be indexed per pixel in core GL, so Resolve draws one screen pass per material; pixels of other
+// materials are rejected after the id fetch.
+class VisibilityBuffer
+{
+    public:
+        static const unsigned int TriangleBits = 20; // triangles per draw: 1M
+        static const unsigned int DrawBits = 12;     // draws: 4095, the all ones id marks empty pixels
+        static const uint32_t EmptyID = 0xFFFFFFFFu;
+        // storage blocks of visibilityresolve.fs; 1 to 3 are shared with the culling passes, which bind theirs per dispatch
+        static const GLuint RecordBinding = IndirectDrawList::RecordBinding;
+        static const GLuint DrawBinding = 1;
+        static const GLuint IndexBinding = 2;
+        static const GLuint VertexBinding = 3;
+        // after the material (0, 1) and shadow map (2 to 4) units
+        static const GLuint IDUnit = 5;
+        static const GLuint DepthUnit = 6;
+
+        struct Stats
+        {
+            unsigned int draws = 0;
+            unsigned int materials = 0; // screen passes of the last Resolve
+        };
+
+        unsigned int width, height;
+
+        // Resolves the meshes of one arena format; the resolve program is built with the matching QUANTIZED_VERTICES
+        VisibilityBuffer(unsigned int width, unsigned int height, VertexFormat format) : width(width), height(height), format(format)
+        {
+            glGenFramebuffers(1, framebuffer.Replace());
+            glGenTextures(1, idTexture.Replace());
+            glGenTextures(1, depthTexture.Replace());
+            glGenBuffers(1, drawBuffer.Replace());
+            allocate();
+
+            GLState::Instance().BindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, idTexture, 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                std::cout << "ERROR::VISIBILITYBUFFER:: Framebuffer is not complete!" << std::endl;
+            GLState::Instance().BindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+
+        VisibilityBuffer(const VisibilityBuffer&) = delete;
+        VisibilityBuffer& operator=(const VisibilityBuffer&) = delete;
+
+        // Framebuffer of the geometry pass, for PipelineState::WithFramebuffer
+        GLuint Framebuffer() const
+        {
+            return framebuffer;
+        }
+
+        // Single sampled depth of the geometry pass, e.g. for HiZCuller::BuildPyramid
+        GLuint DepthTexture() const
+        {
+            return depthTexture;
+        }
+
+        // Binds the framebuffer and marks every pixel empty; glClear would convert the clear color, ids need the exact bits
+        void Clear()
+        {
+            GLState::Instance().BindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+            const GLuint empty[4] = { EmptyID, 0, 0, 0 };
+            glClearBufferuiv(GL_COLOR, 0, empty);
+            glClearBufferfi(GL_DEPTH_STENCIL, 0, 1.0f, 0);
+        }
+
+        // Points the id and depth samplers of a visibilityresolve.fs program at their units; once per program
+        void SetSamplers(Shader &shader) const
+        {
+            shader.Activate();
+            shader.setInt("visibilityIDs", IDUnit);
+            shader.setInt("visibilityDepth", DepthUnit);
+        }
+
+        // Per draw geometry at the current LOD and material of the queued meshes, indexed like the DrawRecords; before the
+        // geometry pass. False when a draw does not fit the id layout (more than 4095 draws or 1M triangles in one) or
+        // the vertex format: its ids would alias other triangles, the frame has to be shaded another way.
+        bool Prepare(const IndirectDrawList &drawList)
+        {
+            const std::vector<Mesh*> &meshes = drawList.Meshes();
+            draws.resize(meshes.size());
+            materials.clear();
+            stats = Stats();
+            for (size_t i = 0; i < meshes.size(); i++)
+            {
+                const Mesh &mesh = *meshes[i];
+                const MeshLod &lod = mesh.lods[mesh.currentLod];
+                bool fits = mesh.format == format && i < (size_t(1) << DrawBits) - 1 && lod.indexCount / 3 <= (1u << TriangleBits);
+                if (!fits)
+                {
+                    if (!reportedOverflow)
+                        std::cout << "ERROR::VISIBILITYBUFFER:: Draw " << i << " does not fit the id layout or the vertex format" << std::endl;
+                    reportedOverflow = true;
+                    materials.clear();
+                    return false;
+                }
+                uint32_t material = 0;
+                while (material < materials.size() && materials[material]->textures != mesh.textures)
+                    material++;
+                if (material == materials.size())
+                    materials.push_back(meshes[i]);
+                draws[i] = glm::uvec4(mesh.arenaAllocation.firstIndex + lod.indexOffset, mesh.arenaAllocation.baseVertex, material, 0);
+            }
+            stats.draws = static_cast<unsigned int>(meshes.size());
+            stats.materials = static_cast<unsigned int>(materials.size());
+
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(draws.size(), 1) * sizeof(glm::uvec4), draws.empty() ? nullptr : draws.data(), GL_STREAM_DRAW);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+            return true;
+        }
+
+        // Clears target's framebuffer to the current clear color and shades the pixels drawn from drawList (the list of
+        // the geometry pass, same frame, after a successful Prepare) into it with shader. The caller binds the light
+        // blocks and shadow maps as for the forward pass.
+        void Resolve(Shader &shader, PostProcessEffect &target, const IndirectDrawList &drawList)
+        {
+            GLState &state = GLState::Instance();
+            state.Apply(PipelineState().WithFramebuffer(target.framebuffer).WithViewport(0, 0, width, height)
+                                       .WithDepthTest(true, GL_ALWAYS).WithCullFace(GL_NONE));
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            if (materials.empty())
+                return;
+
+            const GeometryArena &arena = GeometryArena::Instance(format);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, RecordBinding, drawList.RecordBuffer());
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DrawBinding, drawBuffer);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, IndexBinding, arena.GetIndexBuffer());
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VertexBinding, arena.GetVertexBuffer());
+            state.BindTexture(IDUnit, idTexture);
+            state.BindTexture(DepthUnit, depthTexture);
+
+            shader.Activate();
+            shader.setVec2("viewportSize", glm::vec2(width, height));
+            glBindVertexArray(target.quadVAO);
+            for (size_t material = 0; material < materials.size(); material++)
+            {
+                materials[material]->BindTextures(shader);
+                shader.setInt("materialIndex", static_cast<int>(material));
+                glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+            }
+            glBindVertexArray(0);
+        }
+
+        void Resize(unsigned int width, unsigned int height)
+        {
+            this->width = width;
+            this->height = height;
+            allocate();
+        }
+
+        // Counts of the last Prepare
+        const Stats& GetStats() const
+        {
+            return stats;
+        }
+
+    private:
+        FramebufferHandle framebuffer;
+        TextureHandle idTexture, depthTexture;
+        BufferHandle drawBuffer;
+        VertexFormat format;
+        std::vector<glm::uvec4> draws; // std430 VisibilityDraws: first index, base vertex, material
+        std::vector<Mesh*> materials;  // first mesh of every texture set, in material index order
+        bool reportedOverflow = false;
+        Stats stats;
+
+        void allocate()
+        {
+            glBindTexture(GL_TEXTURE_2D, idTexture);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, width, height, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glBindTexture(GL_TEXTURE_2D, depthTexture);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, width, height, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+};
@@ -0,0 +1,41 @@
+// Point lights of ClusteredLights (clusteredlights.h): the froxel of a fragment lists the lights whose range reaches
+// it. Needs lighting.glsl and matrices.glsl (for the view matrix).
+
+layout (std430, binding = 4) readonly buffer ClusterLights
+{
+    PointLight clusterLights[];
+};
+
+layout (std430, binding = 5) readonly buffer ClusterGrid
+{
+    uvec2 clusterRanges[]; // offset into clusterLightIndices, count
+};
+
+layout (std430, binding = 6) readonly buffer ClusterIndices
+{
+    uint clusterLightIndices[];
+};
+
+layout (std140, binding = 2) uniform Clusters
+{
+    uvec4 clusterCount; // tiles x, tiles y, depth slices, lights
+    vec4 clusterScale;  // pixels per tile x and y, depth slice scale and bias
+};
+
+uint ClusterIndex(vec3 fragPos)
+{
+    float depth = max(-(view * vec4(fragPos, 1.0)).z, 1e-4);
+    uvec2 tile = min(uvec2(gl_FragCoord.xy / clusterScale.xy), clusterCount.xy - 1u);
+    uint slice = uint(clamp(floor(log(depth) * clusterScale.z - clusterScale.w), 0.0, float(clusterCount.z - 1u)));
+    return (slice * clusterCount.y + tile.y) * clusterCount.x + tile.x;
+}
+
+// sum over the point lights of the fragment's froxel, unshadowed
+vec3 CalcClusteredLights(vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, float specularMask)
+{
+    uvec2 range = clusterRanges[ClusterIndex(fragPos)];
+    vec3 result = vec3(0.0);
+    for(uint i = 0u; i < range.y; i++)
+        result += CalcPointLight(clusterLights[clusterLightIndices[range.x + i]], normal, fragPos, viewDir, albedo, specularMask, 0.0);
+    return result;
+}
@@ -1,30 +1,27 @@
 #version 460 core
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
-layout (location = 2) in vec2 aTexCoords;
+#include "vertex.glsl"
+#include "matrices.glsl"
 
-#define MAX_NR_SHADOWS 4
+#ifndef SHADOW_SLOTS
+#define SHADOW_SLOTS 4
+#endif
 
 out VS_OUT {
-    vec4 FragPosLightSpace[MAX_NR_SHADOWS];
+    vec4 FragPosLightSpace[SHADOW_SLOTS];
     vec3 FragPos;
     vec3 Normal;
     vec2 TexCoords;
 } vs_out;
 
-uniform mat4 model;
-uniform mat4 projection;
-uniform mat4 view;
-
-uniform int numShadows;
-uniform mat4 lightSpaceMatrix[MAX_NR_SHADOWS];
+// matches depthprepass.vs to the bit for the GL_EQUAL lit pass
+invariant gl_Position;
 
 void main()
 {
-    vs_out.FragPos = vec3(model * vec4(aPos, 1.0));
-    vs_out.Normal = mat3(transpose(inverse(model))) * aNormal;  
-    vs_out.TexCoords = aTexCoords;
-    for(int i = 0; i < numShadows; i++)
+    vs_out.FragPos = vec3(ModelMatrix() * vec4(VertexPosition(), 1.0));
+    vs_out.Normal = mat3(transpose(inverse(ModelMatrix()))) * VertexNormal();  
+    vs_out.TexCoords = VertexTexCoords();
+    for(int i = 0; i < SHADOW_SLOTS; i++)
     {
         vs_out.FragPosLightSpace[i] = lightSpaceMatrix[i] * vec4(vs_out.FragPos, 1.0);
     }
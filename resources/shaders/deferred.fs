@@ -0,0 +1,78 @@
+#version 460 core
+out vec4 FragColor;
+
+// Lighting pass of the deferred path (gbuffer.h), drawn with postprocess.vs over the whole target. Takes the same
+// light configuration defines as defaultShadow.fs (LightPermutation in light.h); APPLY_LIGHTS reads the fragment
+// through fs_in, here rebuilt from the G-buffer.
+#ifndef NR_DIR_LIGHTS
+#define NR_DIR_LIGHTS 0
+#endif
+#ifndef NR_POINT_LIGHTS
+#define NR_POINT_LIGHTS 0
+#endif
+#ifndef NR_SPOT_LIGHTS
+#define NR_SPOT_LIGHTS 0
+#endif
+#ifndef SHADOW_SLOTS
+#define SHADOW_SLOTS 4
+#endif
+#ifndef APPLY_LIGHTS
+#define APPLY_LIGHTS
+#endif
+
+#include "matrices.glsl"
+#include "lighting.glsl"
+#include "shadows.glsl"
+#include "gbuffer.glsl"
+#ifdef CLUSTERED_LIGHTS
+#include "clusters.glsl"
+#endif
+
+in vec2 TexCoords;
+
+struct Fragment {
+    vec4 FragPosLightSpace[SHADOW_SLOTS];
+    vec3 FragPos;
+};
+Fragment fs_in;
+
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+uniform mat4 inverseViewProjection;
+
+#if NR_DIR_LIGHTS > 0
+uniform sampler2D dirShadowMaps[NR_DIR_LIGHTS];
+#endif
+#if NR_POINT_LIGHTS > 0
+uniform samplerCube pointShadowMaps[NR_POINT_LIGHTS];
+#endif
+#if NR_SPOT_LIGHTS > 0
+uniform sampler2D spotShadowMaps[NR_SPOT_LIGHTS];
+#endif
+
+void main()
+{
+    float depth = texture(gDepth, TexCoords).r;
+    if(depth == 1.0)
+        discard;
+    vec4 position = inverseViewProjection * vec4(vec3(TexCoords, depth) * 2.0 - 1.0, 1.0);
+    fs_in.FragPos = position.xyz / position.w;
+    for(int i = 0; i < SHADOW_SLOTS; i++)
+        fs_in.FragPosLightSpace[i] = lightSpaceMatrix[i] * vec4(fs_in.FragPos, 1.0);
+
+    vec3 viewPos = viewPosition.xyz;
+    vec3 norm = OctahedralDecode(texture(gNormal, TexCoords).xy);
+    vec3 viewDir = normalize(viewPos - fs_in.FragPos);
+    vec4 surface = texture(gAlbedo, TexCoords);
+    vec3 albedo = surface.rgb;
+    float specularMask = surface.a;
+
+    vec3 result = vec3(0.0);
+    APPLY_LIGHTS
+#ifdef CLUSTERED_LIGHTS
+    result += CalcClusteredLights(norm, fs_in.FragPos, viewDir, albedo, specularMask);
+#endif
+
+    FragColor = vec4(result, 1.0);
+}
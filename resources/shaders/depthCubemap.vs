@@ -1,9 +1,7 @@
 #version 460 core
-layout(location = 0) in vec3 aPos;
-
-uniform mat4 model;
+#include "vertex.glsl"
 
 void main() 
 {
-    gl_Position = model * vec4(aPos, 1.0);
+    gl_Position = ModelMatrix() * vec4(VertexPosition(), 1.0);
 }
\ No newline at end of file
@@ -1,10 +1,9 @@
 #version 460 core
-layout(location = 0) in vec3 aPos;
+#include "vertex.glsl"
 
 uniform mat4 lightSpaceMatrix;
-uniform mat4 model;
 
 void main() 
 {
-    gl_Position = lightSpaceMatrix * model * vec4(aPos, 1.0);
+    gl_Position = lightSpaceMatrix * ModelMatrix() * vec4(VertexPosition(), 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,13 @@
+#version 460 core
+// Position only camera pass (DepthPrepass in depthprepass.h), drawn with depthmap.fs. The lit pass that follows tests
+// GL_EQUAL against it, so the position is computed exactly as defaultNoUboShadow.vs does, both invariant.
+#include "vertex.glsl"
+#include "matrices.glsl"
+
+invariant gl_Position;
+
+void main()
+{
+    vec3 fragPos = vec3(ModelMatrix() * vec4(VertexPosition(), 1.0));
+    gl_Position = projection * view * vec4(fragPos, 1.0);
+}
@@ -0,0 +1,15 @@
+// Per draw data of IndirectDrawList (indirectdraw.h), indexed by the command's baseInstance (vertex.glsl) or by the
+// draw index of a visibility buffer pixel (visibilityresolve.fs).
+
+struct DrawRecord
+{
+    mat4 model;
+    vec4 positionOffset;
+    vec4 positionScale;
+    vec4 uvTransform;
+};
+
+layout (std430, binding = 0) readonly buffer DrawRecords
+{
+    DrawRecord drawRecords[];
+};
@@ -0,0 +1,30 @@
+#version 460 core
+// Geometry pass of the deferred path (gbuffer.h), drawn with defaultNoUboShadow.vs
+layout (location = 0) out vec4 gAlbedo;
+layout (location = 1) out vec2 gNormal;
+
+#ifndef SHADOW_SLOTS
+#define SHADOW_SLOTS 4
+#endif
+
+#include "gbuffer.glsl"
+
+struct Material {
+    sampler2D diffuse;
+    sampler2D specular;
+};
+
+in VS_OUT {
+    vec4 FragPosLightSpace[SHADOW_SLOTS];
+    vec3 FragPos;
+    vec3 Normal;
+    vec2 TexCoords;
+} fs_in;
+
+uniform Material material;
+
+void main()
+{
+    gAlbedo = vec4(texture(material.diffuse, fs_in.TexCoords).rgb, texture(material.specular, fs_in.TexCoords).x);
+    gNormal = OctahedralEncode(normalize(fs_in.Normal));
+}
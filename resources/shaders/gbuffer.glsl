@@ -0,0 +1,20 @@
+// Packing of the G-buffer (gbuffer.h): world space normals are octahedral mapped onto [-1, 1]^2 and stored as unorm16,
+// the same mapping as the quantized vertices (vertexformat.h).
+
+vec2 OctahedralEncode(vec3 normal)
+{
+    normal /= abs(normal.x) + abs(normal.y) + abs(normal.z);
+    vec2 encoded = normal.xy;
+    if(normal.z < 0.0)
+        encoded = (1.0 - abs(encoded.yx)) * vec2(encoded.x >= 0.0 ? 1.0 : -1.0, encoded.y >= 0.0 ? 1.0 : -1.0);
+    return encoded * 0.5 + 0.5;
+}
+
+vec3 OctahedralDecode(vec2 stored)
+{
+    vec2 encoded = stored * 2.0 - 1.0;
+    vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    float t = max(-normal.z, 0.0);
+    normal.xy += vec2(normal.x >= 0.0 ? -t : t, normal.y >= 0.0 ? -t : t);
+    return normalize(normal);
+}
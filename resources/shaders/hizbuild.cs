@@ -0,0 +1,36 @@
+#version 460 core
+// One level of the hierarchical depth pyramid of HiZCuller (hizculler.h): level 0 copies the resolved depth buffer,
+// every further level keeps the farthest depth of the texels it covers in the level above. Along an odd sized
+// axis the last texel also covers the third, left over, texel.
+
+layout (local_size_x = 8, local_size_y = 8) in;
+
+layout (binding = 0) uniform sampler2D source;
+layout (r32f, binding = 0) uniform writeonly image2D destination;
+
+uniform int sourceLevel; // -1: source is the depth texture
+
+void main()
+{
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 size = imageSize(destination);
+    if(any(greaterThanEqual(texel, size)))
+        return;
+
+    float depth = 0.0;
+    if(sourceLevel < 0)
+        depth = texelFetch(source, texel, 0).r;
+    else
+    {
+        ivec2 sourceSize = textureSize(source, sourceLevel);
+        ivec2 extent = ivec2(2);
+        if(texel.x == size.x - 1 && (sourceSize.x & 1) == 1)
+            extent.x = 3;
+        if(texel.y == size.y - 1 && (sourceSize.y & 1) == 1)
+            extent.y = 3;
+        for(int y = 0; y < extent.y; y++)
+            for(int x = 0; x < extent.x; x++)
+                depth = max(depth, texelFetch(source, min(texel * 2 + ivec2(x, y), sourceSize - 1), sourceLevel).r);
+    }
+    imageStore(destination, texel, vec4(depth));
+}
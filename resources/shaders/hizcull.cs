@@ -0,0 +1,132 @@
+#version 460 core
+// Occlusion test of the commands of an IndirectDrawList against the depth pyramid (HiZCuller in hizculler.h).
+// A mesh is occluded when the nearest depth of its projected box lies behind the farthest depth the pyramid holds for
+// the pixels the box covers. Phase 0 tests against the pyramid of the previous frame; phase 1 re-tests the meshes
+// phase 0 rejected against the pyramid of the current frame's depth, so only those are drawn a second time.
+// Phase 2 re-enables every command either phase drew, for a further pass over the same draws; phase 3 tests once
+// against the pyramid of the current frame, for draws that follow the ones it was built from.
+// The instanceCount of each command is set to 1 (draw) or 0 (skip) for the draw that follows.
+
+layout (local_size_x = 64) in;
+
+struct DrawElementsIndirectCommand
+{
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout (std430, binding = 0) buffer Commands
+{
+    DrawElementsIndirectCommand commands[];
+};
+
+// world space center and half extent per mesh, indexed by baseInstance
+layout (std430, binding = 1) readonly buffer Bounds
+{
+    vec4 bounds[];
+};
+
+// per command: 1 when drawn by phase 0, 2 when drawn by phase 1
+layout (std430, binding = 2) buffer PhaseVisibility
+{
+    uint drawnPhase[];
+};
+
+layout (std430, binding = 3) buffer Counters
+{
+    uint tested;
+    uint visibleFirst;
+    uint visibleSecond;
+};
+
+layout (binding = 0) uniform sampler2D pyramid;
+
+uniform mat4 viewProjection;
+uniform int phase;
+uniform int commandCount;
+uniform bool pyramidValid;
+
+bool occluded(vec3 center, vec3 extent)
+{
+    vec3 ndcMin = vec3(1.0);
+    vec3 ndcMax = vec3(-1.0);
+    for(int i = 0; i < 8; i++)
+    {
+        vec3 corner = center + extent * vec3((i & 1) != 0 ? 1.0 : -1.0, (i & 2) != 0 ? 1.0 : -1.0, (i & 4) != 0 ? 1.0 : -1.0);
+        vec4 clip = viewProjection * vec4(corner, 1.0);
+        // boxes reaching behind the near plane cover the view
+        if(clip.w <= 0.0 || clip.z < -clip.w)
+            return false;
+        vec3 ndc = clip.xyz / clip.w;
+        ndcMin = min(ndcMin, ndc);
+        ndcMax = max(ndcMax, ndc);
+    }
+
+    // covered pixels, one pixel wider for the resolve of multisampled edges
+    ivec2 size = textureSize(pyramid, 0);
+    ivec2 pixelMin = clamp(ivec2(floor((ndcMin.xy * 0.5 + 0.5) * vec2(size))) - 1, ivec2(0), size - 1);
+    ivec2 pixelMax = clamp(ivec2(floor((ndcMax.xy * 0.5 + 0.5) * vec2(size))) + 1, ivec2(0), size - 1);
+
+    // coarsest texels: the level where the box spans at most 2x2 of them
+    int levels = textureQueryLevels(pyramid);
+    int level = 0;
+    while(level < levels - 1 && any(greaterThan((pixelMax >> level) - (pixelMin >> level), ivec2(1))))
+        level++;
+
+    ivec2 levelSize = textureSize(pyramid, level);
+    ivec2 texelMin = min(pixelMin >> level, levelSize - 1);
+    ivec2 texelMax = min(pixelMax >> level, levelSize - 1);
+    float farthest = 0.0;
+    for(int y = texelMin.y; y <= texelMax.y; y++)
+        for(int x = texelMin.x; x <= texelMax.x; x++)
+            farthest = max(farthest, texelFetch(pyramid, ivec2(x, y), level).r);
+
+    float nearest = ndcMin.z * 0.5 + 0.5;
+    return nearest > farthest;
+}
+
+void main()
+{
+    uint command = gl_GlobalInvocationID.x;
+    if(command >= uint(commandCount))
+        return;
+
+    uint record = commands[command].baseInstance;
+    if(phase == 2)
+    {
+        commands[command].instanceCount = drawnPhase[command] != 0u ? 1u : 0u;
+        return;
+    }
+    if(phase == 1 && drawnPhase[command] == 1u)
+    {
+        commands[command].instanceCount = 0u;
+        return;
+    }
+
+    bool visible = !pyramidValid || !occluded(bounds[record * 2].xyz, bounds[record * 2 + 1].xyz);
+    commands[command].instanceCount = visible ? 1u : 0u;
+    if(phase == 0)
+    {
+        drawnPhase[command] = visible ? 1u : 0u;
+        atomicAdd(tested, 1u);
+        if(visible)
+            atomicAdd(visibleFirst, 1u);
+    }
+    else if(phase == 1)
+    {
+        if(visible)
+        {
+            drawnPhase[command] = 2u;
+            atomicAdd(visibleSecond, 1u);
+        }
+    }
+    else
+    {
+        atomicAdd(tested, 1u);
+        if(visible)
+            atomicAdd(visibleSecond, 1u);
+    }
+}
@@ -0,0 +1,62 @@
+#version 460 core
+// Frustum culling of the instances of an instanced Model (InstanceCuller in instanceculler.h).
+// One invocation per instance and mesh: the mesh box under the instance matrix is tested against the frustum planes
+// and, when not entirely behind one, the matrix is appended to the mesh's range of the visible instance buffer and
+// counted in the instanceCount of the mesh's draw command.
+
+layout (local_size_x = 64) in;
+
+struct DrawElementsIndirectCommand
+{
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout (std430, binding = 0) readonly buffer Instances
+{
+    mat4 instances[];
+};
+
+// object space box per mesh: min, max
+layout (std430, binding = 1) readonly buffer MeshBounds
+{
+    vec4 meshBounds[];
+};
+
+layout (std430, binding = 2) writeonly buffer VisibleInstances
+{
+    mat4 visibleInstances[];
+};
+
+layout (std430, binding = 3) buffer Commands
+{
+    DrawElementsIndirectCommand commands[];
+};
+
+uniform vec4 planes[6];
+uniform int instanceCount;
+
+void main()
+{
+    uint instance = gl_GlobalInvocationID.x;
+    uint mesh = gl_GlobalInvocationID.y;
+    if(instance >= uint(instanceCount))
+        return;
+
+    mat4 model = instances[instance];
+    vec3 localMin = meshBounds[mesh * 2].xyz;
+    vec3 localMax = meshBounds[mesh * 2 + 1].xyz;
+    vec3 center = vec3(model * vec4((localMin + localMax) * 0.5, 1.0));
+    vec3 extent = mat3(abs(model[0].xyz), abs(model[1].xyz), abs(model[2].xyz)) * ((localMax - localMin) * 0.5);
+    for(int i = 0; i < 6; i++)
+    {
+        if(dot(planes[i].xyz, center) + planes[i].w + dot(abs(planes[i].xyz), extent) < 0.0)
+            return;
+    }
+
+    uint slot = atomicAdd(commands[mesh].instanceCount, 1u);
+    visibleInstances[commands[mesh].baseInstance + slot] = model;
+}
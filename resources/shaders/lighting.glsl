@@ -0,0 +1,122 @@
+// Light structures and per light shading shared by the lit shaders.
+// BLINN selects the specular model at compile time (Blinn-Phong when 1, Phong when 0).
+// Each function takes the sampled albedo / specular mask and the light's shadow factor (0 when unshadowed).
+
+#ifndef BLINN
+#define BLINN 1
+#endif
+
+struct Material {
+    sampler2D diffuse;
+    sampler2D specular;    
+    float shininess;
+}; 
+
+// Light records of the Lights block (std140), filled by LightBuffer (lightbuffer.h) from the records of light.h.
+// Every vec3 shares its 16 byte slot with the float after it; the arrays have fixed sizes so all lit programs read
+// the same layout, NR_*_LIGHTS of them are shaded.
+#define MAX_DIR_LIGHTS 4
+#define MAX_POINT_LIGHTS 4
+#define MAX_SPOT_LIGHTS 4
+
+struct DirLight {
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+    vec3 direction;
+};
+
+struct PointLight {
+    vec3 ambient;
+    float constant;
+    vec3 diffuse;
+    float linear;
+    vec3 specular;
+    float quadratic;
+    vec3 position;
+    float farPlane;
+};
+
+struct SpotLight {
+    vec3 ambient;
+    float constant;
+    vec3 diffuse;
+    float linear;
+    vec3 specular;
+    float quadratic;
+    vec3 position;
+    float cutOff;
+    vec3 direction;
+    float outerCutOff;
+};
+
+layout (std140, binding = 1) uniform Lights
+{
+    DirLight dirLights[MAX_DIR_LIGHTS];
+    PointLight pointLights[MAX_POINT_LIGHTS];
+    SpotLight spotLights[MAX_SPOT_LIGHTS];
+};
+
+uniform Material material;
+
+// specular term, zero on faces turned away from the light
+float CalcSpecular(vec3 lightDir, vec3 normal, vec3 viewDir, float diff)
+{
+#if BLINN
+    vec3 halfwayDir = normalize(lightDir + viewDir);  
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
+#else
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+#endif
+    return diff > 0.0 ? spec : 0.0;
+}
+
+float CalcAttenuation(float constant, float linear, float quadratic, float distance)
+{
+    return 1.0 / (constant + linear * distance + quadratic * (distance * distance));
+}
+
+// calculates the color when using a directional light.
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec3 albedo, float specularMask, float shadow)
+{
+    vec3 lightDir = normalize(-light.direction);
+    float diff = max(dot(normal, lightDir), 0.0);
+    float spec = CalcSpecular(lightDir, normal, viewDir, diff);
+
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * specularMask;
+    return (1.0 - shadow) * (diffuse + specular);
+}
+
+// calculates the color when using a point light.
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, float specularMask, float shadow)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    float diff = max(dot(normal, lightDir), 0.0);
+    float spec = CalcSpecular(lightDir, normal, viewDir, diff);
+    float attenuation = CalcAttenuation(light.constant, light.linear, light.quadratic, length(light.position - fragPos));
+
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * specularMask;
+    return attenuation * (ambient + (1.0 - shadow) * (diffuse + specular));
+}
+
+// calculates the color when using a spot light.
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, float specularMask, float shadow)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    float diff = max(dot(normal, lightDir), 0.0);
+    float spec = CalcSpecular(lightDir, normal, viewDir, diff);
+    float attenuation = CalcAttenuation(light.constant, light.linear, light.quadratic, length(light.position - fragPos));
+    // spotlight intensity
+    float theta = dot(lightDir, normalize(-light.direction)); 
+    float epsilon = light.cutOff - light.outerCutOff;
+    float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
+
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * specularMask;
+    return attenuation * intensity * (ambient + (1.0 - shadow) * (diffuse + specular));
+}
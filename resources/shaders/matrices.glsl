@@ -0,0 +1,11 @@
+// Per frame matrices (std140), filled by LightBuffer (lightbuffer.h) and shared by every lit program.
+// default.vs declares the projection and view prefix of the same block.
+#define MAX_SHADOW_SLOTS 4
+
+layout (std140, binding = 0) uniform Matrices
+{
+    mat4 projection;
+    mat4 view;
+    vec4 viewPosition;
+    mat4 lightSpaceMatrix[MAX_SHADOW_SLOTS];
+};
@@ -0,0 +1,67 @@
+// Shadow map lookups for the light structures of lighting.glsl, which leave the shadow maps to separate samplers;
+// each returns the shadowed fraction in [0, 1].
+
+// array of offset direction for sampling
+const vec3 gridSamplingDisk[20] = vec3[]
+(
+   vec3(1, 1,  1), vec3( 1, -1,  1), vec3(-1, -1,  1), vec3(-1, 1,  1), 
+   vec3(1, 1, -1), vec3( 1, -1, -1), vec3(-1, -1, -1), vec3(-1, 1, -1),
+   vec3(1, 1,  0), vec3( 1, -1,  0), vec3(-1, -1,  0), vec3(-1, 1,  0),
+   vec3(1, 0,  1), vec3(-1,  0,  1), vec3( 1,  0, -1), vec3(-1, 0, -1),
+   vec3(0, 1,  1), vec3( 0, -1,  1), vec3( 0, -1, -1), vec3( 0, 1, -1)
+);
+
+// 3x3 PCF around the projected position, plus the centre sample
+float CalcProjectedShadow(sampler2D shadowMap, vec4 fragPosLightSpace, float bias)
+{
+    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
+    projCoords = projCoords * 0.5 + 0.5;
+
+    float closestDepth = texture(shadowMap, projCoords.xy).r;
+    float currentDepth = projCoords.z;
+    float shadow = currentDepth - bias > closestDepth ? 1.0 : 0.0;
+    vec2 texelSize = 1.0 / textureSize(shadowMap, 0);
+    for(int x = -1; x <= 1; ++x)
+    {
+        for(int y = -1; y <= 1; ++y)
+        {
+            float pcfDepth = texture(shadowMap, projCoords.xy + vec2(x, y) * texelSize).r; 
+            shadow += currentDepth - bias > pcfDepth ? 1.0 : 0.0;        
+        }    
+    }
+    shadow /= 10.0;
+
+    return projCoords.z > 1.0 ? 0.0 : shadow;
+}
+
+float CalcDirShadow(DirLight light, sampler2D shadowMap, vec4 fragPosLightSpace, vec3 normal)
+{
+    float bias = max(0.05 * (1.0 - dot(normal, normalize(light.direction))), 0.005);
+    return CalcProjectedShadow(shadowMap, fragPosLightSpace, bias);
+}
+
+float CalcSpotShadow(SpotLight light, sampler2D shadowMap, vec4 fragPosLightSpace, vec3 normal)
+{
+    float bias = max(0.00025 * (1.0 - dot(normal, normalize(light.direction))), 0.000005);
+    return CalcProjectedShadow(shadowMap, fragPosLightSpace, bias);
+}
+
+float CalcPointShadow(PointLight light, samplerCube shadowMap, vec3 fragPos, vec3 viewPos) 
+{
+    vec3 fragToLight = fragPos - light.position;
+    float currentDepth = length(fragToLight);
+
+    float shadow = 0.0;
+    float bias = 0.15;
+    const int samples = 20;
+    float viewDistance = length(viewPos - fragPos);
+    float diskRadius = (1.0 + (viewDistance / light.farPlane)) / 25.0;
+    for(int i = 0; i < samples; i++) {
+        float pcfDepth = texture(shadowMap, fragToLight + gridSamplingDisk[i] * diskRadius).r;
+        pcfDepth *= light.farPlane; 
+        shadow += currentDepth - bias > pcfDepth ? 1.0 : 0.0;
+    }
+    shadow /= float(samples);
+
+    return shadow;
+}
@@ -0,0 +1,110 @@
+// Mesh vertex attributes in either vertex layout (VertexFormat in vertexformat.h).
+// With QUANTIZED_VERTICES the attributes are normalized integers (PackedVertex): positions and uvs inside the mesh
+// bounds given by the uniforms Mesh::Draw sets, normals octahedral encoded.
+// With INDIRECT_DRAWS the model matrix and mesh bounds come from the DrawRecord of IndirectDrawList (indirectdraw.h)
+// selected by the command's baseInstance instead of uniforms.
+// With INSTANCE_MATRICES the model matrix is the per instance attribute of instanced meshes (Model's instanceMatrix,
+// or the visible instances compacted by InstanceCuller).
+
+#ifdef INDIRECT_DRAWS
+#include "drawrecords.glsl"
+
+mat4 ModelMatrix()
+{
+    return drawRecords[gl_BaseInstance].model;
+}
+
+vec3 PositionOffset()
+{
+    return drawRecords[gl_BaseInstance].positionOffset.xyz;
+}
+
+vec3 PositionScale()
+{
+    return drawRecords[gl_BaseInstance].positionScale.xyz;
+}
+
+vec4 UVTransform()
+{
+    return drawRecords[gl_BaseInstance].uvTransform;
+}
+#else
+#ifdef INSTANCE_MATRICES
+layout (location = 3) in mat4 aInstanceMatrix;
+
+mat4 ModelMatrix()
+{
+    return aInstanceMatrix;
+}
+#else
+uniform mat4 model;
+
+mat4 ModelMatrix()
+{
+    return model;
+}
+#endif
+
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+uniform vec4 uvTransform;
+
+vec3 PositionOffset()
+{
+    return positionOffset;
+}
+
+vec3 PositionScale()
+{
+    return positionScale;
+}
+
+vec4 UVTransform()
+{
+    return uvTransform;
+}
+#endif
+
+#ifdef QUANTIZED_VERTICES
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec2 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+
+vec3 VertexPosition()
+{
+    return PositionOffset() + aPos * PositionScale();
+}
+
+vec3 VertexNormal()
+{
+    vec3 normal = vec3(aNormal, 1.0 - abs(aNormal.x) - abs(aNormal.y));
+    float t = max(-normal.z, 0.0);
+    normal.xy += vec2(normal.x >= 0.0 ? -t : t, normal.y >= 0.0 ? -t : t);
+    return normalize(normal);
+}
+
+vec2 VertexTexCoords()
+{
+    vec4 transform = UVTransform();
+    return transform.xy + aTexCoords * transform.zw;
+}
+#else
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+
+vec3 VertexPosition()
+{
+    return aPos;
+}
+
+vec3 VertexNormal()
+{
+    return aNormal;
+}
+
+vec2 VertexTexCoords()
+{
+    return aTexCoords;
+}
+#endif
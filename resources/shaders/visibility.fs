@@ -0,0 +1,11 @@
+#version 460 core
+layout (location = 0) out uint VisibilityID;
+
+#include "visibility.glsl"
+
+flat in uint DrawIndex;
+
+void main()
+{
+    VisibilityID = PackVisibility(DrawIndex, uint(gl_PrimitiveID));
+}
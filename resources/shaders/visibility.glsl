@@ -0,0 +1,18 @@
+// Pixel ids of the visibility buffer (visibilitybuffer.h): draw index in the high bits, primitive in the low TRIANGLE_BITS.
+#define TRIANGLE_BITS 20
+#define EMPTY_ID 0xFFFFFFFFu
+
+uint PackVisibility(uint drawIndex, uint primitive)
+{
+    return (drawIndex << TRIANGLE_BITS) | primitive;
+}
+
+uint VisibilityDraw(uint id)
+{
+    return id >> TRIANGLE_BITS;
+}
+
+uint VisibilityPrimitive(uint id)
+{
+    return id & ((1u << TRIANGLE_BITS) - 1u);
+}
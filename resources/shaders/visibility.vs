@@ -0,0 +1,12 @@
+#version 460 core
+// Geometry pass of the visibility buffer: positions only, needs INDIRECT_DRAWS
+#include "vertex.glsl"
+#include "matrices.glsl"
+
+flat out uint DrawIndex;
+
+void main()
+{
+    DrawIndex = uint(gl_BaseInstance);
+    gl_Position = projection * view * ModelMatrix() * vec4(VertexPosition(), 1.0);
+}
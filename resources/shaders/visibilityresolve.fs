@@ -0,0 +1,167 @@
+#version 460 core
+out vec4 FragColor;
+
+// Shading pass of the visibility buffer (visibilitybuffer.h), drawn with postprocess.vs once per material. Takes the
+// light configuration defines of defaultShadow.fs (LightPermutation in light.h) plus QUANTIZED_VERTICES for the arena
+// format; APPLY_LIGHTS reads the fragment through fs_in, here rebuilt from the triangle under the pixel.
+#ifndef NR_DIR_LIGHTS
+#define NR_DIR_LIGHTS 0
+#endif
+#ifndef NR_POINT_LIGHTS
+#define NR_POINT_LIGHTS 0
+#endif
+#ifndef NR_SPOT_LIGHTS
+#define NR_SPOT_LIGHTS 0
+#endif
+#ifndef SHADOW_SLOTS
+#define SHADOW_SLOTS 4
+#endif
+#ifndef APPLY_LIGHTS
+#define APPLY_LIGHTS
+#endif
+
+#include "matrices.glsl"
+#include "lighting.glsl"
+#include "shadows.glsl"
+#include "drawrecords.glsl"
+#include "visibility.glsl"
+#ifdef CLUSTERED_LIGHTS
+#include "clusters.glsl"
+#endif
+
+layout (std430, binding = 1) readonly buffer VisibilityDraws
+{
+    uvec4 visibilityDraws[]; // first index, base vertex, material
+};
+
+layout (std430, binding = 2) readonly buffer ArenaIndices
+{
+    uint arenaIndices[];
+};
+
+#ifdef QUANTIZED_VERTICES
+layout (std430, binding = 3) readonly buffer ArenaVertices
+{
+    uvec4 arenaVertices[]; // PackedVertex
+};
+#else
+layout (std430, binding = 3) readonly buffer ArenaVertices
+{
+    float arenaVertices[]; // Vertex, 8 floats
+};
+#endif
+
+in vec2 TexCoords;
+
+struct Fragment {
+    vec4 FragPosLightSpace[SHADOW_SLOTS];
+    vec3 FragPos;
+};
+Fragment fs_in;
+
+uniform usampler2D visibilityIDs;
+uniform sampler2D visibilityDepth;
+uniform vec2 viewportSize;
+uniform int materialIndex;
+
+#if NR_DIR_LIGHTS > 0
+uniform sampler2D dirShadowMaps[NR_DIR_LIGHTS];
+#endif
+#if NR_POINT_LIGHTS > 0
+uniform samplerCube pointShadowMaps[NR_POINT_LIGHTS];
+#endif
+#if NR_SPOT_LIGHTS > 0
+uniform sampler2D spotShadowMaps[NR_SPOT_LIGHTS];
+#endif
+
+// object space vertex of the arena, dequantized as vertex.glsl does
+void FetchVertex(uint index, DrawRecord record, out vec3 position, out vec3 normal, out vec2 uv)
+{
+#ifdef QUANTIZED_VERTICES
+    uvec4 packedVertex = arenaVertices[index];
+    position = record.positionOffset.xyz + vec3(unpackUnorm2x16(packedVertex.x), unpackUnorm2x16(packedVertex.y).x) * record.positionScale.xyz;
+    vec2 encoded = unpackSnorm2x16(packedVertex.z);
+    normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    float t = max(-normal.z, 0.0);
+    normal.xy += vec2(normal.x >= 0.0 ? -t : t, normal.y >= 0.0 ? -t : t);
+    uv = record.uvTransform.xy + unpackUnorm2x16(packedVertex.w) * record.uvTransform.zw;
+#else
+    uint base = index * 8u;
+    position = vec3(arenaVertices[base], arenaVertices[base + 1u], arenaVertices[base + 2u]);
+    normal = vec3(arenaVertices[base + 3u], arenaVertices[base + 4u], arenaVertices[base + 5u]);
+    uv = vec2(arenaVertices[base + 6u], arenaVertices[base + 7u]);
+#endif
+}
+
+// Perspective correct barycentrics of ndc inside the clip space triangle, and their change over one pixel in x and y
+void CalcBarycentrics(vec4 p0, vec4 p1, vec4 p2, vec2 ndc, out vec3 lambda, out vec3 ddx, out vec3 ddy)
+{
+    vec3 invW = 1.0 / vec3(p0.w, p1.w, p2.w);
+    vec2 ndc0 = p0.xy * invW.x;
+    vec2 ndc1 = p1.xy * invW.y;
+    vec2 ndc2 = p2.xy * invW.z;
+    float invDet = 1.0 / determinant(mat2(ndc2 - ndc1, ndc0 - ndc1));
+    // screen space gradients of lambda / w
+    vec3 dx = vec3(ndc1.y - ndc2.y, ndc2.y - ndc0.y, ndc0.y - ndc1.y) * invDet * invW;
+    vec3 dy = vec3(ndc2.x - ndc1.x, ndc0.x - ndc2.x, ndc1.x - ndc0.x) * invDet * invW;
+    float dxSum = dx.x + dx.y + dx.z;
+    float dySum = dy.x + dy.y + dy.z;
+
+    vec2 delta = ndc - ndc0;
+    float interpInvW = invW.x + delta.x * dxSum + delta.y * dySum;
+    vec3 lambdaOverW = vec3(invW.x, 0.0, 0.0) + delta.x * dx + delta.y * dy;
+    lambda = lambdaOverW / interpInvW;
+
+    vec2 pixel = 2.0 / viewportSize;
+    ddx = (lambdaOverW + pixel.x * dx) / (interpInvW + pixel.x * dxSum) - lambda;
+    ddy = (lambdaOverW + pixel.y * dy) / (interpInvW + pixel.y * dySum) - lambda;
+}
+
+void main()
+{
+    uint id = texelFetch(visibilityIDs, ivec2(gl_FragCoord.xy), 0).r;
+    if(id == EMPTY_ID)
+        discard;
+    uint drawIndex = VisibilityDraw(id);
+    uvec4 draw = visibilityDraws[drawIndex];
+    if(draw.z != uint(materialIndex))
+        discard;
+
+    DrawRecord record = drawRecords[drawIndex];
+    uint firstIndex = draw.x + VisibilityPrimitive(id) * 3u;
+    vec3 positions[3];
+    vec3 normals[3];
+    vec2 uvs[3];
+    vec4 clip[3];
+    for(int i = 0; i < 3; i++)
+    {
+        FetchVertex(arenaIndices[firstIndex + uint(i)] + draw.y, record, positions[i], normals[i], uvs[i]);
+        positions[i] = vec3(record.model * vec4(positions[i], 1.0));
+        clip[i] = projection * view * vec4(positions[i], 1.0);
+    }
+    vec3 lambda, ddx, ddy;
+    CalcBarycentrics(clip[0], clip[1], clip[2], gl_FragCoord.xy / viewportSize * 2.0 - 1.0, lambda, ddx, ddy);
+
+    fs_in.FragPos = lambda.x * positions[0] + lambda.y * positions[1] + lambda.z * positions[2];
+    for(int i = 0; i < SHADOW_SLOTS; i++)
+        fs_in.FragPosLightSpace[i] = lightSpaceMatrix[i] * vec4(fs_in.FragPos, 1.0);
+    vec3 objectNormal = lambda.x * normals[0] + lambda.y * normals[1] + lambda.z * normals[2];
+    vec2 uv = lambda.x * uvs[0] + lambda.y * uvs[1] + lambda.z * uvs[2];
+    vec2 uvDx = ddx.x * uvs[0] + ddx.y * uvs[1] + ddx.z * uvs[2];
+    vec2 uvDy = ddy.x * uvs[0] + ddy.y * uvs[1] + ddy.z * uvs[2];
+
+    vec3 viewPos = viewPosition.xyz;
+    vec3 norm = normalize(mat3(transpose(inverse(record.model))) * objectNormal);
+    vec3 viewDir = normalize(viewPos - fs_in.FragPos);
+    vec3 albedo = textureGrad(material.diffuse, uv, uvDx, uvDy).rgb;
+    float specularMask = textureGrad(material.specular, uv, uvDx, uvDy).x;
+
+    vec3 result = vec3(0.0);
+    APPLY_LIGHTS
+#ifdef CLUSTERED_LIGHTS
+    result += CalcClusteredLights(norm, fs_in.FragPos, viewDir, albedo, specularMask);
+#endif
+
+    FragColor = vec4(result, 1.0);
+    gl_FragDepth = texelFetch(visibilityDepth, ivec2(gl_FragCoord.xy), 0).r;
+}
@@ -0,0 +1,1325 @@
+#include <glad/gl.h>
+#include <GLFW/glfw3.h>
+
+#include <multiproject/camera.h>
+#include <multiproject/model.h>
+#include <multiproject/clusteredlights.h>
+#include <multiproject/culling.h>
+#include <multiproject/depthprepass.h>
+#include <multiproject/glstate.h>
+#include <multiproject/indirectdraw.h>
+#include <multiproject/instanceculler.h>
+#include <multiproject/hizculler.h>
+#include <multiproject/postprocesseffect.h>
+#include <multiproject/renderqueue.h>
+#include <multiproject/softwareocclusion.h>
+#include <multiproject/meshcache.h>
+#include <multiproject/texturecache.h>
+#include <multiproject/shader.h>
+#include <multiproject/shadervariants.h>
+#include <multiproject/light.h>
+#include <multiproject/lightbuffer.h>
+#include <multiproject/filesystem.h>
+#include <multiproject/processmemory.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+// Offscreen benchmarks for the loading and rendering paths of the multiproject headers.
+// Usage: benchmarks [name]   (runs every benchmark when no name is given)
+// Entries ending in "test" check results instead of timing them, clusteredlights also checks its froxel lists and
+// vertexformat its image diff (PSNR of at least 40 dB); the exit code is 1 when a check failed.
+
+int failedTests = 0;
+
+const char* benchmarkModels[] = {
+    "resources/objects/backpack/backpack.obj",
+    "resources/objects/nanosuit/nanosuit.obj",
+    "resources/objects/cyborg/cyborg.obj",
+    "resources/objects/planet/planet.obj",
+    "resources/objects/rocks/rock_001.obj",
+};
+
+// Cold load goes through Assimp and writes the mesh cache, warm load maps the cache
+void benchmarkMeshCache()
+{
+    std::cout << "== mesh cache: cold vs warm load ==" << std::endl;
+    for(const char* model : benchmarkModels)
+    {
+        std::string path = FileSystem::getPath(model);
+        if(!std::filesystem::exists(path))
+            continue;
+
+        std::error_code error;
+        std::filesystem::remove(MeshCache::GetCachePath(path), error);
+
+        Model cold(path.c_str());
+        Model warm(path.c_str());
+        std::cout << model << ": cold " << cold.loadMilliseconds << " ms, warm " << warm.loadMilliseconds << " ms"
+                  << (warm.loadedFromCache ? "" : " (cache miss)") << std::endl;
+    }
+}
+
+// Same model loaded with serial and parallel image decoding; meshes come from the (warm) mesh cache both times
+void benchmarkTextureDecode()
+{
+    std::cout << "== texture decoding: serial vs parallel (" << ThreadPool::Shared().Size() << " workers) ==" << std::endl;
+    for(const char* model : benchmarkModels)
+    {
+        std::string path = FileSystem::getPath(model);
+        if(!std::filesystem::exists(path))
+            continue;
+
+        // each model is unloaded before the next one so neither run is served by the TextureCache
+        ModelLoadOptions serialOptions;
+        serialOptions.parallelTextureDecode = false;
+        auto serial = std::make_unique<Model>(path.c_str(), 1, std::vector<glm::mat4>{}, serialOptions);
+        double serialTotal = serial->loadMilliseconds, serialTextures = serial->textureMilliseconds;
+        serial.reset();
+        auto parallel = std::make_unique<Model>(path.c_str());
+        std::cout << model << ": serial " << serialTotal << " ms, parallel " << parallel->loadMilliseconds << " ms"
+                  << " (textures " << serialTextures << " ms -> " << parallel->textureMilliseconds << " ms)" << std::endl;
+    }
+}
+
+// Loads every model twice while the first copies are alive, so the second round should only hit the TextureCache
+void benchmarkTextureCache()
+{
+    TextureCache &cache = TextureCache::Instance();
+    cache.contentDeduplication = true;
+    cache.ResetCounters();
+    std::cout << "== texture cache: shared textures across models ==" << std::endl;
+    {
+        std::vector<std::unique_ptr<Model>> models;
+        for(int round = 0; round < 2; round++)
+            for(const char* model : benchmarkModels)
+            {
+                std::string path = FileSystem::getPath(model);
+                if(std::filesystem::exists(path))
+                    models.push_back(std::make_unique<Model>(path.c_str()));
+            }
+        const TextureCache::Stats &stats = cache.GetStats();
+        std::cout << "hits " << stats.hits << ", content hits " << stats.contentHits << ", misses " << stats.misses
+                  << ", live textures " << stats.textures << std::endl;
+    }
+    std::cout << "live textures after unloading: " << cache.GetStats().textures << std::endl;
+    cache.contentDeduplication = false;
+}
+
+// GPU memory of every model's textures, uncompressed vs the .ktx2 files written by ktxconverter
+void benchmarkTextureMemory()
+{
+    TextureCache &cache = TextureCache::Instance();
+    std::cout << "== texture memory: uncompressed vs KTX2 ==" << std::endl;
+    for(const char* model : benchmarkModels)
+    {
+        std::string path = FileSystem::getPath(model);
+        if(!std::filesystem::exists(path))
+            continue;
+
+        size_t footprint[2];
+        double milliseconds[2];
+        for(int compressed = 0; compressed < 2; compressed++)
+        {
+            ModelLoadOptions options;
+            options.preferCompressedTextures = compressed == 1;
+            size_t before = cache.GetStats().bytes;
+            Model loaded(path.c_str(), 1, {}, options);
+            footprint[compressed] = cache.GetStats().bytes - before;
+            milliseconds[compressed] = loaded.textureMilliseconds;
+        }
+        std::cout << model << ": " << footprint[0] / 1024 << " KiB -> " << footprint[1] / 1024 << " KiB"
+                  << " (texture load " << milliseconds[0] << " ms -> " << milliseconds[1] << " ms)" << std::endl;
+    }
+}
+
+// Builds the shadowmapping programs from source, then with an empty and a filled program binary cache
+void benchmarkShaderCache()
+{
+    ProgramBinaryCache &cache = ProgramBinaryCache::Instance();
+    std::cout << "== shader cache: source vs program binary ==" << std::endl;
+
+    auto buildPrograms = [&]()
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        Shader programs[] = {
+            Shader("depthmap.vs", "depthmap.fs"),
+            Shader("depthcubemap.vs", "depthcubemap.fs", "depthcubemap.gs"),
+            Shader("defaultNoUboShadow.vs", "defaultShadow.fs"),
+            Shader("postprocess.vs", "postprocess.fs"),
+        };
+        for(Shader &program : programs)
+            program.Finish();
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        for(Shader &program : programs)
+            program.Delete();
+        return milliseconds;
+    };
+
+    cache.enabled = false;
+    double source = buildPrograms();
+    cache.enabled = true;
+    std::error_code error;
+    std::filesystem::remove_all(cache.directory, error);
+    double cold = buildPrograms();
+    ProgramBinaryCache::Stats coldStats = cache.GetStats();
+    double warm = buildPrograms();
+    ProgramBinaryCache::Stats warmStats = cache.GetStats();
+
+    std::cout << "source: " << source << " ms, cold cache: " << cold << " ms, warm cache: " << warm << " ms" << std::endl;
+    std::cout << "warm hits " << warmStats.hits - coldStats.hits << ", misses " << warmStats.misses - coldStats.misses
+              << ", rejected " << warmStats.rejected << " (overall hit rate " << cache.HitRate() * 100.0f << "%)" << std::endl;
+}
+
+// Same programs with the binary cache off: each one checked right after submission vs all submitted before the first check.
+// Unique defines per run keep the driver's own shader cache from serving the later runs.
+void benchmarkShaderCompile()
+{
+    ProgramBinaryCache &cache = ProgramBinaryCache::Instance();
+    cache.enabled = false;
+    std::cout << "== shader compile: serial vs batched (parallel compile " << (Shader::ParallelCompileSupported() ? "supported" : "not supported") << ") ==" << std::endl;
+
+    const char* stages[][3] = {
+        { "depthmap.vs", "depthmap.fs", nullptr },
+        { "depthcubemap.vs", "depthcubemap.fs", "depthcubemap.gs" },
+        { "defaultNoUboShadow.vs", "defaultShadow.fs", nullptr },
+        { "postprocess.vs", "postprocess.fs", nullptr },
+    };
+    int run = 0;
+    for(int batched = 0; batched < 2; batched++)
+    {
+        std::string defines = "#define BENCHMARK_RUN " + std::to_string(run++);
+        auto start = std::chrono::high_resolution_clock::now();
+        std::vector<std::unique_ptr<Shader>> programs;
+        for(const auto &program : stages)
+        {
+            programs.push_back(std::make_unique<Shader>(program[0], program[1], program[2], defines));
+            if(!batched)
+                programs.back()->Finish();
+        }
+        for(auto &program : programs)
+            program->Finish();
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        for(auto &program : programs)
+            program->Delete();
+        std::cout << (batched ? "batched: " : "serial: ") << milliseconds << " ms" << std::endl;
+    }
+    cache.enabled = true;
+}
+
+// Renders every model with full precision and quantized vertices and compares the images (lit with one directional light)
+void benchmarkVertexFormat()
+{
+    const int size = 512;
+    std::cout << "== vertex format: float vs quantized ==" << std::endl;
+
+    GLuint framebuffer, color, depth;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glGenRenderbuffers(1, &color);
+    glBindRenderbuffer(GL_RENDERBUFFER, color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, size, size);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+    glGenRenderbuffers(1, &depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size, size);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+    glViewport(0, 0, size, size);
+    glEnable(GL_DEPTH_TEST);
+
+    DirectionalLight light(glm::vec3(0.05f), glm::vec3(0.8f), glm::vec3(1.0f), false, 2, 0, glm::vec3(-2.0f, -4.0f, -1.0f));
+    DirectionalLight* lights[] = { &light };
+    ShaderVariants litVariants("defaultNoUboShadow.vs", "defaultShadow.fs");
+    ShaderPermutation permutation = LightPermutation(lights, {}, {}, true);
+    LightBuffer lightBuffer(lights, {}, {});
+    lightBuffer.SetCamera(glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 100.0f),
+                          glm::lookAt(glm::vec3(0.0f, 0.0f, 6.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f)), glm::vec3(0.0f, 0.0f, 6.0f));
+    lightBuffer.Update();
+
+    for(const char* model : benchmarkModels)
+    {
+        std::string path = FileSystem::getPath(model);
+        if(!std::filesystem::exists(path))
+            continue;
+
+        std::vector<unsigned char> images[2];
+        size_t vertexBytes[2];
+        for(int quantized = 0; quantized < 2; quantized++)
+        {
+            ModelLoadOptions options;
+            options.vertexFormat = quantized ? VertexFormat::Quantized : VertexFormat::Float;
+            Model loaded(path.c_str(), 1, {}, options);
+            vertexBytes[quantized] = loaded.VertexBytes();
+
+            ShaderPermutation variant = permutation;
+            if(quantized)
+                variant.Define("QUANTIZED_VERTICES");
+            Shader &shader = litVariants.Get(variant);
+            shader.Activate();
+            shader.setMat4("model", glm::mat4(1.0f));
+            shader.setFloat("material.shininess", 32.0f);
+
+            glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            loaded.Draw(shader);
+            images[quantized].resize(size_t(size) * size * 4);
+            glReadPixels(0, 0, size, size, GL_RGBA, GL_UNSIGNED_BYTE, images[quantized].data());
+        }
+
+        int maxDifference = 0;
+        double squaredError = 0.0;
+        size_t differingPixels = 0;
+        for(size_t i = 0; i < images[0].size(); i += 4)
+        {
+            int pixelDifference = 0;
+            for(int c = 0; c < 3; c++)
+            {
+                int difference = std::abs(int(images[0][i + c]) - int(images[1][i + c]));
+                pixelDifference = std::max(pixelDifference, difference);
+                squaredError += double(difference) * difference;
+            }
+            maxDifference = std::max(maxDifference, pixelDifference);
+            differingPixels += pixelDifference > 8 ? 1 : 0;
+        }
+        double meanSquaredError = squaredError / (double(size) * size * 3);
+        double psnr = meanSquaredError > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / meanSquaredError) : 99.0;
+        bool matches = psnr >= 40.0 && differingPixels * 1000 < size_t(size) * size;
+        std::cout << model << ": vertices " << vertexBytes[0] / 1024 << " KiB -> " << vertexBytes[1] / 1024 << " KiB, PSNR " << psnr
+                  << " dB, max difference " << maxDifference << ", " << differingPixels << " pixels off by more than 8 "
+                  << (matches ? "(match)" : "(MISMATCH)") << std::endl;
+        if(!matches)
+            failedTests++;
+    }
+
+    litVariants.Delete();
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteRenderbuffers(1, &color);
+    glDeleteRenderbuffers(1, &depth);
+}
+
+// Vertex cache efficiency of every model in resources/objects as imported and after Model's optimization stage.
+// Imports through Assimp directly, without creating any GL objects.
+void benchmarkMeshOptimize()
+{
+    std::cout << "== mesh optimization: ACMR / ATVR (16 entry FIFO) ==" << std::endl;
+    MeshOptimizationStats total;
+    for(const auto &entry : std::filesystem::recursive_directory_iterator(FileSystem::getPath("resources/objects")))
+    {
+        if(entry.path().extension() != ".obj")
+            continue;
+
+        Assimp::Importer importer;
+        const aiScene *scene = importer.ReadFile(entry.path().string(), Model::importFlags);
+        if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+            continue;
+        MeshOptimizationStats stats;
+        std::vector<Vertex> vertices;
+        std::vector<unsigned int> indices;
+        for(unsigned int i = 0; i < scene->mNumMeshes; i++)
+        {
+            Model::ReadMesh(scene->mMeshes[i], vertices, indices);
+            stats += optimizeMesh(vertices, indices);
+        }
+        total += stats;
+        std::cout << entry.path().filename().string() << ": vertices " << stats.before.vertices << " -> " << stats.after.vertices
+                  << ", ACMR " << stats.before.ACMR() << " -> " << stats.after.ACMR()
+                  << ", ATVR " << stats.before.ATVR() << " -> " << stats.after.ATVR() << std::endl;
+    }
+    std::cout << "total: vertices " << total.before.vertices << " -> " << total.after.vertices
+              << ", ACMR " << total.before.ACMR() << " -> " << total.after.ACMR()
+              << ", ATVR " << total.before.ATVR() << " -> " << total.after.ATVR() << std::endl;
+}
+
+// Triangles drawn by SelectLod (1 pixel error, 1080p) and GPU time of 100 depth-only draws, as the camera backs away
+void benchmarkLod()
+{
+    const float viewportHeight = 1080.0f;
+    const int draws = 100;
+    std::cout << "== LOD: triangles and depth-only draw time by distance ==" << std::endl;
+
+    Shader depthShader("depthmap.vs", "depthmap.fs");
+    GLuint query;
+    glGenQueries(1, &query);
+    glEnable(GL_DEPTH_TEST);
+
+    const char* models[] = { "resources/objects/planet/planet.obj", "resources/objects/rocks/rock_001.obj" };
+    for(const char* model : models)
+    {
+        std::string path = FileSystem::getPath(model);
+        if(!std::filesystem::exists(path))
+            continue;
+
+        Model loaded(path.c_str());
+        for(float distance : { 2.0f, 5.0f, 10.0f, 25.0f, 50.0f, 100.0f, 250.0f })
+        {
+            Camera camera(glm::vec3(0.0f, 0.0f, distance));
+            size_t triangles = loaded.SelectLod(camera, glm::mat4(1.0f), viewportHeight);
+
+            depthShader.Activate();
+            depthShader.setMat4("lightSpaceMatrix", glm::perspective(glm::radians(camera.Zoom), 1.0f, 0.1f, 1000.0f) * camera.GetViewMatrix());
+            depthShader.setMat4("model", glm::mat4(1.0f));
+            glClear(GL_DEPTH_BUFFER_BIT);
+            glBeginQuery(GL_TIME_ELAPSED, query);
+            for(int i = 0; i < draws; i++)
+                loaded.Draw(depthShader);
+            glEndQuery(GL_TIME_ELAPSED);
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+
+            std::cout << model << " at " << distance << ": " << triangles << " triangles, " << double(nanoseconds) / 1.0e6 / draws << " ms per draw" << std::endl;
+        }
+    }
+
+    glDeleteQueries(1, &query);
+    depthShader.Delete();
+}
+
+// a unit cube, 24 vertices and 12 triangles
+void makeCube(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices)
+{
+    for(int axis = 0; axis < 3; axis++)
+        for(float side : { -1.0f, 1.0f })
+        {
+            glm::vec3 normal(0.0f);
+            normal[axis] = side;
+            glm::vec3 u(0.0f), v(0.0f);
+            u[(axis + 1) % 3] = 1.0f;
+            v[(axis + 2) % 3] = side;
+            unsigned int base = static_cast<unsigned int>(vertices.size());
+            for(int corner = 0; corner < 4; corner++)
+            {
+                glm::vec2 uv(float(corner & 1), float(corner >> 1));
+                vertices.push_back({ 0.5f * (normal + (uv.x * 2.0f - 1.0f) * u + (uv.y * 2.0f - 1.0f) * v), normal, uv });
+            }
+            indices.insert(indices.end(), { base, base + 1, base + 2, base + 2, base + 1, base + 3 });
+        }
+}
+
+// CPU submission time of a frame of small meshes: one glDrawElements per mesh with its own VAO
+// against the shared geometry arena submitted with one glMultiDrawElementsIndirect
+void benchmarkDrawCalls()
+{
+    const int frames = 20;
+    std::cout << "== draw calls: per mesh glDrawElements vs glMultiDrawElementsIndirect ==" << std::endl;
+
+    std::vector<Vertex> cubeVertices;
+    std::vector<unsigned int> cubeIndices;
+    makeCube(cubeVertices, cubeIndices);
+
+    Shader directShader("depthmap.vs", "depthmap.fs");
+    Shader indirectShader("depthmap.vs", "depthmap.fs", nullptr, "#define INDIRECT_DRAWS 1\n");
+    glm::mat4 viewProjection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 500.0f) * glm::lookAt(glm::vec3(0.0f, 0.0f, 150.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glEnable(GL_DEPTH_TEST);
+
+    for(int meshCount : { 1024, 4096, 16384 })
+    {
+        std::vector<Mesh> direct, arena;
+        std::vector<glm::mat4> transforms;
+        direct.reserve(meshCount);
+        arena.reserve(meshCount);
+        int side = static_cast<int>(std::ceil(std::sqrt(float(meshCount))));
+        for(int i = 0; i < meshCount; i++)
+        {
+            direct.emplace_back(cubeVertices, cubeIndices, std::vector<Texture*>());
+            arena.emplace_back(cubeVertices, cubeIndices, std::vector<Texture*>(), 1, 0, VertexFormat::Float, std::vector<MeshLod>(), true);
+            transforms.push_back(glm::translate(glm::mat4(1.0f), glm::vec3(float(i % side - side / 2) * 1.5f, float(i / side - side / 2) * 1.5f, 0.0f)));
+        }
+
+        double milliseconds[2] = {};
+        double finishedMilliseconds[2] = {};
+        IndirectDrawList drawList;
+        for(int indirect = 0; indirect < 2; indirect++)
+        {
+            Shader &shader = indirect ? indirectShader : directShader;
+            shader.Activate();
+            shader.setMat4("lightSpaceMatrix", viewProjection);
+            glFinish();
+            for(int frame = 0; frame < frames; frame++)
+            {
+                glClear(GL_DEPTH_BUFFER_BIT);
+                auto start = std::chrono::steady_clock::now();
+                if(indirect)
+                {
+                    drawList.Clear();
+                    for(int i = 0; i < meshCount; i++)
+                        drawList.Add(arena[i], transforms[i]);
+                    drawList.Submit(shader, false);
+                }
+                else
+                    for(int i = 0; i < meshCount; i++)
+                    {
+                        shader.setMat4("model", transforms[i]);
+                        direct[i].Draw(shader);
+                    }
+                auto submitted = std::chrono::steady_clock::now();
+                glFinish();
+                milliseconds[indirect] += std::chrono::duration<double, std::milli>(submitted - start).count() / frames;
+                finishedMilliseconds[indirect] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+            }
+        }
+
+        std::cout << meshCount << " meshes: direct " << milliseconds[0] << " ms CPU (" << finishedMilliseconds[0] << " ms with GPU, " << meshCount << " draw calls), indirect "
+                  << milliseconds[1] << " ms CPU (" << finishedMilliseconds[1] << " ms with GPU, " << drawList.GetStats().drawCalls << " draw calls)" << std::endl;
+        drawList.Delete();
+    }
+
+    GeometryArena::Instance(VertexFormat::Float).Delete();
+    directShader.Delete();
+    indirectShader.Delete();
+}
+
+// 4096 cubes with one of 4 programs and 64 materials in random submission order: Mesh::Draw in that order vs a
+// RenderQueue sorted by state, with the program and texture binds of each
+void benchmarkRenderQueue()
+{
+    const int meshCount = 4096;
+    const int materialCount = 64;
+    const int frames = 20;
+    std::cout << "== render queue: " << meshCount << " meshes, submission order vs sorted ==" << std::endl;
+
+    std::vector<Vertex> cubeVertices;
+    std::vector<unsigned int> cubeIndices;
+    makeCube(cubeVertices, cubeIndices);
+
+    // the textures are never filled, only bound
+    std::vector<std::unique_ptr<Texture>> textures;
+    for(int i = 0; i < materialCount * 2; i++)
+    {
+        textures.push_back(std::make_unique<Texture>(4, 4, 3, "renderqueue", i % 2 ? "specular" : "diffuse", GL_TEXTURE0));
+        textures.back()->MarkResident();
+    }
+
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 500.0f);
+    glm::vec3 viewPosition(0.0f, 0.0f, 150.0f);
+    glm::mat4 view = glm::lookAt(viewPosition, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    DirectionalLight light(glm::vec3(0.05f), glm::vec3(0.8f), glm::vec3(1.0f), false, 2, 0, glm::vec3(-2.0f, -4.0f, -1.0f));
+    DirectionalLight* oneLight[] = { &light };
+    DirectionalLight* twoLights[] = { &light, &light };
+    ShaderVariants litVariants("defaultNoUboShadow.vs", "defaultShadow.fs");
+    LightBuffer lightBuffer(twoLights, {}, {});
+    lightBuffer.SetCamera(projection, view, viewPosition);
+    lightBuffer.Update();
+    std::vector<Shader*> programs;
+    for(bool blinn : { false, true })
+    {
+        programs.push_back(&litVariants.Get(LightPermutation(oneLight, {}, {}, blinn)));
+        programs.push_back(&litVariants.Get(LightPermutation(twoLights, {}, {}, blinn)));
+    }
+    for(Shader *program : programs)
+    {
+        program->Activate();
+        program->setFloat("material.shininess", 32.0f);
+    }
+
+    std::mt19937 random(3);
+    std::vector<Mesh> meshes;
+    std::vector<Shader*> meshPrograms;
+    std::vector<glm::mat4> transforms;
+    meshes.reserve(meshCount);
+    int side = static_cast<int>(std::ceil(std::sqrt(float(meshCount))));
+    for(int i = 0; i < meshCount; i++)
+    {
+        int material = static_cast<int>(random() % materialCount);
+        std::vector<Texture*> meshTextures = { textures[material * 2].get(), textures[material * 2 + 1].get() };
+        meshes.emplace_back(cubeVertices, cubeIndices, meshTextures, 1, 0, VertexFormat::Float, std::vector<MeshLod>(), true);
+        meshPrograms.push_back(programs[random() % programs.size()]);
+        transforms.push_back(glm::translate(glm::mat4(1.0f), glm::vec3(float(i % side - side / 2) * 1.5f, float(i / side - side / 2) * 1.5f, 0.0f)));
+    }
+
+    glEnable(GL_DEPTH_TEST);
+    RenderQueue queue;
+    double milliseconds[2] = {}, sortMilliseconds = 0.0;
+    GLState::Stats stateStats[2];
+    for(int sorted = 0; sorted < 2; sorted++)
+    {
+        glFinish();
+        GLState::Instance().ResetStats();
+        for(int frame = 0; frame < frames; frame++)
+        {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            auto start = std::chrono::steady_clock::now();
+            if(sorted)
+            {
+                queue.Begin(viewPosition, 500.0f);
+                for(int i = 0; i < meshCount; i++)
+                    queue.Add(0, *meshPrograms[i], meshes[i], transforms[i]);
+                auto sortStart = std::chrono::steady_clock::now();
+                queue.Sort();
+                sortMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sortStart).count() / frames;
+                queue.Execute(0);
+            }
+            else
+                for(int i = 0; i < meshCount; i++)
+                {
+                    meshPrograms[i]->Activate();
+                    meshPrograms[i]->setMat4("model", transforms[i]);
+                    meshes[i].Draw(*meshPrograms[i]);
+                }
+            glFinish();
+            milliseconds[sorted] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+        }
+        stateStats[sorted] = GLState::Instance().GetStats();
+    }
+
+    // Mesh::Draw binds the vertex array for every mesh; GLState drops the program and texture binds that change nothing
+    const RenderQueue::Stats &stats = queue.GetStats();
+    std::cout << "submission order: " << milliseconds[0] << " ms, " << meshCount << " vertex array binds, GL state "
+              << stateStats[0].issued / frames << " calls issued, " << stateStats[0].suppressed / frames << " suppressed per frame" << std::endl;
+    std::cout << "sorted: " << milliseconds[1] << " ms (radix sort " << sortMilliseconds << " ms), " << stats.programBinds << " program binds, "
+              << stats.materialChanges << " material changes, " << stats.textureBinds << " texture binds, " << stats.vertexArrayBinds << " vertex array binds, GL state "
+              << stateStats[1].issued / frames << " calls issued, " << stateStats[1].suppressed / frames << " suppressed per frame" << std::endl;
+
+    meshes.clear();
+    textures.clear();
+    litVariants.Delete();
+    GeometryArena::Instance(VertexFormat::Float).Delete();
+}
+
+// A field of cubes lit by 4 to 4096 small point lights: clustered forward shading against the baseline that shades
+// every light in front of the camera for every fragment (ClusteredLights::SetCulling(false)), plus the CPU time of
+// the light assignment on one thread and on the shared pool
+void benchmarkClusteredLights()
+{
+    const int width = 1280;
+    const int height = 720;
+    const int frames = 5;
+    const int field = 32;
+    std::cout << "== clustered lights: " << width << "x" << height << ", " << field * field << " cubes, forward vs clustered ==" << std::endl;
+
+    GLuint framebuffer, color, depth;
+    glGenFramebuffers(1, &framebuffer);
+    GLState::Instance().BindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glGenRenderbuffers(1, &color);
+    glBindRenderbuffer(GL_RENDERBUFFER, color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+    glGenRenderbuffers(1, &depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+    GLState::Instance().Apply(PipelineState().WithFramebuffer(framebuffer).WithViewport(0, 0, width, height));
+
+    std::vector<Vertex> cubeVertices;
+    std::vector<unsigned int> cubeIndices;
+    makeCube(cubeVertices, cubeIndices);
+    Texture diffuse(4, 4, 3, "clusteredlights", "diffuse", GL_TEXTURE0);
+    Texture specular(4, 4, 3, "clusteredlights", "specular", GL_TEXTURE1);
+    diffuse.MarkResident();
+    specular.MarkResident();
+    Mesh cube(cubeVertices, cubeIndices, { &diffuse, &specular });
+
+    const float fovY = glm::radians(45.0f), aspect = float(width) / float(height), nearPlane = 0.1f, farPlane = 300.0f;
+    glm::vec3 viewPosition(0.0f, 20.0f, 70.0f);
+    glm::mat4 projection = glm::perspective(fovY, aspect, nearPlane, farPlane);
+    glm::mat4 view = glm::lookAt(viewPosition, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    LightBuffer lightBuffer({}, {}, {});
+    lightBuffer.SetCamera(projection, view, viewPosition);
+    ShaderVariants litVariants("defaultNoUboShadow.vs", "defaultShadow.fs");
+    Shader &shader = litVariants.Get(LightPermutation({}, {}, {}, true).Define("CLUSTERED_LIGHTS"));
+    shader.Activate();
+    shader.setFloat("material.shininess", 32.0f);
+
+    std::vector<glm::mat4> transforms;
+    for(int z = 0; z < field; z++)
+        for(int x = 0; x < field; x++)
+            transforms.push_back(glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3((x - field / 2) * 3.0f, 0.0f, (z - field / 2) * 3.0f)), glm::vec3(2.0f)));
+
+    std::mt19937 random(11);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    ClusteredLights clusters;
+    for(unsigned int count : { 4u, 16u, 64u, 256u, 1024u, 4096u })
+    {
+        std::vector<PointLight> pointLights;
+        std::vector<PointLight*> lights;
+        pointLights.reserve(count);
+        for(unsigned int i = 0; i < count; i++)
+        {
+            glm::vec3 lightColor(unit(random), unit(random), unit(random));
+            glm::vec3 position((unit(random) - 0.5f) * field * 3.0f, 1.0f + unit(random) * 2.0f, (unit(random) - 0.5f) * field * 3.0f);
+            pointLights.emplace_back(glm::vec3(0.0f), lightColor * 0.5f, lightColor * 0.5f, false, 0, 0, 1.0f, 0.7f, 1.8f, position);
+            lights.push_back(&pointLights.back());
+        }
+
+        // every light against every froxel: a light reaching one of 4x4x4 points inside the froxel must be listed, and
+        // a listed light must touch the froxel's view space box (8 corners). Returns the froxels breaking either.
+        auto bruteForceMismatches = [&]() {
+            const unsigned int tiles = ClusteredLights::TilesX * ClusteredLights::TilesY;
+            const int samples = 4;
+            float tanY = std::tan(fovY * 0.5f), tanX = tanY * aspect;
+            auto froxelPoint = [&](unsigned int x, unsigned int y, unsigned int slice, glm::vec3 fraction) {
+                float ndcX = (float(x) + fraction.x) / float(ClusteredLights::TilesX) * 2.0f - 1.0f;
+                float ndcY = (float(y) + fraction.y) / float(ClusteredLights::TilesY) * 2.0f - 1.0f;
+                float depth = nearPlane * std::pow(farPlane / nearPlane, (float(slice) + fraction.z) / float(ClusteredLights::Slices));
+                return glm::vec3(ndcX * depth * tanX, ndcY * depth * tanY, -depth);
+            };
+            std::vector<glm::vec3> centers;
+            for(PointLight *light : lights)
+                centers.push_back(glm::vec3(view * glm::vec4(light->position, 1.0f)));
+            size_t mismatches = 0;
+            for(unsigned int cluster = 0; cluster < ClusteredLights::ClusterCount; cluster++)
+            {
+                unsigned int slice = cluster / tiles;
+                unsigned int x = cluster % ClusteredLights::TilesX, y = cluster % tiles / ClusteredLights::TilesX;
+                glm::vec3 boxMin(FLT_MAX), boxMax(-FLT_MAX);
+                for(int corner = 0; corner < 8; corner++)
+                {
+                    glm::vec3 point = froxelPoint(x, y, slice, glm::vec3(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1));
+                    boxMin = glm::min(boxMin, point);
+                    boxMax = glm::max(boxMax, point);
+                }
+                std::span<const uint32_t> listed = clusters.ClusterLights(cluster);
+                bool broken = false;
+                for(uint32_t i = 0; i < lights.size() && !broken; i++)
+                {
+                    float radius = lights[i]->Range();
+                    glm::vec3 offset = glm::clamp(centers[i], boxMin, boxMax) - centers[i];
+                    bool touchesBox = radius > 0.0f && glm::dot(offset, offset) <= radius * radius;
+                    bool isListed = std::find(listed.begin(), listed.end(), i) != listed.end();
+                    if(!touchesBox)
+                    {
+                        broken = isListed;
+                        continue;
+                    }
+                    bool reachesPoint = false;
+                    for(int sample = 0; sample < samples * samples * samples && !reachesPoint; sample++)
+                    {
+                        glm::vec3 fraction(sample % samples, sample / samples % samples, sample / (samples * samples));
+                        glm::vec3 point = froxelPoint(x, y, slice, (fraction + 0.5f) / float(samples));
+                        reachesPoint = glm::dot(point - centers[i], point - centers[i]) <= radius * radius;
+                    }
+                    broken = reachesPoint && !isListed;
+                }
+                mismatches += broken;
+            }
+            return mismatches;
+        };
+        auto buildMilliseconds = [&](bool threaded) {
+            clusters.SetThreaded(threaded);
+            auto start = std::chrono::steady_clock::now();
+            for(int frame = 0; frame < frames; frame++)
+                clusters.Build(lights, view, fovY, aspect, nearPlane, farPlane, width, height);
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+        };
+        double milliseconds[2];
+        ClusteredLights::Stats stats;
+        for(int culling = 0; culling < 2; culling++)
+        {
+            clusters.SetCulling(culling == 1);
+            clusters.Build(lights, view, fovY, aspect, nearPlane, farPlane, width, height);
+            clusters.Bind();
+            stats = clusters.GetStats();
+            glFinish();
+            auto start = std::chrono::steady_clock::now();
+            for(int frame = 0; frame < frames; frame++)
+            {
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                for(const glm::mat4 &transform : transforms)
+                {
+                    shader.setMat4("model", transform);
+                    cube.Draw(shader);
+                }
+            }
+            glFinish();
+            milliseconds[culling] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+        }
+        double single = buildMilliseconds(false);
+        double threaded = buildMilliseconds(true);
+        size_t mismatches = bruteForceMismatches();
+        std::cout << count << " lights (" << stats.lights << " in view): forward " << milliseconds[0] << " ms, clustered " << milliseconds[1]
+                  << " ms, " << float(stats.indices) / float(std::max(stats.litClusters, 1u)) << " lights per lit froxel (at most " << stats.maxPerCluster
+                  << "), assignment " << single << " ms single, " << threaded << " ms on " << ThreadPool::Shared().Size() << " workers, "
+                  << (mismatches == 0 ? "matches brute force" : "FAILED: " + std::to_string(mismatches) + " froxels differ from brute force") << std::endl;
+        if(mismatches > 0)
+            failedTests++;
+    }
+
+    litVariants.Delete();
+    GLState::Instance().BindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteRenderbuffers(1, &color);
+    glDeleteRenderbuffers(1, &depth);
+}
+
+// Peak and retained resident memory of an Assimp import, with and without the CPU copy of the meshes
+void benchmarkLoadMemory()
+{
+    std::cout << "== load memory: peak / retained RSS of an Assimp import ==" << std::endl;
+    const size_t mebibyte = 1024 * 1024;
+    for(const char* model : benchmarkModels)
+    {
+        std::string path = FileSystem::getPath(model);
+        if(!std::filesystem::exists(path))
+            continue;
+
+        for(int keep = 1; keep >= 0; keep--)
+        {
+            ModelLoadOptions options;
+            options.useMeshCache = false;
+            options.keepMeshData = keep;
+            bool resettable = ProcessMemory::ResetPeak();
+            size_t base = ProcessMemory::CurrentResidentBytes();
+            size_t peak, retained;
+            {
+                Model loaded(path.c_str(), 1, {}, options);
+                peak = ProcessMemory::PeakResidentBytes();
+                ProcessMemory::ReleaseFreeHeap();
+                retained = ProcessMemory::CurrentResidentBytes();
+            }
+            std::cout << model << (keep ? " (mesh data kept)" : " (mesh data dropped)") << ": peak +" << (peak - std::min(peak, base)) / mebibyte
+                      << " MiB, retained +" << (retained - std::min(retained, base)) / mebibyte << " MiB"
+                      << (resettable ? "" : " (peak not resettable here, includes earlier loads)") << std::endl;
+        }
+    }
+}
+
+// Frustum culling of 100k boxes scattered over a 2 km square: one box at a time, 4/8 at a time (SSE/AVX2), and
+// through the BVH, plus BVH build and refit times after every box moves
+void benchmarkCulling()
+{
+    const size_t objects = 100000;
+    const int repeats = 20;
+    std::cout << "== culling: " << objects << " boxes, scalar vs " << (cpuSupportsAVX2() ? "AVX2" : "SSE") << " vs BVH ==" << std::endl;
+
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> position(-1000.0f, 1000.0f), size(0.5f, 4.0f);
+    BoundsSoA bounds;
+    for(size_t i = 0; i < objects; i++)
+    {
+        glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(position(random), position(random) * 0.05f, position(random)));
+        bounds.Add(glm::vec3(-size(random)), glm::vec3(size(random)), transform);
+    }
+
+    Camera camera(glm::vec3(0.0f, 10.0f, 0.0f));
+    Frustum frustum = Frustum::FromMatrix(glm::perspective(glm::radians(camera.Zoom), 16.0f / 9.0f, 0.1f, 1000.0f) * camera.GetViewMatrix());
+    std::vector<uint8_t> visible(objects);
+    auto milliseconds = [&](auto &&run) {
+        auto start = std::chrono::high_resolution_clock::now();
+        for(int i = 0; i < repeats; i++)
+            run();
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / repeats;
+    };
+
+    double scalar = milliseconds([&]() { cullBoxesScalar(frustum, bounds, 0, objects, visible.data()); });
+    size_t scalarVisible = std::count(visible.begin(), visible.end(), 1);
+    CullStats simdStats;
+    double simd = milliseconds([&]() { simdStats = cullBoxes(frustum, bounds, visible); });
+
+    BoundsBVH bvh;
+    double build = milliseconds([&]() { bvh.Build(bounds); });
+    CullStats bvhStats;
+    double bvhCull = milliseconds([&]() { bvhStats = bvh.Cull(frustum, visible); });
+    for(size_t i = 0; i < objects; i++)
+        bounds.centerY[i] += 1.0f;
+    double refit = milliseconds([&]() { bvh.Refit(bounds); });
+
+    std::cout << "scalar: " << scalar << " ms, " << scalarVisible << " visible" << std::endl;
+    std::cout << "simd: " << simd << " ms, " << simdStats.visible << " visible" << std::endl;
+    std::cout << "bvh: " << bvhCull << " ms, " << bvhStats.visible << " visible, " << bvhStats.nodesVisited << " nodes visited, "
+              << bvhStats.boxesTested << " boxes tested (build " << build << " ms, refit " << refit << " ms)" << std::endl;
+}
+
+// Instanced model scattered around the camera: every instance drawn vs culled on the GPU each frame (instancecull.cs),
+// next to the cost of culling the same instance boxes on the CPU; the GPU path's CPU time should not grow with the count
+void benchmarkGpuCulling()
+{
+    const int frames = 20;
+    std::cout << "== GPU culling: instanced draw, all instances vs compute culled ==" << std::endl;
+
+    std::string path;
+    for(const char* model : benchmarkModels)
+        if(path.empty() && std::filesystem::exists(FileSystem::getPath(model)))
+            path = FileSystem::getPath(model);
+    if(path.empty())
+        return;
+
+    Shader shader("depthmap.vs", "depthmap.fs", nullptr, "#define INSTANCE_MATRICES 1\n");
+    glm::mat4 viewProjection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 500.0f) * glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    Frustum frustum = Frustum::FromMatrix(viewProjection);
+    glEnable(GL_DEPTH_TEST);
+
+    for(unsigned int instances : { 1000u, 10000u, 100000u })
+    {
+        std::mt19937 random(42);
+        std::uniform_real_distribution<float> position(-400.0f, 400.0f);
+        std::vector<glm::mat4> matrices;
+        for(unsigned int i = 0; i < instances; i++)
+            matrices.push_back(glm::translate(glm::mat4(1.0f), glm::vec3(position(random), position(random) * 0.1f, position(random))));
+
+        ModelLoadOptions options;
+        options.keepMeshData = false;
+        Model loaded(path.c_str(), instances, matrices, options);
+        InstanceCuller culler(loaded);
+        BoundsSoA bounds;
+        for(Mesh &mesh : loaded.Meshes())
+            for(const glm::mat4 &matrix : matrices)
+                bounds.Add(mesh.boundsMin, mesh.boundsMax, matrix);
+        std::vector<uint8_t> visible;
+
+        shader.Activate();
+        shader.setMat4("lightSpaceMatrix", viewProjection);
+        double milliseconds[2] = {};
+        double finishedMilliseconds[2] = {};
+        for(int culled = 0; culled < 2; culled++)
+        {
+            glFinish();
+            for(int frame = 0; frame < frames; frame++)
+            {
+                glClear(GL_DEPTH_BUFFER_BIT);
+                auto start = std::chrono::steady_clock::now();
+                if(culled)
+                {
+                    culler.Cull(frustum);
+                    culler.Draw(shader, false);
+                }
+                else
+                    loaded.Draw(shader);
+                auto submitted = std::chrono::steady_clock::now();
+                glFinish();
+                milliseconds[culled] += std::chrono::duration<double, std::milli>(submitted - start).count() / frames;
+                finishedMilliseconds[culled] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+            }
+        }
+        auto cpuStart = std::chrono::steady_clock::now();
+        CullStats cpuStats = cullBoxes(frustum, bounds, visible);
+        double cpuCull = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cpuStart).count();
+        CullStats gpuStats = culler.ReadStats();
+
+        std::cout << instances << " instances: all " << milliseconds[0] << " ms CPU (" << finishedMilliseconds[0] << " ms with GPU), culled "
+                  << milliseconds[1] << " ms CPU (" << finishedMilliseconds[1] << " ms with GPU, " << gpuStats.visible << "/" << gpuStats.objects
+                  << " visible); CPU cull of the same boxes " << cpuCull << " ms (" << cpuStats.visible << " visible)" << std::endl;
+    }
+    shader.Delete();
+}
+
+// A wall of cubes in front of a 16k cube field, drawn into a 1024x1024 framebuffer: GPU time of the plain indirect
+// submission against the two phase Hi-Z culled one, and the draws skipped once the counters have come back
+void benchmarkOcclusion()
+{
+    const int frames = 30;
+    const unsigned int size = 1024;
+    std::cout << "== occlusion: Hi-Z two phase culling behind a wall ==" << std::endl;
+
+    std::vector<Vertex> cubeVertices;
+    std::vector<unsigned int> cubeIndices;
+    makeCube(cubeVertices, cubeIndices);
+    std::vector<Mesh> cubes;
+    std::vector<glm::mat4> transforms;
+    const int fieldSide = 128;
+    cubes.reserve(fieldSide * fieldSide + 1);
+    cubes.emplace_back(cubeVertices, cubeIndices, std::vector<Texture*>(), 1, 0, VertexFormat::Float, std::vector<MeshLod>(), true);
+    transforms.push_back(glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -20.0f)), glm::vec3(60.0f, 60.0f, 1.0f)));
+    for(int i = 0; i < fieldSide * fieldSide; i++)
+    {
+        cubes.emplace_back(cubeVertices, cubeIndices, std::vector<Texture*>(), 1, 0, VertexFormat::Float, std::vector<MeshLod>(), true);
+        transforms.push_back(glm::translate(glm::mat4(1.0f), glm::vec3(float(i % fieldSide - fieldSide / 2) * 1.5f, float(i / fieldSide - fieldSide / 2) * 1.5f, -60.0f)));
+    }
+
+    PostProcessEffect target(size, size);
+    Shader shader("depthmap.vs", "depthmap.fs", nullptr, "#define INDIRECT_DRAWS 1\n");
+    glm::mat4 viewProjection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 500.0f);
+    IndirectDrawList drawList;
+    for(size_t i = 0; i < cubes.size(); i++)
+        drawList.Add(cubes[i], transforms[i]);
+    HiZCuller hiZCuller;
+    GLuint query;
+    glGenQueries(1, &query);
+    glEnable(GL_DEPTH_TEST);
+    glViewport(0, 0, size, size);
+
+    double milliseconds[2] = {};
+    for(int occlusion = 0; occlusion < 2; occlusion++)
+    {
+        shader.Activate();
+        shader.setMat4("lightSpaceMatrix", viewProjection);
+        for(int frame = 0; frame < frames; frame++)
+        {
+            target.Bind();
+            glClear(GL_DEPTH_BUFFER_BIT);
+            glBeginQuery(GL_TIME_ELAPSED, query);
+            if(occlusion)
+            {
+                drawList.Prepare(false);
+                hiZCuller.CullFirst(drawList, viewProjection);
+                drawList.Draw(shader);
+                target.ResolveDepth();
+                hiZCuller.BuildPyramid(target.depthTexture, size, size);
+                hiZCuller.CullSecond(drawList, viewProjection);
+                drawList.Draw(shader);
+            }
+            else
+                drawList.Submit(shader, false);
+            glEndQuery(GL_TIME_ELAPSED);
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+            milliseconds[occlusion] += double(nanoseconds) / 1.0e6 / frames;
+        }
+    }
+    target.Unbind();
+
+    const HiZCuller::Stats &stats = hiZCuller.LastStats();
+    std::cout << cubes.size() << " draws: plain " << milliseconds[0] << " ms GPU, Hi-Z culled " << milliseconds[1] << " ms GPU ("
+              << stats.visibleFirst << " drawn first, " << stats.visibleSecond << " after the re-test, " << stats.Skipped() << " skipped)" << std::endl;
+
+    glDeleteQueries(1, &query);
+    drawList.Delete();
+    shader.Delete();
+    GeometryArena::Instance(VertexFormat::Float).Delete();
+}
+
+// A stack of lit walls drawn back to front, the worst case for overdraw: GPU time and fragment shader invocations
+// (pipeline statistics) of the lit pass alone and behind a depth pre-pass of the walls DepthPrepass selects
+void benchmarkDepthPrepass()
+{
+    const int frames = 20;
+    const unsigned int size = 1024;
+    const int layers = 16;
+    std::cout << "== depthprepass: " << layers << " walls back to front, " << size << "x" << size << " ==" << std::endl;
+
+    std::vector<Vertex> cubeVertices;
+    std::vector<unsigned int> cubeIndices;
+    makeCube(cubeVertices, cubeIndices);
+    Texture diffuse(4, 4, 3, "depthprepass", "diffuse", GL_TEXTURE0);
+    Texture specular(4, 4, 3, "depthprepass", "specular", GL_TEXTURE1);
+    diffuse.MarkResident();
+    specular.MarkResident();
+    std::vector<Mesh> walls;
+    walls.reserve(layers);
+    IndirectDrawList drawList;
+    for(int layer = 0; layer < layers; layer++)
+    {
+        walls.emplace_back(cubeVertices, cubeIndices, std::vector<Texture*>{ &diffuse, &specular }, 1, 0, VertexFormat::Float, std::vector<MeshLod>(), true);
+        glm::vec3 offset(float(layer % 4) - 1.5f, float(layer / 4) - 1.5f, -60.0f + float(layer) * 2.0f);
+        drawList.Add(walls.back(), glm::scale(glm::translate(glm::mat4(1.0f), offset), glm::vec3(40.0f, 40.0f, 0.5f)));
+    }
+
+    std::vector<PointLight> pointLights;
+    std::vector<PointLight*> lights;
+    for(int i = 0; i < 4; i++)
+    {
+        pointLights.emplace_back(glm::vec3(0.05f), glm::vec3(0.5f), glm::vec3(1.0f), false, 0, 0, 1.0f, 0.09f, 0.032f,
+                                 glm::vec3(float(i % 2) * 20.0f - 10.0f, float(i / 2) * 20.0f - 10.0f, -20.0f));
+    }
+    for(PointLight &light : pointLights)
+        lights.push_back(&light);
+
+    const float fovY = glm::radians(45.0f);
+    glm::vec3 viewPosition(0.0f);
+    glm::mat4 projection = glm::perspective(fovY, 1.0f, 0.1f, 500.0f);
+    LightBuffer lightBuffer({}, lights, {});
+    lightBuffer.SetCamera(projection, glm::mat4(1.0f), viewPosition);
+    lightBuffer.Update();
+    ShaderVariants litVariants("defaultNoUboShadow.vs", "defaultShadow.fs");
+    Shader &litShader = litVariants.Get(LightPermutation({}, lights, {}, true).Define("INDIRECT_DRAWS"));
+    litShader.Activate();
+    litShader.setFloat("material.shininess", 32.0f);
+    Shader prepassShader("depthprepass.vs", "depthmap.fs", nullptr, "#define INDIRECT_DRAWS 1\n");
+
+    PostProcessEffect target(size, size);
+    const PipelineState passState = PipelineState().WithFramebuffer(target.framebuffer).WithViewport(0, 0, size, size);
+    DepthPrepass depthPrepass;
+    std::vector<uint8_t> visible(drawList.Size(), 1), prepassVisible, directVisible;
+    depthPrepass.Select(drawList, visible, viewPosition, fovY, size, size, prepassVisible, directVisible);
+    GLuint queries[2];
+    glGenQueries(2, queries);
+
+    for(int prepass = 0; prepass < 2; prepass++)
+    {
+        double milliseconds = 0.0;
+        GLuint64 invocations = 0;
+        for(int frame = 0; frame < frames; frame++)
+        {
+            GLState::Instance().Apply(passState);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glBeginQuery(GL_TIME_ELAPSED, queries[0]);
+            glBeginQuery(GL_FRAGMENT_SHADER_INVOCATIONS, queries[1]);
+            if(prepass)
+            {
+                drawList.Prepare(true, &prepassVisible);
+                drawList.Draw(prepassShader, false);
+                GLState::Instance().Apply(passState.WithDepthTest(true, GL_EQUAL).WithDepthWrite(false));
+                drawList.Draw(litShader);
+                GLState::Instance().Apply(passState);
+                drawList.Submit(litShader, true, &directVisible);
+            }
+            else
+                drawList.Submit(litShader, true, &visible);
+            glEndQuery(GL_FRAGMENT_SHADER_INVOCATIONS);
+            glEndQuery(GL_TIME_ELAPSED);
+            GLuint64 nanoseconds = 0, fragments = 0;
+            glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &nanoseconds);
+            glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &fragments);
+            milliseconds += double(nanoseconds) / 1.0e6 / frames;
+            invocations += fragments / frames;
+        }
+        const DepthPrepass::Stats &stats = depthPrepass.GetStats();
+        std::cout << (prepass ? "pre-pass (" + std::to_string(stats.selected) + "/" + std::to_string(drawList.Size()) + " walls): " : "lit only: ")
+                  << milliseconds << " ms GPU, " << invocations << " fragment shader invocations, "
+                  << double(invocations) / double(size * size) << " per pixel" << std::endl;
+    }
+
+    glDeleteQueries(2, queries);
+    GLState::Instance().BindFramebuffer(GL_FRAMEBUFFER, 0);
+    drawList.Delete();
+    prepassShader.Delete();
+    litVariants.Delete();
+    GeometryArena::Instance(VertexFormat::Float).Delete();
+}
+
+// Street level view of a synthetic city: a 24x24 grid of box buildings are the occluders, 100k props stand in the
+// streets and on the roofs. Frustum culling first, then the software occlusion test of the survivors; rasterization
+// and testing are timed scalar/AVX2 and single/multi threaded.
+void benchmarkSoftwareOcclusion()
+{
+    const int blocks = 24;
+    const float blockSize = 40.0f, streetWidth = 12.0f;
+    const size_t props = 100000;
+    const int repeats = 20;
+    std::cout << "== softwareocclusion: city of " << blocks * blocks << " buildings, " << props << " props ==" << std::endl;
+
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> height(8.0f, 60.0f), unit(0.0f, 1.0f);
+    float half = blocks * blockSize * 0.5f;
+    std::vector<glm::vec3> buildingMin, buildingMax;
+    BoundsSoA buildings;
+    for(int z = 0; z < blocks; z++)
+        for(int x = 0; x < blocks; x++)
+        {
+            glm::vec3 min(x * blockSize - half + streetWidth * 0.5f, 0.0f, z * blockSize - half + streetWidth * 0.5f);
+            glm::vec3 max = min + glm::vec3(blockSize - streetWidth, height(random), blockSize - streetWidth);
+            buildingMin.push_back(min);
+            buildingMax.push_back(max);
+            buildings.Add(min, max, glm::mat4(1.0f));
+        }
+
+    BoundsSoA bounds;
+    for(size_t i = 0; i < props; i++)
+    {
+        glm::vec3 position(unit(random) * blocks * blockSize - half, 0.0f, unit(random) * blocks * blockSize - half);
+        // roughly a third on the roof of the building below
+        size_t building = size_t((position.z + half) / blockSize) * blocks + size_t((position.x + half) / blockSize);
+        if(i % 3 == 0)
+            position = glm::mix(buildingMin[building], buildingMax[building], glm::vec3(unit(random), 1.0f, unit(random)));
+        bounds.Add(position + glm::vec3(-0.5f, 0.0f, -0.5f), position + glm::vec3(0.5f, 1.0f + unit(random) * 2.0f, 0.5f), glm::mat4(1.0f));
+    }
+
+    // looking down an avenue, slightly up
+    Camera camera(glm::vec3(-half + blockSize * 3.0f, 1.8f, half - 2.0f), glm::vec3(0.0f, 1.0f, 0.0f), YAW, 2.0f);
+    glm::mat4 viewProjection = glm::perspective(glm::radians(camera.Zoom), 16.0f / 9.0f, 0.1f, 2000.0f) * camera.GetViewMatrix();
+    Frustum frustum = Frustum::FromMatrix(viewProjection);
+
+    std::vector<uint8_t> occluderVisible;
+    cullBoxes(frustum, buildings, occluderVisible);
+    OccluderMesh box = makeBoxOccluder(glm::vec3(0.0f), glm::vec3(1.0f));
+    std::vector<glm::mat4> occluders;
+    for(size_t i = 0; i < buildings.Size(); i++)
+        if(occluderVisible[i])
+            occluders.push_back(glm::scale(glm::translate(glm::mat4(1.0f), buildingMin[i]), buildingMax[i] - buildingMin[i]));
+
+    std::vector<uint8_t> frustumVisible;
+    CullStats frustumStats = cullBoxes(frustum, bounds, frustumVisible);
+
+    auto milliseconds = [&](auto &&run) {
+        auto start = std::chrono::high_resolution_clock::now();
+        for(int i = 0; i < repeats; i++)
+            run();
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / repeats;
+    };
+
+    SoftwareOcclusion occlusion;
+    std::vector<uint8_t> visible;
+    CullStats stats;
+    for(bool simd : { false, true })
+        for(bool threaded : { false, true })
+        {
+            if(simd && !cpuSupportsAVX2())
+                continue;
+            occlusion.SetSimd(simd);
+            occlusion.SetThreaded(threaded);
+            double raster = milliseconds([&]() {
+                occlusion.Begin(viewProjection);
+                for(const glm::mat4 &model : occluders)
+                    occlusion.AddOccluder(box, model);
+                occlusion.Rasterize();
+            });
+            double test = milliseconds([&]() {
+                visible = frustumVisible;
+                stats = occlusion.Test(bounds, visible);
+            });
+            std::cout << (simd ? "avx2" : "scalar") << (threaded ? " threaded" : " single") << ": raster " << raster << " ms ("
+                      << occlusion.GetStats().occluderTriangles << " triangles), test " << test << " ms" << std::endl;
+        }
+    std::cout << "frustum: " << frustumStats.visible << "/" << props << " visible, occlusion: " << stats.visible << " visible ("
+              << stats.boxesTested - stats.visible << " occluded) at " << occlusion.Width() << "x" << occlusion.Height() << std::endl;
+}
+
+// Correctness of SoftwareOcclusion without a GPU: a wall of box occluders in front of the camera, boxes hidden behind
+// it, in front of it, beside it, across its edge and through the near plane, plus random boxes for which every rasterization and test path
+// (scalar/AVX2, single/multi threaded) must agree with the scalar single threaded one
+void testSoftwareOcclusion()
+{
+    std::cout << "== softwareocclusiontest ==" << std::endl;
+    glm::mat4 viewProjection = glm::perspective(glm::radians(60.0f), 2.0f, 0.1f, 100.0f)
+                             * glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    OccluderMesh box = makeBoxOccluder(glm::vec3(0.0f), glm::vec3(1.0f));
+    std::vector<glm::mat4> occluders;
+    // 2x2 bricks of a wall spanning x and y in [-10, 10] at z = -10
+    for(int y = 0; y < 2; y++)
+        for(int x = 0; x < 2; x++)
+            occluders.push_back(glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(x * 10.0f - 10.0f, y * 10.0f - 10.0f, -11.0f)), glm::vec3(10.0f, 10.0f, 1.0f)));
+
+    struct Case { const char* name; glm::vec3 min, max; bool visible; };
+    const Case cases[] = {
+        { "behind the wall", glm::vec3(-1.0f, -1.0f, -21.0f), glm::vec3(1.0f, 1.0f, -19.0f), false },
+        { "behind two bricks", glm::vec3(-2.0f, 4.0f, -31.0f), glm::vec3(2.0f, 6.0f, -29.0f), false },
+        { "in front of the wall", glm::vec3(-1.0f, -1.0f, -6.0f), glm::vec3(1.0f, 1.0f, -4.0f), true },
+        { "beside the wall", glm::vec3(-23.0f, -1.0f, -21.0f), glm::vec3(-21.0f, 1.0f, -19.0f), true },
+        { "across the wall's edge", glm::vec3(18.0f, -1.0f, -21.0f), glm::vec3(22.0f, 1.0f, -19.0f), true },
+        { "through the wall", glm::vec3(-1.0f, -1.0f, -14.0f), glm::vec3(1.0f, 1.0f, -8.0f), true },
+        // not occlusion culled, left to the frustum test
+        { "through the near plane", glm::vec3(-1.0f, -1.0f, -1.0f), glm::vec3(1.0f, 1.0f, 1.0f), true },
+    };
+    BoundsSoA bounds;
+    for(const Case &c : cases)
+        bounds.Add(c.min, c.max, glm::mat4(1.0f));
+    std::mt19937 random(3);
+    std::uniform_real_distribution<float> position(-40.0f, 40.0f), depth(-60.0f, -1.0f), size(0.1f, 4.0f);
+    for(int i = 0; i < 5000; i++)
+    {
+        glm::vec3 min(position(random), position(random) * 0.5f, depth(random));
+        bounds.Add(min, min + glm::vec3(size(random), size(random), size(random)), glm::mat4(1.0f));
+    }
+
+    SoftwareOcclusion occlusion;
+    std::vector<uint8_t> reference;
+    bool passed = true;
+    for(bool simd : { false, true })
+        for(bool threaded : { false, true })
+        {
+            if(simd && !cpuSupportsAVX2())
+                continue;
+            occlusion.SetSimd(simd);
+            occlusion.SetThreaded(threaded);
+            occlusion.Begin(viewProjection);
+            for(const glm::mat4 &model : occluders)
+                occlusion.AddOccluder(box, model);
+            occlusion.Rasterize();
+            std::vector<uint8_t> visible;
+            CullStats stats = occlusion.Test(bounds, visible);
+
+            std::string path = std::string(simd ? "avx2" : "scalar") + (threaded ? " threaded" : " single");
+            for(size_t i = 0; i < std::size(cases); i++)
+                if(bool(visible[i]) != cases[i].visible)
+                {
+                    std::cout << "FAILED " << path << ": box " << cases[i].name << " is " << (visible[i] ? "visible" : "occluded") << std::endl;
+                    passed = false;
+                }
+            if(reference.empty())
+                reference = visible;
+            size_t mismatches = 0;
+            for(size_t i = 0; i < visible.size(); i++)
+                mismatches += visible[i] != reference[i];
+            if(mismatches > 0)
+            {
+                std::cout << "FAILED " << path << ": " << mismatches << " boxes differ from scalar single" << std::endl;
+                passed = false;
+            }
+            std::cout << path << ": " << stats.visible << "/" << stats.objects << " visible" << std::endl;
+        }
+    std::cout << (passed ? "passed" : "FAILED") << std::endl;
+    if(!passed)
+        failedTests++;
+}
+
+struct Benchmark
+{
+    const char* name;
+    void (*run)();
+    bool needsContext = true;
+};
+
+const Benchmark benchmarks[] = {
+    { "meshcache", benchmarkMeshCache },
+    { "texturedecode", benchmarkTextureDecode },
+    { "texturecache", benchmarkTextureCache },
+    { "texturememory", benchmarkTextureMemory },
+    { "shadercache", benchmarkShaderCache },
+    { "shadercompile", benchmarkShaderCompile },
+    { "vertexformat", benchmarkVertexFormat },
+    { "meshoptimize", benchmarkMeshOptimize, false },
+    { "lod", benchmarkLod },
+    { "drawcalls", benchmarkDrawCalls },
+    { "renderqueue", benchmarkRenderQueue },
+    { "clusteredlights", benchmarkClusteredLights },
+    { "loadmemory", benchmarkLoadMemory },
+    { "culling", benchmarkCulling, false },
+    { "gpuculling", benchmarkGpuCulling },
+    { "occlusion", benchmarkOcclusion },
+    { "depthprepass", benchmarkDepthPrepass },
+    { "softwareocclusion", benchmarkSoftwareOcclusion, false },
+    { "softwareocclusiontest", testSoftwareOcclusion, false },
+};
+
+int main(int argc, char** argv)
+{
+    // benchmarks that run on the CPU alone need no window, so they also run on machines without a GPU
+    auto selected = [&](const Benchmark &benchmark) {
+        return argc <= 1 || std::strcmp(argv[1], benchmark.name) == 0;
+    };
+    bool needsContext = false;
+    for(const Benchmark& benchmark : benchmarks)
+        needsContext = needsContext || (selected(benchmark) && benchmark.needsContext);
+
+    if (needsContext)
+    {
+        if (!glfwInit())
+            return -1;
+
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+#ifdef __APPLE__
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+
+        GLFWwindow* window = glfwCreateWindow(64, 64, "Benchmarks", NULL, NULL);
+        if (window == NULL)
+        {
+            std::cout << "Failed to create GLFW window" << std::endl;
+            glfwTerminate();
+            return -1;
+        }
+        glfwMakeContextCurrent(window);
+
+        if (!gladLoadGL((GLADloadfunc)glfwGetProcAddress))
+        {
+            std::cout << "Failed to initialize GLAD" << std::endl;
+            return -1;
+        }
+    }
+
+    for(const Benchmark& benchmark : benchmarks)
+    {
+        if(!selected(benchmark))
+            continue;
+        // the benchmarks also change GL state directly
+        if(benchmark.needsContext)
+            GLState::Instance().Invalidate();
+        benchmark.run();
+    }
+
+    if (needsContext)
+        glfwTerminate();
+    return failedTests > 0 ? 1 : 0;
+}
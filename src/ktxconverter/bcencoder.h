@@ -0,0 +1,190 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Small BC1/BC3/BC4 block encoders for the offline converter.
+// Colour endpoints come from the principal axis of the block, indices from the nearest palette entry;
+// good enough for the demo assets and fast enough to convert the whole resources tree in seconds.
+
+inline uint16_t packRGB565(const float color[3])
+{
+    int r = std::clamp(int(color[0] * 31.0f / 255.0f + 0.5f), 0, 31);
+    int g = std::clamp(int(color[1] * 63.0f / 255.0f + 0.5f), 0, 63);
+    int b = std::clamp(int(color[2] * 31.0f / 255.0f + 0.5f), 0, 31);
+    return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+inline void unpackRGB565(uint16_t packed, float color[3])
+{
+    color[0] = float((packed >> 11) & 31) * 255.0f / 31.0f;
+    color[1] = float((packed >> 5) & 63) * 255.0f / 63.0f;
+    color[2] = float(packed & 31) * 255.0f / 31.0f;
+}
+
+// block: 16 RGBA texels, row major; writes 8 bytes
+inline void encodeBC1Block(const unsigned char block[16][4], unsigned char out[8])
+{
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+    for(int i = 0; i < 16; i++)
+        for(int c = 0; c < 3; c++)
+            mean[c] += block[i][c] / 16.0f;
+
+    float covariance[6] = {};
+    for(int i = 0; i < 16; i++)
+    {
+        float d[3] = { block[i][0] - mean[0], block[i][1] - mean[1], block[i][2] - mean[2] };
+        covariance[0] += d[0] * d[0]; covariance[1] += d[0] * d[1]; covariance[2] += d[0] * d[2];
+        covariance[3] += d[1] * d[1]; covariance[4] += d[1] * d[2]; covariance[5] += d[2] * d[2];
+    }
+
+    // principal axis by power iteration
+    float axis[3] = { 1.0f, 1.0f, 1.0f };
+    for(int iteration = 0; iteration < 8; iteration++)
+    {
+        float next[3] = {
+            covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+            covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+            covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2],
+        };
+        float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+        if(length < 1e-6f)
+            break;
+        for(int c = 0; c < 3; c++)
+            axis[c] = next[c] / length;
+    }
+
+    float minProjection = 1e9f, maxProjection = -1e9f;
+    for(int i = 0; i < 16; i++)
+    {
+        float projection = (block[i][0] - mean[0]) * axis[0] + (block[i][1] - mean[1]) * axis[1] + (block[i][2] - mean[2]) * axis[2];
+        minProjection = std::min(minProjection, projection);
+        maxProjection = std::max(maxProjection, projection);
+    }
+    float maxColor[3], minColor[3];
+    for(int c = 0; c < 3; c++)
+    {
+        maxColor[c] = mean[c] + axis[c] * maxProjection;
+        minColor[c] = mean[c] + axis[c] * minProjection;
+    }
+
+    uint16_t color0 = packRGB565(maxColor);
+    uint16_t color1 = packRGB565(minColor);
+    if(color0 < color1)
+        std::swap(color0, color1);
+
+    uint32_t indices = 0;
+    if(color0 != color1)
+    {
+        // four colour mode (color0 > color1): palette c0, c1, 2/3 c0 + 1/3 c1, 1/3 c0 + 2/3 c1
+        float palette[4][3];
+        unpackRGB565(color0, palette[0]);
+        unpackRGB565(color1, palette[1]);
+        for(int c = 0; c < 3; c++)
+        {
+            palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+            palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+        }
+        for(int i = 0; i < 16; i++)
+        {
+            int best = 0;
+            float bestDistance = 1e30f;
+            for(int p = 0; p < 4; p++)
+            {
+                float distance = 0.0f;
+                for(int c = 0; c < 3; c++)
+                    distance += (block[i][c] - palette[p][c]) * (block[i][c] - palette[p][c]);
+                if(distance < bestDistance)
+                {
+                    bestDistance = distance;
+                    best = p;
+                }
+            }
+            indices |= uint32_t(best) << (2 * i);
+        }
+    }
+
+    std::memcpy(out, &color0, 2);
+    std::memcpy(out + 2, &color1, 2);
+    std::memcpy(out + 4, &indices, 4);
+}
+
+// values: 16 single channel texels; writes 8 bytes (also the alpha half of BC3)
+inline void encodeBC4Block(const unsigned char values[16], unsigned char out[8])
+{
+    unsigned char maxValue = *std::max_element(values, values + 16);
+    unsigned char minValue = *std::min_element(values, values + 16);
+
+    uint64_t indices = 0;
+    if(maxValue != minValue)
+    {
+        // eight value mode (a0 > a1): a0, a1, then six interpolated steps from a0 to a1
+        float palette[8] = { float(maxValue), float(minValue) };
+        for(int p = 1; p < 7; p++)
+            palette[p + 1] = ((7 - p) * palette[0] + p * palette[1]) / 7.0f;
+        for(int i = 0; i < 16; i++)
+        {
+            int best = 0;
+            for(int p = 1; p < 8; p++)
+                if(std::abs(values[i] - palette[p]) < std::abs(values[i] - palette[best]))
+                    best = p;
+            indices |= uint64_t(best) << (3 * i);
+        }
+    }
+
+    out[0] = maxValue;
+    out[1] = minValue;
+    for(int byte = 0; byte < 6; byte++)
+        out[2 + byte] = static_cast<unsigned char>(indices >> (8 * byte));
+}
+
+enum class BlockFormat { BC1, BC3, BC4 };
+
+inline size_t blockBytes(BlockFormat format)
+{
+    return format == BlockFormat::BC3 ? 16 : 8;
+}
+
+// Encodes an RGBA8 image (4 bytes per texel); edge blocks repeat the last row/column
+inline std::vector<unsigned char> encodeImage(const std::vector<unsigned char> &rgba, int width, int height, BlockFormat format)
+{
+    int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    std::vector<unsigned char> out(size_t(blocksX) * blocksY * blockBytes(format));
+    unsigned char *cursor = out.data();
+    for(int by = 0; by < blocksY; by++)
+    {
+        for(int bx = 0; bx < blocksX; bx++)
+        {
+            unsigned char block[16][4];
+            for(int y = 0; y < 4; y++)
+                for(int x = 0; x < 4; x++)
+                {
+                    int sx = std::min(bx * 4 + x, width - 1), sy = std::min(by * 4 + y, height - 1);
+                    std::memcpy(block[y * 4 + x], &rgba[(size_t(sy) * width + sx) * 4], 4);
+                }
+
+            if(format == BlockFormat::BC4)
+            {
+                unsigned char red[16];
+                for(int i = 0; i < 16; i++)
+                    red[i] = block[i][0];
+                encodeBC4Block(red, cursor);
+            }
+            else if(format == BlockFormat::BC3)
+            {
+                unsigned char alpha[16];
+                for(int i = 0; i < 16; i++)
+                    alpha[i] = block[i][3];
+                encodeBC4Block(alpha, cursor);
+                encodeBC1Block(block, cursor + 8);
+            }
+            else
+                encodeBC1Block(block, cursor);
+            cursor += blockBytes(format);
+        }
+    }
+    return out;
+}
@@ -0,0 +1,230 @@
+#include <stb/stb_image.h>
+
+#include <multiproject/ktx2.h>
+#include <multiproject/filesystem.h>
+
+#include "bcencoder.h"
+
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Offline converter: encodes every image below a directory (resources/textures by default) into a .ktx2 next to it,
+// with a full mip chain, so Texture and Cubemap can upload them with glCompressedTexImage2D.
+// Usage: ktxconverter [directory] [--force] [--no-flip]
+//   Colour maps become BC1 (opaque) or BC3 (with alpha) sRGB, single channel maps BC4, normal/height maps linear.
+//   Images are flipped like Texture does with stb, except below "skybox"/"cubemaps" directories (Cubemap loads them unflipped).
+
+struct ConversionTotals
+{
+    size_t files = 0;
+    size_t uncompressedBytes = 0;
+    size_t compressedBytes = 0;
+};
+
+float srgbToLinear(float value)
+{
+    value /= 255.0f;
+    return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+unsigned char linearToSrgb(float value)
+{
+    value = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+    return static_cast<unsigned char>(std::clamp(value * 255.0f + 0.5f, 0.0f, 255.0f));
+}
+
+// 2x2 box filter; colour channels are averaged in linear space for sRGB images
+std::vector<unsigned char> downsample(const std::vector<unsigned char> &rgba, int width, int height, bool srgb)
+{
+    int nextWidth = std::max(1, width / 2), nextHeight = std::max(1, height / 2);
+    std::vector<unsigned char> next(size_t(nextWidth) * nextHeight * 4);
+    for(int y = 0; y < nextHeight; y++)
+        for(int x = 0; x < nextWidth; x++)
+            for(int c = 0; c < 4; c++)
+            {
+                float sum = 0.0f;
+                for(int dy = 0; dy < 2; dy++)
+                    for(int dx = 0; dx < 2; dx++)
+                    {
+                        int sx = std::min(x * 2 + dx, width - 1), sy = std::min(y * 2 + dy, height - 1);
+                        unsigned char value = rgba[(size_t(sy) * width + sx) * 4 + c];
+                        sum += (srgb && c < 3) ? srgbToLinear(value) : value;
+                    }
+                sum /= 4.0f;
+                next[(size_t(y) * nextWidth + x) * 4 + c] = (srgb && c < 3) ? linearToSrgb(sum) : static_cast<unsigned char>(sum + 0.5f);
+            }
+    return next;
+}
+
+// Basic data format descriptor for the block formats the encoder produces
+std::vector<unsigned char> basicDfd(BlockFormat format, bool srgb)
+{
+    struct Sample { uint32_t channel, bitOffset; };
+    std::vector<Sample> samples;
+    uint32_t colorModel;
+    if(format == BlockFormat::BC1)
+    {
+        colorModel = 128; // KHR_DF_MODEL_BC1A
+        samples.push_back({ 0, 0 });
+    }
+    else if(format == BlockFormat::BC3)
+    {
+        colorModel = 130; // KHR_DF_MODEL_BC3
+        samples.push_back({ 15, 0 });
+        samples.push_back({ 0, 64 });
+    }
+    else
+    {
+        colorModel = 131; // KHR_DF_MODEL_BC4
+        samples.push_back({ 0, 0 });
+    }
+
+    uint32_t blockSize = 24 + 16 * static_cast<uint32_t>(samples.size());
+    std::vector<uint32_t> words = {
+        4 + blockSize,
+        0,                                          // vendor KHR, basic descriptor type
+        2 | (blockSize << 16),                      // version 2
+        colorModel | (1 << 8) | ((srgb ? 2u : 1u) << 16), // BT.709 primaries, sRGB or linear transfer
+        3 | (3 << 8),                               // 4x4x1x1 texel blocks
+        static_cast<uint32_t>(blockBytes(format)),
+        0,
+    };
+    for(const Sample &sample : samples)
+    {
+        words.push_back(sample.bitOffset | (63u << 16) | (sample.channel << 24));
+        words.push_back(0);
+        words.push_back(0);
+        words.push_back(0xFFFFFFFFu);
+    }
+    std::vector<unsigned char> dfd(words.size() * 4);
+    std::memcpy(dfd.data(), words.data(), dfd.size());
+    return dfd;
+}
+
+bool isLinearMap(const std::string &name)
+{
+    for(const char *marker : { "normal", "ddn", "nrm", "disp", "height", "bump" })
+        if(name.find(marker) != std::string::npos)
+            return true;
+    return false;
+}
+
+bool convert(const std::filesystem::path &source, bool flip, ConversionTotals &totals)
+{
+    int width, height, channels;
+    stbi_set_flip_vertically_on_load(flip);
+    unsigned char *pixels = stbi_load(source.string().c_str(), &width, &height, &channels, 4);
+    if(pixels == nullptr)
+    {
+        std::cerr << "ERROR::KTXCONVERTER:: Could not decode " << source << std::endl;
+        return false;
+    }
+    std::vector<unsigned char> rgba(pixels, pixels + size_t(width) * height * 4);
+    stbi_image_free(pixels);
+
+    bool hasAlpha = false;
+    for(size_t i = 3; i < rgba.size() && !hasAlpha; i += 4)
+        hasAlpha = rgba[i] != 255;
+
+    std::string name = source.filename().string();
+    BlockFormat format = channels == 1 ? BlockFormat::BC4 : (hasAlpha ? BlockFormat::BC3 : BlockFormat::BC1);
+    bool srgb = format != BlockFormat::BC4 && !isLinearMap(name);
+    uint32_t vkFormat;
+    if(format == BlockFormat::BC4)
+        vkFormat = KTX2_BC4_UNORM;
+    else if(format == BlockFormat::BC3)
+        vkFormat = srgb ? KTX2_BC3_SRGB : KTX2_BC3_UNORM;
+    else
+        vkFormat = srgb ? KTX2_BC1_RGB_SRGB : KTX2_BC1_RGB_UNORM;
+
+    std::vector<std::vector<unsigned char>> levels;
+    int levelWidth = width, levelHeight = height;
+    while(true)
+    {
+        levels.push_back(encodeImage(rgba, levelWidth, levelHeight, format));
+        if(levelWidth == 1 && levelHeight == 1)
+            break;
+        rgba = downsample(rgba, levelWidth, levelHeight, srgb);
+        levelWidth = std::max(1, levelWidth / 2);
+        levelHeight = std::max(1, levelHeight / 2);
+    }
+
+    std::filesystem::path target = source;
+    target.replace_extension(".ktx2");
+    std::vector<std::pair<std::string, std::string>> keyValues = {
+        { "KTXorientation", flip ? "ru" : "rd" },
+        { "KTXwriter", "MultiprojectOpenGL ktxconverter" },
+    };
+    if(!writeKtx2(target.string(), vkFormat, width, height, 1, levels, basicDfd(format, srgb), keyValues))
+        return false;
+
+    // what Texture would allocate for the source (RGB is padded to 4 bytes by drivers) vs the compressed chain
+    size_t uncompressed = size_t(width) * height * (channels == 3 ? 4 : channels) * 4 / 3;
+    size_t compressed = 0;
+    for(const auto &level : levels)
+        compressed += level.size();
+    totals.files++;
+    totals.uncompressedBytes += uncompressed;
+    totals.compressedBytes += compressed;
+
+    const char *formatName = format == BlockFormat::BC1 ? "BC1" : (format == BlockFormat::BC3 ? "BC3" : "BC4");
+    std::cout << source.string() << " -> " << formatName << (srgb ? " sRGB" : "") << ", " << levels.size() << " levels, "
+              << uncompressed / 1024 << " KiB -> " << compressed / 1024 << " KiB ("
+              << blockBytes(format) * 8 / 16 << " bits/texel sampled)" << std::endl;
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    std::filesystem::path root = FileSystem::getPath("resources/textures");
+    bool force = false;
+    bool noFlip = false;
+    for(int i = 1; i < argc; i++)
+    {
+        if(std::strcmp(argv[i], "--force") == 0)
+            force = true;
+        else if(std::strcmp(argv[i], "--no-flip") == 0)
+            noFlip = true;
+        else
+            root = argv[i];
+    }
+
+    if(!std::filesystem::is_directory(root))
+    {
+        std::cerr << "ERROR::KTXCONVERTER:: " << root << " is not a directory" << std::endl;
+        return -1;
+    }
+
+    ConversionTotals totals;
+    int failures = 0;
+    for(const auto &entry : std::filesystem::recursive_directory_iterator(root))
+    {
+        if(!entry.is_regular_file())
+            continue;
+        std::string extension = entry.path().extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        if(extension != ".png" && extension != ".jpg" && extension != ".jpeg" && extension != ".tga" && extension != ".bmp")
+            continue;
+
+        std::filesystem::path target = entry.path();
+        target.replace_extension(".ktx2");
+        if(!force && std::filesystem::exists(target) && std::filesystem::last_write_time(target) >= entry.last_write_time())
+            continue;
+
+        std::string directory = entry.path().parent_path().generic_string();
+        bool cubemapFace = directory.find("skybox") != std::string::npos || directory.find("cubemaps") != std::string::npos;
+        if(!convert(entry.path(), !noFlip && !cubemapFace, totals))
+            failures++;
+    }
+
+    std::cout << totals.files << " textures converted: " << totals.uncompressedBytes / (1024 * 1024) << " MiB uncompressed -> "
+              << totals.compressedBytes / (1024 * 1024) << " MiB compressed";
+    if(totals.uncompressedBytes > 0)
+        std::cout << " (" << 100.0 * totals.compressedBytes / totals.uncompressedBytes << "%)";
+    std::cout << std::endl;
+    return failures == 0 ? 0 : -1;
+}
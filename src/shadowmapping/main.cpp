@@ -7,13 +7,29 @@
 
 #include <multiproject/camera.h>
 #include <multiproject/shader.h>
+#include <multiproject/shadervariants.h>
 #include <multiproject/model.h>
+#include <multiproject/clusteredlights.h>
+#include <multiproject/culling.h>
+#include <multiproject/depthprepass.h>
+#include <multiproject/gbuffer.h>
+#include <multiproject/glstate.h>
+#include <multiproject/instanceculler.h>
+#include <multiproject/hizculler.h>
+#include <multiproject/renderqueue.h>
+#include <multiproject/softwareocclusion.h>
+#include <multiproject/texturestreamer.h>
+#include <multiproject/visibilitybuffer.h>
 #include <multiproject/light.h>
+#include <multiproject/lightbuffer.h>
 #include <multiproject/postprocesseffect.h>
 #include <multiproject/skybox.h>
 #include <multiproject/filesystem.h>
 
+#include <chrono>
 #include <iostream>
+#include <random>
+#include <vector>
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
@@ -42,6 +58,18 @@ bool firstMouse = true;
 
 //Post Processing Framebuffer
 PostProcessEffect *postProcessEffect;
+//Shading path of the camera pass, G cycles through them; the deferred and visibility buffer targets are lit into the
+//post processing framebuffer
+enum class ShadingPath { Forward, Deferred, Visibility };
+const char *shadingPathNames[] = { "Forward", "Deferred", "Visibility buffer" };
+ShadingPath shadingPath = ShadingPath::Forward;
+GBuffer *gBuffer;
+VisibilityBuffer *visibilityBuffer;
+//Forward path only: depth pre-pass of the meshes DepthPrepass selects, toggled with P
+bool depthPrepassEnabled = true;
+//Indirect draws only: the camera pass draws are tested on the CPU against the model's low poly proxies before any
+//command is prepared, toggled with O
+bool softwareOcclusionEnabled = true;
 
 //Quad vertices for rendering depth map
 float quadVerticesStrip[] = {
@@ -52,9 +80,10 @@ float quadVerticesStrip[] = {
      1.0f, -1.0f, 0.0f, 1.0f, 0.0f,
 };
 
-int main(void)
+int main(int argc, char **argv)
 {
     GLFWwindow* window;
+    auto startTime = std::chrono::high_resolution_clock::now();
 
     if (!glfwInit())
         return -1;
@@ -90,158 +119,533 @@ int main(void)
         return -1;
     }
 
-    Shader shadowShader("depthmap.vs", "depthmap.fs");
-    Shader shadowCubeShader("depthcubemap.vs", "depthcubemap.fs", "depthcubemap.gs");
-    Shader litShader("defaultNoUboShadow.vs", "defaultShadow.fs");
-    Shader postprocessShader("postprocess.vs", "postprocess.fs");
-
-    Model defaultModel(FileSystem::getPath("resources/objects/backpack/backpack.obj").c_str());
-
-	postProcessEffect = new PostProcessEffect(SCR_WIDTH, SCR_HEIGHT);
-
-    //Light configuration
-    const bool blinn = true;
-    const unsigned int numDirLights = 1;
-    const unsigned int numPointLights = 1;
-    const unsigned int numSpotLights = 1;
-    const unsigned int numShadows = 2;
-    DirectionalLight* dirLights[numDirLights];
-    dirLights[0] = new DirectionalLight(
-        glm::vec3(0.05f, 0.05f, 0.05f), //ambient
-        glm::vec3(0.25f, 0.25f, 0.25f), //diffuse
-        glm::vec3(1.0f, 1.0f, 1.0f), //specular
-        true, 2, 0,             //hasShadow, shadowMap, shadowIndex
-        glm::vec3(-2.0f, -4.0f, -1.0f) //direction
-    );
-    PointLight* pointLights[numPointLights];
-    pointLights[0] = new PointLight(
-        glm::vec3(0.05f, 0.05f, 0.05f), //ambient
-        glm::vec3(0.25f, 0.25f, 0.25f), //diffuse
-        glm::vec3(1.0f, 1.0f, 1.0f), //specular
-        true, 3, 0,             //hasShadow, shadowMap, shadowIndex
-        1.0f, 0.09f, 0.032f,   //constant, linear, quadratic
-        glm::vec3(2.0f, 2.0f, 2.0f) //position
-    );
-    SpotLight* spotLights[numSpotLights];
-    spotLights[0] = new SpotLight(
-        glm::vec3(0.0f, 0.0f, 0.0f), //ambient
-        glm::vec3(0.35f, 0.35f, 0.35f), //diffuse
-        glm::vec3(1.0f, 1.0f, 1.0f), //specular
-        false, 4, 1,            //hasShadow, shadowMap, shadowIndex
-        1.0f, 0.09f, 0.032f,   //constant, linear, quadratic
-        camera.Position,        //position
-        camera.Front,           //direction
-        glm::cos(glm::radians(12.5f)), //cutOff
-        glm::cos(glm::radians(15.0f))   //outerCutOff
-    );
-    litShader.Activate();
-    litShader.setInt("numDirLights", numDirLights);
-    litShader.setInt("numPointLights", numPointLights);
-    litShader.setInt("numSpotLights", numSpotLights);
-    litShader.setBool("blinn", blinn);
-    litShader.setFloat("material.shininess", 32.0f);
-
-	// configure global opengl state
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_BACK);
-    glFrontFace(GL_CCW);
-    glEnable(GL_FRAMEBUFFER_SRGB);
-
-    while (!glfwWindowShouldClose(window))
+    //GL objects (shaders, model, draw list) are owned by this scope and released before the context goes away
     {
-        float currentFrame = static_cast<float>(glfwGetTime());
-        deltaTime = currentFrame - lastFrame;
-        lastFrame = currentFrame;
-		std::string fpsCount = std::to_string(1.0f / deltaTime);
-		std::string title = "FPS: " + fpsCount;
-		glfwSetWindowTitle(window, title.c_str());
-
-        processInput(window);
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)CURR_WIDTH / (float)CURR_HEIGHT, nearPlane, farPlane);
-        glm::mat4 view = camera.GetViewMatrix();
-
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(0.0f, 0.0f, 1.5f));
-        model = glm::scale(model, glm::vec3(1.0f));
-
-        //render shadows
-        for(const auto& dirLight : dirLights) {
-            glm::mat4 lightSpaceMatrix;
-            dirLight->getLightSpaceMatrix(lightSpaceMatrix);
-            shadowShader.Activate();
-            shadowShader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
-            shadowShader.setMat4("model", model);
-            dirLight->renderDepthMap([&]() {
-                defaultModel.Draw(shadowShader);
-            });
+        //Programs are only submitted here; the driver builds them while the model loads and they are checked on first use
+        std::cout << "Parallel shader compile: " << (Shader::ParallelCompileSupported() ? "yes" : "no") << std::endl;
+        //Packed 16 byte vertices; every program drawing the model is built for that layout
+        const VertexFormat vertexFormat = VertexFormat::Quantized;
+        //Meshes live in the shared geometry arena and each pass is one glMultiDrawElementsIndirect per texture set;
+        //--direct-draws draws every pass from the state sorted render queue instead and reports its binds
+        bool indirectDraws = true;
+        for(int i = 1; i < argc; i++)
+            if(std::string(argv[i]) == "--direct-draws")
+                indirectDraws = false;
+        std::cout << "Draw submission: " << (indirectDraws ? "indirect" : "render queue") << std::endl;
+        //Camera pass draws are occlusion culled against a depth pyramid (needs indirectDraws)
+        const bool occlusionCulling = true;
+        std::string vertexDefines = vertexFormat == VertexFormat::Quantized ? "#define QUANTIZED_VERTICES 1\n" : "";
+        if(indirectDraws)
+            vertexDefines += "#define INDIRECT_DRAWS 1\n";
+        Shader shadowShader("depthmap.vs", "depthmap.fs", nullptr, vertexDefines);
+        Shader prepassShader("depthprepass.vs", "depthmap.fs", nullptr, vertexDefines);
+        Shader shadowCubeShader("depthcubemap.vs", "depthcubemap.fs", "depthcubemap.gs", vertexDefines);
+        //The instanced ring reads its model matrices from the instance attributes
+        std::string instancedDefines = vertexFormat == VertexFormat::Quantized ? "#define QUANTIZED_VERTICES 1\n" : "";
+        instancedDefines += "#define INSTANCE_MATRICES 1\n";
+        Shader instancedShadowShader("depthmap.vs", "depthmap.fs", nullptr, instancedDefines);
+        Shader postprocessShader("postprocess.vs", "postprocess.fs");
+
+        //Textures are streamed in over the first frames, meshes draw with placeholders until then
+        TextureStreamer textureStreamer;
+        ModelLoadOptions modelOptions;
+        modelOptions.textureStreamer = &textureStreamer;
+        modelOptions.vertexFormat = vertexFormat;
+        modelOptions.useGeometryArena = indirectDraws;
+        Model defaultModel(FileSystem::getPath("resources/objects/backpack/backpack.obj").c_str(), 1, {}, modelOptions);
+
+        //Ring of instanced copies around the scene, frustum culled per pass on the GPU (instancecull.cs)
+        const unsigned int ringInstances = 2000;
+        std::vector<glm::mat4> ringMatrices;
+        std::mt19937 ringRandom(7);
+        std::uniform_real_distribution<float> ringOffset(-4.0f, 4.0f);
+        for(unsigned int i = 0; i < ringInstances; i++) {
+            float angle = glm::radians(360.0f) * i / ringInstances;
+            glm::mat4 instance = glm::translate(glm::mat4(1.0f), glm::vec3(std::cos(angle) * 40.0f + ringOffset(ringRandom), ringOffset(ringRandom) * 0.5f, std::sin(angle) * 40.0f + ringOffset(ringRandom)));
+            instance = glm::rotate(instance, angle * 7.0f, glm::vec3(0.3f, 1.0f, 0.2f));
+            ringMatrices.push_back(glm::scale(instance, glm::vec3(0.25f)));
         }
-        for(const auto& pointLight : pointLights) {
-            std::vector<glm::mat4> shadowTransform = pointLight->getShadowTransformations();
-            shadowCubeShader.Activate();
-            for(unsigned int i = 0; i < 6; i++) {
-                shadowCubeShader.setMat4("shadowTransforms[" + std::to_string(i) + "]", shadowTransform[i]);
-            }
-            shadowCubeShader.setFloat("farPlane", pointLight->farPlane);
-            shadowCubeShader.setVec3("lightPos", pointLight->position);
-            pointLight->renderDepthMap([&]() {
-                defaultModel.Draw(shadowShader);
-            });
+        ModelLoadOptions ringOptions = modelOptions;
+        ringOptions.useGeometryArena = false;
+        Model ringModel(FileSystem::getPath("resources/objects/backpack/backpack.obj").c_str(), ringInstances, ringMatrices, ringOptions);
+        InstanceCuller ringCuller(ringModel);
+
+        //Occluders of the software occlusion test, simplified from the mesh data the model keeps (keepMeshData)
+        std::vector<OccluderMesh> occluderProxies;
+        size_t proxySourceTriangles = 0, proxyTriangles = 0;
+        for(const Mesh &mesh : defaultModel.Meshes()) {
+            occluderProxies.push_back(makeOccluderProxy(mesh.vertices, mesh.indices));
+            proxySourceTriangles += mesh.lods.empty() ? mesh.indices.size() / 3 : mesh.lods[0].indexCount / 3;
+            proxyTriangles += occluderProxies.back().TriangleCount();
         }
-        for(const auto& spotLight : spotLights) {
-            glm::mat4 lightSpaceMatrix;
-            spotLight->getLightSpaceMatrix(lightSpaceMatrix);
-            shadowShader.Activate();
-            shadowShader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
-            shadowShader.setMat4("model", model);
-            spotLight->renderDepthMap([&]() {
-                defaultModel.Draw(shadowShader);
-            });
+        std::cout << "Occluder proxies: " << proxySourceTriangles << " -> " << proxyTriangles << " triangles" << std::endl;
+        SoftwareOcclusion softwareOcclusion(256, 256);
+
+    	postProcessEffect = new PostProcessEffect(SCR_WIDTH, SCR_HEIGHT);
+        GBuffer deferredTarget(SCR_WIDTH, SCR_HEIGHT);
+        gBuffer = &deferredTarget;
+        VisibilityBuffer visibilityTarget(SCR_WIDTH, SCR_HEIGHT, vertexFormat);
+        visibilityBuffer = &visibilityTarget;
+
+        //Light configuration
+        const bool blinn = true;
+        const unsigned int numDirLights = 1;
+        const unsigned int numPointLights = 1;
+        const unsigned int numSpotLights = 1;
+        DirectionalLight* dirLights[numDirLights];
+        dirLights[0] = new DirectionalLight(
+            glm::vec3(0.05f, 0.05f, 0.05f), //ambient
+            glm::vec3(0.25f, 0.25f, 0.25f), //diffuse
+            glm::vec3(1.0f, 1.0f, 1.0f), //specular
+            true, 2, 0,             //hasShadow, shadowMap, shadowIndex
+            glm::vec3(-2.0f, -4.0f, -1.0f) //direction
+        );
+        PointLight* pointLights[numPointLights];
+        pointLights[0] = new PointLight(
+            glm::vec3(0.05f, 0.05f, 0.05f), //ambient
+            glm::vec3(0.25f, 0.25f, 0.25f), //diffuse
+            glm::vec3(1.0f, 1.0f, 1.0f), //specular
+            true, 3, 0,             //hasShadow, shadowMap, shadowIndex
+            1.0f, 0.09f, 0.032f,   //constant, linear, quadratic
+            glm::vec3(2.0f, 2.0f, 2.0f) //position
+        );
+        SpotLight* spotLights[numSpotLights];
+        spotLights[0] = new SpotLight(
+            glm::vec3(0.0f, 0.0f, 0.0f), //ambient
+            glm::vec3(0.35f, 0.35f, 0.35f), //diffuse
+            glm::vec3(1.0f, 1.0f, 1.0f), //specular
+            false, 4, 1,            //hasShadow, shadowMap, shadowIndex
+            1.0f, 0.09f, 0.032f,   //constant, linear, quadratic
+            camera.Position,        //position
+            camera.Front,           //direction
+            glm::cos(glm::radians(12.5f)), //cutOff
+            glm::cos(glm::radians(15.0f))   //outerCutOff
+        );
+
+        //Small unshadowed point lights along the ring, shaded per froxel (clustered forward) on top of the lights above
+        const unsigned int ringLights = 256;
+        //owned by value, ClusteredLights::Build takes pointers into it
+        std::vector<PointLight> ringPointLights;
+        std::vector<PointLight*> clusteredPointLights;
+        ringPointLights.reserve(ringLights);
+        std::uniform_real_distribution<float> ringColor(0.2f, 1.0f);
+        for(unsigned int i = 0; i < ringLights; i++) {
+            float angle = glm::radians(360.0f) * (i + 0.5f) / ringLights;
+            glm::vec3 color(ringColor(ringRandom), ringColor(ringRandom), ringColor(ringRandom));
+            ringPointLights.emplace_back(
+                glm::vec3(0.0f), color * 0.5f, color * 0.5f, false, 0, 0,
+                1.0f, 0.7f, 1.8f,
+                glm::vec3(std::cos(angle) * 40.0f, 1.0f, std::sin(angle) * 40.0f)
+            );
+            clusteredPointLights.push_back(&ringPointLights.back());
         }
-
-        //render scene
-        glViewport(0, 0, CURR_WIDTH, CURR_HEIGHT);
-		postProcessEffect->Bind();
-        glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        ClusteredLights clusteredLights;
+
+        //The lit shader is specialised for this light configuration: unrolled loops, no shadow or blinn branches
+        ShaderVariants litVariants("defaultNoUboShadow.vs", "defaultShadow.fs");
+        ShaderPermutation litPermutation = LightPermutation(dirLights, pointLights, spotLights, blinn);
+        if(vertexFormat == VertexFormat::Quantized)
+            litPermutation.Define("QUANTIZED_VERTICES");
+        if(indirectDraws)
+            litPermutation.Define("INDIRECT_DRAWS");
+        if(ringLights > 0)
+            litPermutation.Define("CLUSTERED_LIGHTS");
+        Shader &litShader = litVariants.Get(litPermutation);
+        ShaderPermutation instancedLitPermutation = LightPermutation(dirLights, pointLights, spotLights, blinn);
+        if(vertexFormat == VertexFormat::Quantized)
+            instancedLitPermutation.Define("QUANTIZED_VERTICES");
+        instancedLitPermutation.Define("INSTANCE_MATRICES");
+        if(ringLights > 0)
+            instancedLitPermutation.Define("CLUSTERED_LIGHTS");
+        Shader &instancedLitShader = litVariants.Get(instancedLitPermutation);
+        //Deferred path: the geometry pass writes the G-buffer, one screen pass lights it with the same permutation
+        ShaderVariants gBufferVariants("defaultNoUboShadow.vs", "gbuffer.fs");
+        ShaderPermutation gBufferPermutation;
+        if(vertexFormat == VertexFormat::Quantized)
+            gBufferPermutation.Define("QUANTIZED_VERTICES");
+        if(indirectDraws)
+            gBufferPermutation.Define("INDIRECT_DRAWS");
+        Shader &gBufferShader = gBufferVariants.Get(gBufferPermutation);
+        ShaderPermutation instancedGBufferPermutation;
+        if(vertexFormat == VertexFormat::Quantized)
+            instancedGBufferPermutation.Define("QUANTIZED_VERTICES");
+        instancedGBufferPermutation.Define("INSTANCE_MATRICES");
+        Shader &instancedGBufferShader = gBufferVariants.Get(instancedGBufferPermutation);
+        ShaderVariants deferredVariants("postprocess.vs", "deferred.fs");
+        ShaderPermutation deferredPermutation = LightPermutation(dirLights, pointLights, spotLights, blinn);
+        if(ringLights > 0)
+            deferredPermutation.Define("CLUSTERED_LIGHTS");
+        Shader &deferredShader = deferredVariants.Get(deferredPermutation);
+        gBuffer->SetSamplers(deferredShader);
+        //Visibility buffer path (arena meshes, needs indirectDraws): ids only, then one shading pass per material that
+        //rebuilds each pixel's triangle from the arena buffers
+        ShaderVariants visibilityVariants("visibility.vs", "visibility.fs");
+        ShaderPermutation visibilityPermutation;
+        if(vertexFormat == VertexFormat::Quantized)
+            visibilityPermutation.Define("QUANTIZED_VERTICES");
+        visibilityPermutation.Define("INDIRECT_DRAWS");
+        Shader &visibilityShader = visibilityVariants.Get(visibilityPermutation);
+        ShaderVariants visibilityResolveVariants("postprocess.vs", "visibilityresolve.fs");
+        ShaderPermutation visibilityResolvePermutation = LightPermutation(dirLights, pointLights, spotLights, blinn);
+        if(vertexFormat == VertexFormat::Quantized)
+            visibilityResolvePermutation.Define("QUANTIZED_VERTICES");
+        if(ringLights > 0)
+            visibilityResolvePermutation.Define("CLUSTERED_LIGHTS");
+        Shader &visibilityResolveShader = visibilityResolveVariants.Get(visibilityResolvePermutation);
+        visibilityBuffer->SetSamplers(visibilityResolveShader);
+        //Light records and the camera matrices live in uniform buffers shared by every lit program
+        LightBuffer lightBuffer(dirLights, pointLights, spotLights);
+        lightBuffer.SetShadowSamplers(litShader);
+        lightBuffer.SetShadowSamplers(instancedLitShader);
+        lightBuffer.SetShadowSamplers(deferredShader);
+        lightBuffer.SetShadowSamplers(visibilityResolveShader);
+        const ProgramBinaryCache::Stats &shaderCacheStats = ProgramBinaryCache::Instance().GetStats();
+        std::cout << "Shader cache: " << shaderCacheStats.hits << " hits, " << shaderCacheStats.misses << " misses, "
+                  << shaderCacheStats.rejected << " rejected (" << ProgramBinaryCache::Instance().HitRate() * 100.0f << "%)" << std::endl;
 
         litShader.Activate();
-        litShader.setVec3("viewPos", camera.Position);
-        litShader.setMat4("projection", projection);
-        litShader.setMat4("view", view);
-        litShader.setMat4("model", model);
-        glm::mat4 lightSpaceMatrix;
-        litShader.setInt("numShadows", numShadows);
-        for(unsigned int i = 0; i < numDirLights; i++) {
-            dirLights[i]->bindShadowMap();
-            dirLights[i]->setInShader(litShader, "dirLights", i);
-            dirLights[i]->getLightSpaceMatrix(lightSpaceMatrix);
-            litShader.setMat4("lightSpaceMatrix[" + std::to_string(dirLights[i]->shadowIndex)  + "]", lightSpaceMatrix);
-        }
-        for(unsigned int i = 0; i < numPointLights; i++) {
-            pointLights[i]->bindShadowMap();
-            pointLights[i]->setInShader(litShader, "pointLights", i);
-        }
-        for(unsigned int i = 0; i < numSpotLights; i++) {
-            spotLights[i]->bindShadowMap();
-            spotLights[i]->setInShader(litShader, "spotLights", i);
-            spotLights[i]->getLightSpaceMatrix(lightSpaceMatrix);
-            litShader.setMat4("lightSpaceMatrix[" + std::to_string(spotLights[i]->shadowIndex)  + "]", lightSpaceMatrix);
-        }
-        defaultModel.Draw(litShader);
+        litShader.setFloat("material.shininess", 32.0f);
+        instancedLitShader.Activate();
+        instancedLitShader.setFloat("material.shininess", 32.0f);
+        deferredShader.Activate();
+        deferredShader.setFloat("material.shininess", 32.0f);
+        visibilityResolveShader.Activate();
+        visibilityResolveShader.setFloat("material.shininess", 32.0f);
+
+    	// configure global opengl state; per pass state goes through GLState, which skips calls that change nothing
+        GLState &glState = GLState::Instance();
+        glFrontFace(GL_CCW);
+        glState.Enable(GL_FRAMEBUFFER_SRGB, true);
+
+        IndirectDrawList drawList;
+        //path shading the current frame: the selected one, unless the visibility buffer cannot address the frame's draws
+        ShadingPath activePath = shadingPath;
+        //frustum culling of the indirect draws, one BVH cull per pass
+        BoundsBVH sceneBVH;
+        std::vector<uint8_t> visible;
+        std::vector<std::pair<std::string, CullStats>> passCullStats;
+        HiZCuller hiZCuller;
+        //without indirect draws every pass draws from a render queue sorted by state, one queue pass per drawScene
+        RenderQueue renderQueue;
+        unsigned int scenePass = 0;
+        unsigned int frameIndex = 0;
+        //frustum culls the indirect draws into visible, then drops the ones occluders (rasterized for this pass) hide
+        auto cullDraws = [&](const Frustum &frustum, const std::string &pass, const SoftwareOcclusion *occluders) {
+            CullStats stats = sceneBVH.Cull(frustum, visible);
+            passCullStats.push_back({ pass, stats });
+            if(occluders) {
+                CullStats occlusion = occluders->Test(drawList.Bounds(), visible);
+                passCullStats.push_back({ pass + " (software occlusion)", occlusion });
+                stats.visible = occlusion.visible;
+            }
+            return stats;
+        };
+        auto drawInstances = [&](Shader &instancedShader, bool bindTextures, const std::string &pass, const Frustum &frustum) {
+            ringCuller.Cull(frustum);
+            ringCuller.Draw(instancedShader, bindTextures);
+            if(frameIndex == 1)
+                passCullStats.push_back({ pass + " (gpu instances)", ringCuller.ReadStats() });
+        };
+        //draws the commands of the last drawList.Prepare; occlusionViewProjection enables the two phase Hi-Z occlusion
+        //culling of the draws (camera pass, drawn into the target of the shading path)
+        auto drawPrepared = [&](Shader &shader, bool bindTextures, const glm::mat4 *occlusionViewProjection) {
+            if(!occlusionViewProjection) {
+                drawList.Draw(shader, bindTextures);
+                return;
+            }
+            hiZCuller.CullFirst(drawList, *occlusionViewProjection);
+            drawList.Draw(shader, bindTextures);
+            if(activePath == ShadingPath::Deferred) {
+                hiZCuller.BuildPyramid(gBuffer->DepthTexture(), gBuffer->width, gBuffer->height);
+            } else if(activePath == ShadingPath::Visibility) {
+                hiZCuller.BuildPyramid(visibilityBuffer->DepthTexture(), visibilityBuffer->width, visibilityBuffer->height);
+            } else {
+                postProcessEffect->ResolveDepth();
+                hiZCuller.BuildPyramid(postProcessEffect->depthTexture, postProcessEffect->width, postProcessEffect->height);
+            }
+            hiZCuller.CullSecond(drawList, *occlusionViewProjection);
+            drawList.Draw(shader, bindTextures);
+        };
+        //indirect draws flagged in mask
+        auto drawIndirect = [&](Shader &shader, bool bindTextures, const std::vector<uint8_t> &mask, const glm::mat4 *occlusionViewProjection) {
+            drawList.Prepare(bindTextures, &mask);
+            drawPrepared(shader, bindTextures, occlusionViewProjection);
+        };
+        //returns the CPU culling stats of the indirect draws. Without an instancedShader the ring is left to the caller.
+        auto drawScene = [&](Shader &shader, Shader *instancedShader, bool bindTextures, const std::string &pass, const Frustum &frustum,
+                             const glm::mat4 *occlusionViewProjection = nullptr, const SoftwareOcclusion *occluders = nullptr) {
+            if(instancedShader)
+                drawInstances(*instancedShader, bindTextures, pass, frustum);
+
+            if(!indirectDraws) {
+                renderQueue.Execute(scenePass++);
+                return CullStats();
+            }
+            CullStats stats = cullDraws(frustum, pass, occluders);
+            drawIndirect(shader, bindTextures, visible, occlusionViewProjection);
+            return stats;
+        };
+        //forward camera pass with a depth pre-pass: the selected draws are prepared once, with their textures, fill the
+        //depth (taking the Hi-Z occlusion culling) and are shaded with GL_EQUAL from the same culled commands; the ring
+        //and the other draws are shaded directly against that depth, the latter tested against its pyramid
+        DepthPrepass depthPrepass;
+        std::vector<uint8_t> prepassVisible, directVisible;
+        auto drawPrepassed = [&](const Frustum &frustum, const glm::mat4 &viewProjection, const PipelineState &passState, const SoftwareOcclusion *occluders) {
+            CullStats stats = cullDraws(frustum, "camera", occluders);
+            depthPrepass.Select(drawList, visible, camera.Position, glm::radians(camera.Zoom), CURR_WIDTH, CURR_HEIGHT, prepassVisible, directVisible);
+
+            depthPrepass.Begin(DepthPrepass::Prepass);
+            drawList.Prepare(true, &prepassVisible);
+            drawPrepared(prepassShader, false, occlusionCulling ? &viewProjection : nullptr);
+            if(occlusionCulling)
+                hiZCuller.Restore(drawList);
+            depthPrepass.End();
+
+            depthPrepass.Begin(DepthPrepass::Shading);
+            glState.Apply(passState.WithDepthTest(true, GL_EQUAL).WithDepthWrite(false));
+            drawList.Draw(litShader);
+            glState.Apply(passState);
+            drawInstances(instancedLitShader, true, "camera", frustum);
+            drawList.Prepare(true, &directVisible);
+            if(occlusionCulling)
+                hiZCuller.CullCurrent(drawList, viewProjection);
+            drawList.Draw(litShader);
+            depthPrepass.End();
+            return stats;
+        };
+
+        //average frame time of the selected path, printed when G switches paths
+        ShadingPath framePath = shadingPath;
+        unsigned int pathFrames = 0;
+        float pathTime = 0.0f;
+
+        while (!glfwWindowShouldClose(window))
+        {
+            UniformStats uniformsBefore = UniformStats::Global();
+            float currentFrame = static_cast<float>(glfwGetTime());
+            deltaTime = currentFrame - lastFrame;
+            lastFrame = currentFrame;
+            processInput(window);
+            //the visibility buffer reads its triangles from the geometry arena
+            if(shadingPath == ShadingPath::Visibility && !indirectDraws)
+                shadingPath = ShadingPath::Forward;
+            if(shadingPath != framePath) {
+                if(pathFrames > 0)
+                    std::cout << shadingPathNames[int(framePath)] << " shading: " << pathTime * 1000.0f / pathFrames << " ms per frame over "
+                              << pathFrames << " frames" << std::endl;
+                framePath = shadingPath;
+                pathFrames = 0;
+                pathTime = 0.0f;
+            }
+            pathFrames++;
+            pathTime += deltaTime;
+            glState.ResetStats();
+            textureStreamer.Update();
+            glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)CURR_WIDTH / (float)CURR_HEIGHT, nearPlane, farPlane);
+            glm::mat4 view = camera.GetViewMatrix();
+
+            glm::mat4 model = glm::mat4(1.0f);
+            model = glm::translate(model, glm::vec3(0.0f, 0.0f, 1.5f));
+            model = glm::scale(model, glm::vec3(1.0f));
+            size_t triangles = defaultModel.SelectLod(camera, model, (float)CURR_HEIGHT);
+            ringModel.SelectLod(camera, ringMatrices[0], (float)CURR_HEIGHT);
+
+            drawList.Clear();
+            passCullStats.clear();
+            activePath = shadingPath;
+            if(indirectDraws) {
+                defaultModel.Draw(drawList, model);
+                if(sceneBVH.Size() == drawList.Size())
+                    sceneBVH.Refit(drawList.Bounds());
+                else
+                    sceneBVH.Build(drawList.Bounds());
+                //ids that would alias other triangles: forward shade the frame rather than resolve the wrong ones
+                if(activePath == ShadingPath::Visibility && !visibilityBuffer->Prepare(drawList))
+                    activePath = ShadingPath::Forward;
+            } else {
+                //queued in drawScene call order: shadow maps, then the camera
+                renderQueue.Begin(camera.Position, farPlane);
+                unsigned int shadowPasses = numDirLights + numPointLights + numSpotLights;
+                for(unsigned int pass = 0; pass < shadowPasses; pass++)
+                    defaultModel.Draw(renderQueue, pass, shadowShader, model);
+                defaultModel.Draw(renderQueue, shadowPasses, activePath == ShadingPath::Deferred ? gBufferShader : litShader, model);
+                scenePass = 0;
+            }
+
+            //lights marked dirty are uploaded again, unchanged lights cost nothing
+            lightBuffer.Update();
+
+            //render shadows
+            for(const auto& dirLight : dirLights) {
+                glm::mat4 lightSpaceMatrix;
+                dirLight->getLightSpaceMatrix(lightSpaceMatrix);
+                shadowShader.Activate();
+                shadowShader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
+                shadowShader.setMat4("model", model);
+                instancedShadowShader.Activate();
+                instancedShadowShader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
+                dirLight->renderDepthMap([&]() {
+                    drawScene(shadowShader, &instancedShadowShader, false, "directional shadow", Frustum::FromMatrix(lightSpaceMatrix));
+                });
+            }
+            for(const auto& pointLight : pointLights) {
+                std::vector<glm::mat4> shadowTransform = pointLight->getShadowTransformations();
+                shadowCubeShader.Activate();
+                for(unsigned int i = 0; i < 6; i++) {
+                    shadowCubeShader.setMat4(UniformName("shadowTransforms").Index(i), shadowTransform[i]);
+                }
+                shadowCubeShader.setFloat("farPlane", pointLight->farPlane);
+                shadowCubeShader.setVec3("lightPos", pointLight->position);
+                glm::vec3 reach(pointLight->farPlane);
+                pointLight->renderDepthMap([&]() {
+                    drawScene(shadowShader, &instancedShadowShader, false, "point shadow", Frustum::FromBox(pointLight->position - reach, pointLight->position + reach));
+                });
+            }
+            for(const auto& spotLight : spotLights) {
+                glm::mat4 lightSpaceMatrix;
+                spotLight->getLightSpaceMatrix(lightSpaceMatrix);
+                shadowShader.Activate();
+                shadowShader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
+                shadowShader.setMat4("model", model);
+                instancedShadowShader.Activate();
+                instancedShadowShader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
+                spotLight->renderDepthMap([&]() {
+                    drawScene(shadowShader, &instancedShadowShader, false, "spot shadow", Frustum::FromMatrix(lightSpaceMatrix));
+                });
+            }
+
+            //render scene, straight into the post process framebuffer or into the G-buffer / visibility buffer to shade
+            //it into the post process framebuffer afterwards
+            GLuint sceneFramebuffer = postProcessEffect->framebuffer;
+            if(activePath == ShadingPath::Deferred)
+                sceneFramebuffer = gBuffer->Framebuffer();
+            else if(activePath == ShadingPath::Visibility)
+                sceneFramebuffer = visibilityBuffer->Framebuffer();
+            const PipelineState scenePassState = PipelineState().WithFramebuffer(sceneFramebuffer).WithViewport(0, 0, CURR_WIDTH, CURR_HEIGHT);
+            glState.Apply(scenePassState);
+            glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
+            if(activePath == ShadingPath::Visibility)
+                visibilityBuffer->Clear();
+            else
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+            lightBuffer.SetCamera(projection, view, camera.Position);
+            if(ringLights > 0) {
+                clusteredLights.Build(clusteredPointLights, view, glm::radians(camera.Zoom), (float)CURR_WIDTH / (float)CURR_HEIGHT, nearPlane, farPlane,
+                                      CURR_WIDTH, CURR_HEIGHT);
+                clusteredLights.Bind();
+            }
+            lightBuffer.BindShadowMaps();
+            Shader *sceneShader = &litShader;
+            Shader *instancedSceneShader = &instancedLitShader;
+            if(activePath == ShadingPath::Deferred) {
+                sceneShader = &gBufferShader;
+                instancedSceneShader = &instancedGBufferShader;
+            } else if(activePath == ShadingPath::Visibility) {
+                sceneShader = &visibilityShader;
+                instancedSceneShader = nullptr;
+            }
+            sceneShader->Activate();
+            sceneShader->setMat4("model", model);
+            glm::mat4 viewProjection = projection * view;
+            Frustum cameraFrustum = Frustum::FromMatrix(viewProjection);
+            const SoftwareOcclusion *cameraOccluders = nullptr;
+            if(indirectDraws && softwareOcclusionEnabled) {
+                softwareOcclusion.Begin(viewProjection);
+                for(const OccluderMesh &proxy : occluderProxies)
+                    softwareOcclusion.AddOccluder(proxy, model);
+                softwareOcclusion.Rasterize();
+                cameraOccluders = &softwareOcclusion;
+            }
+            //fragment shader invocations of the camera pass are counted on every path, the pre-pass ones separately
+            depthPrepass.BeginFrame(CURR_WIDTH, CURR_HEIGHT);
+            CullStats cameraStats;
+            if(activePath == ShadingPath::Forward && indirectDraws && depthPrepassEnabled) {
+                cameraStats = drawPrepassed(cameraFrustum, viewProjection, scenePassState, cameraOccluders);
+            } else {
+                depthPrepass.Begin(DepthPrepass::Shading);
+                cameraStats = drawScene(*sceneShader, instancedSceneShader, activePath != ShadingPath::Visibility, "camera", cameraFrustum,
+                                        occlusionCulling ? &viewProjection : nullptr, cameraOccluders);
+                depthPrepass.End();
+            }
+            if(activePath == ShadingPath::Deferred) {
+                gBuffer->Resolve(deferredShader, *postProcessEffect, viewProjection);
+            } else if(activePath == ShadingPath::Visibility) {
+                visibilityBuffer->Resolve(visibilityResolveShader, *postProcessEffect, drawList);
+                //the ring is not in the arena: forward shaded on top of the resolved depth
+                glState.Apply(PipelineState().WithFramebuffer(postProcessEffect->framebuffer).WithViewport(0, 0, CURR_WIDTH, CURR_HEIGHT));
+                drawInstances(instancedLitShader, true, "camera", cameraFrustum);
+            }
 
-        postProcessEffect->Blit();
-		postProcessEffect->Unbind();
+    		std::string fpsCount = std::to_string(1.0f / deltaTime);
+    		std::string title = std::string(shadingPathNames[int(activePath)]) + " FPS: " + fpsCount + " Triangles: " + std::to_string(triangles);
+            if(cameraStats.objects > 0) {
+                title += " Visible: " + std::to_string(cameraStats.visible) + "/" + std::to_string(cameraStats.objects);
+            }
+            if(indirectDraws && occlusionCulling) {
+                title += " Occluded: " + std::to_string(hiZCuller.LastStats().Skipped());
+            }
+            title += " Overdraw: " + std::to_string(depthPrepass.GetStats().Overdraw());
+    		glfwSetWindowTitle(window, title.c_str());
+
+            postProcessEffect->Blit();
 
-        //render framebuffer
-        glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
-        glDisable(GL_DEPTH_TEST);
-        postProcessEffect->Render(postprocessShader);
-        glEnable(GL_DEPTH_TEST);
+            //render framebuffer
+            glState.Apply(PipelineState().WithDepthTest(false).WithViewport(0, 0, CURR_WIDTH, CURR_HEIGHT));
+            glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT);
+            postProcessEffect->Render(postprocessShader);
 
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+            if(frameIndex == 0) {
+                double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+                std::cout << "Time to first frame: " << milliseconds << " ms" << std::endl;
+            }
+            //uniforms are set through the tables resolved at link time (the first frame still finishes the programs):
+            //from the second frame on both query counters stay at 0
+            if(frameIndex == 1) {
+                const UniformStats &uniforms = UniformStats::Global();
+                std::cout << "Uniforms per frame: " << uniforms.lookups - uniformsBefore.lookups << " lookups, "
+                          << uniforms.locationQueries - uniformsBefore.locationQueries << " location queries, "
+                          << uniforms.runtimeNames - uniformsBefore.runtimeNames << " runtime names" << std::endl;
+            }
+            if(frameIndex == 1 && !indirectDraws) {
+                const RenderQueue::Stats &queue = renderQueue.GetStats();
+                std::cout << "Render queue: " << queue.draws << " draws, " << queue.programBinds << " program binds, "
+                          << queue.materialChanges << " material changes, " << queue.textureBinds << " texture binds, "
+                          << queue.vertexArrayBinds << " vertex array binds" << std::endl;
+            }
+            if(frameIndex == 1) {
+                const GLState::Stats &state = glState.GetStats();
+                std::cout << "GL state: " << state.issued << " calls issued, " << state.suppressed << " suppressed" << std::endl;
+                const ClusteredLights::Stats &clusters = clusteredLights.GetStats();
+                std::cout << "Clustered lights: " << clusters.lights << "/" << ringLights << " in view, " << clusters.litClusters << "/"
+                          << ClusteredLights::ClusterCount << " froxels lit, " << clusters.indices << " light references, at most "
+                          << clusters.maxPerCluster << " per froxel" << std::endl;
+                const LightBuffer::Stats &lightUploads = lightBuffer.GetStats();
+                std::cout << "Light buffer: " << lightUploads.uploads << " uploads, " << lightUploads.bytes << " bytes over two frames" << std::endl;
+                for(const auto &[pass, stats] : passCullStats)
+                    std::cout << "Culling " << pass << ": " << stats.visible << "/" << stats.objects << " visible, "
+                              << stats.nodesVisited << " nodes visited, " << stats.boxesTested << " boxes tested" << std::endl;
+            }
+            if(frameIndex == DepthPrepass::StatsLatency + 1) {
+                const DepthPrepass::Stats &prepass = depthPrepass.GetStats();
+                std::cout << "Depth pre-pass: " << prepass.selected << " draws pre-passed, " << prepass.direct << " shaded directly, "
+                          << prepass.prepassInvocations << " pre-pass fragments, " << prepass.shadingInvocations << " shaded fragments, "
+                          << prepass.Overdraw() << "x overdraw" << std::endl;
+            }
+            //occlusion counters arrive a few frames late; report them once they cover a full frame
+            if(indirectDraws && occlusionCulling && frameIndex == HiZCuller::StatsLatency + 1) {
+                const HiZCuller::Stats &occlusion = hiZCuller.LastStats();
+                std::cout << "Occlusion culling: " << occlusion.tested << " draws, " << occlusion.visibleFirst << " drawn with the previous depth, "
+                          << occlusion.visibleSecond << " after the re-test, " << occlusion.Skipped() << " skipped" << std::endl;
+            }
+            frameIndex++;
+
+            glfwSwapBuffers(window);
+            glfwPollEvents();
+        }
+
+        GeometryArena::Instance(vertexFormat).Delete();
     }
 
     glfwTerminate();
@@ -270,6 +674,25 @@ void processInput(GLFWwindow *window)
         camera.ProcessKeyboardMovement(UP, deltaTime);
     if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
         camera.ProcessKeyboardMovement(DOWN, deltaTime);
+
+    //next shading path once per key press
+    static bool togglePressed = false;
+    bool toggleDown = glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS;
+    if(toggleDown && !togglePressed)
+        shadingPath = ShadingPath((int(shadingPath) + 1) % 3);
+    togglePressed = toggleDown;
+
+    static bool prepassPressed = false;
+    bool prepassDown = glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS;
+    if(prepassDown && !prepassPressed)
+        depthPrepassEnabled = !depthPrepassEnabled;
+    prepassPressed = prepassDown;
+
+    static bool occlusionPressed = false;
+    bool occlusionDown = glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS;
+    if(occlusionDown && !occlusionPressed)
+        softwareOcclusionEnabled = !softwareOcclusionEnabled;
+    occlusionPressed = occlusionDown;
 }
 
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
@@ -280,8 +703,10 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
     // height will be significantly larger than specified on retina displays.
     CURR_WIDTH = width;
     CURR_HEIGHT = height;
-    glViewport(0, 0, width, height);
+    GLState::Instance().Viewport(0, 0, width, height);
     postProcessEffect->Resize(width, height);
+    gBuffer->Resize(width, height);
+    visibilityBuffer->Resize(width, height);
 }
 
 // glfw: whenever the mouse moves, this callback is called